@@ -8,6 +8,7 @@
 
 #include "util/util.h"
 #include "threading/queue.h"
+#include "threading/threadpool.h"
 #include "http/http.h"
 #include "debug/blt_debug.h"
 #include "tweaker/xmltweaker.h"
@@ -18,7 +19,9 @@
 #include "luautil/LuaAssetDb.h"
 #include "luautil/LuaAsyncIO.h"
 #include "dbutil/DB.h"
+#include "dbutil/Datastore.h"
 
+#include <chrono>
 #include <format>
 #include <thread>
 #include <list>
@@ -184,7 +187,9 @@ namespace raidhook
 		const char* archivePath = lua_tolstring(L, 1, &len);
 		const char* extractPath = lua_tolstring(L, 2, &len);
 
-		bool retVal = raidhook::ExtractZIPArchive(archivePath, extractPath);
+		bool parallel = lua_toboolean(L, 3);
+
+		bool retVal = raidhook::ExtractZIPArchive(archivePath, extractPath, parallel);
 		lua_pushboolean(L, retVal);
 		return 1;
 	}
@@ -307,6 +312,29 @@ namespace raidhook
 		lua_State* L;
 	};
 
+	static void push_lua_http_info(lua_State* L, HTTPItem* httpItem, bool querySucceeded)
+	{
+		lua_newtable(L);
+		lua_pushstring(L, "statusCode");
+		lua_pushinteger(L, httpItem->httpStatusCode);
+		lua_settable(L, -3);
+		lua_pushstring(L, "querySucceeded");
+		lua_pushboolean(L, querySucceeded);
+		lua_settable(L, -3);
+		lua_pushstring(L, "url");
+		lua_pushstring(L, httpItem->url.c_str());
+		lua_settable(L, -3);
+		lua_pushstring(L, "headers");
+		lua_newtable(L);
+		for(std::pair<std::string, std::string> element:httpItem->responseHeaders)
+		{
+			lua_pushstring(L, element.first.c_str());
+			lua_pushstring(L, element.second.c_str());
+			lua_settable(L, -3);
+		}
+		lua_settable(L, -3);
+	}
+
 	static void return_lua_http(HTTPItem* httpItem)
 	{
 		lua_http_data* ourData = (lua_http_data*)httpItem->data;
@@ -321,25 +349,28 @@ namespace raidhook
 		lua_rawgeti(ourData->L, LUA_REGISTRYINDEX, ourData->funcRef);
 		lua_pushlstring(ourData->L, httpItem->httpContents.c_str(), httpItem->httpContents.length());
 		lua_pushinteger(ourData->L, ourData->requestIdentifier);
-		lua_newtable(ourData->L);
-		lua_pushstring(ourData->L, "statusCode");
-		lua_pushinteger(ourData->L, statusCode);
-		lua_settable(ourData->L, -3);
-		lua_pushstring(ourData->L, "querySucceeded");
-		lua_pushboolean(ourData->L, querySucceeded);
-		lua_settable(ourData->L, -3);
-		lua_pushstring(ourData->L, "url");
-		lua_pushstring(ourData->L, httpItem->url.c_str());
-		lua_settable(ourData->L, -3);
-		lua_pushstring(ourData->L, "headers");
-		lua_newtable(ourData->L);
-		for(std::pair<std::string, std::string> element:httpItem->responseHeaders)
+		push_lua_http_info(ourData->L, httpItem, querySucceeded);
+		handled_pcall(ourData->L, 3, 0);
+		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->funcRef);
+		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->progressRef);
+		delete ourData;
+	}
+
+	static void return_lua_download(HTTPItem* httpItem)
+	{
+		lua_http_data* ourData = (lua_http_data*)httpItem->data;
+		if (!check_active_state(ourData->L))
 		{
-			lua_pushstring(ourData->L, element.first.c_str());
-			lua_pushstring(ourData->L, element.second.c_str());
-			lua_settable(ourData->L, -3);
+			delete ourData;
+			return;
 		}
-		lua_settable(ourData->L, -3);
+		int statusCode = httpItem->httpStatusCode;
+		bool querySucceeded = httpItem->errorCode == 0 && statusCode >= 100 && statusCode < 400;
+
+		lua_rawgeti(ourData->L, LUA_REGISTRYINDEX, ourData->funcRef);
+		lua_pushboolean(ourData->L, querySucceeded);
+		lua_pushinteger(ourData->L, ourData->requestIdentifier);
+		push_lua_http_info(ourData->L, httpItem, querySucceeded);
 		handled_pcall(ourData->L, 3, 0);
 		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->funcRef);
 		luaL_unref(ourData->L, LUA_REGISTRYINDEX, ourData->progressRef);
@@ -472,6 +503,62 @@ namespace raidhook
 		return 1;
 	}
 
+	// Arguments: string(url) string(path) function(callback) optional function(progress)
+	// Streams the response straight into the file rather than holding it in memory, for big downloads
+	static int luaF_download_file(lua_State* L)
+	{
+		std::string url = luaL_checkstring(L, 1);
+		std::string path = luaL_checkstring(L, 2);
+		luaL_checktype(L, 3, LUA_TFUNCTION);
+
+		int progressReference = 0;
+		if (!lua_isnoneornil(L, 4))
+		{
+			luaL_checktype(L, 4, LUA_TFUNCTION);
+			lua_pushvalue(L, 4);
+			progressReference = luaL_ref(L, LUA_REGISTRYINDEX);
+		}
+
+		lua_pushvalue(L, 3);
+		int functionReference = luaL_ref(L, LUA_REGISTRYINDEX);
+
+		RAIDHOOK_LOG_LOG("HTTP download from " << url << " to " << path);
+
+		lua_http_data* ourData = new lua_http_data();
+		ourData->funcRef = functionReference;
+		ourData->progressRef = progressReference;
+		ourData->L = L;
+
+		HTTPReqIdent++;
+		ourData->requestIdentifier = HTTPReqIdent;
+
+		std::unique_ptr<HTTPItem> reqItem(new HTTPItem());
+		reqItem->call = return_lua_download;
+		reqItem->data = ourData;
+		reqItem->url = url;
+		reqItem->downloadPath = path;
+
+		if (progressReference != 0)
+		{
+			reqItem->progress = progress_lua_http;
+		}
+
+		HTTPManager::GetSingleton()->LaunchHTTPRequest(std::move(reqItem));
+		lua_pushinteger(L, HTTPReqIdent);
+		return 1;
+	}
+
+	static int luaF_set_max_http_requests(lua_State* L)
+	{
+		// Zero means no limit
+		lua_Number limit = luaL_checknumber(L, 1);
+		if (limit < 0)
+			luaL_error(L, "HTTP request limit must not be negative");
+
+		HTTPManager::GetSingleton()->SetMaxConcurrentRequests((size_t)limit);
+		return 0;
+	}
+
 	/*static int luaF_createconsole(lua_State* L) // TODO reenable
 	{
 		if (gbl_mConsole) return 0;
@@ -782,6 +869,118 @@ namespace raidhook
 		return 1;
 	}
 
+	static int luaF_set_event_budget(lua_State* L)
+	{
+		// Both are optional, and zero or nil means no limit
+		lua_Number timeMs = luaL_optnumber(L, 1, 0);
+		lua_Number maxEvents = luaL_optnumber(L, 2, 0);
+		if (timeMs < 0 || maxEvents < 0)
+			luaL_error(L, "Event budget must not be negative");
+
+		EventQueueMaster::GetSingleton().SetBudget(std::chrono::microseconds((int64_t)(timeMs * 1000)), (size_t)maxEvents);
+		return 0;
+	}
+
+	static int luaF_set_async_datastores(lua_State* L)
+	{
+		// Hooked assets opened after this are read through BLTAsyncFileDataStore, which the game reads
+		// from asynchronously. Off by default, as the game then polls the datastore's state.
+		BLTAsyncFileDataStore::SetEnabled(lua_toboolean(L, 1));
+		return 0;
+	}
+
+	static int luaF_event_queue_stats(lua_State* L)
+	{
+		EventQueueMaster& master = EventQueueMaster::GetSingleton();
+		EventQueueMaster::Stats stats = master.GetStats();
+
+		// Pass true to start counting again from zero after these are returned
+		if (lua_toboolean(L, 1))
+			master.ResetStats();
+
+		lua_createtable(L, 0, 5);
+
+		lua_pushnumber(L, (lua_Number)stats.processed);
+		lua_setfield(L, -2, "processed");
+		lua_pushnumber(L, (lua_Number)stats.lastProcessed);
+		lua_setfield(L, -2, "last_processed");
+		lua_pushnumber(L, (lua_Number)stats.deferred);
+		lua_setfield(L, -2, "deferred");
+		lua_pushnumber(L, (lua_Number)stats.peakDeferred);
+		lua_setfield(L, -2, "peak_deferred");
+		lua_pushnumber(L, (lua_Number)stats.deferredFrames);
+		lua_setfield(L, -2, "deferred_frames");
+
+		return 1;
+	}
+
+	static int luaF_thread_pool_stats(lua_State* L)
+	{
+		ThreadPool& pool = ThreadPool::GetSingleton();
+		ThreadPool::Stats stats = pool.GetStats();
+
+		// Pass true to start counting again from zero after these are returned
+		if (lua_toboolean(L, 1))
+			pool.ResetStats();
+
+		lua_createtable(L, 0, 5);
+
+		lua_pushnumber(L, (lua_Number)stats.workers);
+		lua_setfield(L, -2, "workers");
+		lua_pushnumber(L, (lua_Number)stats.busy);
+		lua_setfield(L, -2, "busy");
+		lua_pushnumber(L, stats.utilisation);
+		lua_setfield(L, -2, "utilisation");
+
+		// Queue depth and completed task counts, each keyed by task class
+		const char* classNames[] = { "io", "cpu" };
+		static_assert(std::size(classNames) == (size_t)TaskClass::Count);
+
+		lua_createtable(L, 0, (int)TaskClass::Count);
+		for (size_t i = 0; i < (size_t)TaskClass::Count; i++)
+		{
+			lua_pushnumber(L, (lua_Number)stats.queued[i]);
+			lua_setfield(L, -2, classNames[i]);
+		}
+		lua_setfield(L, -2, "queued");
+
+		lua_createtable(L, 0, (int)TaskClass::Count);
+		for (size_t i = 0; i < (size_t)TaskClass::Count; i++)
+		{
+			lua_pushnumber(L, (lua_Number)stats.completed[i]);
+			lua_setfield(L, -2, classNames[i]);
+		}
+		lua_setfield(L, -2, "completed");
+
+		return 1;
+	}
+
+	static int luaF_tweaker_stats(lua_State* L)
+	{
+		tweaker::TweakerStats stats = tweaker::get_tweaker_stats();
+
+		// Pass true to start counting again from zero after these are returned
+		if (lua_toboolean(L, 1))
+			tweaker::reset_tweaker_stats();
+
+		lua_createtable(L, 0, 6);
+
+		lua_pushnumber(L, (lua_Number)stats.skipped);
+		lua_setfield(L, -2, "skipped");
+		lua_pushnumber(L, (lua_Number)stats.cached);
+		lua_setfield(L, -2, "cached");
+		lua_pushnumber(L, (lua_Number)stats.files);
+		lua_setfield(L, -2, "files");
+		lua_pushnumber(L, (lua_Number)stats.tweaked);
+		lua_setfield(L, -2, "tweaked");
+		lua_pushnumber(L, (lua_Number)stats.totalMicros / 1000.0);
+		lua_setfield(L, -2, "total_ms");
+		lua_pushnumber(L, (lua_Number)stats.maxMicros / 1000.0);
+		lua_setfield(L, -2, "max_ms");
+
+		return 1;
+	}
+
 	static int luaF_sd_identify(lua_State* L)
 	{
 		size_t len;
@@ -811,7 +1010,8 @@ namespace raidhook
 		bool is32bit = lua_toboolean(L, -1);
 		lua_pop(L, 1);
 
-		raidhook::scriptdata::ScriptData sd(len, (const uint8_t*)data);
+		// The Lua string stays alive until we return, so there's no need to copy it
+		raidhook::scriptdata::ScriptData sd(len, (const uint8_t*)data, raidhook::scriptdata::ScriptData::SourceMode::Borrow);
 		std::string out = sd.GetRoot()->Serialise(is32bit);
 
 		lua_pushlstring(L, out.c_str(), out.length());
@@ -990,6 +1190,13 @@ namespace blt
 				{ "blt_info", luaF_blt_info },
 				{ "blt_version", luaF_blt_version },
 				{ "flush_log", luaF_flush_log },
+				{ "set_event_budget", luaF_set_event_budget },
+				{ "set_async_datastores", luaF_set_async_datastores },
+				{ "event_queue_stats", luaF_event_queue_stats },
+				{ "thread_pool_stats", luaF_thread_pool_stats },
+				{ "tweaker_stats", luaF_tweaker_stats },
+				{ "set_max_http_requests", luaF_set_max_http_requests },
+				{ "download_file", luaF_download_file },
 
 				// Functions that are supposed to be in Lua, but are either omitted or implemented improperly (pcall)
 				{ "pcall", luaF_pcall_proper }, // Lua pcall shouldn't print errors, however BLT's global pcall does (leave it for compat)
@@ -0,0 +1,94 @@
+#include "ChunkCache.h"
+
+using blt::db::ChunkCache;
+
+size_t ChunkCache::KeyHash::operator()(const Key& key) const
+{
+    return std::hash<const void*>()(key.bundle) ^ (key.chunkIdx * 0x9e3779b97f4a7c15ull);
+}
+
+ChunkCache& ChunkCache::Instance()
+{
+    static ChunkCache instance;
+    return instance;
+}
+
+ChunkCache::Chunk ChunkCache::Find(const DieselBundle* bundle, size_t chunkIdx)
+{
+    std::lock_guard guard(mutex);
+
+    auto iter = entries.find(Key{bundle, chunkIdx});
+    if (iter == entries.end())
+    {
+        misses++;
+        return nullptr;
+    }
+
+    hits++;
+    lru.splice(lru.begin(), lru, iter->second);
+    return iter->second->chunk;
+}
+
+ChunkCache::Chunk ChunkCache::Insert(const DieselBundle* bundle, size_t chunkIdx, std::vector<uint8_t>&& data)
+{
+    Chunk chunk = std::make_shared<const std::vector<uint8_t>>(std::move(data));
+
+    std::lock_guard guard(mutex);
+
+    if (chunk->size() > limit)
+        return chunk;
+
+    Key  key{bundle, chunkIdx};
+    auto iter = entries.find(key);
+    if (iter != entries.end())
+    {
+        lru.splice(lru.begin(), lru, iter->second);
+        return iter->second->chunk;
+    }
+
+    lru.push_front(Entry{key, chunk});
+    entries[key] = lru.begin();
+    size += chunk->size();
+
+    EvictToLimit();
+
+    return chunk;
+}
+
+void ChunkCache::SetLimit(size_t bytes)
+{
+    std::lock_guard guard(mutex);
+
+    limit = bytes;
+    EvictToLimit();
+}
+
+ChunkCache::Stats ChunkCache::GetStats() const
+{
+    std::lock_guard guard(mutex);
+
+    return Stats{hits, misses, evictions, entries.size(), size, limit};
+}
+
+void ChunkCache::ResetStats()
+{
+    std::lock_guard guard(mutex);
+
+    hits      = 0;
+    misses    = 0;
+    evictions = 0;
+}
+
+void ChunkCache::EvictToLimit()
+{
+    while (size > limit && !lru.empty())
+    {
+        const Entry& oldest = lru.back();
+
+        size -= oldest.chunk->size();
+        entries.erase(oldest.key);
+        lru.pop_back();
+
+        evictions++;
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db {
+    struct DieselBundle;
+
+    /**
+     * A size-limited LRU cache of inflated chunks from packaged bundles.
+     *
+     * Small assets packed next to each other in a package share their 64KiB chunks, so without this,
+     * reading a run of them inflates the same chunk over and over. Only chunks that are partly used
+     * by an asset go in here - chunks entirely covered by one asset are inflated straight into place,
+     * and are unlikely to be needed again.
+     *
+     * This is safe to use from multiple threads at once.
+     */
+    class ChunkCache
+    {
+      public:
+        // Chunks are shared with the readers using them, so evicting one while it's being copied out is fine
+        using Chunk = std::shared_ptr<const std::vector<uint8_t>>;
+
+        struct Stats
+        {
+            uint64_t hits;
+            uint64_t misses;
+            uint64_t evictions;
+            size_t   chunks;
+            size_t   size;
+            size_t   limit;
+        };
+
+        static ChunkCache& Instance();
+
+        // Returns nullptr (and counts a miss) if the chunk isn't cached
+        Chunk Find(const DieselBundle* bundle, size_t chunkIdx);
+
+        // Add a freshly inflated chunk. If another thread beat us to it, the existing copy is returned instead.
+        Chunk Insert(const DieselBundle* bundle, size_t chunkIdx, std::vector<uint8_t>&& data);
+
+        // Set the maximum total size of the cached chunks in bytes, evicting anything over it. Zero disables the cache.
+        void SetLimit(size_t bytes);
+
+        [[nodiscard]] Stats GetStats() const;
+
+        void ResetStats();
+
+      private:
+        ChunkCache() = default;
+
+        struct Key
+        {
+            const DieselBundle* bundle;
+            size_t              chunkIdx;
+
+            bool operator==(const Key& other) const { return bundle == other.bundle && chunkIdx == other.chunkIdx; }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const;
+        };
+
+        struct Entry
+        {
+            Key   key;
+            Chunk chunk;
+        };
+
+        void EvictToLimit();
+
+        mutable std::mutex mutex;
+
+        // Most recently used at the front
+        std::list<Entry>                                             lru;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+
+        size_t size  = 0;
+        size_t limit = 8 * 1024 * 1024;
+
+        uint64_t hits      = 0;
+        uint64_t misses    = 0;
+        uint64_t evictions = 0;
+    };
+}; // namespace blt::db
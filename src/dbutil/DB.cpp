@@ -1,9 +1,13 @@
 #include "DB.h"
+#include "ChunkCache.h"
 
+#include <threading/threadpool.h>
 #include <util/util.h>
 
 #include <algorithm>
+#include <exception>
 #include <fstream>
+#include <map>
 #include <mutex>
 #include <vector>
 
@@ -19,7 +23,6 @@ using blt::idstring;
 static_assert(sizeof(void*) == sizeof(intptr_t));
 using pos_t    = std::ios::pos_type;
 using FileList = std::vector<DslFile>&;
-using FileMap  = std::map<std::pair<idstring, idstring>, DslFile*>&;
 
 static uint64_t monotonicTimeMicros()
 {
@@ -105,8 +108,45 @@ DieselDB* DieselDB::Instance()
     return &instance;
 }
 
-static void          loadPackageHeader(DieselBundle* bundle, const std::string& headerPath, const std::string& dataPath, FileList);
-static void          loadBundleHeader(DieselBundle* bundle, const std::string& headerPath, const std::string& dataPath, FileList);
+// Files
+struct FilePos
+{
+    int32_t fileId;
+    int32_t offset;
+};
+static_assert(sizeof(FilePos) == 8); // Same on 32 and 64 bit
+
+struct ItemInfo
+{
+    uint32_t fileId;
+    uint32_t offset;
+    uint32_t length;
+};
+static_assert(sizeof(ItemInfo) == 12); // True on 32/64 bit
+
+/**
+ * A bundle header found in the assets folder, along with everything that was read out of it.
+ *
+ * Reading these doesn't touch the file list, so it can be done for many headers at once. The
+ * results are then applied to the file list one header at a time, in the order they were found.
+ */
+struct HeaderEntry
+{
+    std::string headerPath;
+    std::string dataPath;
+    bool        package;
+
+    DieselBundle*         bundle = nullptr;
+    std::vector<FilePos>  positions; // Only for package headers
+    std::vector<ItemInfo> items;     // Only for regular bundle headers
+    std::exception_ptr    error;
+};
+
+static void          loadHeaders(std::vector<HeaderEntry>& headers);
+static void          readPackageHeader(HeaderEntry& header);
+static void          readBundleHeader(HeaderEntry& header);
+static void          applyPackageHeader(const HeaderEntry& header, FileList);
+static void          applyBundleHeader(const HeaderEntry& header, FileList);
 static DieselBundle* loadPackageBundle(const std::string& dataPath);
 static DieselBundle* loadBundle(const std::string& dataPath);
 
@@ -114,81 +154,137 @@ static DieselBundle* loadBundle(const std::string& dataPath);
 ////// DSL FILE ////////
 ////////////////////////
 
-std::vector<uint8_t> DslFile::ReadContents(std::istream& fi) const
+// Each compressed block in a bundle ends with the size of its decompressed contents
+static uint32_t readDecompressedSize(const uint8_t* block, size_t blockLength)
+{
+    if (blockLength < sizeof(uint32_t))
+        throw std::runtime_error("Compressed block is too short");
+
+    uint32_t size;
+    memcpy(&size, block + blockLength - sizeof(uint32_t), sizeof(size));
+    return size;
+}
+
+static size_t inflateBlock(uint8_t* dest, size_t destCapacity, const uint8_t* source, size_t sourceLength)
+{
+    auto destSize   = static_cast<uLongf>(destCapacity);
+    auto sourceSize = static_cast<uLong>(sourceLength);
+
+    auto ret = uncompress2(dest, &destSize, source, &sourceSize);
+
+    if (ret != Z_OK)
+        throw std::runtime_error("Failed to decompress data");
+
+    return destSize;
+}
+
+const MappedFile& DieselBundle::Mapping()
+{
+    std::call_once(mappingOnce, [this]() { mapping = std::make_unique<MappedFile>(path); });
+    return *mapping;
+}
+
+// Find one of the chunks of a packaged bundle in its mapping, making sure it's entirely inside the file
+static const uint8_t* locateChunk(const DieselBundle* bundle, const MappedFile& mapping, size_t chunkIdx, uint32_t* compressedLength)
 {
+    if (chunkIdx >= bundle->ChunkOffsets.size())
+        throw std::runtime_error("block index bigger then chunk offsets");
+
+    auto   fileOffset = bundle->ChunkOffsets[chunkIdx];
+    size_t fileSize   = mapping.Size();
+
+    if (fileOffset + sizeof(*compressedLength) > fileSize)
+        throw std::runtime_error("Chunk lies past the end of its bundle");
+
+    memcpy(compressedLength, mapping.Data() + fileOffset, sizeof(*compressedLength));
+
+    if (*compressedLength > fileSize - fileOffset - sizeof(*compressedLength))
+        throw std::runtime_error("Chunk runs past the end of its bundle");
+
+    return mapping.Data() + fileOffset + sizeof(*compressedLength);
+}
+
+void DieselBundle::InflateChunk(size_t chunkIdx, std::vector<uint8_t>& out)
+{
+    uint32_t       compressedLength;
+    const uint8_t* compressedData = locateChunk(this, Mapping(), chunkIdx, &compressedLength);
+
+    out.resize(readDecompressedSize(compressedData, compressedLength));
+    out.resize(inflateBlock(out.data(), out.size(), compressedData, compressedLength));
+}
+
+std::vector<uint8_t> DslFile::ReadContents() const
+{
+    const MappedFile& mapping  = bundle->Mapping();
+    const uint8_t*    fileData = mapping.Data();
+    size_t            fileSize = mapping.Size();
+
+    // Offsets into packaged bundles are positions in the decompressed data, rather than in the file itself
+    size_t contentSize = bundle->ChunkOffsets.empty() ? fileSize : bundle->DecompressedFileSize;
+
+    if (offset > contentSize)
+        throw std::runtime_error("Asset offset lies past the end of its bundle");
+
     unsigned int realLength = length;
     if (!HasLength())
     {
         // This is an end-of-file asset, so it's length is it's start until the end of the file
-        fi.seekg(0, std::ios::end);
-        realLength = (unsigned int)fi.tellg() - offset;
+        realLength = (unsigned int)(contentSize - offset);
     }
 
     std::vector<uint8_t> result;
 
     if (bundle->ChunkOffsets.empty())
     {
-        fi.seekg(offset, std::ios::beg);
-        std::vector<uint8_t> data(length);
-        fi.read((char*)data.data(), data.size());
-
-        uint32_t dstSize = *reinterpret_cast<uint32_t*>(data.data() + (data.size() - sizeof(uint32_t)));
-        result.resize(dstSize);
+        if (realLength > fileSize - offset)
+            throw std::runtime_error("Asset runs past the end of its bundle");
 
-        auto destSize   = static_cast<uLongf>(dstSize);
-        auto sourceSize = static_cast<uLongf>(data.size());
+        const uint8_t* data = fileData + offset;
 
-        auto ret = uncompress2(result.data(), &destSize, data.data(), &sourceSize);
-
-        if (ret != Z_OK)
-            throw std::runtime_error("Failed to decompress data");
+        result.resize(readDecompressedSize(data, realLength));
+        result.resize(inflateBlock(result.data(), result.size(), data, realLength));
     }
     else
     {
         result.resize(realLength);
 
-        size_t blockIdx       = offset / 0x10000;
-        size_t bufferOffset   = offset % 0x10000;
+        size_t blockIdx       = offset / DieselBundle::CHUNK_SIZE;
+        size_t bufferOffset   = offset % DieselBundle::CHUNK_SIZE;
         size_t destFileOffset = 0;
 
-        std::vector<uint8_t> data(0x10000);
+        ChunkCache& chunkCache = ChunkCache::Instance();
 
         while (destFileOffset < realLength)
         {
-            uint32_t compressedLength;
-
-            if (blockIdx >= bundle->ChunkOffsets.size())
-                throw std::runtime_error("block index bigger then chunk offsets");
-
-            auto fileOffset = bundle->ChunkOffsets[blockIdx];
-
-            fi.seekg(fileOffset, std::ios::beg);
-            fi.read((char*)&compressedLength, sizeof(compressedLength));
-
-            std::vector<uint8_t> compressedData(compressedLength);
-            fi.read((char*)compressedData.data(), compressedData.size());
+            uint32_t       compressedLength;
+            const uint8_t* compressedData = locateChunk(bundle, mapping, blockIdx, &compressedLength);
 
-            uint32_t dstSize = *reinterpret_cast<uint32_t*>(compressedData.data() + (compressedData.size() - sizeof(uint32_t)));
-            data.resize(dstSize);
+            uint32_t dstSize   = readDecompressedSize(compressedData, compressedLength);
+            size_t   skip      = destFileOffset == 0 ? bufferOffset : 0;
+            size_t   remaining = realLength - destFileOffset;
 
-            auto destSize   = static_cast<uLongf>(dstSize);
-            auto sourceSize = static_cast<uLongf>(compressedData.size());
-
-            auto ret = uncompress2(data.data(), &destSize, compressedData.data(), &sourceSize);
-
-            if (ret != Z_OK)
-                throw std::runtime_error("Failed to decompress data");
-
-            auto dataPtr = data.data();
+            // If this entire block belongs to this asset, decompress it straight into place
+            if (skip == 0 && dstSize <= remaining)
+            {
+                destFileOffset += inflateBlock(result.data() + destFileOffset, dstSize, compressedData, compressedLength);
+                ++blockIdx;
+                continue;
+            }
 
-            if (destFileOffset == 0)
+            // Otherwise it's shared with the neighbouring assets, which are likely to be read soon too
+            ChunkCache::Chunk chunk = chunkCache.Find(bundle, blockIdx);
+            if (!chunk)
             {
-                dataPtr += bufferOffset;
-                destSize -= bufferOffset;
+                std::vector<uint8_t> data(dstSize);
+                data.resize(inflateBlock(data.data(), data.size(), compressedData, compressedLength));
+                chunk = chunkCache.Insert(bundle, blockIdx, std::move(data));
             }
 
-            memcpy(result.data() + destFileOffset, dataPtr, min(destSize, (realLength - destFileOffset)));
-            destFileOffset += destSize;
+            size_t destSize = chunk->size();
+            size_t usable   = destSize > skip ? destSize - skip : 0;
+
+            memcpy(result.data() + destFileOffset, chunk->data() + skip, std::min(usable, remaining));
+            destFileOffset += usable;
 
             ++blockIdx;
         }
@@ -215,7 +311,8 @@ DieselDB::DieselDB()
     std::string blb_suffix = ".blb";
     std::string blb_path;
 
-    for (const std::string& name : raidhook::Util::GetDirectoryContents("assets"))
+    std::vector<std::string> assetFiles = raidhook::Util::GetDirectoryContents("assets");
+    for (const std::string& name : assetFiles)
     {
         if (name.length() <= blb_suffix.size())
             continue;
@@ -244,6 +341,65 @@ DieselDB::DieselDB()
         return;
     }
 
+    // Find each of the bundle headers
+    std::vector<HeaderEntry> headers;
+
+    std::string suffix        = "_h.bundle";
+    std::string prefix        = "all_";
+    std::string stream_prefix = "stream_";
+    for (const std::string& name : assetFiles)
+    {
+        if (name.length() <= suffix.size())
+            continue;
+        if (name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
+            continue;
+        if (name == "all_h.bundle")
+            continue; // all_h handling later
+
+        bool package = true;
+        if (name.compare(0, prefix.size(), prefix) == 0)
+            package = false;
+
+        std::string headerPath = "assets/" + name;
+
+        // Find the headerPath to the data file - chop out the '_h' bit
+        std::string dataPath = headerPath;
+        dataPath.erase(dataPath.end() - 9, dataPath.end() - 7);
+
+        if (name.compare(0, stream_prefix.size(), stream_prefix) == 0)
+            package = false;
+
+        HeaderEntry& header = headers.emplace_back();
+        header.headerPath   = headerPath;
+        header.dataPath     = dataPath;
+        header.package      = package;
+    }
+
+    // Everything the index is built from. If none of these have changed since the last launch, the
+    // cached copy of the index can be used instead of parsing them all again. The package data files
+    // are included since their chunk offsets are part of the index.
+    std::vector<std::string> sourceFiles = {"assets/" + blb_path};
+    for (const HeaderEntry& header : headers)
+    {
+        sourceFiles.push_back(header.headerPath);
+        if (header.package)
+            sourceFiles.push_back(header.dataPath);
+    }
+
+    std::vector<IndexSource> sources = GetIndexSources(sourceFiles);
+
+    if (LoadIndexCache(sources))
+    {
+        uint64_t end_time = monotonicTimeMicros();
+
+        char buff[1024];
+        memset(buff, 0, sizeof(buff));
+        snprintf(buff, sizeof(buff) - 1, "Finished loading DB info from cache: %zd files from %zd bundles in %d ms", filesList.size(),
+                 bundles.size(), (int)(end_time - start_time) / 1000);
+        RAIDHOOK_LOG_LOG(buff);
+        return;
+    }
+
     in.open("assets/" + blb_path, std::ios::binary);
 
     in.seekg(sizeof(uint32_t) * 2, std::ios::beg);
@@ -279,6 +435,7 @@ DieselDB::DieselDB()
     static_assert(sizeof(MiniFile) == 32); // Same on 32 and 64 bit
     std::vector<MiniFile> miniFiles = loadVector<MiniFile>(in, 0);
     filesList.resize(miniFiles.size());
+    files.Reserve(miniFiles.size());
 
     for (size_t i = 0; i < miniFiles.size(); i++)
     {
@@ -312,73 +469,80 @@ DieselDB::DieselDB()
             fi.langId = 0x11df684c9591b7e0; // 'unknown' - is in the hashlist, so you'll be able to find it
 
         // If it's a repeated file, the language must be different
-        const auto& prev = files.find(fi.Key());
-        if (prev != files.end())
+        DslFile* prev = files.Insert(&fi);
+        if (prev != nullptr)
         {
-            assert(prev->second->langId != fi.langId);
-            fi.next = prev->second;
+            assert(prev->langId != fi.langId);
+            fi.next = prev;
         }
-
-        files[fi.Key()] = &fi;
     }
 
-    // printf("File count: %ld\n", files.size());
+    // printf("File count: %ld\n", files.Size());
 
-    // Load each of the bundle headers
-    std::string suffix        = "_h.bundle";
-    std::string prefix        = "all_";
-    std::string stream_prefix = "stream_";
-    for (const std::string& name : raidhook::Util::GetDirectoryContents("assets"))
-    {
-        if (name.length() <= suffix.size())
-            continue;
-        if (name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0)
-            continue;
-        if (name == "all_h.bundle")
-            continue; // all_h handling later
+    uint64_t blb_time = monotonicTimeMicros();
 
-        bool package = true;
-        if (name.compare(0, prefix.size(), prefix) == 0)
-            package = false;
-
-        std::string headerPath = "assets/" + name;
+    // Inflate and parse all the headers in parallel. This is most of the work, since the package
+    // data files also have to be walked to find their chunks.
+    loadHeaders(headers);
 
-        // Find the headerPath to the data file - chop out the '_h' bit
-        std::string dataPath = headerPath;
-        dataPath.erase(dataPath.end() - 9, dataPath.end() - 7);
+    uint64_t headers_time = monotonicTimeMicros();
 
-        if (name.compare(0, stream_prefix.size(), stream_prefix) == 0)
-            package = false;
+    // Then apply them in the order they were found, so that if a file shows up in more than one
+    // bundle, the same one wins every time.
+    for (HeaderEntry& header : headers)
+    {
+        if (header.error)
+            std::rethrow_exception(header.error);
 
-        if (package)
-        {
-            DieselBundle* bundle = loadPackageBundle(dataPath);
-            loadPackageHeader(bundle, headerPath, dataPath, filesList);
-        }
+        if (header.package)
+            applyPackageHeader(header, filesList);
         else
-        {
-            DieselBundle* bundle = loadBundle(dataPath);
-            loadBundleHeader(bundle, headerPath, dataPath, filesList);
-        }
+            applyBundleHeader(header, filesList);
+
+        bundles.push_back(header.bundle);
+
+        header.positions = {};
+        header.items     = {};
     }
 
+    SaveIndexCache(sources);
+
     // We're done loading, print out how long it took and how many files it's tracking (to estimate memory usage)
     uint64_t end_time = monotonicTimeMicros();
 
     char buff[1024];
     memset(buff, 0, sizeof(buff));
-    snprintf(buff, sizeof(buff) - 1, "Finished loading DB info: %zd files in %d ms", filesList.size(), (int)(end_time - start_time) / 1000);
+    snprintf(buff, sizeof(buff) - 1, "Finished loading DB info: %zd files from %zd bundles in %d ms (blb: %d ms, headers: %d ms on %zd threads, merge: %d ms)",
+             filesList.size(), headers.size(), (int)(end_time - start_time) / 1000, (int)(blb_time - start_time) / 1000,
+             (int)(headers_time - blb_time) / 1000, raidhook::ThreadPool::GetSingleton().GetWorkerCount(), (int)(end_time - headers_time) / 1000);
     RAIDHOOK_LOG_LOG(buff);
 }
 
-static void loadPackageHeader(DieselBundle* bundle, const std::string& headerPath, const std::string& dataPath, FileList files)
+static void loadHeaders(std::vector<HeaderEntry>& headers)
 {
-    bundle->headerPath = headerPath;
-    bundle->path       = dataPath;
+    // Each header keeps its own error, so one bad bundle doesn't stop the rest from loading
+    raidhook::ThreadPool::GetSingleton().ParallelFor(headers.size(), [&headers](size_t i) {
+        HeaderEntry& header = headers[i];
 
+        try
+        {
+            if (header.package)
+                readPackageHeader(header);
+            else
+                readBundleHeader(header);
+        }
+        catch (...)
+        {
+            header.error = std::current_exception();
+        }
+    }, raidhook::TaskClass::IO);
+}
+
+static std::vector<uint8_t> loadHeaderData(const std::string& headerPath)
+{
     std::ifstream in;
     in.exceptions(std::ios::failbit | std::ios::badbit);
-    in.open(bundle->headerPath, std::ios::binary);
+    in.open(headerPath, std::ios::binary);
 
     in.seekg(sizeof(uint64_t), std::ios::beg);
 
@@ -400,17 +564,28 @@ static void loadPackageHeader(DieselBundle* bundle, const std::string& headerPat
     if (ret != Z_OK)
         throw std::runtime_error("Failed to decompress package header");
 
+    return dstData;
+}
+
+static void readPackageHeader(HeaderEntry& header)
+{
+    DieselBundle* bundle = loadPackageBundle(header.dataPath);
+    bundle->headerPath   = header.headerPath;
+    bundle->path         = header.dataPath;
+    header.bundle        = bundle;
+
+    std::vector<uint8_t> dstData = loadHeaderData(header.headerPath);
+
     // if BlockSize != 0 then there are more vector blocks in this file
     uint32_t blockSize = *reinterpret_cast<uint32_t*>(dstData.data());
 
-    // Files
-    struct FilePos
-    {
-        int32_t fileId;
-        int32_t offset;
-    };
-    static_assert(sizeof(FilePos) == 8); // Same on 32 and 64 bit
-    std::vector<FilePos> positions = loadVector<FilePos>(dstData.data() + sizeof(uint32_t), 0);
+    header.positions = loadVector<FilePos>(dstData.data() + sizeof(uint32_t), 0);
+}
+
+static void applyPackageHeader(const HeaderEntry& header, FileList files)
+{
+    DieselBundle*               bundle    = header.bundle;
+    const std::vector<FilePos>& positions = header.positions;
 
     for (size_t i = 0; i < positions.size(); ++i)
     {
@@ -456,31 +631,9 @@ static void loadPackageHeader(DieselBundle* bundle, const std::string& headerPat
     }
 }
 
-static void loadBundleHeader(DieselBundle* dieselBundle, const std::string& headerPath, const std::string& dataPath, FileList files)
+static void readBundleHeader(HeaderEntry& header)
 {
-    std::ifstream in;
-    in.exceptions(std::ios::failbit | std::ios::badbit);
-    in.open(headerPath, std::ios::binary);
-
-    in.seekg(sizeof(uint64_t), std::ios::beg);
-
-    uint32_t compressedSize;
-    in.read((char*)&compressedSize, sizeof(compressedSize));
-
-    std::vector<uint8_t> srcData(compressedSize);
-    in.read((char*)srcData.data(), srcData.size());
-
-    uint32_t dstSize = *reinterpret_cast<uint32_t*>(srcData.data() + (srcData.size() - sizeof(uint32_t)));
-
-    std::vector<uint8_t> dstData(dstSize);
-
-    auto destSize   = static_cast<uLongf>(dstData.size());
-    auto sourceSize = static_cast<uLongf>(srcData.size());
-
-    auto ret = uncompress2(dstData.data(), &destSize, srcData.data(), &sourceSize);
-
-    if (ret != Z_OK)
-        throw std::runtime_error("Failed to decompress package header");
+    std::vector<uint8_t> dstData = loadHeaderData(header.headerPath);
 
     struct BundleInfo
     {
@@ -492,27 +645,26 @@ static void loadBundleHeader(DieselBundle* dieselBundle, const std::string& head
 
     static_assert(sizeof(BundleInfo) == 48);
 
-    struct ItemInfo
-    {
-        uint32_t fileId;
-        uint32_t offset;
-        uint32_t length;
-    };
-    static_assert(sizeof(ItemInfo) == 12); // True on 32/64 bit
-
     BundleInfo bundle = *reinterpret_cast<BundleInfo*>(dstData.data() + sizeof(uint32_t));
     size_t     offset = sizeof(uint32_t) + sizeof(BundleInfo);
 
     assert(bundle.zero == 0);
     assert(bundle.one == 1);
 
-    dieselBundle->headerPath = headerPath;
-    dieselBundle->path       = dataPath;
+    DieselBundle* dieselBundle = loadBundle(header.dataPath);
+    dieselBundle->headerPath   = header.headerPath;
+    dieselBundle->path         = header.dataPath;
+    header.bundle              = dieselBundle;
+
+    header.items = loadVector<ItemInfo>(dstData.data() + sizeof(uint32_t), 0, bundle.vec);
+}
 
-    for (ItemInfo item : loadVector<ItemInfo>(dstData.data() + sizeof(uint32_t), 0, bundle.vec))
+static void applyBundleHeader(const HeaderEntry& header, FileList files)
+{
+    for (const ItemInfo& item : header.items)
     {
         DslFile* fi = &files.at(item.fileId - 1);
-        fi->bundle  = dieselBundle;
+        fi->bundle  = header.bundle;
         fi->offset  = item.offset; // Compressed File Offset
         fi->length  = item.length;
     }
@@ -559,24 +711,20 @@ static DieselBundle* loadBundle(const std::string& dataPath)
 
 DslFile* DieselDB::Find(idstring name, idstring ext)
 {
-    auto res = files.find(std::pair<idstring, idstring>(name, ext));
-
-    // Not found?
-    if (res == files.end())
-    {
-        return nullptr;
-    }
-
-    return res->second;
+    return files.Find(name, ext);
 }
 
-BLTAbstractDataStore* DieselDB::Open(DieselBundle* bundle)
+BLTAbstractDataStore* DieselDB::Open(DieselBundle* bundle, uint64_t position, uint64_t length)
 {
-    // Ideally we'd cache these to avoid opening files all the time, but this is
-    // pretty much what the Linux version of PD2 seems to do internally. The
-    // problem here is that the data store is reference counted by dsl::Archive, so
-    // caching it will be somewhat difficult.
-    // TODO: there is no raid linux binary tho, what now?
-    BLTFileDataStore* fds = BLTFileDataStore::Open(bundle->path);
+    // The data store itself is reference counted by dsl::Archive, so we make a new one every time, but
+    // they all share the bundle's file handle through the FileHandleCache.
+    // Packaged bundles are compressed, so they have to be inflated as the game reads them
+    if (!bundle->ChunkOffsets.empty())
+        return new BLTChunkedBundleDataStore(bundle);
+
+    if (BLTAsyncFileDataStore::IsEnabled())
+        return BLTAsyncFileDataStore::Open(bundle->path);
+
+    BLTPrefetchDataStore* fds = BLTPrefetchDataStore::Open(bundle->path, position, length);
     return fds;
 }
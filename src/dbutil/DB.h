@@ -1,10 +1,12 @@
 #pragma once
 
 #include "Datastore.h"
+#include "FileIndex.h"
+#include "MappedFile.h"
 #include "platform.h"
 
-#include <istream>
-#include <map>
+#include <memory>
+#include <mutex>
 #include <vector>
 
 namespace blt::db {
@@ -15,6 +17,28 @@ namespace blt::db {
         std::string         headerPath;
         size_t              DecompressedFileSize;
         std::vector<size_t> ChunkOffsets;
+
+        /**
+         * Get a read-only mapping of this bundle's data file. It's created the first time an asset
+         * is read from this bundle, and then shared by every reader for as long as the DB exists.
+         *
+         * Throws std::runtime_error if the file can't be mapped.
+         */
+        const MappedFile& Mapping();
+
+        // The decompressed size of each chunk in a packaged bundle, other than the last one
+        static constexpr size_t CHUNK_SIZE = 0x10000;
+
+        /**
+         * Inflate one of the chunks of a packaged bundle into out, resizing it to fit.
+         *
+         * Throws std::runtime_error if there's no such chunk, or it's corrupt.
+         */
+        void InflateChunk(size_t chunkIdx, std::vector<uint8_t>& out);
+
+      private:
+        std::once_flag              mappingOnce;
+        std::unique_ptr<MappedFile> mapping;
     };
 
     struct DslFile
@@ -43,7 +67,12 @@ namespace blt::db {
 
         [[nodiscard]] std::pair<idstring, idstring> Key() const { return std::pair<idstring, idstring>(name, type); }
 
-        [[nodiscard]] std::vector<uint8_t> ReadContents(std::istream& fi) const;
+        /**
+         * Read and decompress this asset, straight from the bundle's mapping into the returned buffer.
+         *
+         * Throws std::runtime_error if the bundle can't be read or the data is corrupt.
+         */
+        [[nodiscard]] std::vector<uint8_t> ReadContents() const;
     };
 
     class DieselDB
@@ -59,11 +88,26 @@ namespace blt::db {
 
         static DieselDB* Instance();
 
-        BLTAbstractDataStore* Open(DieselBundle* bundle);
+        // Open a bundle for the game to read an asset from, and start reading that asset's part of it in the background
+        BLTAbstractDataStore* Open(DieselBundle* bundle, uint64_t position, uint64_t length);
 
       private:
-        std::vector<DslFile>                              filesList;
-        std::map<std::pair<idstring, idstring>, DslFile*> files;
+        // The size and last write time of one of the files the index was built from
+        struct IndexSource
+        {
+            std::string path;
+            uint64_t    size;
+            uint64_t    mtime;
+        };
+
+        // These are in DBCache.cpp
+        static std::vector<IndexSource> GetIndexSources(const std::vector<std::string>& paths);
+        bool                            LoadIndexCache(const std::vector<IndexSource>& sources);
+        void                            SaveIndexCache(const std::vector<IndexSource>& sources) const;
+
+        std::vector<DslFile>       filesList;
+        FileIndex                  files;
+        std::vector<DieselBundle*> bundles;
     };
 
 }; // namespace blt::db
@@ -0,0 +1,321 @@
+#include "DB.h"
+
+#include <util/util.h>
+
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <string.h>
+
+#include <windows.h>
+
+using namespace blt::db;
+using blt::idstring;
+
+// Bump this whenever the layout of the cache changes, so old caches get thrown away
+static const uint32_t INDEX_CACHE_MAGIC    = 0x49544c42; // 'BLTI'
+static const uint32_t INDEX_CACHE_REVISION = 1;
+static const char*    INDEX_CACHE_FILE     = "assetdb_cache.db";
+
+static const uint32_t NO_INDEX = ~0u;
+
+#pragma pack(1)
+
+struct CachedFile
+{
+    idstring name;
+    idstring type;
+    int32_t  fileId;
+    int32_t  rawLangId;
+    idstring langId;
+    uint32_t next;   // Index into the file list, or NO_INDEX
+    uint32_t bundle; // Index into the bundle list, or NO_INDEX
+    uint32_t offset;
+    uint32_t length;
+};
+
+#pragma pack()
+
+static_assert(sizeof(CachedFile) == 48);
+
+namespace
+{
+    class CacheReader
+    {
+      public:
+        CacheReader(const uint8_t* data, size_t size) : data(data), size(size) {}
+
+        void ReadBytes(void* dest, size_t length)
+        {
+            if (length > size - pos)
+                throw std::runtime_error("cache file is truncated");
+
+            memcpy(dest, data + pos, length);
+            pos += length;
+        }
+
+        template<typename T>
+        T Read()
+        {
+            T value;
+            ReadBytes(&value, sizeof(value));
+            return value;
+        }
+
+        // Read an element count, checking that many elements could fit in the rest of the file
+        uint32_t ReadCount(size_t elementSize)
+        {
+            uint32_t count = Read<uint32_t>();
+            if (count > (size - pos) / elementSize)
+                throw std::runtime_error("cache file is truncated");
+            return count;
+        }
+
+        std::string ReadString()
+        {
+            std::string str(ReadCount(1), '\0');
+            ReadBytes(str.data(), str.size());
+            return str;
+        }
+
+        [[nodiscard]] bool AtEnd() const { return pos == size; }
+
+      private:
+        const uint8_t* data;
+        size_t         size;
+        size_t         pos = 0;
+    };
+
+    class CacheWriter
+    {
+      public:
+        void WriteBytes(const void* src, size_t length)
+        {
+            const auto* bytes = static_cast<const uint8_t*>(src);
+            data.insert(data.end(), bytes, bytes + length);
+        }
+
+        template<typename T>
+        void Write(const T& value)
+        {
+            WriteBytes(&value, sizeof(value));
+        }
+
+        void WriteString(const std::string& str)
+        {
+            Write<uint32_t>((uint32_t)str.size());
+            WriteBytes(str.data(), str.size());
+        }
+
+        std::vector<uint8_t> data;
+    };
+} // namespace
+
+std::vector<DieselDB::IndexSource> DieselDB::GetIndexSources(const std::vector<std::string>& paths)
+{
+    std::vector<IndexSource> sources;
+    sources.reserve(paths.size());
+
+    for (const std::string& path : paths)
+    {
+        IndexSource& source = sources.emplace_back();
+        source.path         = path;
+        source.size         = 0;
+        source.mtime        = 0;
+
+        // If it's missing, leave it zeroed - the full parse will fail on it anyway
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &attributes))
+            continue;
+
+        source.size  = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+        source.mtime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+    }
+
+    return sources;
+}
+
+bool DieselDB::LoadIndexCache(const std::vector<IndexSource>& sources)
+{
+    std::unique_ptr<MappedFile> cacheFile;
+    try
+    {
+        cacheFile = std::make_unique<MappedFile>(INDEX_CACHE_FILE);
+    }
+    catch (const std::runtime_error&)
+    {
+        RAIDHOOK_LOG_LOG("No asset index cache found, loading DB from the game files");
+        return false;
+    }
+
+    std::vector<DieselBundle*> loadedBundles;
+
+    try
+    {
+        CacheReader in(cacheFile->Data(), cacheFile->Size());
+
+        if (in.Read<uint32_t>() != INDEX_CACHE_MAGIC || in.Read<uint32_t>() != INDEX_CACHE_REVISION)
+            throw std::runtime_error("different revision");
+
+        // Make sure every file the cache was built from is exactly the same as it was then
+        if (in.Read<uint32_t>() != sources.size())
+            throw std::runtime_error("the asset files have changed");
+
+        for (const IndexSource& source : sources)
+        {
+            std::string path  = in.ReadString();
+            uint64_t    size  = in.Read<uint64_t>();
+            uint64_t    mtime = in.Read<uint64_t>();
+
+            if (path != source.path || size != source.size || mtime != source.mtime)
+                throw std::runtime_error("the asset files have changed");
+        }
+
+        uint32_t bundleCount = in.Read<uint32_t>();
+        for (uint32_t i = 0; i < bundleCount; i++)
+        {
+            // Memory leak, same as when the bundles are loaded normally
+            DieselBundle* bundle = loadedBundles.emplace_back(new DieselBundle());
+
+            bundle->path                 = in.ReadString();
+            bundle->headerPath           = in.ReadString();
+            bundle->DecompressedFileSize = (size_t)in.Read<uint64_t>();
+
+            bundle->ChunkOffsets.resize(in.ReadCount(sizeof(uint64_t)));
+            for (size_t& chunkOffset : bundle->ChunkOffsets)
+                chunkOffset = (size_t)in.Read<uint64_t>();
+        }
+
+        std::vector<CachedFile> cachedFiles(in.ReadCount(sizeof(CachedFile)));
+        in.ReadBytes(cachedFiles.data(), cachedFiles.size() * sizeof(CachedFile));
+
+        if (!in.AtEnd())
+            throw std::runtime_error("unexpected data at the end of the file");
+
+        filesList.resize(cachedFiles.size());
+
+        // Files that are pointed to by another file's next pointer are further down a language
+        // chain, everything else is the head of its chain and goes into the lookup index.
+        std::vector<bool> isChained(cachedFiles.size());
+
+        for (size_t i = 0; i < cachedFiles.size(); i++)
+        {
+            const CachedFile& cached = cachedFiles[i];
+            DslFile&          fi     = filesList[i];
+
+            if (cached.next != NO_INDEX && cached.next >= cachedFiles.size())
+                throw std::runtime_error("invalid file index");
+            if (cached.bundle != NO_INDEX && cached.bundle >= loadedBundles.size())
+                throw std::runtime_error("invalid bundle index");
+
+            fi.name      = cached.name;
+            fi.type      = cached.type;
+            fi.fileId    = cached.fileId;
+            fi.rawLangId = cached.rawLangId;
+            fi.langId    = cached.langId;
+            fi.next      = cached.next == NO_INDEX ? nullptr : &filesList[cached.next];
+            fi.bundle    = cached.bundle == NO_INDEX ? nullptr : loadedBundles[cached.bundle];
+            fi.offset    = cached.offset;
+            fi.length    = cached.length;
+
+            if (cached.next != NO_INDEX)
+                isChained[cached.next] = true;
+        }
+
+        // Files that never showed up in the .blb are just padding, and were never put in the index
+        files.Reserve(filesList.size());
+        for (size_t i = 0; i < filesList.size(); i++)
+        {
+            if (!isChained[i] && filesList[i].fileId != 0)
+                files.Insert(&filesList[i]);
+        }
+    }
+    catch (const std::runtime_error& ex)
+    {
+        RAIDHOOK_LOG_WARN(std::string("Discarding asset index cache: ") + ex.what());
+
+        for (DieselBundle* bundle : loadedBundles)
+            delete bundle;
+
+        filesList.clear();
+        files.Clear();
+        return false;
+    }
+
+    bundles = std::move(loadedBundles);
+    return true;
+}
+
+void DieselDB::SaveIndexCache(const std::vector<IndexSource>& sources) const
+{
+    CacheWriter out;
+
+    out.Write<uint32_t>(INDEX_CACHE_MAGIC);
+    out.Write<uint32_t>(INDEX_CACHE_REVISION);
+
+    out.Write<uint32_t>((uint32_t)sources.size());
+    for (const IndexSource& source : sources)
+    {
+        out.WriteString(source.path);
+        out.Write<uint64_t>(source.size);
+        out.Write<uint64_t>(source.mtime);
+    }
+
+    std::unordered_map<const DieselBundle*, uint32_t> bundleIndices;
+
+    out.Write<uint32_t>((uint32_t)bundles.size());
+    for (const DieselBundle* bundle : bundles)
+    {
+        bundleIndices[bundle] = (uint32_t)bundleIndices.size();
+
+        out.WriteString(bundle->path);
+        out.WriteString(bundle->headerPath);
+        out.Write<uint64_t>(bundle->DecompressedFileSize);
+
+        out.Write<uint32_t>((uint32_t)bundle->ChunkOffsets.size());
+        for (size_t chunkOffset : bundle->ChunkOffsets)
+            out.Write<uint64_t>(chunkOffset);
+    }
+
+    out.Write<uint32_t>((uint32_t)filesList.size());
+    for (const DslFile& fi : filesList)
+    {
+        CachedFile cached;
+        cached.name      = fi.name;
+        cached.type      = fi.type;
+        cached.fileId    = fi.fileId;
+        cached.rawLangId = fi.rawLangId;
+        cached.langId    = fi.langId;
+        cached.next      = fi.next ? (uint32_t)(fi.next - filesList.data()) : NO_INDEX;
+        cached.bundle    = fi.bundle ? bundleIndices.at(fi.bundle) : NO_INDEX;
+        cached.offset    = fi.offset;
+        cached.length    = fi.length;
+        out.Write(cached);
+    }
+
+    // Write it out under a temporary name first, so a crash halfway through can't leave a broken
+    // cache in place.
+    std::string tempFile = std::string(INDEX_CACHE_FILE) + ".tmp";
+    {
+        std::ofstream outfile(tempFile, std::ios::binary);
+        if (!outfile.good())
+        {
+            RAIDHOOK_LOG_ERROR("Could not open asset index cache file for saving");
+            return;
+        }
+
+        outfile.write((const char*)out.data.data(), out.data.size());
+        if (!outfile.good())
+        {
+            RAIDHOOK_LOG_ERROR("Could not write asset index cache file");
+            return;
+        }
+    }
+
+    if (!MoveFileExA(tempFile.c_str(), INDEX_CACHE_FILE, MOVEFILE_REPLACE_EXISTING))
+    {
+        RAIDHOOK_LOG_ERROR("Could not replace asset index cache file");
+        DeleteFileA(tempFile.c_str());
+    }
+}
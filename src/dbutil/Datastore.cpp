@@ -1,13 +1,20 @@
 #include "Datastore.h"
+#include "DB.h"
+#include "FileHandleCache.h"
+#include "threading/queue.h"
+#include "threading/threadpool.h"
 #include "util/util.h"
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+
 #include <assert.h>
-#include <fcntl.h>
 #include <stdlib.h>
 #include <string.h>
 
-#include <io.h>
-#define lseek64 _lseeki64
+using blt::db::DieselBundle;
+using blt::db::FileHandleCache;
 
 // BLTAbstractDataStore
 
@@ -34,34 +41,30 @@ uint64_t BLTAbstractDataStore::state()
 
 BLTFileDataStore* BLTFileDataStore::Open(std::string filePath)
 {
-	int flags = O_RDONLY | O_BINARY;
-	int fd = open(filePath.c_str(), flags);
+	auto file = FileHandleCache::Instance().Open(filePath);
 
 	// Make sure the file opened correctly
-	if (fd == -1)
+	if (!file)
 	{
 		return nullptr;
 	}
 
 	auto obj = new BLTFileDataStore();
-	obj->fd = fd;
-
-	int64_t res = lseek64(fd, 0, SEEK_END);
-	assert(res != -1);
-	obj->file_size = (size_t)res;
+	obj->file = std::move(file);
+	obj->file_size = (size_t)obj->file->Size();
 
 	return obj;
 }
 
 BLTFileDataStore::~BLTFileDataStore()
 {
-	::close(fd);
+	// The file itself is closed by the cache, once nothing is using it
 }
 
 size_t BLTFileDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
 {
-	lseek64(fd, position_in_file, SEEK_SET);
-	size_t count = ::read(fd, data, length);
+	// Positional reads don't share a file pointer, so any number of datastores can read the same file at once
+	size_t count = file->ReadAt(position_in_file, data, length);
 	assert(count == length);
 
 	return count;
@@ -132,3 +135,348 @@ bool BLTStringDataStore::good() const
 {
 	return true;
 }
+
+// BLTPrefetchDataStore
+
+// Don't read more than this ahead of time, so a huge asset (eg, a movie) isn't pulled into memory in one go
+static const uint64_t MAX_PREFETCH_SIZE = 16 * 1024 * 1024;
+
+BLTPrefetchDataStore* BLTPrefetchDataStore::Open(std::string filePath, uint64_t position, uint64_t length)
+{
+	BLTFileDataStore* file = BLTFileDataStore::Open(filePath);
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	auto obj = new BLTPrefetchDataStore(file);
+	PrefetchState& state = *obj->prefetch_state;
+	state.position = std::min<uint64_t>(position, file->size());
+
+	uint64_t available = file->size() - state.position;
+	state.data.resize((size_t)std::min<uint64_t>(std::min<uint64_t>(length, available), MAX_PREFETCH_SIZE));
+
+	// The shared pool might be busy with long tasks, but read won't wait for this unless it's already started
+	raidhook::ThreadPool::GetSingleton().Submit(raidhook::TaskClass::IO, [state{obj->prefetch_state}, file]() { prefetch(state, file); });
+
+	return obj;
+}
+
+BLTPrefetchDataStore::~BLTPrefetchDataStore()
+{
+	// The I/O thread uses the file if the prefetch is running
+	finish_prefetch();
+	delete file;
+}
+
+void BLTPrefetchDataStore::prefetch(const std::shared_ptr<PrefetchState>& state, BLTFileDataStore* file)
+{
+	{
+		std::lock_guard guard(state->mutex);
+
+		// If it was claimed, the datastore (and file) might not even exist any more
+		if (state->status != PrefetchStatus::Queued)
+			return;
+
+		state->status = PrefetchStatus::Running;
+	}
+
+	if (!state->data.empty())
+	{
+		size_t count = file->read(state->position, state->data.data(), state->data.size());
+
+		// If it didn't work, read everything directly from the file instead
+		if (count != state->data.size())
+			state->data.clear();
+	}
+
+	{
+		std::lock_guard guard(state->mutex);
+		state->status = PrefetchStatus::Done;
+	}
+	state->done_cv.notify_all();
+}
+
+void BLTPrefetchDataStore::finish_prefetch()
+{
+	std::unique_lock lock(prefetch_state->mutex);
+
+	if (prefetch_state->status == PrefetchStatus::Queued)
+	{
+		prefetch_state->status = PrefetchStatus::Claimed;
+		std::vector<uint8_t>().swap(prefetch_state->data);
+		return;
+	}
+
+	prefetch_state->done_cv.wait(lock, [this]() { return prefetch_state->status != PrefetchStatus::Running; });
+}
+
+size_t BLTPrefetchDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	// Usually the prefetch will be long done by the time the game reads the asset, so this won't block
+	finish_prefetch();
+
+	const PrefetchState& state = *prefetch_state;
+	if (state.status == PrefetchStatus::Done && position_in_file >= state.position &&
+	    position_in_file - state.position + length <= state.data.size())
+	{
+		memcpy(data, state.data.data() + (position_in_file - state.position), length);
+		return length;
+	}
+
+	return file->read(position_in_file, data, length);
+}
+
+bool BLTPrefetchDataStore::close()
+{
+	RAIDHOOK_LOG_ERROR("BLTPrefetchDataStore::close called - unimplemented!");
+	abort();
+}
+
+size_t BLTPrefetchDataStore::size() const
+{
+	return file->size();
+}
+
+bool BLTPrefetchDataStore::is_asynchronous() const
+{
+	// The reading is done in the background, but from the game's point of view this is still a regular
+	// synchronous datastore - see BLTAsyncFileDataStore for one that isn't
+	return false;
+}
+
+bool BLTPrefetchDataStore::good() const
+{
+	return true;
+}
+
+// BLTAsyncFileDataStore
+
+namespace
+{
+	struct AsyncReadCompletion
+	{
+		std::function<void()> func;
+	};
+} // namespace
+
+RAIDHOOK_REGISTER_EVENTQUEUE(AsyncReadCompletion, AsyncReadCompletion);
+
+static std::atomic<BLTAsyncFileDataStore::CompletionHandler> completion_handler = nullptr;
+static std::atomic<bool> async_enabled = false;
+
+void BLTAsyncFileDataStore::SetCompletionHandler(CompletionHandler handler)
+{
+	completion_handler = handler;
+}
+
+void BLTAsyncFileDataStore::SetEnabled(bool enabled)
+{
+	async_enabled = enabled;
+}
+
+bool BLTAsyncFileDataStore::IsEnabled()
+{
+	return async_enabled;
+}
+
+BLTAsyncFileDataStore* BLTAsyncFileDataStore::Open(std::string filePath)
+{
+	auto file = FileHandleCache::Instance().Open(filePath);
+	if (!file)
+	{
+		return nullptr;
+	}
+
+	return new BLTAsyncFileDataStore(std::move(file));
+}
+
+BLTAsyncFileDataStore::~BLTAsyncFileDataStore()
+{
+	// The read in flight is writing into a buffer the archive might free as soon as this is gone
+	std::unique_lock lock(read_state->mutex);
+	read_state->done_cv.wait(lock, [this]() { return read_state->state != State::Busy; });
+	read_state->closed = true;
+}
+
+void BLTAsyncFileDataStore::wait_for_read()
+{
+	std::unique_lock lock(read_state->mutex);
+	read_state->done_cv.wait(lock, [this]() { return read_state->state != State::Busy; });
+}
+
+size_t BLTAsyncFileDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	wait_for_read();
+
+	// Reads past the end give as much as there is, the same as the other datastores
+	if (position_in_file >= file->Size())
+		length = 0;
+	else
+		length = (size_t)std::min<uint64_t>(length, file->Size() - position_in_file);
+
+	{
+		std::lock_guard guard(read_state->mutex);
+		read_state->state = State::Busy;
+	}
+
+	raidhook::ThreadPool::GetSingleton().Submit(
+	    raidhook::TaskClass::IO, [read_state{read_state}, file{file}, this, position_in_file, data, length]() {
+		    size_t count = length == 0 ? 0 : file->ReadAt(position_in_file, data, length);
+
+		    {
+			    std::lock_guard guard(read_state->mutex);
+			    read_state->state = count == length ? State::Ready : State::Failed;
+		    }
+		    read_state->done_cv.notify_all();
+
+		    complete(read_state, this);
+	    });
+
+	return length;
+}
+
+void BLTAsyncFileDataStore::complete(const std::shared_ptr<ReadState>& read_state, BLTAsyncFileDataStore* datastore)
+{
+	{
+		std::lock_guard guard(read_state->mutex);
+		if (!read_state->callback)
+			return;
+	}
+
+	// The callback belongs to the engine, so it can only be run from the game thread. The datastore might
+	// have been destroyed by then, in which case the archive that set the callback is gone too.
+	GetAsyncReadCompletionQueue().AddToQueue(
+	    [](AsyncReadCompletion completion) { completion.func(); },
+	    AsyncReadCompletion{[read_state, datastore]() {
+		    void* callback;
+		    {
+			    std::lock_guard guard(read_state->mutex);
+			    if (read_state->closed)
+				    return;
+			    callback = read_state->callback;
+		    }
+
+		    CompletionHandler handler = completion_handler;
+		    if (handler && callback)
+			    handler(datastore, callback);
+	    }});
+}
+
+bool BLTAsyncFileDataStore::close()
+{
+	RAIDHOOK_LOG_ERROR("BLTAsyncFileDataStore::close called - unimplemented!");
+	abort();
+}
+
+size_t BLTAsyncFileDataStore::size() const
+{
+	return (size_t)file->Size();
+}
+
+bool BLTAsyncFileDataStore::is_asynchronous() const
+{
+	return true;
+}
+
+void BLTAsyncFileDataStore::set_asynchronous_completion_callback(void* callback)
+{
+	std::lock_guard guard(read_state->mutex);
+	read_state->callback = callback;
+}
+
+uint64_t BLTAsyncFileDataStore::state()
+{
+	std::lock_guard guard(read_state->mutex);
+	return (uint64_t)read_state->state;
+}
+
+bool BLTAsyncFileDataStore::good() const
+{
+	return true;
+}
+
+// BLTChunkedBundleDataStore
+
+BLTChunkedBundleDataStore::BLTChunkedBundleDataStore(DieselBundle* bundle) : bundle(bundle)
+{
+}
+
+const std::vector<uint8_t>& BLTChunkedBundleDataStore::get_chunk(size_t index)
+{
+	// Reuse the least recently used slot, unless we already have it
+	WindowChunk* target = &window[0];
+	for (WindowChunk& chunk : window)
+	{
+		if (chunk.index == index)
+		{
+			target = &chunk;
+			break;
+		}
+
+		if (chunk.last_used < target->last_used)
+			target = &chunk;
+	}
+
+	if (target->index != index)
+	{
+		// Mark it empty first, in case inflating it fails
+		target->index = SIZE_MAX;
+		bundle->InflateChunk(index, target->data);
+		target->index = index;
+	}
+
+	target->last_used = ++use_counter;
+	return target->data;
+}
+
+size_t BLTChunkedBundleDataStore::read(uint64_t position_in_file, uint8_t* data, size_t length)
+{
+	std::lock_guard guard(mutex);
+
+	size_t count = 0;
+
+	try
+	{
+		while (count < length && position_in_file + count < size())
+		{
+			uint64_t position = position_in_file + count;
+			size_t offset = (size_t)(position % DieselBundle::CHUNK_SIZE);
+
+			const std::vector<uint8_t>& chunk = get_chunk((size_t)(position / DieselBundle::CHUNK_SIZE));
+			if (offset >= chunk.size())
+				break;
+
+			size_t amount = std::min<size_t>(chunk.size() - offset, length - count);
+			memcpy(data + count, chunk.data() + offset, amount);
+			count += amount;
+		}
+	}
+	catch (const std::exception& ex)
+	{
+		RAIDHOOK_LOG_ERROR(std::string("Failed to read from packaged bundle ") + bundle->path + " - " + ex.what());
+	}
+
+	return count;
+}
+
+bool BLTChunkedBundleDataStore::close()
+{
+	RAIDHOOK_LOG_ERROR("BLTChunkedBundleDataStore::close called - unimplemented!");
+	abort();
+}
+
+size_t BLTChunkedBundleDataStore::size() const
+{
+	return bundle->DecompressedFileSize;
+}
+
+bool BLTChunkedBundleDataStore::is_asynchronous() const
+{
+	return false;
+}
+
+bool BLTChunkedBundleDataStore::good() const
+{
+	return true;
+}
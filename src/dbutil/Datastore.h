@@ -1,9 +1,19 @@
 #pragma once
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include <stdint.h>
 
+namespace blt::db
+{
+	class SharedFile;
+	struct DieselBundle;
+}
+
 // All this is checked on Linux, verify that it's the same on Windows
 
 class BLTAbstractDataStore
@@ -17,8 +27,8 @@ class BLTAbstractDataStore
 	virtual bool close() = 0;
 	virtual size_t size() const = 0;
 	virtual bool is_asynchronous() const = 0;
-	virtual void set_asynchronous_completion_callback(void* /*dsl::LuaRef*/); // ignore this
-	virtual uint64_t state(); // ignore this
+	virtual void set_asynchronous_completion_callback(void* /*dsl::LuaRef*/); // Only for asynchronous datastores
+	virtual uint64_t state(); // Only for asynchronous datastores
 	virtual bool good() const = 0;
 };
 
@@ -39,7 +49,9 @@ class BLTFileDataStore : public BLTAbstractDataStore
 
   private:
 	BLTFileDataStore() = default; // Used by Open, which can return null to indicate it didn't open properly
-	int fd = -1;
+
+	// Shared with every other datastore reading the same file, see FileHandleCache
+	std::shared_ptr<blt::db::SharedFile> file;
 	size_t file_size = 0;
 };
 
@@ -60,3 +72,168 @@ class BLTStringDataStore : public BLTAbstractDataStore
   private:
 	std::string contents;
 };
+
+// Reads part of a file on a background I/O thread as soon as it's opened, so by the time the game
+// gets around to reading the asset it's usually already in memory. If the game gets there before the
+// prefetch has even started, it reads the file directly instead of waiting in the thread pool's queue.
+class BLTPrefetchDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTPrefetchDataStore(const BLTPrefetchDataStore&) = delete;
+	BLTPrefetchDataStore& operator=(const BLTPrefetchDataStore&) = delete;
+
+	// Open a file and start reading length bytes of it from position, which is clamped to the end
+	// of the file and to a maximum prefetch size. Returns null if the file couldn't be opened.
+	static BLTPrefetchDataStore* Open(std::string filePath, uint64_t position, uint64_t length);
+	virtual ~BLTPrefetchDataStore();
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	explicit BLTPrefetchDataStore(BLTFileDataStore* file) : file(file)
+	{
+	}
+
+	enum class PrefetchStatus
+	{
+		Queued,
+		Running,
+		Done,
+		Claimed, // Something needed the datastore before the prefetch started, so it won't be run
+	};
+
+	// Shared with the queued task, which can outlive the datastore if the prefetch was claimed
+	struct PrefetchState
+	{
+		std::mutex mutex;
+		std::condition_variable done_cv;
+		PrefetchStatus status = PrefetchStatus::Queued;
+
+		uint64_t position = 0;
+		std::vector<uint8_t> data;
+	};
+
+	static void prefetch(const std::shared_ptr<PrefetchState>& state, BLTFileDataStore* file);
+
+	// Claims the prefetch if it hasn't started yet, or waits for it if it has. Afterwards the state
+	// isn't touched by anything else.
+	void finish_prefetch();
+
+	// Only used by the I/O thread while the prefetch is running, then only by whoever's reading
+	BLTFileDataStore* file;
+
+	std::shared_ptr<PrefetchState> prefetch_state = std::make_shared<PrefetchState>();
+};
+
+// A truly asynchronous datastore, using the protocol the engine has for them. dsl::Archive checks
+// is_asynchronous() when it's given the datastore, and if it's set:
+//  - It passes set_asynchronous_completion_callback a dsl::LuaRef, to be run once each read is done
+//  - read() only starts reading into the archive's buffer, and returns the number of bytes that will be read
+//  - The archive doesn't touch the buffer again until state() stops returning Busy
+// Only one read is in flight at a time - starting a new one waits for the last one to finish.
+//
+// The reading is done on the shared thread pool's I/O workers, and the completion callback is run on
+// the game thread while the event queues are being processed.
+class BLTAsyncFileDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTAsyncFileDataStore(const BLTAsyncFileDataStore&) = delete;
+	BLTAsyncFileDataStore& operator=(const BLTAsyncFileDataStore&) = delete;
+
+	// The values state() returns
+	enum class State : uint64_t
+	{
+		Ready = 0, // Nothing is being read, and the last read (if any) worked
+		Busy = 1,
+		Failed = 2, // The last read couldn't get everything it asked for
+	};
+
+	// Runs the dsl::LuaRef given to set_asynchronous_completion_callback. Without one, the engine only
+	// finds out a read is done by polling state().
+	typedef void (*CompletionHandler)(BLTAsyncFileDataStore* datastore, void* callback);
+	static void SetCompletionHandler(CompletionHandler handler);
+
+	// Whether hooked assets are given to the game through one of these, rather than a BLTPrefetchDataStore.
+	// Off by default.
+	static void SetEnabled(bool enabled);
+	static bool IsEnabled();
+
+	// Returns null if the file couldn't be opened
+	static BLTAsyncFileDataStore* Open(std::string filePath);
+	virtual ~BLTAsyncFileDataStore();
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual void set_asynchronous_completion_callback(void* callback) override;
+	virtual uint64_t state() override;
+	virtual bool good() const override;
+
+  private:
+	explicit BLTAsyncFileDataStore(std::shared_ptr<blt::db::SharedFile> file) : file(std::move(file))
+	{
+	}
+
+	// Shared with the read in flight and its completion event, which can outlive the datastore
+	struct ReadState
+	{
+		std::mutex mutex;
+		std::condition_variable done_cv;
+		State state = State::Ready;
+
+		// Set once the datastore is gone, so a late completion event doesn't run the callback
+		bool closed = false;
+
+		void* callback = nullptr;
+	};
+
+	static void complete(const std::shared_ptr<ReadState>& read_state, BLTAsyncFileDataStore* datastore);
+
+	// Blocks until there's no read in flight
+	void wait_for_read();
+
+	std::shared_ptr<blt::db::SharedFile> file;
+	std::shared_ptr<ReadState> read_state = std::make_shared<ReadState>();
+};
+
+// Presents the decompressed contents of a packaged bundle, inflating its chunks as they're read. Only
+// a few chunks are kept around at once, so any asset can be streamed out of a package without
+// inflating the whole thing into memory first.
+class BLTChunkedBundleDataStore : public BLTAbstractDataStore
+{
+  public:
+	// Delete default crap
+	BLTChunkedBundleDataStore(const BLTChunkedBundleDataStore&) = delete;
+	BLTChunkedBundleDataStore& operator=(const BLTChunkedBundleDataStore&) = delete;
+
+	explicit BLTChunkedBundleDataStore(blt::db::DieselBundle* bundle);
+	virtual size_t read(uint64_t position_in_file, uint8_t* data, size_t length) override;
+	virtual bool close() override;
+	virtual size_t size() const override;
+	virtual bool is_asynchronous() const override;
+	virtual bool good() const override;
+
+  private:
+	// Enough for the game to read across a chunk boundary, or go back a little, without inflating anything twice
+	static const size_t WINDOW_SIZE = 4;
+
+	struct WindowChunk
+	{
+		size_t index = SIZE_MAX;
+		uint64_t last_used = 0;
+		std::vector<uint8_t> data;
+	};
+
+	const std::vector<uint8_t>& get_chunk(size_t index);
+
+	blt::db::DieselBundle* bundle;
+
+	std::mutex mutex;
+	WindowChunk window[WINDOW_SIZE];
+	uint64_t use_counter = 0;
+};
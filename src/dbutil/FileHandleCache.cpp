@@ -0,0 +1,153 @@
+#include "FileHandleCache.h"
+
+#include <algorithm>
+
+using blt::db::FileHandleCache;
+using blt::db::SharedFile;
+
+SharedFile::~SharedFile()
+{
+	CloseHandle(handle);
+}
+
+namespace
+{
+	// The event a thread waits on for its reads to finish. Made the first time each thread reads, and
+	// closed when it exits.
+	class ReadEvent
+	{
+	  public:
+		ReadEvent() : event(CreateEventA(nullptr, TRUE, FALSE, nullptr))
+		{
+		}
+		~ReadEvent()
+		{
+			if (event)
+				CloseHandle(event);
+		}
+
+		ReadEvent(const ReadEvent&) = delete;
+		ReadEvent& operator=(const ReadEvent&) = delete;
+
+		HANDLE event;
+	};
+} // namespace
+
+size_t SharedFile::ReadAt(uint64_t position, uint8_t* data, size_t length) const
+{
+	// The handle is opened for overlapped I/O, so reads from different threads don't queue up behind each
+	// other. Each read has to wait on its own event: without one it'd wait on the file handle, which any
+	// other read finishing would signal.
+	thread_local ReadEvent read_event;
+	if (!read_event.event)
+		return 0;
+
+	size_t total = 0;
+
+	// ReadFile takes a 32-bit length, so read at most 2GiB at a time
+	while (total < length)
+	{
+		uint64_t offset = position + total;
+		DWORD chunk = (DWORD)std::min<size_t>(length - total, 0x80000000);
+
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD)offset;
+		overlapped.OffsetHigh = (DWORD)(offset >> 32);
+		overlapped.hEvent = read_event.event;
+
+		// Reading past the end of the file fails here or in GetOverlappedResult with ERROR_HANDLE_EOF,
+		// either way that's the end of the read.
+		if (!ReadFile(handle, data + total, chunk, nullptr, &overlapped) && GetLastError() != ERROR_IO_PENDING)
+			break;
+
+		DWORD count = 0;
+		if (!GetOverlappedResult(handle, &overlapped, &count, TRUE) || count == 0)
+			break;
+
+		total += count;
+	}
+
+	return total;
+}
+
+FileHandleCache& FileHandleCache::Instance()
+{
+	static FileHandleCache instance;
+	return instance;
+}
+
+bool FileHandleCache::GetStamp(const std::string& path, FileStamp& stamp)
+{
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesExA(path.c_str(), GetFileExInfoStandard, &data))
+		return false;
+
+	stamp.size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	stamp.write_time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+	return true;
+}
+
+std::shared_ptr<SharedFile> FileHandleCache::Open(const std::string& path)
+{
+	std::lock_guard guard(mutex);
+
+	// Taken before the file is opened, so if it's replaced in between it's just opened again next time
+	FileStamp stamp;
+	if (!GetStamp(path, stamp))
+		return nullptr;
+
+	auto iter = files.find(path);
+	if (iter != files.end())
+	{
+		if (iter->second.stamp == stamp)
+		{
+			lru.splice(lru.begin(), lru, iter->second.lru_position);
+			return iter->second.file;
+		}
+
+		// The file has been changed or replaced. Anything still reading the old one keeps its handle.
+		lru.erase(iter->second.lru_position);
+		files.erase(iter);
+	}
+
+	// Don't stop anything else writing to, deleting or renaming the file while it's open
+	HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+	                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED, nullptr);
+	if (handle == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size))
+	{
+		CloseHandle(handle);
+		return nullptr;
+	}
+
+	auto file = std::make_shared<SharedFile>(handle, (uint64_t)size.QuadPart);
+
+	lru.push_front(path);
+	files[path] = Entry{file, stamp, lru.begin()};
+
+	CloseIdleFiles();
+
+	return file;
+}
+
+void FileHandleCache::CloseIdleFiles()
+{
+	// Walk from the least recently used end, closing anything that's not in use. If everything is in
+	// use then we go over the limit, as there's nothing else we can do.
+	for (auto iter = lru.end(); files.size() > MAX_OPEN_FILES && iter != lru.begin();)
+	{
+		--iter;
+
+		auto entry = files.find(*iter);
+
+		// Only the cache itself is holding onto this one
+		if (entry->second.file.use_count() == 1)
+		{
+			files.erase(entry);
+			iter = lru.erase(iter);
+		}
+	}
+}
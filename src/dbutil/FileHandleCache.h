@@ -0,0 +1,92 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <windows.h>
+
+namespace blt::db
+{
+	// An open read-only file, shared between every datastore reading from it
+	class SharedFile
+	{
+	  public:
+		SharedFile(HANDLE handle, uint64_t size) : handle(handle), file_size(size)
+		{
+		}
+		~SharedFile();
+
+		SharedFile(const SharedFile&) = delete;
+		SharedFile& operator=(const SharedFile&) = delete;
+
+		// Read from a given position without touching the file pointer, so this is safe to call from
+		// any number of threads at once. Returns the number of bytes read.
+		size_t ReadAt(uint64_t position, uint8_t* data, size_t length) const;
+
+		uint64_t Size() const
+		{
+			return file_size;
+		}
+
+	  private:
+		HANDLE handle;
+		uint64_t file_size;
+	};
+
+	/**
+	 * Keeps the bundles and hooked files open between datastores, so loading a lot of assets from the
+	 * same bundle doesn't open and close it every time.
+	 *
+	 * Files are reference counted - they stay open as long as any datastore is using them. Once they're
+	 * no longer in use, they're kept around in case they're needed again, but the least recently used
+	 * ones are closed whenever there are more than MAX_OPEN_FILES open.
+	 *
+	 * The files are opened with every sharing mode, so mods can still be updated while the game is
+	 * running. If a file's size or modification time has changed since it was opened, the next Open
+	 * opens it again rather than handing out the old handle.
+	 */
+	class FileHandleCache
+	{
+	  public:
+		static const size_t MAX_OPEN_FILES = 64;
+
+		static FileHandleCache& Instance();
+
+		// Returns nullptr if the file can't be opened
+		std::shared_ptr<SharedFile> Open(const std::string& path);
+
+	  private:
+		FileHandleCache() = default;
+
+		void CloseIdleFiles();
+
+		// What the file looked like when it was opened
+		struct FileStamp
+		{
+			uint64_t size = 0;
+			uint64_t write_time = 0;
+
+			bool operator==(const FileStamp&) const = default;
+		};
+
+		// Returns false if the file doesn't exist
+		static bool GetStamp(const std::string& path, FileStamp& stamp);
+
+		struct Entry
+		{
+			std::shared_ptr<SharedFile> file;
+			FileStamp stamp;
+			std::list<std::string>::iterator lru_position;
+		};
+
+		std::mutex mutex;
+		std::unordered_map<std::string, Entry> files;
+		std::list<std::string> lru; // Most recently used at the front
+	};
+}; // namespace blt::db
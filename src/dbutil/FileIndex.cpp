@@ -0,0 +1,98 @@
+#include "FileIndex.h"
+
+#include "DB.h"
+
+using blt::idstring;
+using blt::db::DslFile;
+using blt::db::FileIndex;
+
+static size_t hashKey(idstring name, idstring type)
+{
+    // The idstrings are already hashes, but names often share a type, so mix the two together
+    // properly (this is the splitmix64 finaliser) rather than just xoring them.
+    uint64_t hash = name ^ (type * 0x9e3779b97f4a7c15ull);
+    hash          = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash          = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    hash          = hash ^ (hash >> 31);
+    return (size_t)hash;
+}
+
+void FileIndex::Reserve(size_t count)
+{
+    // Keep the table at most half full, so probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < count * 2)
+        capacity *= 2;
+
+    if (capacity > slots.size())
+        Rehash(capacity);
+}
+
+DslFile* FileIndex::Insert(DslFile* file)
+{
+    if ((count + 1) * 2 > slots.size())
+        Rehash(slots.empty() ? 16 : slots.size() * 2);
+
+    size_t mask = slots.size() - 1;
+    for (size_t i = hashKey(file->name, file->type) & mask;; i = (i + 1) & mask)
+    {
+        Slot& slot = slots[i];
+
+        if (slot.file == nullptr)
+        {
+            slot = Slot{file->name, file->type, file};
+            count++;
+            return nullptr;
+        }
+
+        if (slot.name == file->name && slot.type == file->type)
+        {
+            DslFile* previous = slot.file;
+            slot.file         = file;
+            return previous;
+        }
+    }
+}
+
+DslFile* FileIndex::Find(idstring name, idstring type) const
+{
+    if (slots.empty())
+        return nullptr;
+
+    size_t mask = slots.size() - 1;
+    for (size_t i = hashKey(name, type) & mask;; i = (i + 1) & mask)
+    {
+        const Slot& slot = slots[i];
+
+        if (slot.file == nullptr)
+            return nullptr;
+
+        if (slot.name == name && slot.type == type)
+            return slot.file;
+    }
+}
+
+void FileIndex::Clear()
+{
+    slots.clear();
+    count = 0;
+}
+
+void FileIndex::Rehash(size_t capacity)
+{
+    std::vector<Slot> old = std::move(slots);
+    slots.assign(capacity, Slot{0, 0, nullptr});
+
+    size_t mask = capacity - 1;
+    for (const Slot& slot : old)
+    {
+        if (slot.file == nullptr)
+            continue;
+
+        size_t i = hashKey(slot.name, slot.type) & mask;
+        while (slots[i].file != nullptr)
+            i = (i + 1) & mask;
+
+        slots[i] = slot;
+    }
+}
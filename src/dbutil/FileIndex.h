@@ -0,0 +1,47 @@
+#pragma once
+
+#include "platform.h"
+
+#include <vector>
+
+#include <stddef.h>
+
+namespace blt::db {
+    struct DslFile;
+
+    /**
+     * A hash table mapping asset names and types to their DslFile, for DieselDB::Find.
+     *
+     * There are hundreds of thousands of assets and the keys are already hashes, so this uses
+     * open addressing with linear probing over a single flat array. The keys are stored inline,
+     * so a lookup usually touches one cache line rather than walking down a tree.
+     */
+    class FileIndex
+    {
+      public:
+        // Make room for at least this many files without having to grow the table
+        void Reserve(size_t count);
+
+        // Add a file, replacing and returning the existing file with the same name and type (if any)
+        DslFile* Insert(DslFile* file);
+
+        [[nodiscard]] DslFile* Find(idstring name, idstring type) const;
+
+        [[nodiscard]] size_t Size() const { return count; }
+
+        void Clear();
+
+      private:
+        struct Slot
+        {
+            idstring name;
+            idstring type;
+            DslFile* file; // nullptr if this slot is empty
+        };
+
+        void Rehash(size_t capacity);
+
+        std::vector<Slot> slots;
+        size_t            count = 0;
+    };
+}; // namespace blt::db
@@ -0,0 +1,128 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using blt::db::MappedFile;
+
+#ifdef _WIN32
+
+static std::runtime_error mappingError(const char* what, const std::string& path)
+{
+    return std::runtime_error(std::string(what) + " '" + path + "': error " + std::to_string(GetLastError()));
+}
+
+MappedFile::MappedFile(const std::string& path)
+{
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw mappingError("Failed to open", path);
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        auto err = mappingError("Failed to get the size of", path);
+        CloseHandle(file);
+        throw err;
+    }
+
+    // Windows refuses to map empty files, but there's nothing to read from them anyway
+    if (fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return;
+    }
+
+    // The view keeps the mapping alive, and the mapping keeps the file alive, so neither handle is
+    // needed once the view exists.
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        auto err = mappingError("Failed to create a file mapping for", path);
+        CloseHandle(file);
+        throw err;
+    }
+    CloseHandle(file);
+
+    data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr)
+    {
+        auto err = mappingError("Failed to map", path);
+        CloseHandle(mapping);
+        throw err;
+    }
+    CloseHandle(mapping);
+
+    size = static_cast<size_t>(fileSize.QuadPart);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        UnmapViewOfFile(data);
+}
+
+#else
+
+// Lets the bundle reader be built and benchmarked off Windows, see tests/dbutil
+
+static std::runtime_error mappingError(const char* what, const std::string& path)
+{
+    return std::runtime_error(std::string(what) + " '" + path + "': error " + std::to_string(errno));
+}
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw mappingError("Failed to open", path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        auto err = mappingError("Failed to get the size of", path);
+        close(fd);
+        throw err;
+    }
+
+    // mmap refuses zero-length mappings, same as Windows
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+
+    // The mapping keeps the file alive, so the descriptor isn't needed once it exists
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED)
+    {
+        auto err = mappingError("Failed to map", path);
+        close(fd);
+        throw err;
+    }
+    close(fd);
+
+    // Assets are read from all over the bundle, so don't bother reading ahead
+    madvise(view, (size_t)st.st_size, MADV_RANDOM);
+
+    data = static_cast<const uint8_t*>(view);
+    size = static_cast<size_t>(st.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data)
+        munmap(const_cast<uint8_t*>(data), size);
+}
+
+#endif
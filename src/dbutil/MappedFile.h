@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace blt::db {
+    /**
+     * A read-only view of an entire file, mapped into memory.
+     *
+     * This lets the bundle readers pull compressed data straight out of the page cache, without
+     * opening a stream and copying it into a temporary buffer for every asset that's read.
+     */
+    class MappedFile
+    {
+      public:
+        // Throws std::runtime_error if the file can't be opened or mapped
+        explicit MappedFile(const std::string& path);
+        ~MappedFile();
+
+        MappedFile(const MappedFile&)            = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        [[nodiscard]] const uint8_t* Data() const { return data; }
+
+        [[nodiscard]] size_t Size() const { return size; }
+
+      private:
+        const uint8_t* data = nullptr;
+        size_t         size = 0;
+    };
+}; // namespace blt::db
@@ -3,9 +3,6 @@
 #include "threading/queue.h"
 #include "util/util.h"
 
-#include <algorithm>
-#include <thread>
-
 namespace raidhook
 {
 	namespace
@@ -26,6 +23,9 @@ namespace raidhook
 		};
 	}
 
+	// Enough to cover a burst of requests at the default concurrency limit
+	static const size_t MAX_IDLE_HANDLES = 16;
+
 	using HTTPProgressNotificationPtr = std::unique_ptr<HTTPProgressNotification>;
 	using HTTPItemPtr = std::unique_ptr<HTTPItem>;
 	RAIDHOOK_REGISTER_EVENTQUEUE(HTTPProgressNotificationPtr, HTTPProgressNotification)
@@ -35,18 +35,48 @@ namespace raidhook
 	{
 		// Curl Init
 		curl_global_init(CURL_GLOBAL_ALL);
+		multi = curl_multi_init();
+
+		// Everything runs on the network thread, so the share doesn't need any locking callbacks
+		share = curl_share_init();
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
 		RAIDHOOK_LOG_LOG("CURL_INITD");
 	}
 
 	HTTPManager::~HTTPManager()
 	{
-		RAIDHOOK_LOG_LOG("CURL CLOSED");
-		curl_global_cleanup();
+		if (networkThread.joinable())
+		{
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				stopping = true;
+			}
+			curl_multi_wakeup(multi);
+			networkThread.join();
+		}
 
-		std::for_each(threadList.begin(), threadList.end(), [](const std::unique_ptr<std::thread>& t)
+		// Whatever was still running never gets a reply
+		for (CURL *curl : active)
 		{
-			t->join();
-		});
+			HTTPItem *item = nullptr;
+			curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&item);
+			curl_multi_remove_handle(multi, curl);
+			curl_easy_cleanup(curl);
+			if (item && item->downloadFile)
+				fclose(item->downloadFile);
+			delete item;
+		}
+
+		for (CURL *curl : idleHandles)
+			curl_easy_cleanup(curl);
+
+		// Only once nothing's using it any more
+		curl_share_cleanup(share);
+		curl_multi_cleanup(multi);
+
+		RAIDHOOK_LOG_LOG("CURL CLOSED");
+		curl_global_cleanup();
 	}
 
 	HTTPManager* HTTPManager::GetSingleton()
@@ -77,12 +107,60 @@ namespace raidhook
 
 	size_t write_http_data(char* ptr, size_t size, size_t nmemb, void* data)
 	{
-		std::string newData = std::string(ptr, size*nmemb);
 		HTTPItem* mainItem = (HTTPItem*)data;
-		mainItem->httpContents += newData;
+
+		// Anything other than the full size makes curl abort the transfer with CURLE_WRITE_ERROR
+		if (mainItem->downloadFile)
+			return fwrite(ptr, 1, size*nmemb, mainItem->downloadFile);
+
+		mainItem->httpContents.append(ptr, size*nmemb);
 		return size*nmemb;
 	}
 
+	static std::string partial_download_path(const HTTPItem *item)
+	{
+		return item->downloadPath + ".part";
+	}
+
+	static bool open_download_file(HTTPItem *item)
+	{
+		item->downloadFile = fopen(partial_download_path(item).c_str(), "wb");
+		if (!item->downloadFile)
+		{
+			RAIDHOOK_LOG_ERROR("Could not open " << partial_download_path(item) << " to download " << item->url);
+			return false;
+		}
+
+		// Big writes go straight through, and this keeps lots of small ones from each hitting the disk
+		setvbuf(item->downloadFile, nullptr, _IOFBF, 256 * 1024);
+		return true;
+	}
+
+	static void finish_download_file(HTTPItem *item)
+	{
+		std::string partPath = partial_download_path(item);
+
+		bool written = fclose(item->downloadFile) == 0;
+		item->downloadFile = nullptr;
+
+		bool succeeded = item->errorCode == CURLE_OK && item->httpStatusCode >= 100 && item->httpStatusCode < 400;
+		if (succeeded && !written)
+		{
+			item->errorCode = CURLE_WRITE_ERROR;
+			succeeded = false;
+		}
+
+		if (succeeded && !MoveFileExA(partPath.c_str(), item->downloadPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+		{
+			RAIDHOOK_LOG_ERROR("Could not move finished download to " << item->downloadPath);
+			item->errorCode = CURLE_WRITE_ERROR;
+			succeeded = false;
+		}
+
+		if (!succeeded)
+			DeleteFileA(partPath.c_str());
+	}
+
 	void run_http_progress_event(std::unique_ptr<HTTPProgressNotification> ourNotify)
 	{
 		RAIDHOOK_TRACE_FUNC;
@@ -116,12 +194,35 @@ namespace raidhook
 		ourItem->call(ourItem.get());
 	}
 
-	void launch_thread_http(HTTPItem *raw_item)
+	CURL* HTTPManager::AcquireHandle()
+	{
+		if (idleHandles.empty())
+		{
+			CURL *curl = curl_easy_init();
+			curl_easy_setopt(curl, CURLOPT_SHARE, share);
+			return curl;
+		}
+
+		// Resetting clears the options, but keeps the handle's caches and its share
+		CURL *curl = idleHandles.back();
+		idleHandles.pop_back();
+		curl_easy_reset(curl);
+		return curl;
+	}
+
+	void HTTPManager::ReleaseHandle(CURL *curl)
+	{
+		curl_multi_remove_handle(multi, curl);
+
+		if (idleHandles.size() < MAX_IDLE_HANDLES)
+			idleHandles.push_back(curl);
+		else
+			curl_easy_cleanup(curl);
+	}
+
+	void setup_http_handle(CURL *curl, HTTPItem *item)
 	{
 		RAIDHOOK_TRACE_FUNC;
-		std::unique_ptr<HTTPItem> item(raw_item);
-		CURL *curl;
-		curl = curl_easy_init();
 		curl_easy_setopt(curl, CURLOPT_URL, item->url.c_str());
 		curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
 		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
@@ -137,31 +238,109 @@ namespace raidhook
 		if (item->progress)
 		{
 			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, http_progress_call);
-			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, item.get());
+			curl_easy_setopt(curl, CURLOPT_XFERINFODATA, item);
 			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0);
 		}
 
 		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, write_http_header);
-		curl_easy_setopt(curl, CURLOPT_HEADERDATA, item.get());
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, item);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_http_data);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, item.get());
-
-		item->errorCode = curl_easy_perform(curl);
-		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(item->httpStatusCode));
-		curl_easy_cleanup(curl);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, item);
 
-		GetHTTPItemQueue().AddToQueue(run_http_event, std::move(item));
+		// So the item can be found again once the transfer is done
+		curl_easy_setopt(curl, CURLOPT_PRIVATE, item);
 	}
 
 	void HTTPManager::LaunchHTTPRequest(std::unique_ptr<HTTPItem> callback)
 	{
 		RAIDHOOK_TRACE_FUNC;
-		// This shit's gonna end eventually, how many threads are people going to launch?
-		// Probably a lot.
-		// I'll manage them I guess, but I've no idea when to tell them to join which I believe is part of the constructor.
 
-		// VC++ 2013 bug, can't pass a unique_ptr through a thread
-		// should be: threadList.push_back(std::unique_ptr<std::thread>(new std::thread(launch_thread_http, std::move(callback)));
-		threadList.push_back(std::unique_ptr<std::thread>(new std::thread(launch_thread_http, callback.release())));
+		// Don't start the thread until it's needed, since the manager is created during static init
+		std::call_once(threadStarted, [this]()
+		{
+			networkThread = std::thread(&HTTPManager::Run, this);
+		});
+
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			pending.push_back(std::move(callback));
+		}
+		curl_multi_wakeup(multi);
+	}
+
+	void HTTPManager::SetMaxConcurrentRequests(size_t limit)
+	{
+		{
+			std::lock_guard<std::mutex> lock(pendingMutex);
+			maxConcurrent = limit;
+		}
+		curl_multi_wakeup(multi);
+	}
+
+	void HTTPManager::Run()
+	{
+		RAIDHOOK_LOG_LOG("Starting HTTP thread");
+
+		while (true)
+		{
+			{
+				std::lock_guard<std::mutex> lock(pendingMutex);
+				if (stopping)
+					break;
+
+				// Anything over the limit waits here until an earlier transfer finishes
+				while (!pending.empty() && (maxConcurrent == 0 || active.size() < maxConcurrent))
+				{
+					std::unique_ptr<HTTPItem> item = std::move(pending.front());
+					pending.pop_front();
+
+					if (!item->downloadPath.empty() && !open_download_file(item.get()))
+					{
+						item->errorCode = CURLE_WRITE_ERROR;
+						item->httpStatusCode = 0;
+						GetHTTPItemQueue().AddToQueue(run_http_event, std::move(item));
+						continue;
+					}
+
+					CURL *curl = AcquireHandle();
+					setup_http_handle(curl, item.get());
+					curl_multi_add_handle(multi, curl);
+					active.insert(curl);
+					item.release();
+				}
+			}
+
+			int running = 0;
+			curl_multi_perform(multi, &running);
+
+			int remaining = 0;
+			while (CURLMsg *msg = curl_multi_info_read(multi, &remaining))
+			{
+				if (msg->msg != CURLMSG_DONE)
+					continue;
+
+				CURL *curl = msg->easy_handle;
+
+				HTTPItem *rawItem = nullptr;
+				curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char**)&rawItem);
+				std::unique_ptr<HTTPItem> item(rawItem);
+
+				item->errorCode = msg->data.result;
+				curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(item->httpStatusCode));
+
+				active.erase(curl);
+				ReleaseHandle(curl);
+
+				if (item->downloadFile)
+					finish_download_file(item.get());
+
+				GetHTTPItemQueue().AddToQueue(run_http_event, std::move(item));
+			}
+
+			// Sleeps until there's network activity, a transfer times out, or LaunchHTTPRequest wakes us up
+			curl_multi_poll(multi, nullptr, 0, 1000, nullptr);
+		}
+
+		RAIDHOOK_LOG_LOG("Exiting HTTP thread");
 	}
 }
@@ -2,11 +2,19 @@
 #define __HTTP_HEADER__
 
 #include <string>
+#include <stdio.h>
 #include <mutex>
-#include <thread>
-#include <list>
 #include <memory>
 #include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <unordered_set>
+
+// Defined by curl, but including it here would drag the winsock headers into everything that uses this
+typedef void CURL;
+typedef void CURLM;
+typedef void CURLSH;
 
 namespace raidhook
 {
@@ -30,6 +38,11 @@ namespace raidhook
 
 		long byteprogress = 0;
 		long bytetotal = 0;
+
+		// If set, the body is streamed into this file instead of httpContents. It's written under a
+		// temporary name first, and only moved into place if the whole download succeeded.
+		std::string downloadPath;
+		FILE* downloadFile = nullptr;
 	};
 
 	class HTTPManager
@@ -43,8 +56,35 @@ namespace raidhook
 		static HTTPManager* GetSingleton();
 
 		void LaunchHTTPRequest(std::unique_ptr<HTTPItem> callback);
+
+		// Requests past this many wait until an earlier one finishes. Zero means no limit.
+		void SetMaxConcurrentRequests(size_t limit);
+
 	private:
-		std::list<std::unique_ptr<std::thread>> threadList;
+		// Every transfer runs on this one thread, through a single curl multi handle
+		void Run();
+
+		CURL* AcquireHandle();
+		void ReleaseHandle(CURL *curl);
+
+		CURLM *multi = nullptr;
+		std::thread networkThread;
+		std::once_flag threadStarted;
+
+		// Guards everything the Lua thread and the network thread share
+		std::mutex pendingMutex;
+		std::deque<std::unique_ptr<HTTPItem>> pending;
+		size_t maxConcurrent = 16;
+		bool stopping = false;
+
+		// Only touched by the network thread, or once it has stopped
+		std::unordered_set<CURL *> active;
+
+		// Finished handles are kept around for the next request, and every handle shares TLS sessions
+		// and DNS lookups. Together with the multi handle's connection cache, this lets requests to the
+		// same host skip the connection setup and TLS handshake.
+		std::vector<CURL *> idleHandles;
+		CURLSH *share = nullptr;
 	};
 }
 
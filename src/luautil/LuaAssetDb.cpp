@@ -4,15 +4,15 @@
 
 #include "LuaAssetDb.h"
 
+#include <dbutil/ChunkCache.h>
 #include <dbutil/DB.h>
-#include <errno.h>
-#include <fstream>
 #include <inttypes.h>
 #include <platform.h>
 #include <string.h>
 #include <util/util.h>
 
 using blt::idstring;
+using blt::db::ChunkCache;
 using blt::db::DieselBundle;
 using blt::db::DieselDB;
 using blt::db::DslFile;
@@ -122,7 +122,6 @@ static int ldb_load(lua_State* L)
         return 0; // Placate CLion's null warning thing, luaL_error never returns
     }
 
-    errno = 0;
     try
     {
         if (file->bundle == nullptr)
@@ -131,17 +130,13 @@ static int ldb_load(lua_State* L)
             return 0;
         }
 
-        std::ifstream fi;
-        fi.exceptions(std::ios::failbit);
-        fi.open(file->bundle->path, std::ios::binary);
-
-        std::vector<uint8_t> data = file->ReadContents(fi);
+        std::vector<uint8_t> data = file->ReadContents();
         lua_pushlstring(L, (const char*)data.data(), data.size());
         return 1;
     }
-    catch (const std::ios::failure& ex)
+    catch (const std::exception& ex)
     {
-        luaL_error(L, "Failed to read bundle: io error: %s", strerror(errno));
+        luaL_error(L, "Failed to read bundle: %s", ex.what());
         return 0; // Will never happen, luaL_error does not return
     }
 }
@@ -153,14 +148,53 @@ static int ldb_has(lua_State* L)
     return 1;
 }
 
+static int ldb_set_chunk_cache_size(lua_State* L)
+{
+    lua_Number bytes = luaL_checknumber(L, 1);
+    if (bytes < 0)
+        luaL_error(L, "Chunk cache size must not be negative");
+
+    ChunkCache::Instance().SetLimit((size_t)bytes);
+    return 0;
+}
+
+static int ldb_chunk_cache_stats(lua_State* L)
+{
+    ChunkCache&       cache = ChunkCache::Instance();
+    ChunkCache::Stats stats = cache.GetStats();
+
+    // Pass true to start counting again from zero after these are returned
+    if (lua_toboolean(L, 1))
+        cache.ResetStats();
+
+    lua_createtable(L, 0, 6);
+
+    lua_pushnumber(L, (lua_Number)stats.hits);
+    lua_setfield(L, -2, "hits");
+    lua_pushnumber(L, (lua_Number)stats.misses);
+    lua_setfield(L, -2, "misses");
+    lua_pushnumber(L, (lua_Number)stats.evictions);
+    lua_setfield(L, -2, "evictions");
+    lua_pushnumber(L, (lua_Number)stats.chunks);
+    lua_setfield(L, -2, "chunks");
+    lua_pushnumber(L, (lua_Number)stats.size);
+    lua_setfield(L, -2, "size");
+    lua_pushnumber(L, (lua_Number)stats.limit);
+    lua_setfield(L, -2, "limit");
+
+    return 1;
+}
+
 void load_lua_asset_db(lua_State* L)
 {
     // (note: ldb = Lua asset DB)
     luaL_Reg vmLib[] = {
-        {"read_file", ldb_load},
-        { "has_file",  ldb_has},
+        {           "read_file",                 ldb_load},
+        {            "has_file",                  ldb_has},
+        {"set_chunk_cache_size", ldb_set_chunk_cache_size},
+        {   "chunk_cache_stats",    ldb_chunk_cache_stats},
 
-        {    nullptr,  nullptr},
+        {               nullptr,                  nullptr},
     };
 
     lua_newtable(L);
@@ -4,40 +4,26 @@
 
 #include "LuaAsyncIO.h"
 
-#include <atomic>
-#include <condition_variable>
+#include <algorithm>
 #include <fstream>
 #include <functional>
-#include <mutex>
-#include <queue>
-#include <thread>
 #include <utility>
+#include <vector>
 
 #include <errno.h>
 #include <string.h>
 
 #include <InitState.h>
 #include <threading/queue.h>
+#include <threading/threadpool.h>
 #include <util/util.h>
 
-static const int MAX_THREADS = 4;
-
-struct IOTask
-{
-	std::function<void()> func;
-};
-
 struct IOCompletion
 {
 	lua_State* L;
 	std::function<void()> func;
 };
 
-static std::mutex task_mutex;
-static std::queue<IOTask> task_list;
-static std::condition_variable condition_var;
-static int thread_count;
-
 RAIDHOOK_REGISTER_EVENTQUEUE(IOCompletion, Completions);
 
 // TODO deduplicate with that in InitiateState
@@ -78,63 +64,84 @@ static void invoke_on_update(lua_State* L, std::function<void()> func)
 		completion);
 }
 
-// MUST BE CALLED UNDER task_mutex
-static void start_task_thread()
+static void dispatch_task(std::function<void()> func)
 {
-	thread_count++;
+	raidhook::ThreadPool::GetSingleton().Submit(raidhook::TaskClass::IO, std::move(func));
+}
 
-	RAIDHOOK_LOG_LOG("Starting async IO thread");
+// Reads up to length bytes from offset, or to the end of the file if length is WHOLE_FILE. Reading past the
+// end of the file just gives less data. On failure, err is set to the errno value.
+static const uint64_t WHOLE_FILE = ~(uint64_t)0;
 
-	std::thread thread([]() {
-		while (true)
-		{
-			// Try and get a task, or timeout
-			// The timeout ensures that we don't hold a bunch of threads if we're not using them
-			IOTask task;
-			const auto timeout = std::chrono::milliseconds(500);
-			{
-				std::unique_lock lock(task_mutex);
-				bool has_item = condition_var.wait_for(lock, timeout, []() { return !task_list.empty(); });
-				if (!has_item)
-					break;
-				task = std::move(task_list.front());
-				task_list.pop();
-			}
+static bool read_file(const std::string& filename, uint64_t offset, uint64_t length, std::string& data, int& err)
+{
+	// Since there's more steps involved with seeking around to find the length, just use
+	// exceptions for this rather than checking goodbit.
+	errno = 0; // Make sure pre-existing errors can't leak in
+	try
+	{
+		std::ifstream stream;
 
-			// Execute this task
-			task.func();
+		// Everything is read in one go straight into the string, so the stream's own buffer would
+		// only add a copy
+		stream.rdbuf()->pubsetbuf(nullptr, 0);
+		stream.open(filename, std::ios::binary);
+
+		// Checked before turning on exceptions, since throwing can clobber errno
+		if (!stream.is_open())
+		{
+			err = errno;
+			return false;
 		}
 
-		RAIDHOOK_LOG_LOG("Exiting async IO thread");
+		stream.exceptions(std::ios::eofbit | std::ios::failbit);
 
+		stream.seekg(0, std::ios::end);
+		uint64_t size = (uint64_t)stream.tellg();
+		if (offset >= size)
 		{
-			std::lock_guard guard(task_mutex);
-			thread_count--;
+			data.clear();
+			return true;
 		}
-	});
-	thread.detach();
-}
 
-static void dispatch_task(IOTask&& task)
-{
+		length = std::min<uint64_t>(length, size - offset);
+		stream.seekg((std::streamoff)offset, std::ios::beg);
+
+		data.resize((size_t)length);
+		stream.read(data.data(), data.size());
+		return true;
+	}
+	catch (const std::ios::failure&)
 	{
-		std::lock_guard guard(task_mutex);
-		task_list.push(std::move(task));
-
-		// Check if we need to start a new thread
-		// Do this under the mutex, since it should not occur very often and we wouldn't want many
-		// threads being started concurrently.
-		if (thread_count == 0 || (thread_count < MAX_THREADS && task_list.size() > 5))
-			start_task_thread();
+		data.clear();
+		err = errno;
+		return false;
 	}
-	condition_var.notify_one();
 }
 
-static void dispatch_task(std::function<void()> func)
+static void dispatch_read(lua_State* L, std::string filename, uint64_t offset, uint64_t length, int completion_func_ref)
 {
-	IOTask task{};
-	task.func = std::move(func);
-	dispatch_task(std::move(task));
+	dispatch_task([filename{std::move(filename)}, offset, length, completion_func_ref, L]() {
+		std::string data;
+		int err = 0;
+		bool success = read_file(filename, offset, length, data, err);
+
+		invoke_on_update(L, [L, func_ref{completion_func_ref}, data{std::move(data)}, success, err]() {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
+			if (success)
+			{
+				lua_pushlstring(L, data.data(), data.size());
+				handled_pcall(L, 1, 0);
+			}
+			else
+			{
+				lua_pushnil(L);
+				lua_pushstring(L, strerror(err));
+				handled_pcall(L, 2, 0);
+			}
+			luaL_unref(L, LUA_REGISTRYINDEX, func_ref);
+		});
+	});
 }
 
 // Arguments: string(filename) function(callback) optional table(options)
@@ -146,46 +153,105 @@ static int aio_read(lua_State* L)
 	lua_pushvalue(L, 2);
 	int completion_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-	dispatch_task([filename, completion_func_ref, L]() {
-		std::vector<char> data;
-		bool success = true;
+	dispatch_read(L, std::move(filename), 0, WHOLE_FILE, completion_func_ref);
 
-		// Since there's more steps involved with seeking around to find the length, just use
-		// exceptions for this rather than checking goodbit.
-		errno = 0; // Make sure pre-existing errors can't leak in
-		try
-		{
-			std::ifstream stream;
-			stream.exceptions(std::ios::eofbit | std::ios::failbit);
-			stream.open(filename, std::ios::binary);
+	return 0;
+}
+
+// Arguments: string(filename) number(offset) number(length) function(callback)
+static int aio_read_range(lua_State* L)
+{
+	std::string filename = luaL_checkstring(L, 1);
+	lua_Number offset = luaL_checknumber(L, 2);
+	lua_Number length = luaL_checknumber(L, 3);
+	if (offset < 0 || length < 0)
+		luaL_error(L, "async_io.read_range: offset and length must not be negative");
 
-			stream.seekg(0, std::ios::end);
-			size_t length = stream.tellg();
-			stream.seekg(0, std::ios::beg);
+	luaL_checktype(L, 4, LUA_TFUNCTION);
+	lua_pushvalue(L, 4);
+	int completion_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
 
-			data.resize(length);
-			stream.read(data.data(), data.size());
-		}
-		catch (const std::ios::failure& ex)
-		{
-			data.clear();
-			success = false;
-		}
+	dispatch_read(L, std::move(filename), (uint64_t)offset, (uint64_t)length, completion_func_ref);
 
-		invoke_on_update(L, [L, func_ref{completion_func_ref}, &data, success, err{errno}]() {
+	return 0;
+}
+
+// Arguments: table(filenames) function(callback)
+// Reads all the files at once, and calls the callback once with a table of contents by filename. If any of
+// them couldn't be read, a second table has the error message for each of those, otherwise it's nil.
+static int aio_read_many(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	size_t count = lua_objlen(L, 1);
+	std::vector<std::string> filenames;
+	filenames.reserve(count);
+	for (size_t i = 1; i <= count; i++)
+	{
+		lua_rawgeti(L, 1, (int)i);
+		if (!lua_isstring(L, -1))
+			luaL_error(L, "async_io.read_many: filename %d is not a string", (int)i);
+		filenames.push_back(lua_tostring(L, -1));
+		lua_pop(L, 1);
+	}
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_pushvalue(L, 2);
+	int completion_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	dispatch_task([filenames{std::move(filenames)}, completion_func_ref, L]() {
+		struct Result
+		{
+			std::string data;
+			bool success;
+			int err;
+		};
+
+		std::vector<Result> results(filenames.size());
+		raidhook::ThreadPool::GetSingleton().ParallelFor(filenames.size(), [&filenames, &results](size_t i) {
+			Result& result = results[i];
+			result.err = 0;
+			result.success = read_file(filenames[i], 0, WHOLE_FILE, result.data, result.err);
+		}, raidhook::TaskClass::IO);
+
+		invoke_on_update(L, [L, func_ref{completion_func_ref}, filenames, results{std::move(results)}]() mutable {
 			lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
-			if (success)
+
+			lua_createtable(L, 0, (int)filenames.size());
+			bool anyFailed = false;
+			for (size_t i = 0; i < filenames.size(); i++)
 			{
-				lua_pushlstring(L, data.data(), data.size());
-				data.clear();
-				handled_pcall(L, 1, 0);
+				if (!results[i].success)
+				{
+					anyFailed = true;
+					continue;
+				}
+
+				lua_pushlstring(L, results[i].data.data(), results[i].data.size());
+				lua_setfield(L, -2, filenames[i].c_str());
+
+				// Let each file go once it's a Lua string, rather than holding them all until the end
+				std::string().swap(results[i].data);
+			}
+
+			if (anyFailed)
+			{
+				lua_newtable(L);
+				for (size_t i = 0; i < filenames.size(); i++)
+				{
+					if (results[i].success)
+						continue;
+
+					lua_pushstring(L, strerror(results[i].err));
+					lua_setfield(L, -2, filenames[i].c_str());
+				}
 			}
 			else
 			{
 				lua_pushnil(L);
-				lua_pushstring(L, strerror(err));
-				handled_pcall(L, 2, 0);
 			}
+
+			handled_pcall(L, 2, 0);
 			luaL_unref(L, LUA_REGISTRYINDEX, func_ref);
 		});
 	});
@@ -236,11 +302,75 @@ static int aio_write(lua_State* L)
 	return 0;
 }
 
+// Arguments: string(archive) string(destination) function(callback) optional table(options)
+// Options: progress = function(filepath, success, extracted, total), called after each file is extracted
+//          parallel = boolean, extract the files on several threads at once
+static int aio_unzip(lua_State* L)
+{
+	std::string archive = luaL_checkstring(L, 1);
+	std::string destination = luaL_checkstring(L, 2);
+
+	luaL_checktype(L, 3, LUA_TFUNCTION);
+
+	int progress_func_ref = LUA_NOREF;
+	bool parallel = false;
+	if (!lua_isnoneornil(L, 4))
+	{
+		luaL_checktype(L, 4, LUA_TTABLE);
+
+		lua_getfield(L, 4, "progress");
+		if (lua_isfunction(L, -1))
+			progress_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		else
+			lua_pop(L, 1);
+
+		lua_getfield(L, 4, "parallel");
+		parallel = lua_toboolean(L, -1);
+		lua_pop(L, 1);
+	}
+
+	lua_pushvalue(L, 3);
+	int completion_func_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	dispatch_task([archive, destination, parallel, completion_func_ref, progress_func_ref, L]() {
+		raidhook::ZIPProgressCallback progress;
+		if (progress_func_ref != LUA_NOREF)
+		{
+			progress = [L, progress_func_ref](const std::string& filepath, bool success, size_t extracted, size_t total) {
+				invoke_on_update(L, [L, func_ref{progress_func_ref}, filepath, success, extracted, total]() {
+					lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
+					lua_pushlstring(L, filepath.c_str(), filepath.size());
+					lua_pushboolean(L, success);
+					lua_pushinteger(L, extracted);
+					lua_pushinteger(L, total);
+					handled_pcall(L, 4, 0);
+				});
+			};
+		}
+
+		bool success = raidhook::ExtractZIPArchive(archive, destination, parallel, progress);
+
+		// This is queued after every progress call, so it's always the last thing the mod hears about
+		invoke_on_update(L, [L, func_ref{completion_func_ref}, progress_ref{progress_func_ref}, success]() {
+			lua_rawgeti(L, LUA_REGISTRYINDEX, func_ref);
+			lua_pushboolean(L, success);
+			handled_pcall(L, 1, 0);
+			luaL_unref(L, LUA_REGISTRYINDEX, func_ref);
+			luaL_unref(L, LUA_REGISTRYINDEX, progress_ref);
+		});
+	});
+
+	return 0;
+}
+
 void load_lua_async_io(lua_State* L)
 {
 	luaL_Reg vmLib[] = {
 		{"read", aio_read},
+		{"read_range", aio_read_range},
+		{"read_many", aio_read_many},
 		{"write", aio_write},
+		{"unzip", aio_unzip},
 
 		{nullptr, nullptr},
 	};
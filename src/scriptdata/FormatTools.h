@@ -3,7 +3,6 @@
 #include <ostream>
 #include <sstream>
 #include <memory>
-#include <functional>
 
 namespace raidhook::scriptdata::tools
 {
@@ -39,17 +38,6 @@ namespace raidhook::scriptdata::tools
 		std::ostream *main;
 	};
 
-	class linkage
-	{
-	public:
-		write_block *block;
-
-		typedef std::function<void(uint32_t)> on_address_set_t;
-		on_address_set_t on_address_set;
-
-		linkage(write_block *block, on_address_set_t cb) : block(block), on_address_set(cb) {}
-	};
-
 	template<typename T>
 	void writeVal(write_block &out, T val)
 	{
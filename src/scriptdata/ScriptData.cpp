@@ -4,20 +4,16 @@
 #include <cassert>
 
 // For the writer
-#include <sstream>
 #include <algorithm>
-#include <functional>
-#include <memory>
+#include <iterator>
+#include <unordered_map>
 
-// Testing
-#include <chrono>
+#include <string.h>
 
 #include "util/util.h"
 
 namespace raidhook::scriptdata
 {
-	using namespace tools;
-
 	const SNil SNil::INSTANCE;
 	const SBool SBool::STRUE(true);
 	const SBool SBool::SFALSE(false);
@@ -124,13 +120,16 @@ namespace raidhook::scriptdata
 		}
 	}
 
-	void ScriptData::ReadTable(STable &out, std::pair<valid_t, valid_t> *data, size_t count, uint32_t meta)
+	std::pair<size_t, size_t> ScriptData::ReadTable(STable &out, std::pair<valid_t, valid_t> *data, size_t count, uint32_t meta)
 	{
+		size_t start = tableEntries.size();
+
+		// The entries are sorted once all the tables are read, as the arena might move around until then
 		for(size_t i=0; i<count; i++)
 		{
 			const SItem *key = Read(data[i].first);
 			const SItem *val = Read(data[i].second);
-			out.items[key] = val;
+			tableEntries.emplace_back(key, val);
 		}
 
 		if(meta != ~0u)
@@ -141,6 +140,8 @@ namespace raidhook::scriptdata
 		{
 			out.meta = nullptr;
 		}
+
+		return std::pair<size_t, size_t>(start, count);
 	}
 
 	bool determine_is_32bit(size_t length, const uint8_t *data)
@@ -180,8 +181,14 @@ namespace raidhook::scriptdata
 		return false;
 	}
 
-	ScriptData::ScriptData(size_t length, const uint8_t *data)
+	ScriptData::ScriptData(size_t length, const uint8_t *data, SourceMode mode)
 	{
+		if(mode == SourceMode::Copy)
+		{
+			ownedSource.assign(data, data + length);
+			data = ownedSource.data();
+		}
+
 		bool is32bit = determine_is_32bit(length, data);
 
 		size_t offset = 0;
@@ -199,14 +206,14 @@ namespace raidhook::scriptdata
 		{
 			readIntoVec<RawStr32, SString>(is32bit, strings, data, offset, [data](const RawStr32 &in, SString &out)
 			{
-				out = SString((const char*) &data[in.str]);
+				out = SString(std::string_view((const char*) &data[in.str]));
 			});
 		}
 		else
 		{
 			readIntoVec<RawStr64, SString>(is32bit, strings, data, offset, [data](const RawStr64 &in, SString &out)
 			{
-				out = SString((const char*) &data[in.str]);
+				out = SString(std::string_view((const char*) &data[in.str]));
 			});
 		}
 
@@ -225,21 +232,48 @@ namespace raidhook::scriptdata
 			out = SIdstring(in);
 		});
 
+		// The range of tableEntries used by each table
+		std::vector<std::pair<size_t, size_t>> tableRanges;
+
 		if(is32bit)
 		{
-			readIntoVec<RawTable32, STable>(is32bit, tables, data, offset, [data, this](const RawTable32 &in, STable &out)
+			readIntoVec<RawTable32, STable>(is32bit, tables, data, offset, [data, this, &tableRanges](const RawTable32 &in, STable &out)
 			{
 				out = STable();
-				ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta);
+				tableRanges.push_back(ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta));
 			});
 		}
 		else
 		{
-			readIntoVec<RawTable64, STable>(is32bit, tables, data, offset, [data, this](const RawTable64 &in, STable &out)
+			readIntoVec<RawTable64, STable>(is32bit, tables, data, offset, [data, this, &tableRanges](const RawTable64 &in, STable &out)
 			{
 				out = STable();
-				ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta);
+				tableRanges.push_back(ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta));
+			});
+		}
+
+		// Now the arena won't move anymore, point each table at its entries
+		for(size_t i=0; i<tables.size(); i++)
+		{
+			STable::Entry *entries = tableEntries.data() + tableRanges[i].first;
+			size_t count = tableRanges[i].second;
+
+			std::stable_sort(entries, entries + count, [](const STable::Entry &a, const STable::Entry &b)
+			{
+				return std::less<const SItem*>()(a.first, b.first);
 			});
+
+			// If a key appears more than once, keep the last value for it - the same as assigning them into a map
+			size_t unique = 0;
+			for(size_t j=0; j<count; j++)
+			{
+				if(j + 1 < count && entries[j + 1].first == entries[j].first)
+					continue;
+
+				entries[unique++] = entries[j];
+			}
+
+			tables[i].items = std::span<const STable::Entry>(entries, unique);
 		}
 
 		numberList(numbers);
@@ -285,258 +319,230 @@ namespace raidhook::scriptdata
 
 	// WRITING
 
-	using std::ostream;
+	// The order the contents vectors appear in, both in the header and in the file itself
+	static const int VECTOR_ORDER[] = { SNum::ID, SString::ID, SVector::ID, SQuaternion::ID, SIdstring::ID, STable::ID };
+
+	// One more than the largest type ID
+	static const int TYPE_COUNT = STable::ID + 1;
+
+	template<typename T>
+	static void writeVal(uint8_t *&out, T val)
+	{
+		memcpy(out, &val, sizeof(val));
+		out += sizeof(val);
+	}
 
+	static void writePtr(uint8_t *&out, bool is32bit, uint32_t val)
+	{
+		if(is32bit)
+			writeVal<uint32_t>(out, val);
+		else
+			writeVal<uint64_t>(out, val);
+	}
+
+	// Lays out and writes a ScriptData file in two passes: first every item is registered and the offset
+	// of everything in the file is worked out, then it's all written straight into a single buffer.
 	class SItem::write_info
 	{
 	public:
-		uint32_t IndexOf(const SItem *item, bool *added = nullptr)
-		{
-			if(added) *added = false;
-
-			std::map<const SItem*, int> &oftype_indexes = item_positions[item->GetId()];
+		explicit write_info(bool use32bit) : use32bit(use32bit) {}
+		write_info(write_info&) = delete;
 
-			auto existing_idx = oftype_indexes.find(item);
-			if (existing_idx != oftype_indexes.end()) {
-				return existing_idx->second;
-			}
+		// Returns false if the item was already registered
+		bool Add(const SItem *item)
+		{
+			auto [iter, added] = indices.try_emplace(item, 0);
+			if(!added)
+				return false;
 
 			std::vector<const SItem*> &oftype = items[item->GetId()];
+			iter->second = oftype.size();
+			oftype.push_back(item);
+			return true;
+		}
 
-			if (frozen)
+		// The reference to an item, as used by tables and the root item
+		uint32_t RefOf(const SItem *item) const
+		{
+			uint32_t id = item->GetId();
+
+			switch(id)
 			{
-				throw "Cannot add item after freeze";
+			case SNil::ID:
+			case SBool::ID_F:
+			case SBool::ID_T:
+				return id << 24;
 			}
 
-			int idx = oftype.size();
-			oftype_indexes[item] = idx;
-			oftype.push_back(item);
-			if (added) *added = true;
-			return idx;
+			return (IndexOf(item) & 0xFFFFFF) | (id << 24);
 		}
 
-		const std::vector<const SItem*> &ListOf(int id)
+		uint32_t IndexOf(const SItem *item) const
 		{
-			return items[id];
+			return indices.at(item);
 		}
 
-		void freeze()
+		// The offset of the out-of-line data for a string or table, which follows its type's contents vector
+		uint32_t DataOffsetOf(const SItem *item) const
 		{
-			frozen = true;
-			blocks.clear();
-			linkages.clear();
+			return dataOffsets[item->GetId()][IndexOf(item)];
 		}
 
-		inline bool is32bit()
+		uint8_t* At(uint32_t offset)
 		{
-			return use32bit;
+			return (uint8_t*) buffer.data() + offset;
 		}
 
-		explicit write_info(bool use32bit) : use32bit(use32bit) {}
-		write_info(write_info&) = delete;
+		inline bool is32bit() const
+		{
+			return use32bit;
+		}
 
-		write_block& create_block()
+		std::string Write(const SItem *root)
 		{
-			if(blocks_applied)
+			size_t ptrSize = use32bit ? 4 : 8;
+			size_t vecSize = 8 + ptrSize * 2;
+
+			// First pass: find out where everything goes
+			// The header is the allocator, the vectors and the root reference
+			size_t offset = ptrSize + vecSize * std::size(VECTOR_ORDER) + 4;
+
+			uint32_t contentsOffsets[TYPE_COUNT] = {};
+			for(int id : VECTOR_ORDER)
 			{
-				throw "cannot create blocks after they are applied";
-			}
+				const std::vector<const SItem*> &oftype = items[id];
 
-			write_block *block = new write_block();
+				contentsOffsets[id] = (uint32_t) offset;
+				offset += oftype.size() * RecordSize(id, ptrSize);
 
-			blocks.push_back(std::unique_ptr<write_block>(block));
+				if(id != SString::ID && id != STable::ID)
+					continue;
 
-			return *blocks.back();
-		}
+				dataOffsets[id].resize(oftype.size());
+				for(size_t i=0; i<oftype.size(); i++)
+				{
+					dataOffsets[id][i] = (uint32_t) offset;
+					offset += DataSize(oftype[i]);
+				}
+			}
 
-		void create_linkage(write_block &block, linkage::on_address_set_t cb)
-		{
-			linkage lk = linkage(&block, cb);
-			linkages.push_back(std::move(lk));
-		}
+			// Second pass: write it all out. Everything is zeroed first, which takes care of the allocators
+			// and the string terminators.
+			buffer.assign(offset, '\0');
 
-		void apply_blocks(ostream &out)
-		{
-			blocks_applied = true;
+			uint8_t *out = At(0);
 
-			for(const std::unique_ptr<write_block> &block : blocks)
+			// Allocator pointer
+			// Written over during loading, afaik we can put anything here
+			writePtr(out, use32bit, 0);
+
+			for(int id : VECTOR_ORDER)
 			{
-				block->write_to(out);
+				uint32_t count = items[id].size();
+				writeVal<uint32_t>(out, count); // count
+				writeVal<uint32_t>(out, count); // capacity
+				writePtr(out, use32bit, contentsOffsets[id]); // contents
+				writePtr(out, use32bit, 0 /* 0xDEADBEEF */); // allocator (overwritten, value doesn't matter for RAID, tool thinks it's 32-bit if this is zero, so write an easily identifiable value here)
 			}
 
-			// TODO linkages
-			for(const linkage& ln : linkages)
+			// Reference to the initial item
+			writeVal<uint32_t>(out, RefOf(root));
+
+			for(int id : VECTOR_ORDER)
 			{
-				ln.on_address_set(ln.block->offset);
+				size_t recordSize = RecordSize(id, ptrSize);
+				uint8_t *record = At(contentsOffsets[id]);
+
+				for(const SItem *item : items[id])
+				{
+					item->Serialise(*this, record);
+					record += recordSize;
+				}
 			}
-		}
 
-		const std::map<int, std::vector<const SItem*>> &Items()
-		{
-			return items;
+			return std::move(buffer);
 		}
 
 	private:
-		std::map<int, std::vector<const SItem*>> items;
-		std::map<int, std::map<const SItem*, int>> item_positions;
-		std::vector<std::unique_ptr<write_block>> blocks;
-		std::vector<linkage> linkages;
-
-		bool frozen = false;
-		bool blocks_applied = false;
-		bool use32bit = false;
-	};
-
-	static void writeRef(write_block &out, SItem::write_info *info, const SItem *item)
-	{
-		switch(item->GetId())
+		// The size of an item's entry in the contents vector for its type
+		static size_t RecordSize(int id, size_t ptrSize)
 		{
-		case SNil::ID:
-		case SBool::ID_F:
-		case SBool::ID_T:
-			writeVal<uint32_t>(out, item->GetId() << 24);
-			return;
+			switch(id)
+			{
+			case SNum::ID:
+				return sizeof(float);
+			case SString::ID:
+				return ptrSize * 2;
+			case SVector::ID:
+				return sizeof(float) * 3;
+			case SQuaternion::ID:
+				return sizeof(float) * 4;
+			case SIdstring::ID:
+				return sizeof(uint64_t);
+			case STable::ID:
+				return ptrSize + 8 + ptrSize * 2;
+			default:
+				throw std::exception();
+			}
 		}
 
-		uint32_t index = info->IndexOf(item);
-		uint32_t val = (index & 0xFFFFFF) | (item->GetId() << 24);
-		writeVal<uint32_t>(out, val);
-	}
-
-	std::string SItem::Serialise(bool use32bit) const
-	{
-		auto serialise_vector = [] (write_block &out, SItem::write_info &data, int id)
+		// The size of a string or table's out-of-line data
+		static size_t DataSize(const SItem *item)
 		{
-			const std::vector<const SItem*> &items = data.ListOf(id);
+			if(item->GetId() == SString::ID)
+				return ((const SString*) item)->val.size() + 1;
 
-			// contents vector
-			uint32_t count = items.size(); // 0xEFBEADDE;
-			writeVal<uint32_t>(out, count); // count
-			writeVal<uint32_t>(out, count); // capacity
-
-			bool is32 = data.is32bit();
-
-			// Write the contents pointer, which gets overwritten with the address of the contents block
-			uint32_t pos = out.tellp();
-			write_block &contents = data.create_block();
-			data.create_linkage(contents, [is32, &out, pos](uint32_t offset)
-			{
-				out.seek(pos);
-				writePtr(out, is32, offset);
-			});
-			writePtr(out, is32, 0); // contents
+			return ((const STable*) item)->items.size() * sizeof(uint32_t) * 2;
+		}
 
-			writePtr(out, is32, 0 /* 0xDEADBEEF */); // allocator (overwritten, value doesn't matter for RAID, tool thinks it's 32-bit if this is zero, so write an easily identifiable value here)
+		std::vector<const SItem*> items[TYPE_COUNT];
+		std::unordered_map<const SItem*, uint32_t> indices;
+		std::vector<uint32_t> dataOffsets[TYPE_COUNT];
+		std::string buffer;
 
-			// Write out the contents
-			for(const SItem* item : items)
-			{
-				item->Serialise(contents, data);
-			}
-		};
-
-		//RAIDHOOK_LOG_LOG("S:0");
-		auto timer = std::chrono::high_resolution_clock::now();
-		auto printtime = [&timer](std::string name) {
-			auto now = std::chrono::high_resolution_clock::now();
-			long time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(now - timer).count();
-			std::string str = name + " : " + std::to_string(time_ms);
-			//RAIDHOOK_LOG_LOG(str.c_str());
-			timer = now;
-		};
+		bool use32bit = false;
+	};
 
+	std::string SItem::Serialise(bool use32bit) const
+	{
 		write_info data(use32bit);
 
-		printtime("S:1");
-
 		// Explore the dependency tree between objects, to make sure we've found everything
 		Register([&data](const SItem *item) {
-			bool added;
-			data.IndexOf(item, &added);
-			return added;
+			return data.Add(item);
 		});
 
-		printtime("S:2");
-
-		// Freeze them while serialising
-		data.freeze();
-
-		// Make sure we create the first block after freezing, otherwise it would be removed and be invalid
-		write_block &out = data.create_block();
-
-		// Allocator pointer
-		// Written over during loading, afaik we can put anything here
-		writePtr(out, use32bit, 0);
-
-		printtime("S:3");
-
-		static_assert(sizeof(float) == 4, "incompatible float size");
-		// Write float array
-		serialise_vector(out, data, SNum::ID);
-
-		// Write string array
-		serialise_vector(out, data, SString::ID);
-
-		// Write vector array
-		serialise_vector(out, data, SVector::ID);
-
-		// Write quaternion array
-		serialise_vector(out, data, SQuaternion::ID);
-
-		// Write idstring array
-		serialise_vector(out, data, SIdstring::ID);
-
-		// Write table array
-		serialise_vector(out, data, STable::ID);
-
-		// Write reference to initial item
-		writeRef(out, &data, this);
-
-		printtime("S:4");
-
-		std::stringstream outstream;
-		data.apply_blocks(outstream);
-
-		printtime("S:5");
-
-		return outstream.str();
+		return data.Write(this);
 	}
 
-	void SNum::Serialise(write_block &out, write_info &info) const
+	void SNum::Serialise(write_info &info, uint8_t *out) const
 	{
+		static_assert(sizeof(float) == 4, "incompatible float size");
 		writeVal<float>(out, val);
 	}
 
-	void SString::Serialise(write_block &out, write_info &info) const
+	void SString::Serialise(write_info &info, uint8_t *out) const
 	{
 		bool is32 = info.is32bit();
+		uint32_t dataOffset = info.DataOffsetOf(this);
 
 		// The allocator
 		// as above, we should avoid zero here (though it probably doesn't really matter)
 		writePtr(out, is32, 0 /* 0xDEADBEEF */);
+		writePtr(out, is32, dataOffset);
 
-		write_block &blk = info.create_block();
-		uint32_t pos = out.tellp();
-		info.create_linkage(blk, [is32, &out, pos](uint32_t offset)
-		{
-			out.seek(pos);
-			writePtr(out, is32, offset);
-		});
-
-		// Write zero for the string offset for now, we'll overwrite this with the block as per above
-		writePtr(out, info.is32bit(), 0);
-
-		blk.stream() << val << ((char)0);
+		// The null terminator is already there, since the buffer starts out zeroed
+		memcpy(info.At(dataOffset), val.data(), val.size());
 	}
 
-	void SVector::Serialise(write_block &out, write_info &info) const
+	void SVector::Serialise(write_info &info, uint8_t *out) const
 	{
 		writeVal<float>(out, x);
 		writeVal<float>(out, y);
 		writeVal<float>(out, z);
 	}
 
-	void SQuaternion::Serialise(write_block &out, write_info &info) const
+	void SQuaternion::Serialise(write_info &info, uint8_t *out) const
 	{
 		writeVal<float>(out, x);
 		writeVal<float>(out, y);
@@ -544,14 +550,15 @@ namespace raidhook::scriptdata
 		writeVal<float>(out, w);
 	}
 
-	void SIdstring::Serialise(write_block &out, write_info &info) const
+	void SIdstring::Serialise(write_info &info, uint8_t *out) const
 	{
 		writeVal<uint64_t>(out, val);
 	}
 
-	void STable::Serialise(write_block &out, write_info &info) const
+	void STable::Serialise(write_info &info, uint8_t *out) const
 	{
 		bool is32 = info.is32bit();
+		uint32_t dataOffset = info.DataOffsetOf(this);
 
 		// meta
 		if(meta)
@@ -563,24 +570,15 @@ namespace raidhook::scriptdata
 		uint32_t count = items.size();
 		writeVal<uint32_t>(out, count); // count
 		writeVal<uint32_t>(out, count); // capacity
-
-		// Write the contents pointer, which gets overwritten with the address of the contents block
-		write_block &contents = info.create_block();
-		uint32_t pos = out.tellp();
-		info.create_linkage(contents, [is32, &out, pos](uint32_t offset)
-		{
-			out.seek(pos);
-			writePtr(out, is32, offset);
-		});
-		writePtr(out, is32, 0); // contents
-
+		writePtr(out, is32, dataOffset); // contents
 		writePtr(out, is32, 0 /*0xDEADBEEF*/ ); // allocator - see earlier uses for a comment of this
 
 		// Write out the contents
-		for(std::pair<const SItem*, const SItem*> pair : items)
+		uint8_t *contents = info.At(dataOffset);
+		for(const Entry &pair : items)
 		{
-			writeRef(contents, &info, pair.first);
-			writeRef(contents, &info, pair.second);
+			writeVal<uint32_t>(contents, info.RefOf(pair.first));
+			writeVal<uint32_t>(contents, info.RefOf(pair.second));
 		}
 	}
 
@@ -593,7 +591,7 @@ namespace raidhook::scriptdata
 		if(meta)
 			meta->Register(receiver);
 
-		for(std::pair<const SItem*, const SItem*> pair : items)
+		for(const Entry &pair : items)
 		{
 			pair.first->Register(receiver);
 			pair.second->Register(receiver);
@@ -1,11 +1,13 @@
 #pragma once
 
-#include "FormatTools.h"
-
 #include <functional>
+#include <span>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
-#include <map>
+
+#include <stdint.h>
 
 namespace raidhook::scriptdata
 {
@@ -33,7 +35,8 @@ namespace raidhook::scriptdata
 			receiver(this);
 		};
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const = 0;
+		// Write this item's entry in the contents vector for its type, which is at out
+		virtual void Serialise(write_info &info, uint8_t *out) const = 0;
 	};
 
 	class SNil : public SItem
@@ -47,7 +50,7 @@ namespace raidhook::scriptdata
 		static const SNil INSTANCE;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override
+		virtual void Serialise(write_info &info, uint8_t *out) const override
 		{
 			throw std::exception();
 		};
@@ -71,7 +74,7 @@ namespace raidhook::scriptdata
 		static const SBool SFALSE;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override
+		virtual void Serialise(write_info &info, uint8_t *out) const override
 		{
 			throw std::exception();
 		};
@@ -92,15 +95,17 @@ namespace raidhook::scriptdata
 		static const int ID = 3;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 	};
 
 	class SString : public SItem
 	{
 	public:
-		SString() : SString(std::string()) {}
-		explicit SString(std::string val) : val(val) {}
-		std::string val;
+		SString() : SString(std::string_view()) {}
+		explicit SString(std::string_view val) : val(val) {}
+
+		// Points into the source buffer of the ScriptData this was read from
+		std::string_view val;
 
 		virtual int GetId() const override
 		{
@@ -109,13 +114,13 @@ namespace raidhook::scriptdata
 
 		operator const std::string() const
 		{
-			return val;
+			return std::string(val);
 		}
 
 		static const int ID = 4;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 	};
 
 	class SVector : public SItem
@@ -133,7 +138,7 @@ namespace raidhook::scriptdata
 		static const int ID = 5;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 	};
 
 	class SQuaternion : public SItem
@@ -151,7 +156,7 @@ namespace raidhook::scriptdata
 		static const int ID = 6;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 	};
 
 	class SIdstring : public SItem
@@ -169,14 +174,19 @@ namespace raidhook::scriptdata
 		static const int ID = 7;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 	};
 
 	class STable : public SItem
 	{
 	public:
+		typedef std::pair<const SItem*, const SItem*> Entry;
+
 		SString *meta;
-		std::map<const SItem*, const SItem*> items;
+
+		// Points into the entry arena of the ScriptData this was read from. Sorted by key with no
+		// duplicate keys, so it iterates in the same order a std::map would.
+		std::span<const Entry> items;
 
 		virtual int GetId() const override
 		{
@@ -186,14 +196,26 @@ namespace raidhook::scriptdata
 		static const int ID = 8;
 
 	protected:
-		virtual void Serialise(tools::write_block &out, write_info &info) const override;
+		virtual void Serialise(write_info &info, uint8_t *out) const override;
 		virtual void Register(RegReceiver receiver) const override;
 	};
 
 	class ScriptData
 	{
 	public:
-		ScriptData(size_t length, const uint8_t *data);
+		enum class SourceMode
+		{
+			// Take a single copy of the source buffer, which the strings then point into
+			Copy,
+
+			// Point straight into the caller's buffer, which must outlive this ScriptData
+			Borrow,
+		};
+
+		ScriptData(size_t length, const uint8_t *data, SourceMode mode = SourceMode::Copy);
+
+		ScriptData(const ScriptData&) = delete;
+		ScriptData& operator=(const ScriptData&) = delete;
 
 		inline const SItem* GetRoot()
 		{
@@ -208,10 +230,16 @@ namespace raidhook::scriptdata
 		std::vector<SIdstring> idstrings;
 		std::vector<STable> tables;
 
+		// The contents of every table, each one taking up a contiguous range
+		std::vector<STable::Entry> tableEntries;
+
+		// Only used in SourceMode::Copy
+		std::vector<uint8_t> ownedSource;
+
 		const SItem *root;
 
 		const SItem* Read(uint32_t);
-		void ReadTable(STable &out, std::pair<uint32_t, uint32_t> *data, size_t count, uint32_t meta);
+		std::pair<size_t, size_t> ReadTable(STable &out, std::pair<uint32_t, uint32_t> *data, size_t count, uint32_t meta);
 	};
 
 };
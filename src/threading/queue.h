@@ -2,20 +2,56 @@
 #define __QUEUE_HEADER__
 
 #include <algorithm>
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <list>
 #include <memory>
-#include <mutex>
 
 // Thread-safe, type-safe event manager
 
 namespace raidhook
 {
+	// Limits how much work EventQueueMaster::ProcessEvents does in a single frame. At least one event
+	// always gets to run, so a backlog keeps moving even if a single event takes longer than the budget.
+	class EventBudget
+	{
+	public:
+		// Zero for either limit means there is no limit of that kind
+		EventBudget(std::chrono::microseconds time, size_t maxEvents);
+
+		// Returns true and counts the event against the budget if there's room for another one
+		bool TryConsume();
+
+		size_t Consumed() const { return consumed; }
+		bool Exhausted() const { return exhausted; }
+
+	private:
+		std::chrono::steady_clock::time_point deadline;
+		bool timeLimited;
+		size_t maxEvents;
+		size_t consumed = 0;
+		bool exhausted = false;
+	};
+
 	class IEventQueue
 	{
 	public:
 		virtual ~IEventQueue() {}
-		virtual void ProcessEvents() = 0;
+
+		// Runs pending events for as long as the budget allows, leaving the rest for next time
+		virtual void ProcessEvents(EventBudget &budget) = 0;
+
+		// Number of events that have been picked up but not run yet
+		virtual size_t PendingCount() const = 0;
+
+		int GetPriority() const { return priority; }
+
+	protected:
+		void SetPriority(int newPriority);
+
+	private:
+		int priority = 0;
 	};
 
 	class EventQueueMaster
@@ -27,14 +63,38 @@ namespace raidhook
 		EventQueueMaster() = default;
 
 	public:
+		struct Stats
+		{
+			uint64_t processed;       // Total events run
+			uint64_t deferredFrames;  // Frames that ran out of budget before every queue was empty
+			size_t lastProcessed;     // Events run in the last frame
+			size_t deferred;          // Events left waiting at the end of the last frame
+			size_t peakDeferred;      // Largest number of events ever left waiting at the end of a frame
+		};
+
 		static EventQueueMaster& GetSingleton();
 
 		void ProcessEvents();
 
+		// Zero for either limit means there is no limit of that kind, which is the default
+		void SetBudget(std::chrono::microseconds time, size_t maxEvents);
+
+		Stats GetStats() const { return stats; }
+		void ResetStats();
+
 	private:
+		friend class IEventQueue;
+
 		void registerQueue(IEventQueue *queue);
+		void sortQueues();
 
+		// Sorted by descending priority. Queues with the same priority run in the order they were registered.
 		std::list<IEventQueue *> queues;
+
+		std::chrono::microseconds budgetTime{ 0 };
+		size_t budgetEvents = 0;
+
+		Stats stats{};
 	};
 
 	template<typename DataT>
@@ -61,23 +121,45 @@ namespace raidhook
 
 	protected:
 		EventQueue();
+		~EventQueue();
 
 	public:
-		virtual void ProcessEvents() override;
+		virtual void ProcessEvents(EventBudget &budget) override;
+		virtual size_t PendingCount() const override { return pendingCount; }
 		void AddToQueue(EventItem item);
 		void AddToQueue(EventFunction runFunction, DataT data);
 
+		// Queues with a higher priority get to run their events first each frame
+		using IEventQueue::SetPriority;
+
 	private:
-		std::deque<EventItem> eventQueue;
-		std::mutex lock;
+		struct Node
+		{
+			Node(EventItem item) : item(std::move(item)) {}
+
+			EventItem item;
+			Node *next = nullptr;
+		};
+
+		void push(Node *node);
+
+		// Intrusive lock-free stack of pending events, newest first. Any thread can push onto it, and
+		// ProcessEvents takes the whole thing at once by swapping the head out for null.
+		std::atomic<Node*> head = nullptr;
+
+		// Events taken off the stack that didn't fit into the budget yet, oldest first. Only ever
+		// touched from the thread calling ProcessEvents.
+		Node *pendingHead = nullptr;
+		Node *pendingTail = nullptr;
+		size_t pendingCount = 0;
 	};
 
 	template<typename DataT>
 	struct EventQueueRuntimeRegisterer
 	{
-		EventQueueRuntimeRegisterer()
+		EventQueueRuntimeRegisterer(int priority = 0)
 		{
-			EventQueue<DataT>::GetSingleton();
+			EventQueue<DataT>::GetSingleton().SetPriority(priority);
 		}
 	};
 
@@ -85,15 +167,16 @@ namespace raidhook
 #define RAIDHOOK_CONCAT(x, y) RAIDHOOK_CONCAT_IMPL(x, y)
 
 	// Not strictly necessary, but is a nice chance to make sure the static instance is initialised before there's a chance for multithreaded calls
-#define RAIDHOOK_REGISTER_EVENTQUEUE(DataT, Name) \
-	namespace                                                                                         \
-	{                                                                                                 \
-		::raidhook::EventQueueRuntimeRegisterer<DataT> RAIDHOOK_CONCAT(staticRegisterer, __COUNTER__); \
-		::raidhook::EventQueue<DataT>& Get##Name##Queue()                                              \
-		{                                                                                             \
-			return ::raidhook::EventQueue<DataT>::GetSingleton();                                      \
-		}                                                                                             \
+#define RAIDHOOK_REGISTER_EVENTQUEUE_PRIORITY(DataT, Name, Priority) \
+	namespace                                                                                                   \
+	{                                                                                                           \
+		::raidhook::EventQueueRuntimeRegisterer<DataT> RAIDHOOK_CONCAT(staticRegisterer, __COUNTER__)(Priority); \
+		::raidhook::EventQueue<DataT>& Get##Name##Queue()                                                        \
+		{                                                                                                       \
+			return ::raidhook::EventQueue<DataT>::GetSingleton();                                                \
+		}                                                                                                       \
 	}
+#define RAIDHOOK_REGISTER_EVENTQUEUE(DataT, Name) RAIDHOOK_REGISTER_EVENTQUEUE_PRIORITY(DataT, Name, 0)
 #define RAIDHOOK_REGISTER_EVENTQUEUE_EASY(DataT) RAIDHOOK_REGISTER_EVENTQUEUE(DataT, DataT)
 
 	#pragma region Implementation
@@ -128,37 +211,80 @@ namespace raidhook
 	}
 
 	template<typename DataT>
-	void EventQueue<DataT>::ProcessEvents()
+	EventQueue<DataT>::~EventQueue()
 	{
-		decltype(eventQueue) localQueue;
+		for (Node *list : { head.exchange(nullptr), pendingHead })
 		{
-			std::lock_guard<std::mutex> locker(lock);
-			// localQueue = std::move(eventQueue); standard is a little iffy on what happens to eventQueue after this, so do it manually
-			while (!eventQueue.empty())
+			for (Node *node = list; node;)
 			{
-				localQueue.push_back(std::move(eventQueue.front()));
-				eventQueue.pop_front();
+				Node *next = node->next;
+				delete node;
+				node = next;
 			}
 		}
+	}
+
+	template<typename DataT>
+	void EventQueue<DataT>::ProcessEvents(EventBudget &budget)
+	{
+		// Grab everything that's been queued so far. Anything added while these are running will be
+		// picked up next time, same as before.
+		Node *node = head.exchange(nullptr, std::memory_order_acquire);
+
+		// The stack is newest-first, so flip it around and put it behind whatever was left over from
+		// the last frame, to run the events in the order they were added
+		Node *ordered = nullptr;
+		Node *last = node;
+		while (node)
+		{
+			Node *next = node->next;
+			node->next = ordered;
+			ordered = node;
+			node = next;
+			pendingCount++;
+		}
 
-		std::for_each(localQueue.begin(), localQueue.end(), [](EventItem& e)
+		if (ordered)
 		{
-			e();
-		});
+			if (pendingTail)
+				pendingTail->next = ordered;
+			else
+				pendingHead = ordered;
+			pendingTail = last;
+		}
+
+		while (pendingHead && budget.TryConsume())
+		{
+			std::unique_ptr<Node> current(pendingHead);
+			pendingHead = current->next;
+			if (!pendingHead)
+				pendingTail = nullptr;
+			pendingCount--;
+
+			current->item();
+		}
+	}
+
+	template<typename DataT>
+	void EventQueue<DataT>::push(Node *node)
+	{
+		node->next = head.load(std::memory_order_relaxed);
+		while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed))
+		{
+			// node->next was updated to the current head, so just try again
+		}
 	}
 
 	template<typename DataT>
 	void EventQueue<DataT>::AddToQueue(EventItem item)
 	{
-		std::lock_guard<std::mutex> locker(lock);
-		eventQueue.push_back(std::move(item));
+		push(new Node(std::move(item)));
 	}
 
 	template<typename DataT>
 	void EventQueue<DataT>::AddToQueue(EventFunction runFunction, DataT data)
 	{
-		std::lock_guard<std::mutex> locker(lock);
-		eventQueue.emplace_back(runFunction, std::move(data));
+		push(new Node(EventItem(runFunction, std::move(data))));
 	}
 
 	#pragma endregion
@@ -0,0 +1,270 @@
+#include "threading/threadpool.h"
+#include "util/util.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace raidhook
+{
+	namespace
+	{
+		// Index of the worker running on this thread, if it is one of the pool's workers
+		const size_t NOT_A_WORKER = ~(size_t)0;
+		thread_local size_t currentWorker = NOT_A_WORKER;
+
+		int64_t nowMicros()
+		{
+			return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+	}
+
+	ThreadPool& ThreadPool::GetSingleton()
+	{
+		static ThreadPool instance;
+		return instance;
+	}
+
+	ThreadPool::ThreadPool() : statsStart(nowMicros())
+	{
+		// Most of what runs here spends at least some time waiting on the disk, so don't go below a
+		// handful of workers even on small machines
+		size_t count = std::max<size_t>(std::thread::hardware_concurrency(), 4);
+
+		for (size_t i = 0; i < count; i++)
+			workers.push_back(std::make_unique<Worker>());
+
+		// Start them only once every worker exists, since they look at each other's queues
+		for (size_t i = 0; i < count; i++)
+			workers[i]->thread = std::thread(&ThreadPool::Run, this, i);
+
+		RAIDHOOK_LOG_LOG("Started thread pool with " + std::to_string(count) + " workers");
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		// Anything still queued is dropped, but tasks that are already running get to finish
+		{
+			std::lock_guard lock(sleepMutex);
+			stopping = true;
+		}
+		sleepCv.notify_all();
+
+		for (std::unique_ptr<Worker>& worker : workers)
+		{
+			if (worker->thread.joinable())
+				worker->thread.join();
+		}
+	}
+
+	void ThreadPool::Submit(TaskClass taskClass, Task task)
+	{
+		// Count it before it's visible, so a worker can never take it and bring the count below zero
+		queued[(size_t)taskClass]++;
+
+		if (currentWorker != NOT_A_WORKER)
+		{
+			Worker& worker = *workers[currentWorker];
+			std::lock_guard lock(worker.mutex);
+			worker.tasks.push_back(LocalTask{ taskClass, std::move(task) });
+		}
+		else
+		{
+			std::lock_guard lock(globalMutex);
+			globalTasks[(size_t)taskClass].push_back(std::move(task));
+		}
+
+		Wake();
+	}
+
+	void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn, TaskClass taskClass)
+	{
+		if (count == 0)
+			return;
+
+		// Helpers that only get to run after everything is done just find no items left, so they never
+		// touch fn after this returns
+		struct State
+		{
+			const std::function<void(size_t)>* fn;
+			size_t count;
+			std::atomic<size_t> next = 0;
+			std::atomic<size_t> done = 0;
+
+			std::mutex mutex;
+			std::condition_variable doneCv;
+			std::exception_ptr error;
+		};
+
+		auto state = std::make_shared<State>();
+		state->fn = &fn;
+		state->count = count;
+
+		auto work = [state]()
+		{
+			for (size_t i = state->next++; i < state->count; i = state->next++)
+			{
+				try
+				{
+					(*state->fn)(i);
+				}
+				catch (...)
+				{
+					std::lock_guard lock(state->mutex);
+					if (!state->error)
+						state->error = std::current_exception();
+				}
+
+				if (++state->done == state->count)
+				{
+					std::lock_guard lock(state->mutex);
+					state->doneCv.notify_all();
+				}
+			}
+		};
+
+		size_t helpers = std::min<size_t>(count - 1, workers.size());
+		for (size_t i = 0; i < helpers; i++)
+			Submit(taskClass, work);
+
+		// This thread does its share of the work too, which also means nothing is left waiting on a
+		// queued helper if every worker is busy
+		work();
+
+		std::unique_lock lock(state->mutex);
+		state->doneCv.wait(lock, [&state]() { return state->done == state->count; });
+
+		if (state->error)
+			std::rethrow_exception(state->error);
+	}
+
+	ThreadPool::Stats ThreadPool::GetStats() const
+	{
+		Stats stats{};
+		stats.workers = workers.size();
+		stats.busy = busy;
+		for (size_t i = 0; i < (size_t)TaskClass::Count; i++)
+		{
+			stats.queued[i] = queued[i];
+			stats.completed[i] = completed[i];
+		}
+
+		int64_t elapsed = nowMicros() - statsStart;
+		if (elapsed > 0)
+			stats.utilisation = (double)busyMicros / ((double)elapsed * (double)workers.size());
+
+		return stats;
+	}
+
+	void ThreadPool::ResetStats()
+	{
+		for (std::atomic<uint64_t>& count : completed)
+			count = 0;
+		busyMicros = 0;
+		statsStart = nowMicros();
+	}
+
+	void ThreadPool::Run(size_t index)
+	{
+		currentWorker = index;
+
+		while (true)
+		{
+			Task task;
+			TaskClass taskClass;
+			if (!TryTake(index, task, taskClass))
+			{
+				std::unique_lock lock(sleepMutex);
+				sleepCv.wait(lock, [this]() { return stopping || HasRunnableWork(); });
+				if (stopping)
+					return;
+				continue;
+			}
+
+			busy++;
+			int64_t start = nowMicros();
+
+			try
+			{
+				task();
+			}
+			catch (const std::exception& ex)
+			{
+				RAIDHOOK_LOG_ERROR(std::string("Uncaught exception in thread pool task: ") + ex.what());
+			}
+
+			busyMicros += nowMicros() - start;
+			completed[(size_t)taskClass]++;
+			busy--;
+		}
+	}
+
+	bool ThreadPool::TryTake(size_t index, Task& task, TaskClass& taskClass)
+	{
+		// Our own newest task first, since whatever it works on is most likely still in the cache
+		{
+			Worker& self = *workers[index];
+			std::lock_guard lock(self.mutex);
+			if (!self.tasks.empty())
+			{
+				LocalTask& local = self.tasks.back();
+				task = std::move(local.task);
+				taskClass = local.taskClass;
+				self.tasks.pop_back();
+				queued[(size_t)taskClass]--;
+				return true;
+			}
+		}
+
+		for (TaskClass cls : { TaskClass::IO, TaskClass::CPU })
+		{
+			if (queued[(size_t)cls] == 0)
+				continue;
+
+			std::lock_guard lock(globalMutex);
+			std::deque<Task>& tasks = globalTasks[(size_t)cls];
+			if (!tasks.empty())
+			{
+				task = std::move(tasks.front());
+				taskClass = cls;
+				tasks.pop_front();
+				queued[(size_t)cls]--;
+				return true;
+			}
+		}
+
+		// Then steal the oldest task from another worker, starting with the next one along so that
+		// the workers don't all pile onto the first queue
+		for (size_t offset = 1; offset < workers.size(); offset++)
+		{
+			Worker& victim = *workers[(index + offset) % workers.size()];
+			std::lock_guard lock(victim.mutex);
+			if (!victim.tasks.empty())
+			{
+				LocalTask& local = victim.tasks.front();
+				task = std::move(local.task);
+				taskClass = local.taskClass;
+				victim.tasks.pop_front();
+				queued[(size_t)taskClass]--;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	bool ThreadPool::HasRunnableWork() const
+	{
+		return queued[(size_t)TaskClass::IO] > 0 || queued[(size_t)TaskClass::CPU] > 0;
+	}
+
+	void ThreadPool::Wake()
+	{
+		// Taking the lock means a worker can't be between checking for work and going to sleep, so
+		// it can't miss this
+		{
+			std::lock_guard lock(sleepMutex);
+		}
+
+		sleepCv.notify_one();
+	}
+}
@@ -0,0 +1,106 @@
+#ifndef __THREADPOOL_HEADER__
+#define __THREADPOOL_HEADER__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Shared pool of worker threads for everything that runs in the background
+
+namespace raidhook
+{
+	// What kind of work a task does. When a worker is free it takes IO tasks first, then CPU tasks.
+	// Network requests don't come through here at all, as HTTPManager runs them on its own thread.
+	enum class TaskClass
+	{
+		IO,
+		CPU,
+
+		Count
+	};
+
+	class ThreadPool
+	{
+	public:
+		using Task = std::function<void()>;
+
+		struct Stats
+		{
+			size_t workers;
+			size_t busy;                                  // Workers running a task right now
+			size_t queued[(size_t)TaskClass::Count];     // Tasks waiting to run, by class
+			uint64_t completed[(size_t)TaskClass::Count]; // Tasks run since the stats were last reset, by class
+			double utilisation;                           // Fraction of worker time spent running tasks since the stats were last reset
+		};
+
+		static ThreadPool& GetSingleton();
+
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		void Submit(TaskClass taskClass, Task task);
+
+		// Runs fn(i) for every i in [0, count) across the pool, and returns once they're all done. The
+		// calling thread works through the items too, so this is safe to call from inside a task.
+		// If any call throws, the first exception is rethrown here after the rest have finished.
+		void ParallelFor(size_t count, const std::function<void(size_t)>& fn, TaskClass taskClass = TaskClass::CPU);
+
+		size_t GetWorkerCount() const { return workers.size(); }
+
+		Stats GetStats() const;
+		void ResetStats();
+
+	private:
+		ThreadPool();
+
+		struct LocalTask
+		{
+			TaskClass taskClass;
+			Task task;
+		};
+
+		struct Worker
+		{
+			std::thread thread;
+
+			// Tasks submitted from this worker's own thread. The owner takes the newest task, other
+			// workers steal the oldest.
+			std::mutex mutex;
+			std::deque<LocalTask> tasks;
+		};
+
+		void Run(size_t index);
+		bool TryTake(size_t index, Task& task, TaskClass& taskClass);
+		bool HasRunnableWork() const;
+		void Wake();
+
+		std::vector<std::unique_ptr<Worker>> workers;
+
+		// Tasks submitted from outside the pool, by class
+		std::mutex globalMutex;
+		std::deque<Task> globalTasks[(size_t)TaskClass::Count];
+
+		std::mutex sleepMutex;
+		std::condition_variable sleepCv;
+		bool stopping = false;
+
+		// Counts every queued task, including those in the workers' own queues
+		std::atomic<size_t> queued[(size_t)TaskClass::Count] = {};
+
+		std::atomic<size_t> busy = 0;
+		std::atomic<uint64_t> completed[(size_t)TaskClass::Count] = {};
+		std::atomic<uint64_t> busyMicros = 0;
+		std::atomic<int64_t> statsStart;
+	};
+}
+
+#endif // __THREADPOOL_HEADER__
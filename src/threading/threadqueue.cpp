@@ -3,6 +3,35 @@
 
 namespace raidhook
 {
+	EventBudget::EventBudget(std::chrono::microseconds time, size_t maxEvents) :
+		deadline(std::chrono::steady_clock::now() + time), timeLimited(time.count() > 0), maxEvents(maxEvents)
+	{}
+
+	bool EventBudget::TryConsume()
+	{
+		if (exhausted)
+			return false;
+
+		// Always let the first event through, otherwise one slow event could stall everything forever
+		if (consumed > 0)
+		{
+			if ((maxEvents > 0 && consumed >= maxEvents) || (timeLimited && std::chrono::steady_clock::now() >= deadline))
+			{
+				exhausted = true;
+				return false;
+			}
+		}
+
+		consumed++;
+		return true;
+	}
+
+	void IEventQueue::SetPriority(int newPriority)
+	{
+		priority = newPriority;
+		EventQueueMaster::GetSingleton().sortQueues();
+	}
+
 	EventQueueMaster& EventQueueMaster::GetSingleton()
 	{
 		static EventQueueMaster instance;
@@ -11,14 +40,53 @@ namespace raidhook
 
 	void EventQueueMaster::ProcessEvents()
 	{
-		std::for_each(queues.begin(), queues.end(), [](IEventQueue *q)
+		EventBudget budget(budgetTime, budgetEvents);
+
+		// Once the budget runs out the remaining queues still pick up their new events, but don't run
+		// any of them. Stopping everything at that point (rather than letting later queues go ahead)
+		// keeps related queues, like HTTP progress and completion, in order with each other.
+		size_t deferred = 0;
+		std::for_each(queues.begin(), queues.end(), [&](IEventQueue *q)
 		{
-			q->ProcessEvents();
+			q->ProcessEvents(budget);
+			deferred += q->PendingCount();
 		});
+
+		stats.processed += budget.Consumed();
+		stats.lastProcessed = budget.Consumed();
+		stats.deferred = deferred;
+		stats.peakDeferred = std::max<size_t>(stats.peakDeferred, deferred);
+		if (deferred > 0)
+			stats.deferredFrames++;
+	}
+
+	void EventQueueMaster::SetBudget(std::chrono::microseconds time, size_t maxEvents)
+	{
+		budgetTime = time;
+		budgetEvents = maxEvents;
+	}
+
+	void EventQueueMaster::ResetStats()
+	{
+		// The current backlog is still there, so keep reporting it
+		size_t deferred = stats.deferred;
+		stats = Stats{};
+		stats.deferred = deferred;
+		stats.peakDeferred = deferred;
 	}
 
 	void EventQueueMaster::registerQueue(IEventQueue *q)
 	{
 		queues.push_back(q);
+		sortQueues();
+	}
+
+	void EventQueueMaster::sortQueues()
+	{
+		// std::list::sort is stable, so registration order is kept between queues of the same priority
+		queues.sort([](IEventQueue *a, IEventQueue *b)
+		{
+			return a->GetPriority() > b->GetPriority();
+		});
 	}
 }
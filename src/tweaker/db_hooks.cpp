@@ -13,7 +13,6 @@
 #include <assert.h>
 #include <string.h>
 
-#include <fstream>
 #include <map>
 #include <memory>
 #include <optional>
@@ -21,6 +20,7 @@
 
 using blt::db::DieselDB;
 using blt::db::DslFile;
+using raidhook::tweaker::dbhook::parse_hash;
 
 static const char* MODULE = "base/native/DB_001";
 
@@ -194,7 +194,7 @@ WrenForeignClassMethods raidhook::tweaker::dbhook::bind_dbhook_class([[maybe_unu
 	return {nullptr, nullptr};
 }
 
-static blt::idstring parseHash(std::string value)
+blt::idstring raidhook::tweaker::dbhook::parse_hash(const std::string& value)
 {
 	if (value.size() == 17 && value.at(0) == '@')
 	{
@@ -226,8 +226,8 @@ static blt::idstring parseHash(std::string value)
 
 static void wrenRegisterAssetHook(WrenVM* vm)
 {
-	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
-	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
+	blt::idstring name = parse_hash(wrenGetSlotString(vm, 1));
+	blt::idstring ext = parse_hash(wrenGetSlotString(vm, 2));
 
 	blt::idfile file(name, ext);
 
@@ -254,8 +254,8 @@ static void wrenRegisterAssetHook(WrenVM* vm)
 
 static void wrenLoadAssetContents(WrenVM* vm)
 {
-	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
-	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
+	blt::idstring name = parse_hash(wrenGetSlotString(vm, 1));
+	blt::idstring ext = parse_hash(wrenGetSlotString(vm, 2));
 
 	DslFile* file = DieselDB::Instance()->Find(name, ext);
 
@@ -272,37 +272,15 @@ static void wrenLoadAssetContents(WrenVM* vm)
 		return;
 	}
 
-	// Ahh yes, be sure to enable binary mode
-	// Otherwise stream.read will fail on Windows with failbit set, and won't touch errno
-	// I think I'm getting better at tracking this exact same problem down - this time, it only wasted a
-	// few perfectly good hours of my time.
-	std::ifstream stream(file->bundle->path, std::ios::binary);
-	if (stream.fail())
-	{
-		std::string msg = "Failed to open bundle file containing the asset - " + file->bundle->path;
-		wrenSetSlotString(vm, 0, msg.c_str());
-		wrenAbortFiber(vm, 0);
-		return;
-	}
-
-	// Make sure errno is clear before we do anything, so in some unlikely cornercase where an operation fails without
-	// setting errno it doesn't have some leftover number.
-	errno = 0;
-
 	try
 	{
-		stream.exceptions(std::ios::failbit | std::ios::eofbit);
-
-		std::vector<uint8_t> data = file->ReadContents(stream);
+		std::vector<uint8_t> data = file->ReadContents();
 
 		wrenSetSlotBytes(vm, 0, (const char*)data.data(), data.size());
 	}
-	catch (const std::ios::failure& ex)
+	catch (const std::exception& ex)
 	{
-		char err_buff[128];
-		strerror_s(err_buff, sizeof(err_buff), errno);
-		std::string msg =
-			std::string("Failed to read asset - IO error: ") + std::string(err_buff) + " " + std::string(ex.what());
+		std::string msg = std::string("Failed to read asset from ") + file->bundle->path + " - " + ex.what();
 		wrenSetSlotString(vm, 0, msg.c_str());
 		wrenAbortFiber(vm, 0);
 	}
@@ -336,7 +314,11 @@ bool raidhook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, B
 
 	// Define these loading functions here, as we can use them either directly or after calling Wren
 	auto load_file = [&](const std::string& filename) {
-		BLTFileDataStore* ds = BLTFileDataStore::Open(filename);
+		BLTAbstractDataStore* ds;
+		if (BLTAsyncFileDataStore::IsEnabled())
+			ds = BLTAsyncFileDataStore::Open(filename);
+		else
+			ds = BLTPrefetchDataStore::Open(filename, 0, UINT64_MAX);
 
 		if (!ds)
 		{
@@ -374,7 +356,8 @@ bool raidhook::tweaker::dbhook::hook_asset_load(const blt::idfile& asset_file, B
 			ExitProcess(1);
 		}
 
-		BLTAbstractDataStore* ds = DieselDB::Instance()->Open(file->bundle);
+		uint64_t length = file->HasLength() ? file->length : UINT64_MAX;
+		BLTAbstractDataStore* ds = DieselDB::Instance()->Open(file->bundle, file->offset, length);
 		*out_datastore = ds;
 		*out_pos = file->offset;
 
@@ -487,8 +470,8 @@ void DBForeignFile::ofFile(WrenVM* vm)
 
 void DBForeignFile::ofAsset(WrenVM* vm)
 {
-	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
-	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
+	blt::idstring name = parse_hash(wrenGetSlotString(vm, 1));
+	blt::idstring ext = parse_hash(wrenGetSlotString(vm, 2));
 	create(vm)->asset = blt::idfile(name, ext);
 }
 
@@ -602,8 +585,8 @@ void DBAssetHook::setDirectBundle(WrenVM* vm)
 	auto* it = get_this(vm);
 	it->clear_sources();
 
-	blt::idstring name = parseHash(wrenGetSlotString(vm, 1));
-	blt::idstring ext = parseHash(wrenGetSlotString(vm, 2));
+	blt::idstring name = parse_hash(wrenGetSlotString(vm, 1));
+	blt::idstring ext = parse_hash(wrenGetSlotString(vm, 2));
 
 	it->direct_bundle = blt::idfile(name, ext);
 }
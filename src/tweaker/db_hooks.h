@@ -15,6 +15,9 @@ namespace raidhook::tweaker::dbhook
 
 	WrenForeignClassMethods bind_dbhook_class(WrenVM* vm, const char* module, const char* class_name);
 
+	// Parses an idstring passed in from Wren, either as a string to hash or as '@' followed by the 16-digit hex hash
+	blt::idstring parse_hash(const std::string& value);
+
 	// Return true if the asset was found and the resulting datastore has been set, false otherwise.
 	bool hook_asset_load(const blt::idfile& asset_file, BLTAbstractDataStore** out_datastore, int64_t* out_pos,
 	                     int64_t* out_len, std::string& out_name, bool fallback_mode);
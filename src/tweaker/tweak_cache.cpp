@@ -0,0 +1,332 @@
+#include "tweak_cache.h"
+#include "wrenloader.h"
+
+#include <threading/threadpool.h>
+#include <util/sha256.h>
+#include <util/util.h>
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <string.h>
+
+// The cached outputs live in a folder named after a fingerprint of everything that could change them:
+// every Wren module and file that's been loaded, and the DLL itself. Each output is in its own file, named
+// after the hash of the file's name, extension and original text. When the fingerprint changes, the
+// folders for the old fingerprints are deleted.
+
+using namespace raidhook;
+using namespace raidhook::tweaker;
+
+// Bump this whenever the format of the cache changes, so old entries get thrown away
+static const uint32_t TWEAK_CACHE_REVISION = 1;
+static const char* TWEAK_CACHE_DIR = "tweak_cache";
+static const char* OPT_OUT_FILE = "disable_tweak_cache";
+
+// Every cache file starts with one of these
+static const char ENTRY_UNCHANGED = 'U';
+static const char ENTRY_TWEAKED = 'T';
+
+// Outputs past this are only kept on disk
+static const size_t MAX_MEMORY_BYTES = 64 * 1024 * 1024;
+
+namespace
+{
+	class TweakCache
+	{
+	public:
+		static TweakCache& Instance()
+		{
+			static TweakCache instance;
+			return instance;
+		}
+
+		bool IsEnabled() const { return enabled; }
+
+		void CheckInputs()
+		{
+			if (!enabled || wren::get_inputs_fingerprint() == keyedInputs)
+				return;
+
+			RAIDHOOK_LOG_WARN("Wren loaded more files after the tweak cache was set up, so it's being cleared and turned off");
+			enabled = false;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				unchanged.clear();
+				tweaked.clear();
+				memoryBytes = 0;
+			}
+
+			// Queued after any writes that are still waiting, and those check enabled before writing
+			std::string dir = directory;
+			ThreadPool::GetSingleton().Submit(TaskClass::IO, [this, dir]() {
+				std::lock_guard<std::mutex> lock(diskMutex);
+				Util::RemoveFilesAndDirectory(dir);
+			});
+		}
+
+		tweak_cache::LookupResult Find(const std::string& key, std::string& output)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (unchanged.count(key))
+					return tweak_cache::LookupResult::Unchanged;
+
+				auto it = tweaked.find(key);
+				if (it != tweaked.end())
+				{
+					output = it->second;
+					return tweak_cache::LookupResult::Tweaked;
+				}
+			}
+
+			// Not loaded since the game started, but it might be from an earlier run
+			std::ifstream in(EntryPath(key), std::ios::binary);
+			if (!in.good())
+				return tweak_cache::LookupResult::Miss;
+
+			char type = 0;
+			in.get(type);
+			if (type == ENTRY_UNCHANGED)
+			{
+				Remember(key, true, std::string());
+				return tweak_cache::LookupResult::Unchanged;
+			}
+			if (type != ENTRY_TWEAKED)
+				return tweak_cache::LookupResult::Miss;
+
+			output.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+			Remember(key, false, output);
+			return tweak_cache::LookupResult::Tweaked;
+		}
+
+		void Store(const std::string& key, bool isUnchanged, std::string output)
+		{
+			Remember(key, isUnchanged, output);
+
+			// Written out in the background, since it's only needed by the next run. It's written under
+			// a temporary name first, so a crash can't leave a partly written entry behind.
+			std::string path = EntryPath(key);
+			std::string tempPath = path + "." + std::to_string(nextTempId++) + ".tmp";
+			ThreadPool::GetSingleton().Submit(TaskClass::IO, [this, path, tempPath, isUnchanged, output{std::move(output)}]() {
+				// The cache might have been cleared since this was queued
+				std::lock_guard<std::mutex> lock(diskMutex);
+				if (!enabled)
+					return;
+
+				{
+					std::ofstream out(tempPath, std::ios::binary);
+					out.put(isUnchanged ? ENTRY_UNCHANGED : ENTRY_TWEAKED);
+					out.write(output.data(), output.size());
+
+					if (!out.good())
+					{
+						out.close();
+						DeleteFileA(tempPath.c_str());
+						return;
+					}
+				}
+
+				if (!MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+					DeleteFileA(tempPath.c_str());
+			});
+		}
+
+	private:
+		TweakCache()
+		{
+			// The fingerprint needs the mods' Wren files to already be loaded
+			if (!wren::get_wren_vm())
+				return;
+
+			if (IsOptedOut())
+				return;
+
+			keyedInputs = wren::get_inputs_fingerprint();
+			std::string fingerprint = MakeFingerprint(keyedInputs);
+			if (fingerprint.empty())
+				return;
+
+			directory = std::string(TWEAK_CACHE_DIR) + "/" + fingerprint;
+			RemoveOldEntries(fingerprint);
+
+			if (!Util::DirectoryExists(directory) && !Util::CreateDirectoryPath(directory))
+			{
+				RAIDHOOK_LOG_WARN("Could not create tweak cache directory, tweaked files will not be cached");
+				return;
+			}
+
+			enabled = true;
+		}
+
+		static bool IsOptedOut()
+		{
+			std::vector<std::string> mods;
+			try
+			{
+				mods = Util::GetDirectoryContents("mods", true);
+			}
+			catch (const std::exception&)
+			{
+				return false;
+			}
+
+			for (const std::string& mod : mods)
+			{
+				if (mod == "." || mod == "..")
+					continue;
+
+				if (Util::GetFileType("mods/" + mod + "/" + OPT_OUT_FILE) == Util::FileType_File)
+				{
+					RAIDHOOK_LOG_LOG("Tweak cache disabled by mods/" << mod << "/" << OPT_OUT_FILE);
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		static std::string MakeFingerprint(const std::string& wrenInputs)
+		{
+			// The DLL is part of it too, since it does the parsing and printing of the XML
+			HMODULE module;
+			char path[MAX_PATH + 1];
+			if (!GetModuleHandleEx(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS, (LPCTSTR)&TweakCache::Instance, &module))
+				return std::string();
+
+			size_t pathSize = GetModuleFileName(module, path, sizeof(path) - 1);
+			path[pathSize] = '\0';
+
+			std::string dllDigest = Util::GetCachedFileDigest(path);
+
+			Util::Sha256 hash;
+			hash.Update(&TWEAK_CACHE_REVISION, sizeof(TWEAK_CACHE_REVISION));
+			hash.Update(dllDigest.data(), dllDigest.size());
+			hash.Update(wrenInputs.data(), wrenInputs.size());
+
+			// Half of the hash is plenty to tell runs apart, and keeps the paths short
+			return hash.HexDigest().substr(0, 32);
+		}
+
+		static void RemoveOldEntries(const std::string& fingerprint)
+		{
+			if (!Util::DirectoryExists(TWEAK_CACHE_DIR))
+				return;
+
+			try
+			{
+				for (const std::string& dir : Util::GetDirectoryContents(TWEAK_CACHE_DIR, true))
+				{
+					if (dir == "." || dir == ".." || dir == fingerprint)
+						continue;
+
+					Util::RemoveFilesAndDirectory(std::string(TWEAK_CACHE_DIR) + "/" + dir);
+				}
+			}
+			catch (const std::exception&)
+			{
+				RAIDHOOK_LOG_WARN("Could not clear out old tweak cache entries");
+			}
+		}
+
+		std::string EntryPath(const std::string& key) const
+		{
+			return directory + "/" + key;
+		}
+
+		void Remember(const std::string& key, bool isUnchanged, const std::string& output)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			if (isUnchanged)
+			{
+				unchanged.insert(key);
+				return;
+			}
+
+			if (memoryBytes + output.size() > MAX_MEMORY_BYTES)
+				return;
+
+			if (tweaked.emplace(key, output).second)
+				memoryBytes += output.size();
+		}
+
+		std::atomic<bool> enabled = false;
+		std::string directory;
+
+		// What get_inputs_fingerprint returned when the directory was picked
+		std::string keyedInputs;
+
+		// Held while writing to or clearing the directory
+		std::mutex diskMutex;
+
+		std::mutex mutex;
+		std::unordered_set<std::string> unchanged;
+		std::unordered_map<std::string, std::string> tweaked;
+		size_t memoryBytes = 0;
+
+		std::atomic<uint64_t> nextTempId = 0;
+	};
+} // namespace
+
+// Off until the basemod asks for it
+static std::atomic<bool> requested = false;
+
+tweak_cache::LookupResult tweak_cache::lookup(const blt::idfile& file, const char* text, std::string& key, std::string& output)
+{
+	// Don't set the cache up (and fingerprint the mods) until it's wanted
+	if (!requested)
+		return LookupResult::Disabled;
+
+	TweakCache& cache = TweakCache::Instance();
+	if (!cache.IsEnabled())
+		return LookupResult::Disabled;
+
+	Util::Sha256 hash;
+	hash.Update(&file.name, sizeof(file.name));
+	hash.Update(&file.ext, sizeof(file.ext));
+	hash.Update(text, strlen(text));
+
+	// Written into the caller's string, so one that's reused doesn't need a new allocation each time
+	uint8_t digest[Util::Sha256::DIGEST_SIZE];
+	char hex[Util::Sha256::DIGEST_SIZE * 2];
+	hash.Final(digest);
+	Util::BytesToHex(digest, sizeof(digest), hex);
+	key.assign(hex, sizeof(hex));
+
+	return cache.Find(key, output);
+}
+
+void tweak_cache::store(const std::string& key, const char* text, const char* new_text)
+{
+	if (!requested)
+		return;
+
+	TweakCache& cache = TweakCache::Instance();
+	if (!cache.IsEnabled())
+		return;
+
+	// Most tweaks only touch some of the files they're given, so don't keep a copy of those that weren't
+	if (strcmp(text, new_text) == 0)
+		cache.Store(key, true, std::string());
+	else
+		cache.Store(key, false, new_text);
+}
+
+void tweak_cache::set_enabled(bool enabled)
+{
+	requested = enabled;
+}
+
+void tweak_cache::check_inputs()
+{
+	if (!requested)
+		return;
+
+	TweakCache::Instance().CheckInputs();
+}
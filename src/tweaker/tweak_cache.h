@@ -0,0 +1,35 @@
+#pragma once
+
+#include <platform.h>
+
+#include <string>
+
+// Cache of the output of the XML tweaker, kept in memory and on disk. The same files get tweaked the
+// same way every time they're loaded while the mods don't change, so the output only needs to be made
+// once. It's off unless the basemod turns it on, since tweaks that depend on anything other than the
+// Wren files they load (Lua state or settings, for example) would be broken by it. Any mod can also turn
+// it off by including a file named disable_tweak_cache in its folder.
+
+namespace raidhook::tweaker::tweak_cache
+{
+	enum class LookupResult
+	{
+		Disabled,  // The cache isn't in use, and store shouldn't be called
+		Miss,      // Nothing cached - the key is filled in, to store the output with once it's made
+		Unchanged, // The tweaker left the file as it was
+		Tweaked,   // The cached output was put in output
+	};
+
+	LookupResult lookup(const blt::idfile& file, const char* text, std::string& key, std::string& output);
+
+	// Stores the tweaker's output for a key given by lookup
+	void store(const std::string& key, const char* text, const char* new_text);
+
+	// Set from the basemod
+	void set_enabled(bool enabled);
+
+	// Called after each run of the tweaker. If Wren has loaded another module or file since the cache was
+	// set up, the cached outputs might not be what the tweaks make now, so the cache is cleared and turned
+	// off for the rest of the session.
+	void check_inputs();
+} // namespace raidhook::tweaker::tweak_cache
@@ -7,6 +7,8 @@
 #include "db_hooks.h"
 #include "global.h"
 #include "plugins/plugins.h"
+#include "tweak_cache.h"
+#include "util/sha256.h"
 #include "util/util.h"
 #include "wren_environment.h"
 #include "wren_lua_interface.h"
@@ -54,6 +56,24 @@ static string file_to_string(ifstream& in)
 	return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
 }
 
+// Hash of every module and file Wren has loaded, in the order it loaded them. The tweaked XML cache uses
+// this to tell whether the mods that make the tweaks have changed.
+static Util::Sha256& wren_inputs_hash()
+{
+	static Util::Sha256 hash;
+	return hash;
+}
+
+static void hash_wren_input(const string& name, const char* data, size_t length)
+{
+	// Lengths are included so the boundaries between inputs can't be shifted around
+	uint64_t lengths[2] = { name.size(), length };
+	Util::Sha256& hash = wren_inputs_hash();
+	hash.Update(lengths, sizeof(lengths));
+	hash.Update(name.data(), name.size());
+	hash.Update(data, length);
+}
+
 void io_listDirectory(WrenVM* vm)
 {
 	string filename = wrenGetSlotString(vm, 1);
@@ -104,6 +124,7 @@ void io_read(WrenVM* vm)
 	}
 
 	string contents = file_to_string(handle);
+	hash_wren_input(file, contents.data(), contents.size());
 	wrenSetSlotString(vm, 0, contents.c_str());
 }
 
@@ -144,6 +165,27 @@ static void internal_set_tweaker_enabled(WrenVM* vm)
 	raidhook::tweaker::tweaker_enabled = wrenGetSlotBool(vm, 1);
 }
 
+static void internal_register_tweaked_file(WrenVM* vm)
+{
+	std::string name = wrenGetSlotString(vm, 1);
+	blt::idstring ext = dbhook::parse_hash(wrenGetSlotString(vm, 2));
+
+	if (name == "*")
+		raidhook::tweaker::register_tweaked_extension(ext);
+	else
+		raidhook::tweaker::register_tweaked_file(blt::idfile(dbhook::parse_hash(name), ext));
+}
+
+static void internal_set_tweak_filter_enabled(WrenVM* vm)
+{
+	raidhook::tweaker::set_tweak_filter_enabled(wrenGetSlotBool(vm, 1));
+}
+
+static void internal_set_tweak_cache_enabled(WrenVM* vm)
+{
+	raidhook::tweaker::tweak_cache::set_enabled(wrenGetSlotBool(vm, 1));
+}
+
 static void internal_register_mod_v1(WrenVM* vm)
 {
 	int slotType;
@@ -277,6 +319,18 @@ static WrenForeignMethodFn bindForeignMethod(WrenVM* vm, const char* module, con
 			{
 				return &internal_register_mod_v1;
 			}
+			else if (isStatic && strcmp(signature, "register_tweaked_file(_,_)") == 0)
+			{
+				return &internal_register_tweaked_file;
+			}
+			else if (isStatic && strcmp(signature, "tweak_filter_enabled=(_)") == 0)
+			{
+				return &internal_set_tweak_filter_enabled;
+			}
+			else if (isStatic && strcmp(signature, "tweak_cache_enabled=(_)") == 0)
+			{
+				return &internal_set_tweak_cache_enabled;
+			}
 		}
 	}
 	// Other modules...
@@ -409,6 +463,8 @@ static WrenLoadModuleResult getModulePath([[maybe_unused]] WrenVM* vm, const cha
 	lookup_builtin_wren_src(name_c, &builtin_string);
 	if (builtin_string)
 	{
+		hash_wren_input(name_c, builtin_string, strlen(builtin_string));
+
 		WrenLoadModuleResult result{};
 		result.source = builtin_string;
 		return result;
@@ -450,6 +506,8 @@ static WrenLoadModuleResult getModulePath([[maybe_unused]] WrenVM* vm, const cha
 		RAIDHOOK_LOG_WARN("Patching around an old use of the variable name 'continue'. Please update your basemod.");
 	}
 
+	hash_wren_input(name, str.data(), str.size());
+
 	size_t length = str.length() + 1;
 	char* output = (char*)malloc(length); // +1 for the null
 	portable_strncpy(output, str.c_str(), length);
@@ -511,6 +569,15 @@ WrenVM* raidhook::wren::get_wren_vm()
 	return vm;
 }
 
+std::string raidhook::wren::get_inputs_fingerprint()
+{
+	auto lock = lock_wren_vm();
+
+	// Finish a copy, so later inputs can still be added to the original
+	Util::Sha256 hash = wren_inputs_hash();
+	return hash.HexDigest();
+}
+
 const char* tweaker::transform_file(const char* text)
 {
 	auto lock = raidhook::wren::lock_wren_vm();
@@ -522,9 +589,16 @@ const char* tweaker::transform_file(const char* text)
 
 	wrenEnsureSlots(vm, 4);
 
-	wrenGetVariable(vm, "base/base", "BaseTweaker", 0);
-	WrenHandle* tweakerClass = wrenGetSlotHandle(vm, 0);
-	WrenHandle* sig = wrenMakeCallHandle(vm, "tweak(_,_,_)");
+	// These are looked up on the first call and kept for as long as the VM exists, which is until the
+	// game closes, rather than being made and released again for every file
+	static WrenHandle* tweakerClass = nullptr;
+	static WrenHandle* sig = nullptr;
+	if (!tweakerClass)
+	{
+		wrenGetVariable(vm, "base/base", "BaseTweaker", 0);
+		tweakerClass = wrenGetSlotHandle(vm, 0);
+		sig = wrenMakeCallHandle(vm, "tweak(_,_,_)");
+	}
 
 	char hex[17]; // 16-chars long +1 for the null
 
@@ -551,9 +625,6 @@ const char* tweaker::transform_file(const char* text)
 		return text;
 	}
 
-	wrenReleaseHandle(vm, tweakerClass);
-	wrenReleaseHandle(vm, sig);
-
 	const char* new_text = wrenGetSlotString(vm, 0);
 
 	return new_text;
@@ -3,9 +3,13 @@
 #include <wren.hpp>
 
 #include <mutex>
+#include <string>
 
 namespace raidhook::wren
 {
 	WrenVM* get_wren_vm();
 	std::lock_guard<std::recursive_mutex> lock_wren_vm();
+
+	// Hex hash of every Wren module and every file read through IO.read so far
+	std::string get_inputs_fingerprint();
 } // namespace raidhook::wren
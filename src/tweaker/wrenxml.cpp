@@ -2,9 +2,12 @@
 
 #include "global.h"
 
+#include <algorithm>
 #include <string>
 #include <util/util.h>
 
+#include <string.h>
+
 using namespace std;
 using namespace raidhook::tweaker;
 using namespace wrenxml;
@@ -22,156 +25,119 @@ const char *MODULE = "base/native";
 
 #define GET_WXML_NODE(vm, slot, name) \
 WXMLNode *name = *(WXMLNode**)wrenGetSlotForeign(vm, slot); \
-if(name->root == NULL) { \
+if(name->root == NULL || name->handle == NULL) { \
 	WXML_ERR("Cannot use closed Wren XML Instance"); \
+	return; \
 }
 
 #define THIS_WXML_NODE(vm) \
 GET_WXML_NODE(vm, 0, wxml) \
-mxml_node_t *handle = wxml->handle; \
+xmldom::Node *handle = wxml->handle; \
 (void)(handle) /* cast our handle to void to eliminate GCC's unused variable errors */
 
-static char *					/* O - Allocated string */
-mxmlToAllocStringSafe(
-    mxml_node_t    *node,		/* I - Node to write */
-    mxml_save_cb_t cb)			/* I - Whitespace callback or @code MXML_NO_CALLBACK@ */
-{
-	int	bytes;				/* Required bytes */
-	char	buffer[8192];			/* Temporary buffer */
-	char	*s;				/* Allocated string */
-
-
-	/*
-	* Write the node to the temporary buffer...
-	*/
-
-	bytes = mxmlSaveString(node, buffer, sizeof(buffer), cb);
-
-	if (bytes <= 0)
-		return strdup(""); // Empty string case
-
-	if (bytes < (int)(sizeof(buffer) - 1))
-	{
-		/*
-		* Node fit inside the buffer, so just duplicate that string and
-		* return...
-		*/
-
-		return strdup(buffer);
-	}
-
-	/*
-	* Allocate a buffer of the required size and save the node to the
-	* new buffer...
-	*/
-
-	if ((s = (char*)malloc(bytes + 1)) == NULL)
-	{
-		const char *message = "[WREN/WXML] XML.string: Cannot allocate enough space for XML string";
-		RAIDHOOK_LOG_ERROR(message);
-		MessageBox(0, message, "SuperBLT OutOfMemory", MB_OK);
-		exit(1);
-	}
-
-	mxmlSaveString(node, s, bytes + 1, cb);
+// The node types as mxml numbered them, which is what scripts see. Since the text between elements has
+// always been thrown away, everything is an element.
+static const int MXML_ELEMENT = 0;
+static const int MXML_TEXT = 4;
 
-	/*
-	* Return the allocated string...
-	*/
-
-	return (s);
-}
-
-static const char *last_loaded_xml = NULL;
-static char *mxml_last_error = NULL;
-
-static void handle_mxml_error_crash(const char* error)
+static void handle_parse_error_crash(const string &error, const char *text)
 {
 	RAIDHOOK_LOG_ERROR("Could not parse XML: Error and original file below");
 	RAIDHOOK_LOG_ERROR(error);
-	RAIDHOOK_LOG_ERROR(last_loaded_xml);
+	RAIDHOOK_LOG_ERROR(text);
 
 	const char *message = "[WREN/WXML] XML parse error - see mods/logs for details";
 	MessageBox(0, message, "XML Parse Error", MB_OK);
 	exit(1);
 }
 
-static void handle_mxml_error_note(const char* error)
-{
-	mxml_last_error = strdup(error);
-}
-
-static mxml_node_t* recursive_clone(mxml_node_t *dest_parent, mxml_node_t *src)
-{
-	mxml_node_t *dest = mxmlNewElement(dest_parent, mxmlGetElement(src));
-	for (int i = 0; i < mxmlElementGetAttrCount(src); i++)
-	{
-		const char *name;
-		const char *value = mxmlElementGetAttrByIndex(src, i, &name);
-		mxmlElementSetAttr(dest, name, value);
-	}
-
-	mxml_node_t *src_child = mxmlGetFirstChild(src);
-	while (src_child != NULL)
-	{
-		recursive_clone(dest, src_child);
-
-		src_child = mxmlGetNextSibling(src_child);
-	}
-
-	return dest;
-}
-
-mxml_type_t remove_whitespace_callback(mxml_node_t *)
-{
-	return MXML_IGNORE;
-}
-
-WXMLDocument::WXMLDocument(const char *text)
+WXMLDocument::WXMLDocument(const char *text, size_t length)
 {
-	root_node = mxmlLoadString(NULL, text, remove_whitespace_callback);
+	arenas.push_back(make_shared<xmldom::Arena>());
+	root_node = xmldom::Parse(GetArena(), text, length, parse_error);
 }
 
 WXMLDocument::WXMLDocument(WXMLNode *clone_from)
 {
-	root_node = recursive_clone(MXML_NO_PARENT, clone_from->handle);
+	arenas.push_back(make_shared<xmldom::Arena>());
+	root_node = xmldom::Clone(GetArena(), clone_from->handle);
 }
 
-WXMLDocument::WXMLDocument(mxml_node_t *root_node) : root_node(root_node) {}
+WXMLDocument::WXMLDocument(xmldom::Node *root_node, const vector<shared_ptr<xmldom::Arena>> &arenas) : root_node(root_node), arenas(arenas) {}
 
 WXMLDocument::~WXMLDocument()
 {
-	for (auto const &node : nodes)
+	WXMLNode *wrapper = first_wrapper;
+	while (wrapper != NULL)
 	{
-		node.second->root = NULL;
-		node.second->handle = NULL;
+		WXMLNode *next = wrapper->next_wrapper;
+
+		if (wrapper->handle)
+			wrapper->handle->userData = NULL;
+		wrapper->root = NULL;
+		wrapper->handle = NULL;
+		wrapper->prev_wrapper = NULL;
+		wrapper->next_wrapper = NULL;
+
+		wrapper = next;
 	}
 
-	mxmlDelete(root_node);
+	// The nodes themselves are freed along with the last document using their arena
 }
 
-WXMLNode* WXMLDocument::GetNode(mxml_node_t *node)
+WXMLNode* WXMLDocument::GetNode(xmldom::Node *node)
 {
-	if (nodes.count(node)) return nodes[node];
+	if (node != NULL && node->userData != NULL) return (WXMLNode*)node->userData;
 
 	return new WXMLNode(this, node);
 }
 
 void WXMLDocument::MergeInto(WXMLDocument *other)
 {
-	for (auto const &pair : nodes)
+	while (first_wrapper != NULL)
+	{
+		WXMLNode *wrapper = first_wrapper;
+		RemoveWrapper(wrapper);
+		other->AddWrapper(wrapper);
+	}
+
+	for (const shared_ptr<xmldom::Arena> &arena : arenas)
 	{
-		other->nodes[pair.first] = pair.second;
-		pair.second->root = other;
+		if (find(other->arenas.begin(), other->arenas.end(), arena) == other->arenas.end())
+			other->arenas.push_back(arena);
 	}
-	nodes.clear();
+
 	root_node = NULL;
 	// TODO mark ourselves for deletion
 }
 
-WXMLNode::WXMLNode(WXMLDocument *root, mxml_node_t *handle) : root(root), handle(handle), usages(0)
+void WXMLDocument::AddWrapper(WXMLNode *wrapper)
+{
+	wrapper->root = this;
+	wrapper->prev_wrapper = NULL;
+	wrapper->next_wrapper = first_wrapper;
+	if (first_wrapper != NULL) first_wrapper->prev_wrapper = wrapper;
+	first_wrapper = wrapper;
+}
+
+void WXMLDocument::RemoveWrapper(WXMLNode *wrapper)
+{
+	if (wrapper->prev_wrapper != NULL)
+		wrapper->prev_wrapper->next_wrapper = wrapper->next_wrapper;
+	else
+		first_wrapper = wrapper->next_wrapper;
+
+	if (wrapper->next_wrapper != NULL)
+		wrapper->next_wrapper->prev_wrapper = wrapper->prev_wrapper;
+
+	wrapper->prev_wrapper = NULL;
+	wrapper->next_wrapper = NULL;
+}
+
+WXMLNode::WXMLNode(WXMLDocument *root, xmldom::Node *handle) : root(root), handle(handle), usages(0)
 {
-	root->nodes[handle] = this;
+	if (handle != NULL) handle->userData = this;
+	root->AddWrapper(this);
 }
 
 void WXMLNode::Release()
@@ -181,9 +147,10 @@ void WXMLNode::Release()
 	{
 		if (root != NULL)
 		{
-			root->nodes.erase(handle);
+			if (handle != NULL) handle->userData = NULL;
+			root->RemoveWrapper(this);
 
-			if (root->nodes.empty())
+			if (root->first_wrapper == NULL)
 			{
 				delete root;
 			}
@@ -198,62 +165,56 @@ void WXMLNode::Release()
 WXMLDocument* WXMLNode::MoveToNewDocument()
 {
 	WXMLDocument *old = root;
-	WXMLDocument *doc = new WXMLDocument(handle);
+	WXMLDocument *doc = new WXMLDocument(handle, old->arenas);
 
-	vector<mxml_node_t*> to_remove;
-	for (auto const &node : old->nodes)
+	WXMLNode *wrapper = old->first_wrapper;
+	while (wrapper != NULL)
 	{
-		mxml_node_t *nod = node.first;
-		bool is_child = false;
-		while (nod != NULL)
+		WXMLNode *next = wrapper->next_wrapper;
+
+		xmldom::Node *nod = wrapper->handle;
+		while (nod != NULL && nod != handle)
 		{
-			if (nod == handle)
-			{
-				is_child = true;
-				break;
-			}
-			nod = mxmlGetParent(nod);
+			nod = nod->parent;
 		}
 
-		if (!is_child) continue;
-
-		to_remove.push_back(node.first);
-		node.second->root = doc;
-		doc->nodes[node.first] = node.second;
-	}
+		if (nod != NULL)
+		{
+			old->RemoveWrapper(wrapper);
+			doc->AddWrapper(wrapper);
+		}
 
-	for (mxml_node_t* const &node : to_remove)
-	{
-		old->nodes.erase(node);
+		wrapper = next;
 	}
 
-	mxmlRemove(handle);
+	xmldom::Remove(handle);
 
 	return doc;
 }
 
-static WXMLNode* attemptParseString(WrenVM* vm)
+// Returns null if the text couldn't be parsed, with the error in the document
+static WXMLNode* attemptParseString(WrenVM* vm, bool crash_on_error)
 {
 	WXMLNode **node = (WXMLNode**)wrenSetSlotNewForeign(vm, 0, 0, sizeof(WXMLNode*));
 
 	const char* text = wrenGetSlotString(vm, 1);
-	last_loaded_xml = text;
 
-	WXMLDocument *doc = new WXMLDocument(text);
+	WXMLDocument *doc = new WXMLDocument(text, strlen(text));
+
+	if (!doc->GetParseError().empty() && crash_on_error)
+	{
+		handle_parse_error_crash(doc->GetParseError(), text);
+	}
 
 	*node = doc->GetRootNode();
 	(*node)->Use();
 
-	// Use the crash callback for anything else
-	mxmlSetErrorCallback(handle_mxml_error_crash);
-
 	return *node;
 }
 
 static void allocateXML(WrenVM* vm)
 {
-	mxmlSetErrorCallback(handle_mxml_error_crash);
-	WXMLNode *wxml = attemptParseString(vm);
+	WXMLNode *wxml = attemptParseString(vm, true);
 
 	if (!wxml->handle)
 	{
@@ -269,16 +230,13 @@ static void finalizeXML(void* data)
 
 static void XMLtry_parse(WrenVM* vm)
 {
-	mxmlSetErrorCallback(handle_mxml_error_note);
-	WXMLNode *wxml = attemptParseString(vm);
+	WXMLNode *wxml = attemptParseString(vm, false);
 
-	if (mxml_last_error)
+	// Text without any elements in it isn't usable either, even though it's not an error as such
+	if (!wxml->handle)
 	{
-		finalizeXML(wxml);
+		finalizeXML(wrenGetSlotForeign(vm, 0));
 		wrenSetSlotNull(vm, 0);
-
-		free(mxml_last_error);
-		mxml_last_error = NULL;
 	}
 }
 
@@ -289,9 +247,13 @@ static void XMLNode_delete(WrenVM* vm)
 	if (wxml->root != NULL) delete wxml->root;
 }
 
-static WXMLNode* XMLNode_create(WrenVM *vm, WXMLDocument *root, mxml_node_t *xnode, int slot)
+static WXMLNode* XMLNode_create(WrenVM *vm, WXMLDocument *root, xmldom::Node *xnode, int slot)
 {
-	if (xnode == NULL) WXML_ERR("Cannot create null XML Node");
+	if (xnode == NULL)
+	{
+		WXML_ERR("Cannot create null XML Node");
+		return NULL;
+	}
 
 	wrenGetVariable(vm, MODULE, "XML", slot);
 
@@ -306,20 +268,20 @@ static void XMLNode_type(WrenVM* vm)
 {
 	THIS_WXML_NODE(vm);
 
-	wrenSetSlotDouble(vm, 0, mxmlGetType(handle));
+	wrenSetSlotDouble(vm, 0, MXML_ELEMENT);
 }
 
 #define XMLNODE_REQUIRE_TYPE(type, name) \
-if (mxmlGetType(handle) != type) \
-WXML_ERR("Can only perform ." #name " on " #type " nodes - ID:" + to_string(mxmlGetType(handle)));
+if (MXML_ELEMENT != type) { \
+	WXML_ERR("Can only perform ." #name " on " #type " nodes - ID:" + to_string(MXML_ELEMENT)); \
+	return; \
+}
 
 static void XMLNode_text(WrenVM* vm)
 {
 	THIS_WXML_NODE(vm);
 
 	XMLNODE_REQUIRE_TYPE(MXML_TEXT, name);
-
-	wrenSetSlotString(vm, 0, mxmlGetText(handle, NULL));
 }
 
 static void XMLNode_text_set(WrenVM* vm)
@@ -327,8 +289,6 @@ static void XMLNode_text_set(WrenVM* vm)
 	THIS_WXML_NODE(vm);
 
 	XMLNODE_REQUIRE_TYPE(MXML_TEXT, name);
-
-	mxmlSetText(handle, 0, wrenGetSlotString(vm, 1));
 }
 
 static void XMLNode_string(WrenVM* vm)
@@ -337,10 +297,11 @@ static void XMLNode_string(WrenVM* vm)
 
 	XMLNODE_REQUIRE_TYPE(MXML_ELEMENT, string);
 
-	mxmlSetWrapMargin(0);
-	char* str = mxmlToAllocStringSafe(handle, MXML_NO_CALLBACK);
-	wrenSetSlotString(vm, 0, str);
-	free(str);
+	// Kept around so big documents don't need a new buffer every time (the VM lock keeps it to one caller)
+	static string str;
+	str.clear();
+	xmldom::Serialise(handle, str);
+	wrenSetSlotBytes(vm, 0, str.data(), str.size());
 }
 
 static void XMLNode_name(WrenVM* vm)
@@ -349,7 +310,7 @@ static void XMLNode_name(WrenVM* vm)
 
 	XMLNODE_REQUIRE_TYPE(MXML_ELEMENT, name);
 
-	wrenSetSlotString(vm, 0, mxmlGetElement(handle));
+	wrenSetSlotString(vm, 0, handle->name);
 }
 
 static void XMLNode_name_set(WrenVM* vm)
@@ -358,7 +319,7 @@ static void XMLNode_name_set(WrenVM* vm)
 
 	XMLNODE_REQUIRE_TYPE(MXML_ELEMENT, name);
 
-	mxmlSetElement(handle, wrenGetSlotString(vm, 1));
+	xmldom::SetName(wxml->root->GetArena(), handle, wrenGetSlotString(vm, 1));
 }
 
 static void XMLNode_attribute(WrenVM* vm)
@@ -367,7 +328,7 @@ static void XMLNode_attribute(WrenVM* vm)
 
 	XMLNODE_REQUIRE_TYPE(MXML_ELEMENT, name);
 
-	const char *value = mxmlElementGetAttr(handle, wrenGetSlotString(vm, 1));
+	const char *value = xmldom::GetAttribute(handle, wrenGetSlotString(vm, 1));
 	if (value)
 		wrenSetSlotString(vm, 0, value);
 	else
@@ -384,12 +345,12 @@ static void XMLNode_attribute_set(WrenVM* vm)
 
 	if (wrenGetSlotType(vm, 2) == WREN_TYPE_NULL)
 	{
-		mxmlElementDeleteAttr(handle, name);
+		xmldom::DeleteAttribute(handle, name);
 	}
 	else
 	{
 		const char *value = wrenGetSlotString(vm, 2);
-		mxmlElementSetAttr(handle, name, value);
+		xmldom::SetAttribute(wxml->root->GetArena(), handle, name, value);
 	}
 }
 
@@ -402,11 +363,9 @@ static void XMLNode_attribute_names(WrenVM* vm)
 	wrenEnsureSlots(vm, 2);
 
 	wrenSetSlotNewList(vm, 0);
-	for (int i = 0; i < mxmlElementGetAttrCount(handle); i++)
+	for (uint32_t i = 0; i < handle->attributeCount; i++)
 	{
-		const char *name;
-		mxmlElementGetAttrByIndex(handle, i, &name);
-		wrenSetSlotString(vm, 1, name);
+		wrenSetSlotString(vm, 1, handle->attributes[i].name);
 		wrenInsertInList(vm, 0, -1, 1);
 	}
 }
@@ -418,7 +377,7 @@ static void XMLNode_create_element(WrenVM* vm)
 	XMLNODE_REQUIRE_TYPE(MXML_ELEMENT, name);
 
 	const char *name = wrenGetSlotString(vm, 1);
-	mxml_node_t *node = mxmlNewElement(handle, name);
+	xmldom::Node *node = xmldom::NewElement(wxml->root->GetArena(), handle, name);
 	XMLNode_create(vm, wxml->root, node, 0);
 }
 
@@ -427,7 +386,7 @@ static void XMLNode_detach(WrenVM* vm)
 	THIS_WXML_NODE(vm);
 
 	// Don't do anything if we're already at the top of a tree
-	if (mxmlGetParent(handle) == NULL) return;
+	if (handle->parent == NULL) return;
 
 	wxml->MoveToNewDocument();
 }
@@ -440,26 +399,46 @@ static void XMLNode_clone(WrenVM* vm)
 	XMLNode_create(vm, doc, doc->GetRootNode()->handle, 0);
 }
 
-static void XMLNode_attach(WrenVM* vm, int where, mxml_node_t *child)
+// Adds the node in slot 1 after prev_child, or as the first child if that's null
+static void XMLNode_attach(WrenVM* vm, xmldom::Node *prev_child)
 {
 	THIS_WXML_NODE(vm);
 	GET_WXML_NODE(vm, 1, new_child);
 
-	if (mxmlGetParent(new_child->handle) != NULL)
+	if (new_child->handle->parent != NULL)
 	{
 		WXML_ERR("Cannot attach a node that already has a parent");
+		return;
+	}
+
+	if (prev_child != NULL && prev_child->parent != handle)
+	{
+		WXML_ERR("Cannot attach a node after one that isn't a child of this node");
+		return;
+	}
+
+	// Attaching a node to itself or one of its own children would make a loop
+	for (xmldom::Node *nod = handle; nod != NULL; nod = nod->parent)
+	{
+		if (nod == new_child->handle)
+		{
+			WXML_ERR("Cannot attach a node to itself or one of its children");
+			return;
+		}
 	}
 
 	WXMLDocument *old_root = new_child->root;
 
-	mxmlAdd(handle, where, child, new_child->handle);
+	xmldom::Insert(handle, new_child->handle, prev_child);
 	new_child->root->MergeInto(wxml->root);
 	delete old_root;
 }
 
 static void XMLNode_attach(WrenVM* vm)
 {
-	XMLNode_attach(vm, MXML_ADD_AFTER, MXML_ADD_TO_PARENT);
+	THIS_WXML_NODE(vm);
+
+	XMLNode_attach(vm, handle->lastChild);
 }
 
 static void XMLNode_attach_pos(WrenVM* vm)
@@ -469,20 +448,20 @@ static void XMLNode_attach_pos(WrenVM* vm)
 
 	if (wrenGetSlotType(vm, 2) == WREN_TYPE_NULL)
 	{
-		XMLNode_attach(vm, MXML_ADD_BEFORE, MXML_ADD_TO_PARENT);
+		XMLNode_attach(vm, NULL);
 	}
 	else
 	{
 		GET_WXML_NODE(vm, 2, prev_child);
 
-		XMLNode_attach(vm, MXML_ADD_AFTER, prev_child->handle);
+		XMLNode_attach(vm, prev_child->handle);
 	}
 }
 
-#define XMLNODE_ACTION_FUNC(getter, name) \
+#define XMLNODE_ACTION_FUNC(field, name) \
 static void XMLNode_ ## name(WrenVM* vm) { \
 	THIS_WXML_NODE(vm); \
-	mxml_node_t *node = mxmlGet ## getter(handle); \
+	xmldom::Node *node = handle->field; \
 	if(node) { \
 		XMLNode_create(vm, wxml->root, node, 0); \
 	} \
@@ -492,11 +471,11 @@ static void XMLNode_ ## name(WrenVM* vm) { \
 }
 
 #define XMLNODE_FUNC_SET(func) \
-func(NextSibling, next) \
-func(PrevSibling, prev) \
-func(Parent, parent) \
-func(FirstChild, first_child) \
-func(LastChild, last_child)
+func(next, next) \
+func(prev, prev) \
+func(parent, parent) \
+func(firstChild, first_child) \
+func(lastChild, last_child)
 
 XMLNODE_FUNC_SET(XMLNODE_ACTION_FUNC)
 
@@ -1,9 +1,10 @@
 #pragma once
 
-#include <unordered_set>
-#include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
-#include "mxml.h"
+#include "xmldom.h"
 
 #include <wren.hpp>
 
@@ -18,20 +19,37 @@ namespace raidhook
 			class WXMLDocument
 			{
 			public:
-				WXMLDocument(const char *text);
+				WXMLDocument(const char *text, size_t length);
 				WXMLDocument(WXMLNode *clone_from);
 				~WXMLDocument();
 				WXMLNode *GetRootNode()
 				{
 					return GetNode(root_node);
 				}
-				WXMLNode *GetNode(mxml_node_t *node);
+				WXMLNode *GetNode(xmldom::Node *node);
 				void MergeInto(WXMLDocument *other);
+				xmldom::Arena &GetArena()
+				{
+					return *arenas.front();
+				}
+				const std::string &GetParseError() const
+				{
+					return parse_error;
+				}
 			private:
-				mxml_node_t *root_node;
-				std::map<mxml_node_t*, WXMLNode*> nodes;
+				xmldom::Node *root_node;
+				std::string parse_error;
 
-				WXMLDocument(mxml_node_t *root_node);
+				// Detached nodes stay in the arena they were made in, so documents share them
+				std::vector<std::shared_ptr<xmldom::Arena>> arenas;
+
+				// The wrappers for this document's nodes, linked through the wrappers themselves
+				WXMLNode *first_wrapper = NULL;
+
+				WXMLDocument(xmldom::Node *root_node, const std::vector<std::shared_ptr<xmldom::Arena>> &arenas);
+
+				void AddWrapper(WXMLNode *wrapper);
+				void RemoveWrapper(WXMLNode *wrapper);
 
 				friend class WXMLNode;
 			};
@@ -41,7 +59,7 @@ namespace raidhook
 			{
 			public:
 				WXMLDocument *root;
-				mxml_node_t *handle;
+				xmldom::Node *handle;
 				void Use()
 				{
 					usages++;
@@ -49,10 +67,13 @@ namespace raidhook
 				void Release();
 				WXMLDocument* MoveToNewDocument();
 			private:
-				WXMLNode(WXMLDocument *root, mxml_node_t *handle);
+				WXMLNode(WXMLDocument *root, xmldom::Node *handle);
 
 				int usages;
 
+				WXMLNode *prev_wrapper = NULL;
+				WXMLNode *next_wrapper = NULL;
+
 				friend class WXMLDocument;
 			};
 
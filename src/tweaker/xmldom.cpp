@@ -0,0 +1,798 @@
+#include "xmldom.h"
+
+#include <algorithm>
+#include <new>
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace raidhook::tweaker;
+using namespace raidhook::tweaker::xmldom;
+
+namespace
+{
+	struct Entity
+	{
+		const char* name;
+		uint32_t codepoint;
+	};
+
+	// The same named entities as mxml: all of HTML 4's, plus apos. Sorted by name, for a binary search.
+	const Entity ENTITIES[] = {
+		{ "AElig", 198 }, { "Aacute", 193 }, { "Acirc", 194 }, { "Agrave", 192 }, { "Alpha", 913 }, { "Aring", 197 },
+		{ "Atilde", 195 }, { "Auml", 196 }, { "Beta", 914 }, { "Ccedil", 199 }, { "Chi", 935 }, { "Dagger", 8225 },
+		{ "Delta", 916 }, { "ETH", 208 }, { "Eacute", 201 }, { "Ecirc", 202 }, { "Egrave", 200 }, { "Epsilon", 917 },
+		{ "Eta", 919 }, { "Euml", 203 }, { "Gamma", 915 }, { "Iacute", 205 }, { "Icirc", 206 }, { "Igrave", 204 },
+		{ "Iota", 921 }, { "Iuml", 207 }, { "Kappa", 922 }, { "Lambda", 923 }, { "Mu", 924 }, { "Ntilde", 209 },
+		{ "Nu", 925 }, { "OElig", 338 }, { "Oacute", 211 }, { "Ocirc", 212 }, { "Ograve", 210 }, { "Omega", 937 },
+		{ "Omicron", 927 }, { "Oslash", 216 }, { "Otilde", 213 }, { "Ouml", 214 }, { "Phi", 934 }, { "Pi", 928 },
+		{ "Prime", 8243 }, { "Psi", 936 }, { "Rho", 929 }, { "Scaron", 352 }, { "Sigma", 931 }, { "THORN", 222 },
+		{ "Tau", 932 }, { "Theta", 920 }, { "Uacute", 218 }, { "Ucirc", 219 }, { "Ugrave", 217 }, { "Upsilon", 933 },
+		{ "Uuml", 220 }, { "Xi", 926 }, { "Yacute", 221 }, { "Yuml", 376 }, { "Zeta", 918 }, { "aacute", 225 },
+		{ "acirc", 226 }, { "acute", 180 }, { "aelig", 230 }, { "agrave", 224 }, { "alefsym", 8501 }, { "alpha", 945 },
+		{ "amp", 38 }, { "and", 8743 }, { "ang", 8736 }, { "apos", 39 }, { "aring", 229 }, { "asymp", 8776 },
+		{ "atilde", 227 }, { "auml", 228 }, { "bdquo", 8222 }, { "beta", 946 }, { "brvbar", 166 }, { "bull", 8226 },
+		{ "cap", 8745 }, { "ccedil", 231 }, { "cedil", 184 }, { "cent", 162 }, { "chi", 967 }, { "circ", 710 },
+		{ "clubs", 9827 }, { "cong", 8773 }, { "copy", 169 }, { "crarr", 8629 }, { "cup", 8746 }, { "curren", 164 },
+		{ "dArr", 8659 }, { "dagger", 8224 }, { "darr", 8595 }, { "deg", 176 }, { "delta", 948 }, { "diams", 9830 },
+		{ "divide", 247 }, { "eacute", 233 }, { "ecirc", 234 }, { "egrave", 232 }, { "empty", 8709 }, { "emsp", 8195 },
+		{ "ensp", 8194 }, { "epsilon", 949 }, { "equiv", 8801 }, { "eta", 951 }, { "eth", 240 }, { "euml", 235 },
+		{ "euro", 8364 }, { "exist", 8707 }, { "fnof", 402 }, { "forall", 8704 }, { "frac12", 189 }, { "frac14", 188 },
+		{ "frac34", 190 }, { "frasl", 8260 }, { "gamma", 947 }, { "ge", 8805 }, { "gt", 62 }, { "hArr", 8660 },
+		{ "harr", 8596 }, { "hearts", 9829 }, { "hellip", 8230 }, { "iacute", 237 }, { "icirc", 238 }, { "iexcl", 161 },
+		{ "igrave", 236 }, { "image", 8465 }, { "infin", 8734 }, { "int", 8747 }, { "iota", 953 }, { "iquest", 191 },
+		{ "isin", 8712 }, { "iuml", 239 }, { "kappa", 954 }, { "lArr", 8656 }, { "lambda", 955 }, { "lang", 9001 },
+		{ "laquo", 171 }, { "larr", 8592 }, { "lceil", 8968 }, { "ldquo", 8220 }, { "le", 8804 }, { "lfloor", 8970 },
+		{ "lowast", 8727 }, { "loz", 9674 }, { "lrm", 8206 }, { "lsaquo", 8249 }, { "lsquo", 8216 }, { "lt", 60 },
+		{ "macr", 175 }, { "mdash", 8212 }, { "micro", 181 }, { "middot", 183 }, { "minus", 8722 }, { "mu", 956 },
+		{ "nabla", 8711 }, { "nbsp", 160 }, { "ndash", 8211 }, { "ne", 8800 }, { "ni", 8715 }, { "not", 172 },
+		{ "notin", 8713 }, { "nsub", 8836 }, { "ntilde", 241 }, { "nu", 957 }, { "oacute", 243 }, { "ocirc", 244 },
+		{ "oelig", 339 }, { "ograve", 242 }, { "oline", 8254 }, { "omega", 969 }, { "omicron", 959 }, { "oplus", 8853 },
+		{ "or", 8744 }, { "ordf", 170 }, { "ordm", 186 }, { "oslash", 248 }, { "otilde", 245 }, { "otimes", 8855 },
+		{ "ouml", 246 }, { "para", 182 }, { "part", 8706 }, { "permil", 8240 }, { "perp", 8869 }, { "phi", 966 },
+		{ "pi", 960 }, { "piv", 982 }, { "plusmn", 177 }, { "pound", 163 }, { "prime", 8242 }, { "prod", 8719 },
+		{ "prop", 8733 }, { "psi", 968 }, { "quot", 34 }, { "rArr", 8658 }, { "radic", 8730 }, { "rang", 9002 },
+		{ "raquo", 187 }, { "rarr", 8594 }, { "rceil", 8969 }, { "rdquo", 8221 }, { "real", 8476 }, { "reg", 174 },
+		{ "rfloor", 8971 }, { "rho", 961 }, { "rlm", 8207 }, { "rsaquo", 8250 }, { "rsquo", 8217 }, { "sbquo", 8218 },
+		{ "scaron", 353 }, { "sdot", 8901 }, { "sect", 167 }, { "shy", 173 }, { "sigma", 963 }, { "sigmaf", 962 },
+		{ "sim", 8764 }, { "spades", 9824 }, { "sub", 8834 }, { "sube", 8838 }, { "sum", 8721 }, { "sup", 8835 },
+		{ "sup1", 185 }, { "sup2", 178 }, { "sup3", 179 }, { "supe", 8839 }, { "szlig", 223 }, { "tau", 964 },
+		{ "there4", 8756 }, { "theta", 952 }, { "thetasym", 977 }, { "thinsp", 8201 }, { "thorn", 254 }, { "tilde", 732 },
+		{ "times", 215 }, { "trade", 8482 }, { "uArr", 8657 }, { "uacute", 250 }, { "uarr", 8593 }, { "ucirc", 251 },
+		{ "ugrave", 249 }, { "uml", 168 }, { "upsih", 978 }, { "upsilon", 965 }, { "uuml", 252 }, { "weierp", 8472 },
+		{ "xi", 958 }, { "yacute", 253 }, { "yen", 165 }, { "yuml", 255 }, { "zeta", 950 }, { "zwj", 8205 },
+		{ "zwnj", 8204 },
+	};
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+	}
+
+	bool IsEntityChar(char c)
+	{
+		unsigned char u = (unsigned char)c;
+		return u > 127 || (u >= '0' && u <= '9') || ((u | 0x20) >= 'a' && (u | 0x20) <= 'z') || u == '#';
+	}
+
+	bool LookupEntity(const std::string& name, uint32_t& codepoint)
+	{
+		if (name.size() > 1 && name[0] == '#')
+		{
+			bool hex = name[1] == 'x' || name[1] == 'X';
+			size_t i = hex ? 2 : 1;
+			if (i == name.size())
+				return false;
+
+			codepoint = 0;
+			for (; i < name.size(); i++)
+			{
+				char c = name[i];
+				uint32_t digit;
+				if (c >= '0' && c <= '9')
+					digit = c - '0';
+				else if (hex && (c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+					digit = (c | 0x20) - 'a' + 10;
+				else
+					return false;
+
+				codepoint = codepoint * (hex ? 16 : 10) + digit;
+				if (codepoint > 0x10FFFF)
+					return false;
+			}
+			return true;
+		}
+
+		const Entity* end = ENTITIES + sizeof(ENTITIES) / sizeof(ENTITIES[0]);
+		const Entity* found = std::lower_bound(ENTITIES, end, name, [](const Entity& entity, const std::string& name) { return strcmp(entity.name, name.c_str()) < 0; });
+		if (found == end || name != found->name)
+			return false;
+
+		codepoint = found->codepoint;
+		return true;
+	}
+
+	char* WriteUtf8(char* out, uint32_t codepoint)
+	{
+		if (codepoint < 0x80)
+		{
+			*out++ = (char)codepoint;
+		}
+		else if (codepoint < 0x800)
+		{
+			*out++ = (char)(0xC0 | (codepoint >> 6));
+			*out++ = (char)(0x80 | (codepoint & 0x3F));
+		}
+		else if (codepoint < 0x10000)
+		{
+			*out++ = (char)(0xE0 | (codepoint >> 12));
+			*out++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (codepoint & 0x3F));
+		}
+		else
+		{
+			*out++ = (char)(0xF0 | (codepoint >> 18));
+			*out++ = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+			*out++ = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+			*out++ = (char)(0x80 | (codepoint & 0x3F));
+		}
+		return out;
+	}
+
+	Node* MakeNode(Arena& arena, Node* parent, const char* name)
+	{
+		Node* node = arena.New<Node>();
+		node->name = name;
+		if (parent)
+			Append(parent, node);
+		return node;
+	}
+
+	// Parses the text in place: names and attribute values are decoded over the top of the text they
+	// came from, which is always at least as long, and null-terminated where their delimiters were.
+	class Parser
+	{
+	public:
+		Parser(Arena& arena, std::string& error) : arena(arena), error(error) {}
+
+		Node* Run(char* text, char* textEnd)
+		{
+			p = text;
+			end = textEnd;
+
+			if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+				p += 3;
+
+			while (p < end)
+			{
+				char c = *p;
+				if (c == '<')
+				{
+					p++;
+					if (!ParseTag())
+						return nullptr;
+				}
+				else if (c == '&')
+				{
+					// The text itself is thrown away, but a broken entity in it is still an error
+					char decoded[4];
+					char* out = decoded;
+					if (!ReadEntity(out))
+						return nullptr;
+				}
+				else
+				{
+					if (!CheckChar(c))
+						return nullptr;
+					p++;
+				}
+			}
+
+			// Anything still open is an error, unless it's at the top (like an <?xml ...?> declaration)
+			if (parent)
+			{
+				if (parent->parent)
+				{
+					Fail(std::string("Missing close tag </") + parent->name + "> under parent <" + parent->parent->name + ">");
+					return nullptr;
+				}
+				return parent;
+			}
+
+			return first;
+		}
+
+	private:
+		bool Fail(const std::string& message)
+		{
+			error = message;
+			return false;
+		}
+
+		const char* ParentName() const
+		{
+			return parent ? parent->name : "(null)";
+		}
+
+		bool CheckChar(char c)
+		{
+			if ((unsigned char)c >= ' ' || c == '\t' || c == '\n' || c == '\r')
+				return true;
+
+			char message[80];
+			snprintf(message, sizeof(message), "Bad control character 0x%02x not allowed by XML standard", (unsigned char)c);
+			return Fail(message);
+		}
+
+		// Decodes the entity at p, writing it to out
+		bool ReadEntity(char*& out)
+		{
+			const char* nameStart = ++p;
+			while (p < end && IsEntityChar(*p))
+				p++;
+
+			std::string name(nameStart, p - nameStart);
+			if (p >= end || *p != ';')
+				return Fail("Character entity \"" + name + "\" not terminated under parent <" + ParentName() + ">");
+			p++;
+
+			uint32_t codepoint;
+			if (!LookupEntity(name, codepoint))
+				return Fail("Entity name \"" + name + ";\" not supported under parent <" + ParentName() + ">");
+
+			if (codepoint < 0x80 && !CheckChar((char)codepoint))
+				return false;
+
+			out = WriteUtf8(out, codepoint);
+			return true;
+		}
+
+		// Copies text to out, decoding entities, until it reaches a character stop returns true for.
+		// That character isn't consumed.
+		template <typename Stop>
+		bool ReadUntil(char*& out, Stop stop, const char* what)
+		{
+			while (true)
+			{
+				if (p >= end)
+					return Fail(std::string("Unexpected end of file in ") + what + " under parent <" + ParentName() + ">");
+
+				char c = *p;
+				if (stop(c))
+					return true;
+
+				if (c == '&')
+				{
+					if (!ReadEntity(out))
+						return false;
+					continue;
+				}
+
+				if (!CheckChar(c))
+					return false;
+				*out++ = c;
+				p++;
+			}
+		}
+
+		// Called with p just after a <
+		bool ParseTag()
+		{
+			char* name = p;
+			char* out = p;
+
+			while (true)
+			{
+				if (p >= end)
+					return Fail(std::string("Unexpected end of file in element under parent <") + ParentName() + ">");
+
+				char c = *p;
+				if (IsSpace(c) || c == '>' || (c == '/' && out > name))
+					break;
+				if (c == '<')
+					return Fail(std::string("Bare < in element under parent <") + ParentName() + ">");
+
+				if (c == '&')
+				{
+					if (!ReadEntity(out))
+						return false;
+				}
+				else
+				{
+					if (!CheckChar(c))
+						return false;
+					*out++ = c;
+					p++;
+				}
+
+				// These run up to their own terminators, rather than the end of the name
+				size_t length = out - name;
+				if ((length == 1 && name[0] == '?') || (length == 3 && memcmp(name, "!--", 3) == 0) || (length == 8 && memcmp(name, "![CDATA[", 8) == 0))
+					break;
+			}
+
+			size_t length = out - name;
+			if (length == 3 && memcmp(name, "!--", 3) == 0)
+				return ParseSpecial(name, out, "comment", [](const char* name, const char* out) { return out - name >= 5 && out[-1] == '-' && out[-2] == '-'; }, false);
+
+			if (length == 8 && memcmp(name, "![CDATA[", 8) == 0)
+				return ParseSpecial(name, out, "CDATA", [](const char* name, const char* out) { return out - name >= 10 && out[-1] == ']' && out[-2] == ']'; }, false);
+
+			if (name[0] == '?')
+				return ParseSpecial(name, out, "declaration", [](const char*, const char* out) { return out[-1] == '?'; }, true);
+
+			if (name[0] == '!')
+			{
+				if (!ReadUntil(out, [](char c) { return c == '>'; }, "declaration"))
+					return false;
+				p++;
+				*out = '\0';
+				AddTopLevel(MakeNode(arena, parent, name), true);
+				return true;
+			}
+
+			if (name[0] == '/')
+			{
+				std::string closing(name, out);
+				while (p < end && *p != '>')
+					p++;
+				if (p >= end)
+					return Fail("Unexpected end of file in close tag <" + closing + ">");
+				p++;
+
+				if (!parent || strlen(parent->name) != length - 1 || memcmp(parent->name, name + 1, length - 1) != 0)
+					return Fail("Mismatched close tag <" + closing + "> under parent <" + ParentName() + ">");
+
+				parent = parent->parent;
+				return true;
+			}
+
+			// A normal element - the name can be terminated once the character after it is consumed
+			char delimiter = *p++;
+			*out = '\0';
+			Node* node = MakeNode(arena, parent, name);
+
+			bool empty = false;
+			if (IsSpace(delimiter))
+			{
+				char closedBy;
+				if (!ParseAttributes(node, closedBy))
+					return false;
+				empty = closedBy == '/';
+			}
+			else if (delimiter == '/')
+			{
+				if (p >= end || *p != '>')
+					return Fail(std::string("Expected > but got '") + (p < end ? *p : ' ') + "' instead for element <" + node->name + "/>");
+				p++;
+				empty = true;
+			}
+
+			if (!first)
+				first = node;
+			if (!empty)
+				parent = node;
+			return true;
+		}
+
+		// Comments, CDATA and <?...?> declarations: everything up to the > that isDone accepts is the name
+		template <typename IsDone>
+		bool ParseSpecial(char* name, char* out, const char* what, IsDone isDone, bool canBeParent)
+		{
+			while (true)
+			{
+				if (p >= end)
+					return Fail(std::string("Early EOF in ") + what + " node");
+
+				char c = *p;
+				if (c == '>' && isDone(name, out))
+					break;
+
+				if (!CheckChar(c))
+					return false;
+				*out++ = c;
+				p++;
+			}
+
+			p++;
+			*out = '\0';
+			AddTopLevel(MakeNode(arena, parent, name), canBeParent);
+			return true;
+		}
+
+		// A declaration that comes first becomes the parent of everything after it
+		void AddTopLevel(Node* node, bool canBeParent)
+		{
+			if (!first)
+				first = node;
+			if (canBeParent && !parent)
+				parent = node;
+		}
+
+		// Called with p just after the whitespace following an element's name
+		bool ParseAttributes(Node* node, char& closedBy)
+		{
+			attributes.clear();
+			terminators.clear();
+
+			while (true)
+			{
+				while (p < end && IsSpace(*p))
+					p++;
+				if (p >= end)
+					return Fail(std::string("Unexpected end of file in element ") + node->name);
+
+				char c = *p;
+				if (c == '/' || c == '?')
+				{
+					p++;
+					if (p >= end || *p != '>')
+						return Fail(std::string("Expected '>' after '") + c + "' for element " + node->name + ", but got '" + (p < end ? *p : ' ') + "'");
+					p++;
+					closedBy = c;
+					break;
+				}
+				if (c == '<')
+					return Fail(std::string("Bare < in element ") + node->name);
+				if (c == '>')
+				{
+					p++;
+					closedBy = c;
+					break;
+				}
+
+				char* name = p;
+				char* out = p;
+				if (c == '"' || c == '\'')
+				{
+					// Quoted names keep their quotes
+					out++;
+					p++;
+					if (!ReadUntil(out, [c](char ch) { return ch == c; }, "attribute name"))
+						return false;
+					*out++ = *p++;
+				}
+				else
+				{
+					if (!ReadUntil(out, [](char ch) { return IsSpace(ch) || ch == '=' || ch == '/' || ch == '>' || ch == '?'; }, "attribute name"))
+						return false;
+				}
+				terminators.push_back(out);
+
+				while (p < end && IsSpace(*p))
+					p++;
+				if (p >= end || *p != '=')
+					return Fail("Missing value for attribute '" + std::string(name, out) + "' in element " + node->name);
+				p++;
+				while (p < end && IsSpace(*p))
+					p++;
+				if (p >= end)
+					return Fail("Missing value for attribute '" + std::string(name, out) + "' in element " + node->name);
+
+				char* value;
+				char quote = *p;
+				if (quote == '"' || quote == '\'')
+				{
+					value = out = ++p;
+					if (!ReadUntil(out, [quote](char ch) { return ch == quote; }, "attribute value"))
+						return false;
+					p++;
+				}
+				else
+				{
+					value = out = p;
+					if (!ReadUntil(out, [](char ch) { return IsSpace(ch) || ch == '=' || ch == '/' || ch == '>'; }, "attribute value"))
+						return false;
+				}
+				terminators.push_back(out);
+
+				attributes.push_back({ name, value });
+			}
+
+			// Now the whole tag has been read, nothing needs the characters after the names and values
+			for (char* terminator : terminators)
+				*terminator = '\0';
+
+			if (attributes.empty())
+				return true;
+
+			// Repeated attributes replace the earlier value, as setting them would
+			uint32_t count = 0;
+			Attribute* result = (Attribute*)arena.Allocate(sizeof(Attribute) * attributes.size(), alignof(Attribute));
+			for (const Attribute& attribute : attributes)
+			{
+				uint32_t i = 0;
+				while (i < count && strcmp(result[i].name, attribute.name) != 0)
+					i++;
+
+				if (i == count)
+					result[count++] = attribute;
+				else
+					result[i].value = attribute.value;
+			}
+
+			node->attributes = result;
+			node->attributeCount = count;
+			node->attributeCapacity = (uint32_t)attributes.size();
+			return true;
+		}
+
+		Arena& arena;
+		std::string& error;
+
+		char* p = nullptr;
+		char* end = nullptr;
+
+		Node* first = nullptr;
+		Node* parent = nullptr;
+
+		std::vector<Attribute> attributes;
+		std::vector<char*> terminators;
+	};
+
+	void WriteEscaped(const char* str, std::string& out)
+	{
+		const char* run = str;
+		for (; *str; str++)
+		{
+			const char* entity;
+			switch (*str)
+			{
+			case '&':
+				entity = "&amp;";
+				break;
+			case '<':
+				entity = "&lt;";
+				break;
+			case '>':
+				entity = "&gt;";
+				break;
+			case '"':
+				entity = "&quot;";
+				break;
+			default:
+				continue;
+			}
+
+			out.append(run, str - run);
+			out += entity;
+			run = str + 1;
+		}
+		out.append(run, str - run);
+	}
+
+	// mxml's default wrap margin, which we never changed: an attribute that would run past it goes on a
+	// new line instead of after a space. Since there's no other whitespace in the output, the column is
+	// only ever reset by one of these line breaks.
+	const size_t WRAP_MARGIN = 72;
+
+	// The column is counted the same way as mxml does, using the lengths of names and values before
+	// they're escaped
+	void WriteNode(const Node* node, std::string& out, size_t& column)
+	{
+		out += '<';
+		out += node->name;
+		column += strlen(node->name) + 1;
+
+		for (uint32_t i = 0; i < node->attributeCount; i++)
+		{
+			const Attribute& attribute = node->attributes[i];
+			size_t width = strlen(attribute.name) + strlen(attribute.value) + 3;
+
+			if (column + width > WRAP_MARGIN)
+			{
+				out += '\n';
+				column = 0;
+			}
+			else
+			{
+				out += ' ';
+				column++;
+			}
+
+			out += attribute.name;
+			out += "=\"";
+			WriteEscaped(attribute.value, out);
+			out += '"';
+			column += width;
+		}
+
+		// Comments and declarations don't get closed, even if something was added to them
+		bool declaration = node->name[0] == '!' || node->name[0] == '?';
+
+		if (!node->firstChild)
+		{
+			out += declaration ? ">" : " />";
+			column += declaration ? 1 : 3;
+			return;
+		}
+
+		out += '>';
+		column++;
+
+		for (const Node* child = node->firstChild; child; child = child->next)
+			WriteNode(child, out, column);
+
+		if (!declaration)
+		{
+			out += "</";
+			out += node->name;
+			out += '>';
+			column += strlen(node->name) + 3;
+		}
+	}
+} // namespace
+
+void* Arena::Allocate(size_t size, size_t align)
+{
+	size_t padding = (align - ((uintptr_t)current & (align - 1))) & (align - 1);
+	if (!current || padding + size > remaining)
+	{
+		// Big allocations (like the text being parsed) get their own block, so the rest of the current one isn't wasted
+		if (size > BLOCK_SIZE / 4)
+		{
+			blocks.emplace_back(new char[size]);
+			return blocks.back().get();
+		}
+
+		blocks.emplace_back(new char[BLOCK_SIZE]);
+		current = blocks.back().get();
+		remaining = BLOCK_SIZE;
+		padding = 0;
+	}
+
+	char* result = current + padding;
+	current += padding + size;
+	remaining -= padding + size;
+	return result;
+}
+
+const char* Arena::CopyString(const char* str)
+{
+	size_t length = strlen(str);
+	char* copy = (char*)Allocate(length + 1, 1);
+	memcpy(copy, str, length + 1);
+	return copy;
+}
+
+Node* xmldom::Parse(Arena& arena, const char* text, size_t length, std::string& error)
+{
+	char* buffer = (char*)arena.Allocate(length + 1, 1);
+	memcpy(buffer, text, length);
+	buffer[length] = '\0';
+
+	Parser parser(arena, error);
+	return parser.Run(buffer, buffer + length);
+}
+
+Node* xmldom::NewElement(Arena& arena, Node* parent, const char* name)
+{
+	return MakeNode(arena, parent, arena.CopyString(name));
+}
+
+Node* xmldom::Clone(Arena& arena, const Node* node)
+{
+	Node* copy = MakeNode(arena, nullptr, arena.CopyString(node->name));
+
+	if (node->attributeCount)
+	{
+		copy->attributes = (Attribute*)arena.Allocate(sizeof(Attribute) * node->attributeCount, alignof(Attribute));
+		copy->attributeCount = copy->attributeCapacity = node->attributeCount;
+		for (uint32_t i = 0; i < node->attributeCount; i++)
+		{
+			copy->attributes[i].name = arena.CopyString(node->attributes[i].name);
+			copy->attributes[i].value = arena.CopyString(node->attributes[i].value);
+		}
+	}
+
+	for (const Node* child = node->firstChild; child; child = child->next)
+		Append(copy, Clone(arena, child));
+
+	return copy;
+}
+
+void xmldom::SetName(Arena& arena, Node* node, const char* name)
+{
+	node->name = arena.CopyString(name);
+}
+
+const char* xmldom::GetAttribute(const Node* node, const char* name)
+{
+	for (uint32_t i = 0; i < node->attributeCount; i++)
+	{
+		if (strcmp(node->attributes[i].name, name) == 0)
+			return node->attributes[i].value;
+	}
+	return nullptr;
+}
+
+void xmldom::SetAttribute(Arena& arena, Node* node, const char* name, const char* value)
+{
+	for (uint32_t i = 0; i < node->attributeCount; i++)
+	{
+		if (strcmp(node->attributes[i].name, name) == 0)
+		{
+			node->attributes[i].value = arena.CopyString(value);
+			return;
+		}
+	}
+
+	if (node->attributeCount == node->attributeCapacity)
+	{
+		// The old array stays in the arena, but attributes are rarely added to one node often enough to matter
+		uint32_t capacity = std::max<uint32_t>(4, node->attributeCapacity * 2);
+		Attribute* attributes = (Attribute*)arena.Allocate(sizeof(Attribute) * capacity, alignof(Attribute));
+		if (node->attributeCount)
+			memcpy(attributes, node->attributes, sizeof(Attribute) * node->attributeCount);
+
+		node->attributes = attributes;
+		node->attributeCapacity = capacity;
+	}
+
+	node->attributes[node->attributeCount++] = { arena.CopyString(name), arena.CopyString(value) };
+}
+
+void xmldom::DeleteAttribute(Node* node, const char* name)
+{
+	for (uint32_t i = 0; i < node->attributeCount; i++)
+	{
+		if (strcmp(node->attributes[i].name, name) == 0)
+		{
+			memmove(node->attributes + i, node->attributes + i + 1, sizeof(Attribute) * (node->attributeCount - i - 1));
+			node->attributeCount--;
+			return;
+		}
+	}
+}
+
+void xmldom::Insert(Node* parent, Node* child, Node* after)
+{
+	child->parent = parent;
+	child->prev = after;
+	child->next = after ? after->next : parent->firstChild;
+
+	if (child->next)
+		child->next->prev = child;
+	else
+		parent->lastChild = child;
+
+	if (after)
+		after->next = child;
+	else
+		parent->firstChild = child;
+}
+
+void xmldom::Append(Node* parent, Node* child)
+{
+	Insert(parent, child, parent->lastChild);
+}
+
+void xmldom::Remove(Node* node)
+{
+	Node* parent = node->parent;
+	if (!parent)
+		return;
+
+	if (node->prev)
+		node->prev->next = node->next;
+	else
+		parent->firstChild = node->next;
+
+	if (node->next)
+		node->next->prev = node->prev;
+	else
+		parent->lastChild = node->prev;
+
+	node->parent = nullptr;
+	node->prev = nullptr;
+	node->next = nullptr;
+}
+
+void xmldom::Serialise(const Node* node, std::string& out)
+{
+	size_t column = 0;
+	WriteNode(node, out, column);
+
+	// mxml always finished with a newline
+	out += '\n';
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// A small XML DOM for the Wren XML API. Everything in a document is allocated from an arena that's freed
+// all at once, and the parser works in-place on a copy of the text. It reads and writes XML the same way
+// mxml did with all the text ignored: only elements are kept, and comments, declarations and CDATA
+// sections become elements whose name is everything between the angle brackets.
+
+namespace raidhook::tweaker::xmldom
+{
+	class Arena
+	{
+	public:
+		Arena() = default;
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		void* Allocate(size_t size, size_t align = alignof(void*));
+		const char* CopyString(const char* str);
+
+		template <typename T>
+		T* New()
+		{
+			return new (Allocate(sizeof(T), alignof(T))) T();
+		}
+
+	private:
+		static const size_t BLOCK_SIZE = 64 * 1024;
+
+		std::vector<std::unique_ptr<char[]>> blocks;
+		char* current = nullptr;
+		size_t remaining = 0;
+	};
+
+	struct Attribute
+	{
+		const char* name;
+		const char* value;
+	};
+
+	struct Node
+	{
+		const char* name = nullptr;
+
+		Attribute* attributes = nullptr;
+		uint32_t attributeCount = 0;
+		uint32_t attributeCapacity = 0;
+
+		Node* parent = nullptr;
+		Node* firstChild = nullptr;
+		Node* lastChild = nullptr;
+		Node* next = nullptr;
+		Node* prev = nullptr;
+
+		// Whatever the user of the DOM wants to keep alongside the node
+		void* userData = nullptr;
+	};
+
+	// Parses some text, returning the root node. Returns null and sets error if the text isn't valid, and
+	// returns null without an error if it doesn't contain any elements.
+	Node* Parse(Arena& arena, const char* text, size_t length, std::string& error);
+
+	// Makes a new element, added as the last child of parent if it isn't null
+	Node* NewElement(Arena& arena, Node* parent, const char* name);
+
+	// Deep copy of a node and its children, without a parent
+	Node* Clone(Arena& arena, const Node* node);
+
+	void SetName(Arena& arena, Node* node, const char* name);
+
+	// Returns null if the node doesn't have the attribute
+	const char* GetAttribute(const Node* node, const char* name);
+	void SetAttribute(Arena& arena, Node* node, const char* name, const char* value);
+	void DeleteAttribute(Node* node, const char* name);
+
+	// Adds a node without a parent as a child, after another of parent's children. If after is null, it's
+	// added as the first child.
+	void Insert(Node* parent, Node* child, Node* after);
+	void Append(Node* parent, Node* child);
+
+	// Takes a node (and its children) out of its parent
+	void Remove(Node* node);
+
+	// Writes a node and its children as XML, onto the end of out
+	void Serialise(const Node* node, std::string& out);
+} // namespace raidhook::tweaker::xmldom
@@ -1,12 +1,18 @@
 #include "global.h"
 #include "xmltweaker_internal.h"
+#include "tweak_cache.h"
 #include <stdio.h>
 #include <fstream>
 #include <unordered_set>
-#include <set>
 #include <string.h>
 #include "util/util.h"
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
 #include <wren.hpp>
 
 using namespace std;
@@ -17,12 +23,146 @@ using blt::idfile;
 
 bool raidhook::tweaker::tweaker_enabled = true;
 
-static unordered_set<char*> buffers;
-static set<idfile> ignored_files;
+namespace
+{
+	// Hands out the buffers tweaked files are returned in. The game frees each one as soon as it's parsed
+	// the file, so only a few are ever in use at once, and they're kept around in power-of-two size classes
+	// to be used again rather than going back to the heap every time. Only a few MiB are kept like this in
+	// total, so one session of huge files doesn't leave their buffers pinned for good.
+	class TweakBufferPool
+	{
+	public:
+		char* Acquire(size_t length)
+		{
+			size_t sizeClass = 0;
+			while (sizeClass < SIZE_CLASSES && ClassSize(sizeClass) < length)
+				sizeClass++;
+
+			lock_guard<mutex> lock(poolMutex);
+
+			char* buffer = nullptr;
+			if (sizeClass < SIZE_CLASSES && !freeBuffers[sizeClass].empty())
+			{
+				buffer = freeBuffers[sizeClass].back();
+				freeBuffers[sizeClass].pop_back();
+				freeBytes -= ClassSize(sizeClass);
+			}
+			else
+			{
+				// Anything too big for the largest class gets a buffer of its own, which isn't kept
+				buffer = (char*)malloc(sizeClass < SIZE_CLASSES ? ClassSize(sizeClass) : length);
+			}
+
+			inUse.push_back(InUseBuffer{ buffer, sizeClass });
+			return buffer;
+		}
+
+		// Returns false if the buffer didn't come from the pool
+		bool Release(char* buffer)
+		{
+			lock_guard<mutex> lock(poolMutex);
+
+			for (size_t i = 0; i < inUse.size(); i++)
+			{
+				if (inUse[i].buffer != buffer)
+					continue;
+
+				size_t sizeClass = inUse[i].sizeClass;
+				inUse[i] = inUse.back();
+				inUse.pop_back();
 
-// The file we last parsed. If we try to parse the same file more than
+				if (sizeClass < SIZE_CLASSES && freeBuffers[sizeClass].size() < MAX_FREE_PER_CLASS &&
+				    freeBytes + ClassSize(sizeClass) <= MAX_FREE_BYTES)
+				{
+					freeBuffers[sizeClass].push_back(buffer);
+					freeBytes += ClassSize(sizeClass);
+				}
+				else
+				{
+					free(buffer);
+				}
+
+				return true;
+			}
+
+			return false;
+		}
+
+	private:
+		// 4KiB up to 16MiB
+		static const size_t SIZE_CLASSES = 13;
+		static const size_t MAX_FREE_PER_CLASS = 4;
+		static const size_t MAX_FREE_BYTES = 8 * 1024 * 1024;
+
+		static size_t ClassSize(size_t sizeClass)
+		{
+			return (size_t)4096 << sizeClass;
+		}
+
+		struct InUseBuffer
+		{
+			char* buffer;
+			size_t sizeClass;
+		};
+
+		mutex poolMutex;
+		vector<char*> freeBuffers[SIZE_CLASSES];
+		vector<InUseBuffer> inUse;
+		size_t freeBytes = 0;
+	};
+
+	struct IdFileHash
+	{
+		size_t operator()(const idfile& file) const
+		{
+			return hash<idstring>()(file.name) ^ (hash<idstring>()(file.ext) * 0x9e3779b97f4a7c15ull);
+		}
+	};
+} // namespace
+
+static TweakBufferPool buffers;
+
+// The ignore list and the tweaked file registry are only changed now and then, but checked for every
+// file that's loaded, from whichever threads the game loads them on
+static shared_mutex file_lists_mutex;
+static unordered_set<idfile, IdFileHash> ignored_files;
+
+// Filled in from Wren
+static unordered_set<idfile, IdFileHash> tweaked_files;
+static unordered_set<idstring> tweaked_extensions;
+static atomic<bool> tweak_filter_enabled = false;
+
+// Read from Lua on the game thread, while files may be tweaked on whichever thread loads them
+static atomic<uint64_t> stat_skipped = 0;
+static atomic<uint64_t> stat_cached = 0;
+static atomic<uint64_t> stat_files = 0;
+static atomic<uint64_t> stat_tweaked = 0;
+static atomic<uint64_t> stat_total_micros = 0;
+static atomic<uint64_t> stat_max_micros = 0;
+
+// The file we last parsed on this thread. If we try to parse the same file more than
 // once, nothing should happen as a file from the filesystem is being loaded.
-idfile last_parsed;
+static thread_local idfile last_parsed;
+
+static bool is_ignored(const idfile& file)
+{
+	shared_lock lock(file_lists_mutex);
+	return ignored_files.count(file) != 0;
+}
+
+static bool is_tweaked(const idfile& file)
+{
+	shared_lock lock(file_lists_mutex);
+	return tweaked_extensions.count(file.ext) || tweaked_files.count(file);
+}
+
+// Copies text into a buffer that stays valid until the game frees it
+static char* copy_to_buffer(const char* text, size_t length)
+{
+	char* buffer = buffers.Acquire(length);
+	portable_strncpy(buffer, text, length);
+	return buffer;
+}
 
 char* tweaker::tweak_raid_xml(char* text, int text_length)
 {
@@ -51,24 +191,67 @@ char* tweaker::tweak_raid_xml(char* text, int text_length)
 	}
 
 	// Check the exclusion list
-	if (ignored_files.count(file))
+	if (is_ignored(file))
 	{
 		return text;
 	}
 
+	// Nothing to do for files no mod tweaks, so don't even take the Wren lock for them
+	if (tweak_filter_enabled && !is_tweaked(file))
+	{
+		stat_skipped++;
+		return text;
+	}
+
+	// The same file with the same mods loaded always comes out the same way, so use the output from last
+	// time if there is one
+	// Kept between calls so their memory gets reused
+	static thread_local string cache_key;
+	static thread_local string cached_text;
+	tweak_cache::LookupResult cached = tweak_cache::lookup(file, text, cache_key, cached_text);
+	if (cached == tweak_cache::LookupResult::Unchanged)
+	{
+		stat_cached++;
+		return text;
+	}
+	if (cached == tweak_cache::LookupResult::Tweaked)
+	{
+		stat_cached++;
+		return copy_to_buffer(cached_text.c_str(), cached_text.size() + 1);
+	}
+
+	auto start = chrono::steady_clock::now();
+
 	const char* new_text = transform_file(text);
 
-	// If the text is not to be altered, we can return it as is.
+	uint64_t micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+	stat_files++;
+	stat_total_micros += micros;
+	uint64_t max_micros = stat_max_micros;
+	while (micros > max_micros && !stat_max_micros.compare_exchange_weak(max_micros, micros))
+		;
+
+	// Anything the tweak loaded at runtime isn't covered by the cache's fingerprint
+	if (cached != tweak_cache::LookupResult::Disabled)
+		tweak_cache::check_inputs();
+
+	// If Wren failed, it gave back the original text - don't cache that, as it might work next time
 	if (new_text == text) return text;
 
+	if (cached == tweak_cache::LookupResult::Miss)
+		tweak_cache::store(cache_key, text, new_text);
+
+	// Otherwise it's always Wren's own copy of the string, so compare what's in it. If the text
+	// wasn't altered, we can return it as is.
+	if (strcmp(new_text, text) == 0) return text;
+
+	stat_tweaked++;
+
 	// Otherwise, copy it so it's not invalidated by another Wren call
 
 	size_t length = strlen(new_text) + 1; // +1 for the null
 
-	char* buffer = (char*)malloc(length);
-	buffers.insert(buffer);
-
-	portable_strncpy(buffer, new_text, length);
+	char* buffer = copy_to_buffer(new_text, length);
 
 	//if (!strncmp(new_text, "<network>", 9)) {
 	//	std::ofstream out("output.txt");
@@ -93,13 +276,50 @@ char* tweaker::tweak_raid_xml(char* text, int text_length)
 
 void tweaker::free_tweaked_raid_xml(char* text)
 {
-	if (buffers.erase(text))
-	{
-		free(text);
-	}
+	buffers.Release(text);
 }
 
 void raidhook::tweaker::ignore_file(idfile file)
 {
+	unique_lock lock(file_lists_mutex);
 	ignored_files.insert(file);
 }
+
+void raidhook::tweaker::register_tweaked_file(idfile file)
+{
+	unique_lock lock(file_lists_mutex);
+	tweaked_files.insert(file);
+}
+
+void raidhook::tweaker::register_tweaked_extension(idstring ext)
+{
+	unique_lock lock(file_lists_mutex);
+	tweaked_extensions.insert(ext);
+}
+
+void raidhook::tweaker::set_tweak_filter_enabled(bool enabled)
+{
+	tweak_filter_enabled = enabled;
+}
+
+tweaker::TweakerStats tweaker::get_tweaker_stats()
+{
+	TweakerStats stats{};
+	stats.skipped = stat_skipped;
+	stats.cached = stat_cached;
+	stats.files = stat_files;
+	stats.tweaked = stat_tweaked;
+	stats.totalMicros = stat_total_micros;
+	stats.maxMicros = stat_max_micros;
+	return stats;
+}
+
+void tweaker::reset_tweaker_stats()
+{
+	stat_skipped = 0;
+	stat_cached = 0;
+	stat_files = 0;
+	stat_tweaked = 0;
+	stat_total_micros = 0;
+	stat_max_micros = 0;
+}
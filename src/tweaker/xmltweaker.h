@@ -11,6 +11,25 @@ namespace raidhook
 
 		void ignore_file(blt::idfile file);
 
+		// Registry of the files that Wren has tweaks for, filled in by the basemod as it loads. Once the
+		// basemod turns the filter on, only files in the registry are passed to Wren at all.
+		void register_tweaked_file(blt::idfile file);
+		void register_tweaked_extension(blt::idstring ext); // Every file with this extension
+		void set_tweak_filter_enabled(bool enabled);
+
+		struct TweakerStats
+		{
+			uint64_t skipped;     // Files that weren't in the tweaked file registry, and so never went to Wren
+			uint64_t cached;      // Files whose tweaked output came from the tweak cache
+			uint64_t files;       // Files passed to the Wren tweaker
+			uint64_t tweaked;     // Files the tweaker changed
+			uint64_t totalMicros; // Time spent in the tweaker
+			uint64_t maxMicros;   // Time spent on the slowest file
+		};
+
+		TweakerStats get_tweaker_stats();
+		void reset_tweaker_stats();
+
 		extern bool tweaker_enabled;
 	}; // namespace tweaker
 }; // namespace raidhook
@@ -1,178 +1,413 @@
 #include "util.h"
+#include "threading/threadpool.h"
 
 #include <zlib.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <fstream>
-#include <list>
 #include <memory>
+#include <set>
+#include <vector>
+
+// Extracts ZIP archives by walking the central directory at the end of the archive, and streaming each
+// entry from the archive to its output file through fixed-size buffers. Nothing is ever held in memory
+// in full, so the size of the archive doesn't matter.
 
 namespace raidhook
 {
 	namespace
 	{
-		const int32_t MagicFileHeader = 0x04034b50;
-
-		typedef std::pair<int32_t, std::string> DataPair_t;
+		const uint32_t MagicFileHeader = 0x04034b50;
+		const uint32_t MagicCentralHeader = 0x02014b50;
+		const uint32_t MagicEndOfCentralDirectory = 0x06054b50;
+		const uint32_t MagicZIP64EndOfCentralDirectory = 0x06064b50;
+		const uint32_t MagicZIP64Locator = 0x07064b50;
 
-		class ByteStream
-		{
-		public:
-			ByteStream(const std::string& path);
+		const uint16_t ZIP64ExtraField = 0x0001;
+		const uint16_t FlagEncrypted = 0x0001;
 
-			template<typename T>
-			T readType();
-			std::string readString(int length);
+		const size_t EndOfCentralDirectorySize = 22;
+		const size_t MaxCommentSize = 0xffff;
 
-		private:
-			std::ifstream mainStream;
-		};
+		// How much of an entry is read from the archive, and inflated, at once
+		const size_t ChunkSize = 64 * 1024;
 
-		struct ZIPFileData
+		struct ZIPEntry
 		{
 			std::string filepath;
-			std::string decompressedData;
-			int compressedSize;
-			int uncompressedSize;
+			uint16_t flags;
+			uint16_t compressionMethod;
+			uint32_t crc;
+			uint64_t compressedSize;
+			uint64_t uncompressedSize;
+			uint64_t localHeaderOffset;
 		};
 
-		ByteStream::ByteStream(const std::string& path) : mainStream(path.c_str(), std::ifstream::binary) {}
+		uint16_t ReadU16(const unsigned char* data)
+		{
+			return (uint16_t)(data[0] | (data[1] << 8));
+		}
 
-		template<typename T>
-		T ByteStream::readType()
+		uint32_t ReadU32(const unsigned char* data)
 		{
-			T read;
+			return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+		}
 
-			mainStream.read(reinterpret_cast<char *>(&read), sizeof(T));
-			return read;
+		uint64_t ReadU64(const unsigned char* data)
+		{
+			return (uint64_t)ReadU32(data) | ((uint64_t)ReadU32(data + 4) << 32);
 		}
 
-		std::string ByteStream::readString(int length)
+		bool ReadAt(std::ifstream& stream, uint64_t offset, void* buffer, size_t length)
 		{
-			std::unique_ptr<char[]> readData(new char[length + 1]);
-			mainStream.read(readData.get(), length);
-			return std::string(readData.get(), length);
+			stream.clear();
+			stream.seekg((std::streamoff)offset);
+			stream.read(reinterpret_cast<char*>(buffer), length);
+			return (size_t)stream.gcount() == length;
 		}
 
-		std::string DecompressData(const DataPair_t& compressedData)
+		// Fills in the sizes and offset from the ZIP64 extra field, for any that didn't fit in the normal header
+		void ApplyZIP64Extra(ZIPEntry& entry, const unsigned char* extra, size_t length)
 		{
-			z_stream stream;
-			stream.zalloc = Z_NULL;
-			stream.zfree = Z_NULL;
-			stream.opaque = Z_NULL;
+			size_t pos = 0;
+			while (pos + 4 <= length)
+			{
+				uint16_t id = ReadU16(extra + pos);
+				uint16_t size = ReadU16(extra + pos + 2);
+				pos += 4;
+				if (pos + size > length)
+					return;
 
-			stream.avail_in = 0;
-			stream.next_in = Z_NULL;
+				if (id == ZIP64ExtraField)
+				{
+					// Only the fields that overflowed are present, in this order
+					const unsigned char* field = extra + pos;
+					const unsigned char* end = field + size;
+					if (entry.uncompressedSize == 0xffffffff && field + 8 <= end)
+					{
+						entry.uncompressedSize = ReadU64(field);
+						field += 8;
+					}
+					if (entry.compressedSize == 0xffffffff && field + 8 <= end)
+					{
+						entry.compressedSize = ReadU64(field);
+						field += 8;
+					}
+					if (entry.localHeaderOffset == 0xffffffff && field + 8 <= end)
+					{
+						entry.localHeaderOffset = ReadU64(field);
+					}
+					return;
+				}
 
-			inflateInit2(&stream, -MAX_WBITS);
+				pos += size;
+			}
+		}
 
-			stream.avail_in = compressedData.second.size();
-			stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char *>(compressedData.second.data()));
+		bool ReadCentralDirectory(std::ifstream& stream, std::vector<ZIPEntry>& entries)
+		{
+			stream.seekg(0, std::ios::end);
+			uint64_t archiveSize = (uint64_t)stream.tellg();
+			if (archiveSize < EndOfCentralDirectorySize)
+				return false;
+
+			// The end of central directory record is followed by a comment of up to 64K, so search backwards
+			// for its signature through the end of the archive
+			size_t tailSize = (size_t)std::min<uint64_t>(archiveSize, EndOfCentralDirectorySize + MaxCommentSize);
+			uint64_t tailOffset = archiveSize - tailSize;
+			std::vector<unsigned char> tail(tailSize);
+			if (!ReadAt(stream, tailOffset, tail.data(), tailSize))
+				return false;
+
+			size_t eocd = tailSize - EndOfCentralDirectorySize;
+			while (ReadU32(&tail[eocd]) != MagicEndOfCentralDirectory)
+			{
+				if (eocd == 0)
+					return false;
+				eocd--;
+			}
 
-			std::unique_ptr<unsigned char[]> out(new unsigned char[compressedData.first + 1]);
+			uint64_t entryCount = ReadU16(&tail[eocd + 10]);
+			uint64_t directorySize = ReadU32(&tail[eocd + 12]);
+			uint64_t directoryOffset = ReadU32(&tail[eocd + 16]);
 
-			stream.avail_out = compressedData.first;
-			stream.next_out = out.get();
+			// Archives with too many entries, or that are too big, keep the real values in a ZIP64 record
+			// found through a locator just before the normal one
+			if ((entryCount == 0xffff || directorySize == 0xffffffff || directoryOffset == 0xffffffff) && tailOffset + eocd >= 20)
+			{
+				unsigned char locator[20];
+				unsigned char record[56];
+				if (ReadAt(stream, tailOffset + eocd - 20, locator, sizeof(locator)) && ReadU32(locator) == MagicZIP64Locator &&
+					ReadAt(stream, ReadU64(locator + 8), record, sizeof(record)) && ReadU32(record) == MagicZIP64EndOfCentralDirectory)
+				{
+					entryCount = ReadU64(record + 32);
+					directorySize = ReadU64(record + 40);
+					directoryOffset = ReadU64(record + 48);
+				}
+			}
 
-			inflate(&stream, Z_NO_FLUSH);
-			inflateEnd(&stream);
+			if (directoryOffset + directorySize > archiveSize)
+				return false;
+
+			std::vector<unsigned char> directory((size_t)directorySize);
+			if (!ReadAt(stream, directoryOffset, directory.data(), directory.size()))
+				return false;
+
+			entries.reserve((size_t)entryCount);
+
+			size_t pos = 0;
+			for (uint64_t i = 0; i < entryCount; i++)
+			{
+				if (pos + 46 > directory.size() || ReadU32(&directory[pos]) != MagicCentralHeader)
+					return false;
 
-			return std::string(reinterpret_cast<const char *>(out.get()), compressedData.first);
+				const unsigned char* header = &directory[pos];
+				uint16_t nameLength = ReadU16(header + 28);
+				uint16_t extraLength = ReadU16(header + 30);
+				uint16_t commentLength = ReadU16(header + 32);
+				if (pos + 46 + nameLength + extraLength + commentLength > directory.size())
+					return false;
+
+				ZIPEntry entry;
+				entry.flags = ReadU16(header + 8);
+				entry.compressionMethod = ReadU16(header + 10);
+				entry.crc = ReadU32(header + 16);
+				entry.compressedSize = ReadU32(header + 20);
+				entry.uncompressedSize = ReadU32(header + 24);
+				entry.localHeaderOffset = ReadU32(header + 42);
+				entry.filepath.assign(reinterpret_cast<const char*>(header + 46), nameLength);
+				ApplyZIP64Extra(entry, header + 46 + nameLength, extraLength);
+
+				entries.push_back(std::move(entry));
+				pos += 46 + nameLength + extraLength + commentLength;
+			}
+
+			return true;
 		}
 
-		std::unique_ptr<ZIPFileData> ReadFile(ByteStream& mainStream)
+		bool IsDirectory(const ZIPEntry& entry)
 		{
-			auto fileHeader = mainStream.readType<int32_t>();
-			if (fileHeader != MagicFileHeader) return nullptr;
+			char trailingChar = entry.filepath.empty() ? '/' : entry.filepath.back();
+			return trailingChar == '/' || trailingChar == '\\';
+		}
 
-			// version needed
-			mainStream.readType<int16_t>();
+		// Refuses anything that would end up outside the extract directory
+		bool IsSafePath(const std::string& filepath)
+		{
+			if (filepath.empty() || filepath[0] == '/' || filepath[0] == '\\' || filepath.find(':') != std::string::npos)
+				return false;
 
-			// Ignore 'general purpose bit flag'
-			mainStream.readType<int16_t>();
+			size_t start = 0;
+			while (start <= filepath.size())
+			{
+				size_t end = filepath.find_first_of("/\\", start);
+				if (end == std::string::npos)
+					end = filepath.size();
 
-			auto compressionMethod = mainStream.readType<int16_t>();
+				if (filepath.compare(start, end - start, "..") == 0)
+					return false;
 
-			// Ignore modified file times.
-			mainStream.readType<int32_t>();
+				start = end + 1;
+			}
 
-			// crc32
-			mainStream.readType<int32_t>();
+			return true;
+		}
 
-			std::unique_ptr<ZIPFileData> newFile(new ZIPFileData());
-			newFile->compressedSize = mainStream.readType<int32_t>();
-			newFile->uncompressedSize = mainStream.readType<int32_t>();
+		bool InflateEntry(std::ifstream& archive, uint64_t offset, const ZIPEntry& entry, std::ofstream& outFile, uint32_t& crc)
+		{
+			z_stream stream;
+			stream.zalloc = Z_NULL;
+			stream.zfree = Z_NULL;
+			stream.opaque = Z_NULL;
+			stream.avail_in = 0;
+			stream.next_in = Z_NULL;
 
-			auto fileNameLength = mainStream.readType<int16_t>();
-			auto extraFieldLength = mainStream.readType<int16_t>();
+			if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+				return false;
 
-			newFile->filepath = mainStream.readString(fileNameLength);
-			std::string extraField = mainStream.readString(extraFieldLength);
-			(void)extraField;
+			std::unique_ptr<unsigned char[]> in(new unsigned char[ChunkSize]);
+			std::unique_ptr<unsigned char[]> out(new unsigned char[ChunkSize]);
 
-			std::string compressedData = mainStream.readString(newFile->compressedSize);
+			uint64_t remaining = entry.compressedSize;
+			int status = Z_OK;
+			while (status != Z_STREAM_END)
+			{
+				if (stream.avail_in == 0)
+				{
+					if (remaining == 0)
+						break;
+
+					size_t length = (size_t)std::min<uint64_t>(remaining, ChunkSize);
+					if (!ReadAt(archive, offset, in.get(), length))
+						break;
+
+					offset += length;
+					remaining -= length;
+					stream.next_in = in.get();
+					stream.avail_in = (uInt)length;
+				}
+
+				stream.next_out = out.get();
+				stream.avail_out = (uInt)ChunkSize;
+
+				status = inflate(&stream, Z_NO_FLUSH);
+				if (status != Z_OK && status != Z_STREAM_END)
+					break;
+
+				size_t produced = ChunkSize - stream.avail_out;
+				crc = crc32(crc, out.get(), (uInt)produced);
+				outFile.write(reinterpret_cast<const char*>(out.get()), produced);
+			}
+
+			inflateEnd(&stream);
+			return status == Z_STREAM_END;
+		}
+
+		bool CopyEntry(std::ifstream& archive, uint64_t offset, const ZIPEntry& entry, std::ofstream& outFile, uint32_t& crc)
+		{
+			std::unique_ptr<unsigned char[]> buffer(new unsigned char[ChunkSize]);
 
-			switch (compressionMethod)
+			uint64_t remaining = entry.compressedSize;
+			while (remaining > 0)
 			{
-			case 0:
-				newFile->decompressedData = std::move(compressedData);
-				break;
-			case 8: // Deflate
-				newFile->decompressedData = DecompressData(std::make_pair(newFile->uncompressedSize, std::move(compressedData)));
-				break;
+				size_t length = (size_t)std::min<uint64_t>(remaining, ChunkSize);
+				if (!ReadAt(archive, offset, buffer.get(), length))
+					return false;
+
+				crc = crc32(crc, buffer.get(), (uInt)length);
+				outFile.write(reinterpret_cast<const char*>(buffer.get()), length);
+				offset += length;
+				remaining -= length;
 			}
 
-			return newFile;
+			return true;
 		}
 
-		bool WriteFile(const std::string& extractPath, const ZIPFileData& data)
+		bool WriteFile(std::ifstream& archive, const std::string& extractPath, const ZIPEntry& entry)
 		{
-			const std::string finalWritePath = extractPath + "/" + data.filepath;
-			Util::EnsurePathWritable(finalWritePath);
+			const std::string finalWritePath = extractPath + "/" + entry.filepath;
 
-			// There doesn't seem to be a better way to detect if the "file" in question is a directory.
-			char trailingChar = finalWritePath.at(finalWritePath.size()-1);
-			if(trailingChar == '/' || trailingChar == '\\')
+			if (entry.flags & FlagEncrypted)
 			{
-				// Ignore directories; They are created automatically when a file is written inside them.
-				return true;
+				RAIDHOOK_LOG_WARN(std::string("Cannot extract encrypted file: ") + finalWritePath);
+				return false;
 			}
-			else
+
+			if (entry.compressionMethod != 0 && entry.compressionMethod != 8)
 			{
-				std::ofstream outFile(finalWritePath.c_str(), std::ios::binary);
-				if (!outFile)
-				{
-					RAIDHOOK_LOG_WARN(std::string("Failed to extract file: ") + finalWritePath);
-					return false;
-				}
+				RAIDHOOK_LOG_WARN(std::string("Cannot extract file with compression method ") + std::to_string(entry.compressionMethod) + ": " + finalWritePath);
+				return false;
+			}
+
+			// The local header's name and extra field don't always match the lengths in the central
+			// directory, so its own lengths are needed to find where the data starts
+			unsigned char localHeader[30];
+			if (!ReadAt(archive, entry.localHeaderOffset, localHeader, sizeof(localHeader)) || ReadU32(localHeader) != MagicFileHeader)
+			{
+				RAIDHOOK_LOG_WARN(std::string("Corrupt local header for file: ") + finalWritePath);
+				return false;
+			}
+
+			uint64_t dataOffset = entry.localHeaderOffset + sizeof(localHeader) + ReadU16(localHeader + 26) + ReadU16(localHeader + 28);
+
+			std::ofstream outFile(finalWritePath.c_str(), std::ios::binary);
+			if (!outFile)
+			{
+				RAIDHOOK_LOG_WARN(std::string("Failed to extract file: ") + finalWritePath);
+				return false;
+			}
 
-				outFile.write(data.decompressedData.data(), data.uncompressedSize);
-				return true;
+			uint32_t crc = crc32(0, Z_NULL, 0);
+			bool read = entry.compressionMethod == 8
+				? InflateEntry(archive, dataOffset, entry, outFile, crc)
+				: CopyEntry(archive, dataOffset, entry, outFile, crc);
+
+			if (!read || crc != entry.crc)
+			{
+				RAIDHOOK_LOG_WARN(std::string("Corrupt data for file: ") + finalWritePath);
+				return false;
+			}
+
+			if (!outFile.flush())
+			{
+				RAIDHOOK_LOG_WARN(std::string("Failed to extract file: ") + finalWritePath);
+				return false;
 			}
+
+			return true;
 		}
 	}
 
-	bool ExtractZIPArchive(const std::string& path, const std::string& extractPath)
+	bool ExtractZIPArchive(const std::string& path, const std::string& extractPath, bool parallel, const ZIPProgressCallback& progress)
 	{
-		ByteStream mainStream(path);
-
-		std::list<std::unique_ptr<ZIPFileData>> files;
+		std::vector<ZIPEntry> entries;
 		{
-			std::unique_ptr<ZIPFileData> file;
-			while ((file = ReadFile(mainStream)))
+			std::ifstream archive(path.c_str(), std::ifstream::binary);
+			if (!archive || !ReadCentralDirectory(archive, entries))
 			{
-				files.push_back(std::move(file));
+				RAIDHOOK_LOG_WARN(std::string("Failed to read ZIP archive: ") + path);
+				return false;
 			}
 		}
 
 		RAIDHOOK_LOG_LOG(std::string("Extracting ") + path + std::string(" to ") + extractPath);
 
 		bool result = true;
-		std::for_each(files.cbegin(), files.cend(), [extractPath, &result](const std::unique_ptr<ZIPFileData>& data)
+
+		// Create every directory up front, so the entries can't race each other to create the same one
+		std::vector<size_t> files;
+		std::set<std::string> directories;
+		for (size_t i = 0; i < entries.size(); i++)
+		{
+			const ZIPEntry& entry = entries[i];
+			if (!IsSafePath(entry.filepath))
+			{
+				RAIDHOOK_LOG_WARN(std::string("Refusing to extract file outside of the target directory: ") + entry.filepath);
+				result = false;
+				continue;
+			}
+
+			const std::string finalWritePath = extractPath + "/" + entry.filepath;
+			if (directories.insert(finalWritePath.substr(0, finalWritePath.find_last_of('/'))).second)
+				Util::EnsurePathWritable(finalWritePath);
+
+			// Directories are created above, only files have anything to extract
+			if (!IsDirectory(entry))
+				files.push_back(i);
+		}
+
+		std::atomic<size_t> extracted = 0;
+		auto reportProgress = [&](const ZIPEntry& entry, bool success)
+		{
+			if (progress)
+				progress(entry.filepath, success, ++extracted, files.size());
+		};
+
+		if (!parallel)
+		{
+			std::ifstream archive(path.c_str(), std::ifstream::binary);
+			for (size_t index : files)
+			{
+				bool success = WriteFile(archive, extractPath, entries[index]);
+				reportProgress(entries[index], success);
+				result &= success;
+			}
+			return result;
+		}
+
+		// Every entry is read with its own stream, so they can all seek independently
+		std::atomic<bool> allWritten = true;
+		ThreadPool::GetSingleton().ParallelFor(files.size(), [&](size_t i)
 		{
-			result &= WriteFile(extractPath, *data);
-		});
-		return result;
+			std::ifstream archive(path.c_str(), std::ifstream::binary);
+			bool success = WriteFile(archive, extractPath, entries[files[i]]);
+			reportProgress(entries[files[i]], success);
+			if (!success)
+				allWritten = false;
+		}, TaskClass::IO);
+
+		return result && allWritten;
 	}
 }
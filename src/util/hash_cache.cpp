@@ -0,0 +1,171 @@
+#include "util.h"
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+// Remembers the digest of every file that's been hashed, so mods that haven't changed since the last
+// launch don't have to be read again to check their hashes.
+//
+// The cache is a text file with one line per digest, which is only ever appended to while the game
+// is running: "<digest> <size> <mtime> <path>". If a file is hashed again after it changes, the later
+// line wins. The file is rewritten without the outdated lines when it's loaded, if there are enough
+// of them to be worth it.
+
+static const char* HASH_CACHE_FILE = "filehash_cache.txt";
+
+namespace
+{
+	struct CachedDigest
+	{
+		uint64_t size;
+		uint64_t mtime;
+		std::string digest;
+	};
+
+	class FileHashCache
+	{
+	public:
+		static FileHashCache& Instance()
+		{
+			static FileHashCache instance;
+			return instance;
+		}
+
+		bool Find(const std::string& path, uint64_t size, uint64_t mtime, std::string& digest)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			auto it = entries.find(path);
+			if (it == entries.end() || it->second.size != size || it->second.mtime != mtime)
+				return false;
+
+			digest = it->second.digest;
+			return true;
+		}
+
+		void Insert(const std::string& path, uint64_t size, uint64_t mtime, const std::string& digest)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			entries[path] = CachedDigest{ size, mtime, digest };
+
+			if (!out.is_open())
+				return;
+
+			// Flushed straight away so nothing's lost if the game crashes, which is when mods tend to
+			// get updated anyway
+			WriteLine(out, path, entries[path]);
+			out.flush();
+		}
+
+	private:
+		FileHashCache()
+		{
+			size_t lines = Load();
+
+			// Every line past the number of files is an outdated digest
+			if (lines > entries.size() * 2 + 1000)
+			{
+				RAIDHOOK_LOG_LOG("Compacting file hash cache");
+				Rewrite();
+			}
+
+			out.open(HASH_CACHE_FILE, std::ios::binary | std::ios::app);
+			if (!out.good())
+			{
+				RAIDHOOK_LOG_WARN("Could not open file hash cache, hashes will not be cached");
+				out.close();
+			}
+		}
+
+		size_t Load()
+		{
+			std::ifstream in(HASH_CACHE_FILE, std::ios::binary);
+			if (!in.good())
+				return 0;
+
+			size_t lines = 0;
+			std::string line;
+			while (std::getline(in, line))
+			{
+				lines++;
+
+				std::istringstream fields(line);
+				CachedDigest entry;
+				std::string path;
+				if (!(fields >> entry.digest >> entry.size >> entry.mtime) || fields.get() != ' ' || !std::getline(fields, path))
+					continue;
+
+				// A torn line from a crash halfway through writing it
+				if (entry.digest.size() != 64 || path.empty())
+					continue;
+
+				entries[path] = std::move(entry);
+			}
+
+			return lines;
+		}
+
+		void Rewrite()
+		{
+			// Write it out under a temporary name first, so a crash halfway through can't lose the cache
+			std::string tempFile = std::string(HASH_CACHE_FILE) + ".tmp";
+			{
+				std::ofstream rewritten(tempFile, std::ios::binary);
+				for (const auto& entry : entries)
+					WriteLine(rewritten, entry.first, entry.second);
+
+				if (!rewritten.good())
+				{
+					RAIDHOOK_LOG_WARN("Could not write compacted file hash cache");
+					return;
+				}
+			}
+
+			if (!MoveFileExA(tempFile.c_str(), HASH_CACHE_FILE, MOVEFILE_REPLACE_EXISTING))
+			{
+				RAIDHOOK_LOG_WARN("Could not replace file hash cache");
+				DeleteFileA(tempFile.c_str());
+			}
+		}
+
+		static void WriteLine(std::ostream& stream, const std::string& path, const CachedDigest& entry)
+		{
+			stream << entry.digest << ' ' << entry.size << ' ' << entry.mtime << ' ' << path << '\n';
+		}
+
+		std::mutex mutex;
+		std::unordered_map<std::string, CachedDigest> entries;
+		std::ofstream out;
+	};
+}
+
+namespace raidhook
+{
+	namespace Util
+	{
+		std::string GetCachedFileDigest(const std::string& filename)
+		{
+			// If the file can't be looked at, hash it normally and let that report the error
+			WIN32_FILE_ATTRIBUTE_DATA attributes;
+			if (!GetFileAttributesExA(filename.c_str(), GetFileExInfoStandard, &attributes))
+				return GetFileDigest(filename);
+
+			uint64_t size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+			uint64_t mtime = ((uint64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+
+			FileHashCache& cache = FileHashCache::Instance();
+
+			std::string digest;
+			if (cache.Find(filename, size, mtime, digest))
+				return digest;
+
+			digest = GetFileDigest(filename);
+			cache.Insert(filename, size, mtime, digest);
+			return digest;
+		}
+	}
+}
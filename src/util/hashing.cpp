@@ -1,7 +1,6 @@
-#include <thread>
-
 #include "util.h"
 #include "threading/queue.h"
+#include "threading/threadpool.h"
 #include "lua.h"
 
 using namespace std;
@@ -19,37 +18,6 @@ struct HashInfo
 
 RAIDHOOK_REGISTER_EVENTQUEUE(HashInfo, HashResult)
 
-class AsyncHashManager
-{
-private:
-	AsyncHashManager();
-
-public:
-	~AsyncHashManager();
-
-	static AsyncHashManager* GetSingleton();
-
-	std::list<std::unique_ptr<std::thread>> threadList;
-};
-
-AsyncHashManager::AsyncHashManager()
-{
-}
-
-AsyncHashManager::~AsyncHashManager()
-{
-	for_each(threadList.begin(), threadList.end(), [](const unique_ptr<thread>& t)
-	{
-		t->join();
-	});
-}
-
-AsyncHashManager* AsyncHashManager::GetSingleton()
-{
-	static AsyncHashManager instance;
-	return &instance;
-}
-
 static void done(HashInfo info)
 {
 	info.callback(info.L, info.ref, info.filename, info.result);
@@ -75,6 +43,5 @@ void raidhook::Util::RunAsyncHash(lua_State* L, int ref, string filename, Direct
 
 	info.result = "<ERR:NOTSET>";
 
-	unique_ptr<thread> ptr = unique_ptr<thread>(new thread(run_async, info));
-	AsyncHashManager::GetSingleton()->threadList.push_back(move(ptr));
+	raidhook::ThreadPool::GetSingleton().Submit(raidhook::TaskClass::CPU, [info]() { run_async(info); });
 }
@@ -0,0 +1,314 @@
+#include "sha256.h"
+
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RAIDHOOK_SHA256_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC lets any function use any intrinsic
+#define RAIDHOOK_TARGET_SHA
+#else
+#include <cpuid.h>
+#define RAIDHOOK_TARGET_SHA __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+namespace raidhook
+{
+	namespace Util
+	{
+		namespace
+		{
+			const uint32_t K[64] = {
+				0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+				0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+				0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+				0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+				0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+				0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+				0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+				0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+			};
+
+			const uint32_t INITIAL_STATE[8] = {
+				0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+			};
+
+			inline uint32_t rotr(uint32_t value, int bits)
+			{
+				return (value >> bits) | (value << (32 - bits));
+			}
+
+			inline uint32_t loadBigEndian(const uint8_t* data)
+			{
+				return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+			}
+
+			// One round, written so that eight calls with the variables rotated one place each time stand
+			// in for shuffling all eight of them along after every round
+			inline void round(uint32_t a, uint32_t b, uint32_t c, uint32_t& d, uint32_t e, uint32_t f, uint32_t g, uint32_t& h, uint32_t k, uint32_t w)
+			{
+				uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+				uint32_t ch = (e & f) ^ (~e & g);
+				uint32_t temp1 = h + s1 + ch + k + w;
+				uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+				uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+
+				d += temp1;
+				h = temp1 + s0 + maj;
+			}
+
+			void compressScalar(uint32_t state[8], const uint8_t* data, size_t blocks)
+			{
+				uint32_t w[64];
+
+				for (; blocks > 0; blocks--, data += 64)
+				{
+					for (int i = 0; i < 16; i++)
+						w[i] = loadBigEndian(data + i * 4);
+
+					for (int i = 16; i < 64; i++)
+					{
+						uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+						uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+						w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+					}
+
+					uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+					uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+
+					for (int i = 0; i < 64; i += 8)
+					{
+						round(a, b, c, d, e, f, g, h, K[i + 0], w[i + 0]);
+						round(h, a, b, c, d, e, f, g, K[i + 1], w[i + 1]);
+						round(g, h, a, b, c, d, e, f, K[i + 2], w[i + 2]);
+						round(f, g, h, a, b, c, d, e, K[i + 3], w[i + 3]);
+						round(e, f, g, h, a, b, c, d, K[i + 4], w[i + 4]);
+						round(d, e, f, g, h, a, b, c, K[i + 5], w[i + 5]);
+						round(c, d, e, f, g, h, a, b, K[i + 6], w[i + 6]);
+						round(b, c, d, e, f, g, h, a, K[i + 7], w[i + 7]);
+					}
+
+					state[0] += a;
+					state[1] += b;
+					state[2] += c;
+					state[3] += d;
+					state[4] += e;
+					state[5] += f;
+					state[6] += g;
+					state[7] += h;
+				}
+			}
+
+#ifdef RAIDHOOK_SHA256_X86
+			bool cpuHasShaExtensions()
+			{
+				unsigned int leaf1[4] = {}, leaf7[4] = {};
+#ifdef _MSC_VER
+				int regs[4];
+				__cpuid(regs, 0);
+				if (regs[0] < 7)
+					return false;
+				__cpuid(regs, 1);
+				memcpy(leaf1, regs, sizeof(regs));
+				__cpuidex(regs, 7, 0);
+				memcpy(leaf7, regs, sizeof(regs));
+#else
+				if (__get_cpuid_max(0, nullptr) < 7)
+					return false;
+				__cpuid(1, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+				__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+				bool ssse3 = (leaf1[2] & (1 << 9)) != 0;
+				bool sse41 = (leaf1[2] & (1 << 19)) != 0;
+				bool sha = (leaf7[1] & (1 << 29)) != 0;
+				return ssse3 && sse41 && sha;
+			}
+
+			// Four rounds, while also working out the message words for the rounds four steps later. The
+			// message words for the current rounds are in current, with the ones before and after them
+			// (wrapping around) in previous and next.
+			template <int step>
+			RAIDHOOK_TARGET_SHA inline void fourRounds(__m128i& state0, __m128i& state1, const __m128i& current, __m128i& next, __m128i& previous)
+			{
+				__m128i words = _mm_add_epi32(current, _mm_loadu_si128((const __m128i*)&K[step * 4]));
+				state1 = _mm_sha256rnds2_epu32(state1, state0, words);
+
+				if constexpr (step >= 3 && step < 15)
+				{
+					next = _mm_add_epi32(next, _mm_alignr_epi8(current, previous, 4));
+					next = _mm_sha256msg2_epu32(next, current);
+				}
+
+				words = _mm_shuffle_epi32(words, 0x0E);
+				state0 = _mm_sha256rnds2_epu32(state0, state1, words);
+
+				if constexpr (step >= 1 && step < 13)
+					previous = _mm_sha256msg1_epu32(previous, current);
+			}
+
+			RAIDHOOK_TARGET_SHA void compressShaExtensions(uint32_t state[8], const uint8_t* data, size_t blocks)
+			{
+				const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+				// The instructions want the state as ABEF and CDGH
+				__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xB1);
+				__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1B);
+				__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+				state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+				for (; blocks > 0; blocks--, data += 64)
+				{
+					__m128i savedState0 = state0;
+					__m128i savedState1 = state1;
+
+					__m128i msg0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 0)), byteSwap);
+					__m128i msg1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16)), byteSwap);
+					__m128i msg2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 32)), byteSwap);
+					__m128i msg3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 48)), byteSwap);
+
+					// Unrolled by hand, since the compiler keeps the message words in memory otherwise
+					fourRounds<0>(state0, state1, msg0, msg1, msg3);
+					fourRounds<1>(state0, state1, msg1, msg2, msg0);
+					fourRounds<2>(state0, state1, msg2, msg3, msg1);
+					fourRounds<3>(state0, state1, msg3, msg0, msg2);
+					fourRounds<4>(state0, state1, msg0, msg1, msg3);
+					fourRounds<5>(state0, state1, msg1, msg2, msg0);
+					fourRounds<6>(state0, state1, msg2, msg3, msg1);
+					fourRounds<7>(state0, state1, msg3, msg0, msg2);
+					fourRounds<8>(state0, state1, msg0, msg1, msg3);
+					fourRounds<9>(state0, state1, msg1, msg2, msg0);
+					fourRounds<10>(state0, state1, msg2, msg3, msg1);
+					fourRounds<11>(state0, state1, msg3, msg0, msg2);
+					fourRounds<12>(state0, state1, msg0, msg1, msg3);
+					fourRounds<13>(state0, state1, msg1, msg2, msg0);
+					fourRounds<14>(state0, state1, msg2, msg3, msg1);
+					fourRounds<15>(state0, state1, msg3, msg0, msg2);
+
+					state0 = _mm_add_epi32(state0, savedState0);
+					state1 = _mm_add_epi32(state1, savedState1);
+				}
+
+				// And back to ABCD EFGH
+				tmp = _mm_shuffle_epi32(state0, 0x1B);
+				state1 = _mm_shuffle_epi32(state1, 0xB1);
+				_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+				_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+			}
+#endif
+
+			using CompressFunction = void (*)(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+			CompressFunction pickCompressFunction()
+			{
+#ifdef RAIDHOOK_SHA256_X86
+				if (cpuHasShaExtensions())
+					return compressShaExtensions;
+#endif
+				return compressScalar;
+			}
+
+			// Looked up on first use rather than during static init, in case something hashes then
+			CompressFunction compressFunction()
+			{
+				static const CompressFunction function = pickCompressFunction();
+				return function;
+			}
+		}
+
+		Sha256::Sha256() : compress(compressFunction())
+		{
+			memcpy(state, INITIAL_STATE, sizeof(state));
+		}
+
+		void Sha256::Update(const void* data, size_t length)
+		{
+			const uint8_t* bytes = (const uint8_t*)data;
+			totalLength += length;
+
+			// Top up a partial block left over from last time first
+			if (bufferLength > 0)
+			{
+				size_t count = sizeof(buffer) - bufferLength;
+				if (count > length)
+					count = length;
+
+				memcpy(buffer + bufferLength, bytes, count);
+				bufferLength += count;
+				bytes += count;
+				length -= count;
+
+				if (bufferLength < sizeof(buffer))
+					return;
+
+				compress(state, buffer, 1);
+				bufferLength = 0;
+			}
+
+			// Then hash as many whole blocks as possible straight from the input
+			size_t blocks = length / 64;
+			if (blocks > 0)
+			{
+				compress(state, bytes, blocks);
+				bytes += blocks * 64;
+				length -= blocks * 64;
+			}
+
+			memcpy(buffer, bytes, length);
+			bufferLength = length;
+		}
+
+		void Sha256::Final(uint8_t digest[DIGEST_SIZE])
+		{
+			uint64_t bitLength = totalLength * 8;
+
+			// A single one bit, zeros up to the last eight bytes of a block, then the length
+			uint8_t padding[72] = { 0x80 };
+			size_t paddingLength = (bufferLength < 56 ? 56 : 120) - bufferLength;
+			for (int i = 0; i < 8; i++)
+				padding[paddingLength + i] = (uint8_t)(bitLength >> (56 - i * 8));
+
+			Update(padding, paddingLength + 8);
+
+			for (int i = 0; i < 8; i++)
+			{
+				digest[i * 4 + 0] = (uint8_t)(state[i] >> 24);
+				digest[i * 4 + 1] = (uint8_t)(state[i] >> 16);
+				digest[i * 4 + 2] = (uint8_t)(state[i] >> 8);
+				digest[i * 4 + 3] = (uint8_t)state[i];
+			}
+		}
+
+		std::string Sha256::HexDigest()
+		{
+			uint8_t digest[DIGEST_SIZE];
+			Final(digest);
+			return BytesToHex(digest, sizeof(digest));
+		}
+
+		bool Sha256::IsHardwareAccelerated()
+		{
+			return compressFunction() != compressScalar;
+		}
+
+		void BytesToHex(const uint8_t* bytes, size_t length, char* hex)
+		{
+			static const char digits[] = "0123456789abcdef";
+
+			for (size_t i = 0; i < length; i++)
+			{
+				hex[i * 2] = digits[bytes[i] >> 4];
+				hex[i * 2 + 1] = digits[bytes[i] & 0xf];
+			}
+		}
+
+		std::string BytesToHex(const uint8_t* bytes, size_t length)
+		{
+			std::string hex(length * 2, '\0');
+			BytesToHex(bytes, length, hex.data());
+			return hex;
+		}
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef __SHA256_HEADER__
+#define __SHA256_HEADER__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+namespace raidhook
+{
+	namespace Util
+	{
+		// Incremental SHA-256, with no dependencies on the platform's crypto libraries. Uses the x86 SHA
+		// extensions when the CPU has them, and plain C++ otherwise.
+		class Sha256
+		{
+		public:
+			static const size_t DIGEST_SIZE = 32;
+
+			Sha256();
+
+			void Update(const void* data, size_t length);
+
+			// Finishes the hash - the object can't be updated any more after this
+			void Final(uint8_t digest[DIGEST_SIZE]);
+
+			// Final, as a lowercase hex string
+			std::string HexDigest();
+
+			// True if the SHA extensions are being used
+			static bool IsHardwareAccelerated();
+
+		private:
+			void (*compress)(uint32_t state[8], const uint8_t* data, size_t blocks);
+
+			uint32_t state[8];
+			uint8_t buffer[64];
+			size_t bufferLength = 0;
+			uint64_t totalLength = 0;
+		};
+
+		// Lowercase hex string of some bytes
+		std::string BytesToHex(const uint8_t* bytes, size_t length);
+
+		// The same, written to hex without a null terminator, which must have room for length * 2 chars
+		void BytesToHex(const uint8_t* bytes, size_t length, char* hex);
+	}
+}
+
+#endif // __SHA256_HEADER__
@@ -1,8 +1,12 @@
 #include "util.h"
+#include "sha256.h"
+#include "threading/threadpool.h"
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <sstream>
+#include <stdio.h>
 #include <string>
 #include <vector>
 
@@ -40,60 +44,33 @@ namespace raidhook
 			os << exceptionName() << " occurred @ (" << mFile << ':' << mLine << "). " << what();
 		}
 
-		// helper function to print the digest bytes as a hex string
-		std::string bytes_to_hex_string(const std::vector<uint8_t>& bytes)
+		std::string sha256(const std::string& input)
 		{
-			std::ostringstream stream;
-			for (uint8_t b : bytes)
-			{
-				stream << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(b);
-			}
-			return stream.str();
+			Sha256 hasher;
+			hasher.Update(input.data(), input.size());
+			return hasher.HexDigest();
 		}
 
-		// Perform SHA-256 hash using Windows CNG API
-		std::string sha256(const std::string& input)
+		std::string GetFileDigest(const std::string& filename)
 		{
-			BCRYPT_ALG_HANDLE hAlgorithm = nullptr;
-			BCRYPT_HASH_HANDLE hHash = nullptr;
-			NTSTATUS status;
-			DWORD hashObjectLength = 0, resultLength = 0;
-			DWORD hashLength = 32;
-			std::vector<uint8_t> hash(hashLength);
-			std::vector<uint8_t> hashObject;
-
-			status = BCryptOpenAlgorithmProvider(&hAlgorithm, BCRYPT_SHA256_ALGORITHM, nullptr, 0);
-			if (status != 0) throw std::runtime_error("Failed to open SHA-256 algorithm provider");
-			try
-			{
-				status = BCryptGetProperty(hAlgorithm, BCRYPT_OBJECT_LENGTH, (PUCHAR)&hashObjectLength, sizeof(DWORD),
-				                           &resultLength, 0);
-				if (status != 0) throw std::runtime_error("Failed to get hash object length");
-				hashObject.resize(hashObjectLength);
-				status = BCryptCreateHash(hAlgorithm, &hHash, hashObject.data(), hashObjectLength, nullptr, 0, 0);
-				if (status != 0) throw std::runtime_error("Failed to create hash");
-				try
-				{
-					status = BCryptHashData(hHash, (PUCHAR)input.data(), input.size(), 0);
-					if (status != 0) throw std::runtime_error("Failed to hash data");
-					status = BCryptFinishHash(hHash, hash.data(), hashLength, 0);
-					if (status != 0) throw std::runtime_error("Failed to finish hash");
-				}
-				catch (std::runtime_error e)
-				{
-					BCryptDestroyHash(hHash);
-					throw std::runtime_error(e);
-				}
-			}
-			catch (std::runtime_error e)
-			{
-				BCryptCloseAlgorithmProvider(hAlgorithm, 0);
-				throw std::runtime_error(e);
-			}
-			BCryptDestroyHash(hHash);
-			BCryptCloseAlgorithmProvider(hAlgorithm, 0);
+			std::unique_ptr<FILE, decltype(&fclose)> file(fopen(filename.c_str(), "rb"), &fclose);
+			if (!file)
+				RAIDHOOK_THROW_IO_MSG("Could not open " + filename + " for hashing");
+
+			// Reads this big go straight into our buffer anyway, so skip stdio's own
+			setvbuf(file.get(), nullptr, _IONBF, 0);
+
+			// Only a piece of the file is ever in memory, and each thread reuses the same buffer
+			thread_local std::vector<char> buffer(256 * 1024);
+
+			Sha256 hasher;
+			while (size_t count = fread(buffer.data(), 1, buffer.size(), file.get()))
+				hasher.Update(buffer.data(), count);
 
-			return bytes_to_hex_string(hash);
+			if (ferror(file.get()))
+				RAIDHOOK_THROW_IO_MSG("Could not read " + filename + " for hashing");
+
+			return hasher.HexDigest();
 		}
 
 		void RecurseDirectoryPaths(std::vector<std::string>& paths, std::string directory, bool ignore_versioning)
@@ -137,12 +114,19 @@ namespace raidhook
 			//  way to change this without breaking hashing on previous versions.
 			std::sort(paths.begin(), paths.end(), CompareStringsCaseInsensitive);
 
+			// Hash the files in parallel, but keep the digests in the sorted order so the result is the same
+			std::vector<std::string> digests(paths.size());
+			ThreadPool::GetSingleton().ParallelFor(paths.size(), [&paths, &digests](size_t i)
+			{
+				digests[i] = GetCachedFileDigest(paths[i]);
+			}, TaskClass::IO);
+
 			std::string hashconcat;
+			hashconcat.reserve(digests.size() * 64);
 
-			for (auto it = paths.begin(); it < paths.end(); it++)
+			for (const std::string& digest : digests)
 			{
-				std::string hashstr = sha256(raidhook::Util::GetFileContents(*it));
-				hashconcat += hashstr;
+				hashconcat += digest;
 			}
 
 			return sha256(hashconcat);
@@ -152,7 +136,7 @@ namespace raidhook
 		{
 			// This has to be hashed twice otherwise it won't be the same hash if we're checking against a file uploaded
 			// to the server
-			std::string hash = sha256(raidhook::Util::GetFileContents(file));
+			std::string hash = GetCachedFileDigest(file);
 			return sha256(hash);
 		}
 
@@ -2,6 +2,7 @@
 #define __UTIL_HEADER__
 
 #include <exception>
+#include <functional>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -36,6 +37,11 @@ namespace raidhook
 		std::vector<std::string> SplitString(const std::string &s, char delim);
 		std::string GetDirectoryHash(std::string directory);
 		std::string GetFileHash(std::string filename);
+		// SHA-256 of a file's contents as lowercase hex, read a piece at a time
+		std::string GetFileDigest(const std::string& filename);
+		// Same as GetFileDigest, but reuses the digest from the last time the file was hashed (even in a
+		// previous launch) if its size and modification time haven't changed. See hash_cache.cpp
+		std::string GetCachedFileDigest(const std::string& filename);
 		bool MoveDirectory(const std::string & path, const std::string & destination);
 
 		template<typename T>
@@ -166,7 +172,13 @@ namespace raidhook
 		};
 	}
 
-	bool ExtractZIPArchive(const std::string& path, const std::string& extractPath);
+	// Called after each file in a ZIP archive has been extracted, with how many have been extracted so far
+	// out of the total. When extracting in parallel this is called from the thread pool.
+	typedef std::function<void(const std::string& filepath, bool success, size_t extracted, size_t total)> ZIPProgressCallback;
+
+	// Extracts every entry of a ZIP archive under extractPath. With parallel set, the entries are extracted
+	// on the thread pool rather than one after another on this thread.
+	bool ExtractZIPArchive(const std::string& path, const std::string& extractPath, bool parallel = false, const ZIPProgressCallback& progress = nullptr);
 }
 
 #ifdef RAIDHOOK_ENABLE_FUNCTION_TRACE
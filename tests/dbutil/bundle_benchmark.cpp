@@ -0,0 +1,202 @@
+#include "dbutil/DB.h"
+
+#include "synthetic_bundle.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+// Times reading every asset out of a large synthetic plain bundle and packaged bundle, in a random
+// order, through the shared mapping and the way DslFile::ReadContents used to: opening an ifstream for
+// each asset and copying every chunk through temporary buffers. Not run as a test: build it in release
+// and run it by hand.
+//
+// Usage: bundle_benchmark [runs]
+
+using blt::db::DieselBundle;
+using blt::db::DslFile;
+
+using namespace synthetic_bundle;
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	// The old DslFile::ReadContents, from before the bundles were mapped
+	std::vector<uint8_t> ReadContentsFromStream(const DslFile& file, std::istream& fi)
+	{
+		unsigned int realLength = file.length;
+		if (!file.HasLength())
+		{
+			fi.seekg(0, std::ios::end);
+			realLength = (unsigned int)fi.tellg() - file.offset;
+		}
+
+		std::vector<uint8_t> result;
+
+		if (file.bundle->ChunkOffsets.empty())
+		{
+			fi.seekg(file.offset, std::ios::beg);
+			std::vector<uint8_t> data(file.length);
+			fi.read((char*)data.data(), data.size());
+
+			uint32_t dstSize;
+			memcpy(&dstSize, data.data() + (data.size() - sizeof(uint32_t)), sizeof(dstSize));
+			result.resize(dstSize);
+
+			auto destSize = static_cast<uLongf>(dstSize);
+			auto sourceSize = static_cast<uLong>(data.size());
+
+			if (uncompress2(result.data(), &destSize, data.data(), &sourceSize) != Z_OK)
+				throw std::runtime_error("Failed to decompress data");
+		}
+		else
+		{
+			result.resize(realLength);
+
+			size_t blockIdx = file.offset / 0x10000;
+			size_t bufferOffset = file.offset % 0x10000;
+			size_t destFileOffset = 0;
+
+			std::vector<uint8_t> data(0x10000);
+
+			while (destFileOffset < realLength)
+			{
+				uint32_t compressedLength;
+
+				fi.seekg(file.bundle->ChunkOffsets[blockIdx], std::ios::beg);
+				fi.read((char*)&compressedLength, sizeof(compressedLength));
+
+				std::vector<uint8_t> compressedData(compressedLength);
+				fi.read((char*)compressedData.data(), compressedData.size());
+
+				uint32_t dstSize;
+				memcpy(&dstSize, compressedData.data() + (compressedData.size() - sizeof(uint32_t)), sizeof(dstSize));
+				data.resize(dstSize);
+
+				auto destSize = static_cast<uLongf>(dstSize);
+				auto sourceSize = static_cast<uLong>(compressedData.size());
+
+				if (uncompress2(data.data(), &destSize, compressedData.data(), &sourceSize) != Z_OK)
+					throw std::runtime_error("Failed to decompress data");
+
+				auto dataPtr = data.data();
+				if (destFileOffset == 0)
+				{
+					dataPtr += bufferOffset;
+					destSize -= bufferOffset;
+				}
+
+				memcpy(result.data() + destFileOffset, dataPtr, std::min<size_t>(destSize, realLength - destFileOffset));
+				destFileOffset += destSize;
+
+				++blockIdx;
+			}
+		}
+
+		return result;
+	}
+
+	// Returns the total time for reading every file once, in the given order
+	template <typename ReadFn>
+	double TimeReads(const std::vector<DslFile>& files, const std::vector<size_t>& order, size_t& bytes, ReadFn read)
+	{
+		bytes = 0;
+		Clock::time_point start = Clock::now();
+
+		for (size_t index : order)
+			bytes += read(files[index]).size();
+
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	void RunBundle(const char* name, DieselBundle& bundle, const std::vector<Asset>& assets, int runs)
+	{
+		std::vector<DslFile> files;
+		for (const Asset& asset : assets)
+		{
+			DslFile file;
+			file.bundle = &bundle;
+			file.offset = asset.offset;
+			file.length = asset.length;
+			files.push_back(file);
+		}
+
+		// Levels load assets from all over the bundles
+		std::vector<size_t> order(files.size());
+		for (size_t i = 0; i < order.size(); i++)
+			order[i] = i;
+		std::shuffle(order.begin(), order.end(), std::mt19937(1));
+
+		// Warm the page cache and the mapping, so both start on an even footing
+		for (const DslFile& file : files)
+		{
+			if (file.ReadContents() != assets[&file - files.data()].contents)
+			{
+				fprintf(stderr, "%s: an asset didn't read back correctly\n", name);
+				exit(1);
+			}
+		}
+
+		double streamTime = 0, mappedTime = 0;
+		size_t bytes = 0;
+
+		for (int i = 0; i < runs; i++)
+		{
+			streamTime += TimeReads(files, order, bytes, [&bundle](const DslFile& file) {
+				std::ifstream in(bundle.path, std::ios::binary);
+				return ReadContentsFromStream(file, in);
+			});
+
+			mappedTime += TimeReads(files, order, bytes, [](const DslFile& file) { return file.ReadContents(); });
+		}
+
+		double megabytes = bytes / 1048576.0;
+		printf("%-9s %zu assets, %.1f MB\n", name, files.size(), megabytes);
+		printf("  stream  %9.2f ms  %8.1f MB/s\n", streamTime / runs, megabytes / (streamTime / runs / 1000));
+		printf("  mapped  %9.2f ms  %8.1f MB/s\n", mappedTime / runs, megabytes / (mappedTime / runs / 1000));
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 5;
+	if (runs < 1)
+		runs = 1;
+
+	printf("average of %d runs\n", runs);
+
+	std::string plainPath = TempPath("sblt_benchmark_plain.bundle");
+	std::string packagedPath = TempPath("sblt_benchmark_packaged.bundle");
+
+	{
+		std::vector<Asset> assets = WritePlainBundle(plainPath, 4000, 32 * 1024, 1);
+
+		DieselBundle bundle;
+		bundle.path = plainPath;
+		RunBundle("plain", bundle, assets, runs);
+	}
+
+	{
+		std::vector<Asset> assets = MakePackagedAssets(4000, 32 * 1024, 2);
+
+		DieselBundle bundle;
+		bundle.path = packagedPath;
+		bundle.ChunkOffsets = WritePackagedBundle(packagedPath, assets, bundle.DecompressedFileSize);
+		RunBundle("packaged", bundle, assets, runs);
+	}
+
+	std::filesystem::remove(plainPath);
+	std::filesystem::remove(packagedPath);
+
+	return 0;
+}
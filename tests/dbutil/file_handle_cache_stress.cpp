@@ -0,0 +1,207 @@
+#include "dbutil/FileHandleCache.h"
+
+#include "test.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reads random ranges of the same file from lots of threads at once through one shared handle, and
+// checks every byte of every read. Some of the ranges run off the end of the file.
+
+using blt::db::FileHandleCache;
+using blt::db::SharedFile;
+
+static const size_t THREADS = 8;
+static const size_t READS_PER_THREAD = 1000;
+static const size_t MAX_READ = 64 * 1024;
+
+// Every byte of the file is different from its neighbours, so a read from the wrong place can't pass
+static uint8_t ByteAt(uint64_t position, uint32_t seed)
+{
+	uint32_t value = (uint32_t)position * 2654435761u + seed;
+	return (uint8_t)(value >> 24) ^ (uint8_t)position;
+}
+
+static std::string MakeFile(const std::string& name, size_t size, uint32_t seed)
+{
+	std::filesystem::path path = std::filesystem::temp_directory_path() / name;
+
+	std::vector<char> contents(size);
+	for (size_t i = 0; i < size; i++)
+		contents[i] = (char)ByteAt(i, seed);
+
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	out.write(contents.data(), contents.size());
+
+	return path.string();
+}
+
+// Returns false if the read came back wrong
+static bool CheckRead(const SharedFile& file, uint64_t position, size_t length, uint32_t seed, std::vector<uint8_t>& buffer)
+{
+	buffer.assign(length, 0xCD);
+	size_t count = file.ReadAt(position, buffer.data(), length);
+
+	size_t expected = position >= file.Size() ? 0 : std::min<uint64_t>(length, file.Size() - position);
+	if (count != expected)
+	{
+		fprintf(stderr, "read of %zu at %llu returned %zu bytes, expected %zu\n", length, (unsigned long long)position, count, expected);
+		return false;
+	}
+
+	for (size_t i = 0; i < count; i++)
+	{
+		if (buffer[i] != ByteAt(position + i, seed))
+		{
+			fprintf(stderr, "read of %zu at %llu has the wrong byte at %llu\n", length, (unsigned long long)position,
+			        (unsigned long long)(position + i));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void ConcurrentReads()
+{
+	const size_t size = 8 * 1024 * 1024 + 123;
+	std::string path = MakeFile("sblt_file_handle_cache_stress.bin", size, 0);
+
+	std::shared_ptr<SharedFile> file = FileHandleCache::Instance().Open(path);
+	TEST_CHECK(file != nullptr);
+	if (!file)
+		return;
+
+	TEST_CHECK(file->Size() == size);
+
+	std::atomic<size_t> failures = 0;
+	std::vector<std::thread> threads;
+
+	for (size_t t = 0; t < THREADS; t++)
+	{
+		threads.emplace_back([&, t] {
+			std::mt19937_64 random(t);
+			std::vector<uint8_t> buffer;
+
+			for (size_t i = 0; i < READS_PER_THREAD; i++)
+			{
+				// Going through the cache again gets the same file, while it's still in use
+				std::shared_ptr<SharedFile> reader = i % 64 == 0 ? FileHandleCache::Instance().Open(path) : file;
+				if (reader != file)
+				{
+					failures++;
+					continue;
+				}
+
+				uint64_t position = random() % (size + 4096);
+				size_t length = random() % MAX_READ;
+
+				if (!CheckRead(*reader, position, length, 0, buffer))
+					failures++;
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	TEST_CHECK_MSG(failures == 0, "%zu of %zu reads failed", failures.load(), THREADS * READS_PER_THREAD);
+
+	file.reset();
+	std::filesystem::remove(path);
+}
+
+// Opening more files than the cache keeps open closes the idle ones, but never one that's in use
+static void ClosesIdleFiles()
+{
+	const size_t count = FileHandleCache::MAX_OPEN_FILES + 16;
+	const size_t size = 4096;
+
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < count; i++)
+		paths.push_back(MakeFile("sblt_file_handle_cache_" + std::to_string(i) + ".bin", size, (uint32_t)i));
+
+	// Keep the first file in use the whole time
+	std::shared_ptr<SharedFile> held = FileHandleCache::Instance().Open(paths[0]);
+	TEST_CHECK(held != nullptr);
+
+	std::vector<uint8_t> buffer;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			std::shared_ptr<SharedFile> file = FileHandleCache::Instance().Open(paths[i]);
+			TEST_CHECK(file != nullptr);
+			if (!file)
+				continue;
+
+			TEST_CHECK(CheckRead(*file, 100, 1000, (uint32_t)i, buffer));
+			TEST_CHECK(CheckRead(*file, size - 10, 1000, (uint32_t)i, buffer));
+		}
+	}
+
+	TEST_CHECK(FileHandleCache::Instance().Open(paths[0]) == held);
+
+	held.reset();
+	for (const std::string& path : paths)
+		std::filesystem::remove(path);
+}
+
+// A file that's changed while it's cached is opened again, rather than handing out the old handle
+static void ReopensChangedFiles()
+{
+	const size_t size = 4096;
+	std::string path = MakeFile("sblt_file_handle_cache_changed.bin", size, 1);
+
+	std::shared_ptr<SharedFile> file = FileHandleCache::Instance().Open(path);
+	TEST_CHECK(file != nullptr);
+	if (!file)
+		return;
+
+	// Unchanged, so it's the same handle
+	TEST_CHECK(FileHandleCache::Instance().Open(path) == file);
+
+	// Rewriting it while it's open works, and the next open sees the new size and contents
+	MakeFile("sblt_file_handle_cache_changed.bin", size * 2, 2);
+	std::shared_ptr<SharedFile> bigger = FileHandleCache::Instance().Open(path);
+	TEST_CHECK(bigger != nullptr && bigger != file);
+	if (!bigger)
+		return;
+
+	std::vector<uint8_t> buffer;
+	TEST_CHECK(bigger->Size() == size * 2);
+	TEST_CHECK(CheckRead(*bigger, size, 1000, 2, buffer));
+
+	// The same size but written again later still counts as a change, even once it's idle
+	file.reset();
+	bigger.reset();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	MakeFile("sblt_file_handle_cache_changed.bin", size * 2, 3);
+
+	std::shared_ptr<SharedFile> rewritten = FileHandleCache::Instance().Open(path);
+	TEST_CHECK(rewritten != nullptr);
+	if (rewritten)
+		TEST_CHECK(CheckRead(*rewritten, 0, size * 2, 3, buffer));
+
+	// Deleting it while it's still held doesn't fail, and it can't be opened afterwards
+	std::error_code error;
+	TEST_CHECK(std::filesystem::remove(path, error));
+	TEST_CHECK(FileHandleCache::Instance().Open(path) == nullptr);
+}
+
+int main()
+{
+	ConcurrentReads();
+	ClosesIdleFiles();
+	ReopensChangedFiles();
+
+	TEST_CHECK(FileHandleCache::Instance().Open("this file does not exist") == nullptr);
+
+	return TEST_RESULT;
+}
@@ -0,0 +1,212 @@
+#include "dbutil/DB.h"
+#include "dbutil/FileIndex.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <new>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Times building a FileIndex over as many assets as the game has and looking them up, against the
+// std::map DieselDB used before, and counts how much memory each of them takes. Not run as a test:
+// build it in release and run it by hand.
+//
+// Usage: file_index_benchmark [runs] [files]
+
+using blt::idstring;
+using blt::db::DslFile;
+using blt::db::FileIndex;
+
+using Clock = std::chrono::steady_clock;
+
+// Counts every byte that's been allocated and not freed yet, so each index's memory is the difference
+// before and after building it. That leaves out the allocator's own overhead, which flatters the map
+// since it makes an allocation for every file.
+
+namespace
+{
+	size_t live_bytes = 0;
+
+	// Keeps the size in front of each allocation, without upsetting its alignment
+	const size_t HEADER = alignof(std::max_align_t);
+} // namespace
+
+void* operator new(size_t size)
+{
+	char* memory = (char*)malloc(size + HEADER);
+	if (!memory)
+		throw std::bad_alloc();
+
+	*(size_t*)memory = size;
+	live_bytes += size;
+	return memory + HEADER;
+}
+
+void operator delete(void* pointer) noexcept
+{
+	if (!pointer)
+		return;
+
+	char* memory = (char*)pointer - HEADER;
+	live_bytes -= *(size_t*)memory;
+	free(memory);
+}
+
+namespace
+{
+	using FileMap = std::map<std::pair<idstring, idstring>, DslFile*>;
+
+	struct Timings
+	{
+		double build = 0;
+		double hits = 0;
+		double misses = 0;
+		size_t bytes = 0;
+		size_t found = 0;
+	};
+
+	double Millis(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	// Hashed names with a few dozen types, most of them using just a handful, like the real asset list
+	std::vector<DslFile> MakeFiles(size_t count)
+	{
+		std::mt19937_64 random(1);
+		std::vector<idstring> types(40);
+		for (idstring& type : types)
+			type = random();
+
+		std::vector<DslFile> files(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			files[i].name = random();
+			files[i].type = types[std::min<size_t>(random() % 64, random() % 64) % types.size()];
+			files[i].fileId = (int)i + 1;
+		}
+
+		return files;
+	}
+
+	// Looks up every key, and returns how many were there
+	template <typename FindFn>
+	size_t LookUp(const std::vector<std::pair<idstring, idstring>>& keys, FindFn find)
+	{
+		size_t found = 0;
+		for (const std::pair<idstring, idstring>& key : keys)
+		{
+			if (find(key.first, key.second))
+				found++;
+		}
+		return found;
+	}
+
+	template <typename Index, typename BuildFn, typename FindFn>
+	Timings Run(const std::vector<DslFile>& files, const std::vector<std::pair<idstring, idstring>>& hits,
+	            const std::vector<std::pair<idstring, idstring>>& misses, int runs, BuildFn build, FindFn find)
+	{
+		Timings timings;
+
+		for (int i = 0; i < runs; i++)
+		{
+			size_t before = live_bytes;
+			Clock::time_point start = Clock::now();
+
+			Index index;
+			build(index);
+
+			Clock::time_point built = Clock::now();
+			timings.bytes = live_bytes - before;
+
+			auto findIn = [&](idstring name, idstring type) { return find(index, name, type); };
+
+			size_t found = LookUp(hits, findIn);
+			Clock::time_point hit = Clock::now();
+
+			found += LookUp(misses, findIn);
+			Clock::time_point missed = Clock::now();
+
+			timings.build += Millis(start, built);
+			timings.hits += Millis(built, hit);
+			timings.misses += Millis(hit, missed);
+			timings.found = found;
+		}
+
+		timings.build /= runs;
+		timings.hits /= runs;
+		timings.misses /= runs;
+		return timings;
+	}
+
+	void Print(const char* name, const Timings& timings, size_t files, size_t lookups)
+	{
+		printf("  %-9s build %8.2f ms   hit %6.1f ns   miss %6.1f ns   %7.2f MB (%.1f bytes/file)\n", name, timings.build,
+		       timings.hits * 1e6 / lookups, timings.misses * 1e6 / lookups, timings.bytes / 1048576.0,
+		       (double)timings.bytes / files);
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 5;
+	if (runs < 1)
+		runs = 1;
+
+	size_t count = argc > 2 ? (size_t)atoll(argv[2]) : 300000;
+	if (count < 1)
+		count = 1;
+
+	std::vector<DslFile> files = MakeFiles(count);
+
+	std::vector<std::pair<idstring, idstring>> hits;
+	for (const DslFile& file : files)
+		hits.push_back(file.Key());
+
+	// The order the game asks for assets in has nothing to do with the order they're stored in
+	std::shuffle(hits.begin(), hits.end(), std::mt19937(2));
+
+	// Mostly real types with names that aren't there, which is what checking for a mod's asset looks like
+	std::vector<std::pair<idstring, idstring>> misses;
+	std::mt19937_64 random(3);
+	for (size_t i = 0; i < count; i++)
+		misses.emplace_back(random(), hits[i].second);
+
+	Timings index = Run<FileIndex>(
+	    files, hits, misses, runs,
+	    [&](FileIndex& index) {
+		    index.Reserve(files.size());
+		    for (DslFile& file : files)
+			    index.Insert(&file);
+	    },
+	    [](const FileIndex& index, idstring name, idstring type) { return index.Find(name, type); });
+
+	Timings map = Run<FileMap>(
+	    files, hits, misses, runs,
+	    [&](FileMap& map) {
+		    for (DslFile& file : files)
+			    map[file.Key()] = &file;
+	    },
+	    [](const FileMap& map, idstring name, idstring type) {
+		    auto it = map.find(std::pair<idstring, idstring>(name, type));
+		    return it == map.end() ? nullptr : it->second;
+	    });
+
+	if (index.found != count || map.found != count)
+	{
+		fprintf(stderr, "found %zu files in the index and %zu in the map, expected %zu\n", index.found, map.found, count);
+		return 1;
+	}
+
+	printf("%zu files, %zu hits and %zu misses, average of %d runs\n", count, hits.size(), misses.size(), runs);
+	Print("FileIndex", index, count, count);
+	Print("std::map", map, count, count);
+
+	return 0;
+}
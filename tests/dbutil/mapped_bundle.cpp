@@ -0,0 +1,203 @@
+#include "dbutil/DB.h"
+#include "dbutil/MappedFile.h"
+
+#include "synthetic_bundle.h"
+#include "test.h"
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+
+// Reads assets out of synthetic plain and packaged bundles through the bundle's shared mapping, and
+// checks they come out the same as they went in.
+
+using blt::db::DieselBundle;
+using blt::db::DslFile;
+using blt::db::MappedFile;
+
+using namespace synthetic_bundle;
+
+static DslFile MakeFile(DieselBundle* bundle, const Asset& asset)
+{
+	DslFile file;
+	file.bundle = bundle;
+	file.offset = asset.offset;
+	file.length = asset.length;
+	return file;
+}
+
+// Returns false if reading it threw or gave the wrong contents
+static bool CheckAsset(const DslFile& file, const std::vector<uint8_t>& expected)
+{
+	try
+	{
+		return file.ReadContents() == expected;
+	}
+	catch (const std::exception& ex)
+	{
+		fprintf(stderr, "reading the asset at %u failed: %s\n", file.offset, ex.what());
+		return false;
+	}
+}
+
+static void MapsFiles()
+{
+	std::string path = TempPath("sblt_mapped_file.bin");
+	std::vector<uint8_t> contents = MakeContents(100000, 1);
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write((const char*)contents.data(), contents.size());
+	}
+
+	{
+		MappedFile mapping(path);
+		TEST_CHECK(mapping.Size() == contents.size());
+		TEST_CHECK(mapping.Data() && memcmp(mapping.Data(), contents.data(), contents.size()) == 0);
+	}
+
+	// Empty files can't be mapped, but there's nothing to read from them either
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	}
+	{
+		MappedFile mapping(path);
+		TEST_CHECK(mapping.Size() == 0);
+	}
+
+	std::filesystem::remove(path);
+
+	bool threw = false;
+	try
+	{
+		MappedFile mapping(path);
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	TEST_CHECK(threw);
+}
+
+static void PlainBundle()
+{
+	std::string path = TempPath("sblt_plain_bundle.bundle");
+	std::vector<Asset> assets = WritePlainBundle(path, 200, 20000, 2);
+
+	DieselBundle bundle;
+	bundle.path = path;
+
+	for (const Asset& asset : assets)
+		TEST_CHECK(CheckAsset(MakeFile(&bundle, asset), asset.contents));
+
+	// The last asset can run to the end of the file
+	DslFile last = MakeFile(&bundle, assets.back());
+	last.length = ~0u;
+	TEST_CHECK(CheckAsset(last, assets.back().contents));
+
+	// Every read shares the one mapping
+	TEST_CHECK(&bundle.Mapping() == &bundle.Mapping());
+
+	// Anything past the end of the file is an error rather than a crash
+	DslFile broken = MakeFile(&bundle, assets.back());
+	broken.length += 1;
+	bool threw = false;
+	try
+	{
+		(void)broken.ReadContents();
+	}
+	catch (const std::runtime_error&)
+	{
+		threw = true;
+	}
+	TEST_CHECK(threw);
+
+	std::filesystem::remove(path);
+}
+
+static void PackagedBundle()
+{
+	std::string path = TempPath("sblt_packaged_bundle.bundle");
+
+	// A mix of assets smaller than a chunk, sharing chunks, and spanning several of them
+	std::vector<Asset> assets = MakePackagedAssets(300, 3 * DieselBundle::CHUNK_SIZE / 2, 3);
+
+	DieselBundle bundle;
+	bundle.path = path;
+	bundle.ChunkOffsets = WritePackagedBundle(path, assets, bundle.DecompressedFileSize);
+	TEST_CHECK(bundle.ChunkOffsets.size() > 100);
+
+	for (const Asset& asset : assets)
+		TEST_CHECK(CheckAsset(MakeFile(&bundle, asset), asset.contents));
+
+	DslFile last = MakeFile(&bundle, assets.back());
+	last.length = ~0u;
+	TEST_CHECK(CheckAsset(last, assets.back().contents));
+
+	// The game streams these out through a datastore instead
+	BLTChunkedBundleDataStore datastore(&bundle);
+	TEST_CHECK(datastore.size() == bundle.DecompressedFileSize);
+	for (size_t i = 0; i < assets.size(); i += 7)
+	{
+		std::vector<uint8_t> data(assets[i].length);
+		TEST_CHECK(datastore.read(assets[i].offset, data.data(), data.size()) == data.size());
+		TEST_CHECK(data == assets[i].contents);
+	}
+
+	std::filesystem::remove(path);
+}
+
+// Lots of threads reading from the same bundle at once, which is what the parallel loaders do
+static void ConcurrentReads()
+{
+	std::string plainPath = TempPath("sblt_concurrent_plain.bundle");
+	std::string packagedPath = TempPath("sblt_concurrent_packaged.bundle");
+
+	std::vector<Asset> plainAssets = WritePlainBundle(plainPath, 100, 30000, 4);
+	std::vector<Asset> packagedAssets = MakePackagedAssets(100, 100000, 5);
+
+	DieselBundle plain;
+	plain.path = plainPath;
+
+	DieselBundle packaged;
+	packaged.path = packagedPath;
+	packaged.ChunkOffsets = WritePackagedBundle(packagedPath, packagedAssets, packaged.DecompressedFileSize);
+
+	std::atomic<size_t> failures = 0;
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < 8; t++)
+	{
+		threads.emplace_back([&, t] {
+			for (size_t i = 0; i < 100; i++)
+			{
+				size_t index = (i * 31 + t * 17) % 100;
+				if (!CheckAsset(MakeFile(&plain, plainAssets[index]), plainAssets[index].contents))
+					failures++;
+				if (!CheckAsset(MakeFile(&packaged, packagedAssets[index]), packagedAssets[index].contents))
+					failures++;
+			}
+		});
+	}
+
+	for (std::thread& thread : threads)
+		thread.join();
+
+	TEST_CHECK_MSG(failures == 0, "%zu reads failed", failures.load());
+
+	std::filesystem::remove(plainPath);
+	std::filesystem::remove(packagedPath);
+}
+
+int main()
+{
+	MapsFiles();
+	PlainBundle();
+	PackagedBundle();
+	ConcurrentReads();
+
+	return TEST_RESULT;
+}
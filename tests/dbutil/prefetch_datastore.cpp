@@ -0,0 +1,611 @@
+#include "dbutil/DB.h"
+#include "dbutil/Datastore.h"
+#include "dbutil/FileHandleCache.h"
+#include "threading/queue.h"
+#include "threading/threadpool.h"
+
+#include "test.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <string.h>
+
+// Runs BLTPrefetchDataStore and BLTAsyncFileDataStore against an in-memory stand-in for the file layer,
+// which can hold reads up to check what happens while a read is queued or in progress.
+
+using blt::db::DieselBundle;
+using blt::db::FileHandleCache;
+using blt::db::SharedFile;
+using raidhook::EventQueueMaster;
+using raidhook::TaskClass;
+using raidhook::ThreadPool;
+
+using namespace std::chrono_literals;
+
+// The stub file layer
+
+namespace
+{
+	std::map<std::string, std::string> memory_files;
+
+	// Every read from a file, including the prefetches
+	std::atomic<size_t> file_reads = 0;
+
+	// While set, reads stop one byte short, as if the file had been cut off
+	std::atomic<bool> short_reads = false;
+
+	// While this is closed, reads wait in ReadAt
+	class Gate
+	{
+	  public:
+		void Close()
+		{
+			std::lock_guard guard(mutex);
+			open = false;
+		}
+
+		void Open()
+		{
+			std::lock_guard guard(mutex);
+			open = true;
+			cv.notify_all();
+		}
+
+		void Pass()
+		{
+			std::unique_lock lock(mutex);
+			waiting++;
+			cv.notify_all();
+			cv.wait(lock, [this] { return open; });
+			waiting--;
+		}
+
+		// Returns false if nothing turned up in time
+		bool WaitForReaders(size_t count)
+		{
+			std::unique_lock lock(mutex);
+			return cv.wait_for(lock, 5s, [this, count] { return waiting >= count; });
+		}
+
+	  private:
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool open = true;
+		size_t waiting = 0;
+	};
+
+	Gate read_gate;
+} // namespace
+
+SharedFile::~SharedFile()
+{
+}
+
+size_t SharedFile::ReadAt(uint64_t position, uint8_t* data, size_t length) const
+{
+	file_reads++;
+	read_gate.Pass();
+
+	const std::string& contents = *(const std::string*)handle;
+	if (position >= contents.size())
+		return 0;
+
+	size_t count = std::min<size_t>(length, contents.size() - position);
+	if (short_reads && count > 0)
+		count--;
+
+	memcpy(data, contents.data() + position, count);
+	return count;
+}
+
+FileHandleCache& FileHandleCache::Instance()
+{
+	static FileHandleCache instance;
+	return instance;
+}
+
+std::shared_ptr<SharedFile> FileHandleCache::Open(const std::string& path)
+{
+	auto iter = memory_files.find(path);
+	if (iter == memory_files.end())
+		return nullptr;
+
+	return std::make_shared<SharedFile>((HANDLE)&iter->second, iter->second.size());
+}
+
+void DieselBundle::InflateChunk(size_t chunkIdx, std::vector<uint8_t>& out)
+{
+	throw std::runtime_error("packaged bundles aren't used by this test");
+}
+
+// Helpers
+
+namespace
+{
+	const std::string TEST_FILE = "test_file";
+	const size_t TEST_FILE_SIZE = 100000;
+
+	// Keeps every I/O worker in the thread pool busy, so any prefetch that's opened stays queued
+	class PoolBlocker
+	{
+	  public:
+		PoolBlocker() : workers(ThreadPool::GetSingleton().GetWorkerCount())
+		{
+			// The tasks might still be finishing up after this is gone
+			std::shared_ptr<State> state = this->state;
+
+			for (size_t i = 0; i < workers; i++)
+			{
+				ThreadPool::GetSingleton().Submit(TaskClass::IO, [state] {
+					std::unique_lock lock(state->mutex);
+					state->started++;
+					state->cv.notify_all();
+					state->cv.wait(lock, [&state] { return state->released; });
+				});
+			}
+
+			std::unique_lock lock(state->mutex);
+			state->cv.wait(lock, [this, &state] { return state->started == workers; });
+		}
+
+		~PoolBlocker()
+		{
+			Release();
+		}
+
+		size_t TaskCount() const
+		{
+			return workers;
+		}
+
+		void Release()
+		{
+			std::lock_guard guard(state->mutex);
+			state->released = true;
+			state->cv.notify_all();
+		}
+
+	  private:
+		struct State
+		{
+			std::mutex mutex;
+			std::condition_variable cv;
+			size_t started = 0;
+			bool released = false;
+		};
+
+		const size_t workers;
+		std::shared_ptr<State> state = std::make_shared<State>();
+	};
+
+	uint64_t CompletedIOTasks()
+	{
+		return ThreadPool::GetSingleton().GetStats().completed[(size_t)TaskClass::IO];
+	}
+
+	// Waits until the pool has finished running count I/O tasks in total
+	void WaitForIOTasks(uint64_t count)
+	{
+		auto deadline = std::chrono::steady_clock::now() + 5s;
+		while (CompletedIOTasks() < count)
+		{
+			if (std::chrono::steady_clock::now() > deadline)
+			{
+				TEST_CHECK_MSG(false, "the thread pool didn't finish its tasks");
+				return;
+			}
+
+			std::this_thread::sleep_for(1ms);
+		}
+	}
+
+	// Reads through the datastore and checks the result against the file
+	void CheckRead(BLTAbstractDataStore* store, uint64_t position, size_t length)
+	{
+		std::string buffer(length, '\0');
+		size_t count = store->read(position, (uint8_t*)buffer.data(), length);
+
+		TEST_CHECK(count == length);
+		TEST_CHECK_MSG(buffer == memory_files[TEST_FILE].substr((size_t)position, length), "read of %zu at %llu", length,
+		               (unsigned long long)position);
+	}
+
+	// Stands in for dsl::Archive, reading from an asynchronous datastore the same way: register a
+	// callback, start a read, then keep running frames (and so the event queues) until it's done.
+	class TestArchive
+	{
+	  public:
+		explicit TestArchive(BLTAbstractDataStore* datastore) : datastore(datastore)
+		{
+			TEST_CHECK(datastore->is_asynchronous());
+			datastore->set_asynchronous_completion_callback(this);
+		}
+
+		// Returns false if the read didn't finish in time, or failed
+		bool Read(uint64_t position, uint8_t* data, size_t length, size_t& count)
+		{
+			count = datastore->read(position, data, length);
+
+			auto deadline = std::chrono::steady_clock::now() + 5s;
+			while (datastore->state() == (uint64_t)BLTAsyncFileDataStore::State::Busy)
+			{
+				if (std::chrono::steady_clock::now() > deadline)
+					return false;
+
+				RunFrame();
+			}
+
+			return datastore->state() == (uint64_t)BLTAsyncFileDataStore::State::Ready;
+		}
+
+		// The game thread's update, which is where the completion callbacks get run
+		static void RunFrame()
+		{
+			EventQueueMaster::GetSingleton().ProcessEvents();
+			std::this_thread::sleep_for(1ms);
+		}
+
+		std::atomic<size_t> completions = 0;
+
+	  private:
+		BLTAbstractDataStore* datastore;
+	};
+
+	// What the completion handler has been called with, in order
+	std::mutex completion_mutex;
+	std::vector<std::pair<BLTAsyncFileDataStore*, void*>> completions;
+
+	void RecordCompletion(BLTAsyncFileDataStore* datastore, void* callback)
+	{
+		std::lock_guard guard(completion_mutex);
+		completions.emplace_back(datastore, callback);
+		((TestArchive*)callback)->completions++;
+	}
+
+	size_t CompletionCount()
+	{
+		std::lock_guard guard(completion_mutex);
+		return completions.size();
+	}
+
+	// Runs frames until the completion handler has been called count times in total
+	void WaitForCompletions(size_t count)
+	{
+		auto deadline = std::chrono::steady_clock::now() + 5s;
+		while (CompletionCount() < count && std::chrono::steady_clock::now() < deadline)
+			TestArchive::RunFrame();
+
+		TEST_CHECK_MSG(CompletionCount() >= count, "only %zu of %zu completions ran", CompletionCount(), count);
+	}
+} // namespace
+
+// Tests
+
+// The prefetch runs when the datastore is opened, and reads inside it don't touch the file
+static void ReadsFromPrefetch()
+{
+	file_reads = 0;
+	uint64_t tasks = CompletedIOTasks();
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 1000, 50000);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	TEST_CHECK(store->size() == TEST_FILE_SIZE);
+
+	WaitForIOTasks(tasks + 1);
+	TEST_CHECK(file_reads == 1);
+
+	CheckRead(store, 1000, 50000);
+	CheckRead(store, 1000, 1);
+	CheckRead(store, 20000, 100);
+	CheckRead(store, 50999, 1);
+	TEST_CHECK(file_reads == 1);
+
+	delete store;
+}
+
+// Anything that's not entirely inside the prefetched part is read from the file
+static void ReadsOutsidePrefetch()
+{
+	uint64_t tasks = CompletedIOTasks();
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 1000, 50000);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	WaitForIOTasks(tasks + 1);
+	file_reads = 0;
+
+	CheckRead(store, 0, 100);
+	CheckRead(store, 999, 2);
+	CheckRead(store, 50999, 2);
+	CheckRead(store, 60000, 40000);
+	TEST_CHECK(file_reads == 4);
+
+	delete store;
+
+	// Prefetching from past the end of the file gets nothing, and everything's read from the file
+	store = BLTPrefetchDataStore::Open(TEST_FILE, TEST_FILE_SIZE + 100, 1000);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	WaitForIOTasks(tasks + 2);
+	file_reads = 0;
+
+	CheckRead(store, 0, TEST_FILE_SIZE);
+	TEST_CHECK(file_reads == 1);
+
+	delete store;
+}
+
+// A read that comes in while the prefetch is running waits for it, then uses it
+static void ReadWaitsForRunningPrefetch()
+{
+	read_gate.Close();
+	file_reads = 0;
+	uint64_t tasks = CompletedIOTasks();
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 0, 10000);
+	TEST_CHECK(store != nullptr);
+	TEST_CHECK(read_gate.WaitForReaders(1));
+
+	std::atomic<bool> done = false;
+	std::thread reader([&] {
+		CheckRead(store, 500, 500);
+		done = true;
+	});
+
+	std::this_thread::sleep_for(50ms);
+	TEST_CHECK(!done);
+
+	read_gate.Open();
+	reader.join();
+
+	TEST_CHECK(done);
+	TEST_CHECK(file_reads == 1);
+
+	delete store;
+	WaitForIOTasks(tasks + 1);
+}
+
+// If the game reads before the prefetch has started, the prefetch is cancelled and the file is read directly
+static void ReadClaimsQueuedPrefetch()
+{
+	uint64_t tasks = CompletedIOTasks();
+	PoolBlocker blocker;
+	file_reads = 0;
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 0, 10000);
+	TEST_CHECK(store != nullptr);
+
+	CheckRead(store, 500, 500);
+	CheckRead(store, 600, 500);
+	TEST_CHECK(file_reads == 2);
+
+	delete store;
+
+	// The prefetch task still runs, but mustn't touch the datastore or its file
+	blocker.Release();
+	WaitForIOTasks(tasks + blocker.TaskCount() + 1);
+	TEST_CHECK(file_reads == 2);
+}
+
+// Destroying the datastore while the prefetch is running waits for it to finish with the file
+static void DestroyWhilePrefetchRunning()
+{
+	read_gate.Close();
+	file_reads = 0;
+	uint64_t tasks = CompletedIOTasks();
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 0, 10000);
+	TEST_CHECK(store != nullptr);
+	TEST_CHECK(read_gate.WaitForReaders(1));
+
+	std::atomic<bool> destroyed = false;
+	std::thread destroyer([&] {
+		delete store;
+		destroyed = true;
+	});
+
+	std::this_thread::sleep_for(50ms);
+	TEST_CHECK(!destroyed);
+
+	read_gate.Open();
+	destroyer.join();
+
+	TEST_CHECK(destroyed);
+	TEST_CHECK(file_reads == 1);
+	WaitForIOTasks(tasks + 1);
+}
+
+// Destroying the datastore before the prefetch starts doesn't wait for it at all
+static void DestroyWhilePrefetchQueued()
+{
+	uint64_t tasks = CompletedIOTasks();
+	PoolBlocker blocker;
+	file_reads = 0;
+
+	BLTPrefetchDataStore* store = BLTPrefetchDataStore::Open(TEST_FILE, 0, 10000);
+	TEST_CHECK(store != nullptr);
+	delete store;
+
+	blocker.Release();
+	WaitForIOTasks(tasks + blocker.TaskCount() + 1);
+	TEST_CHECK(file_reads == 0);
+}
+
+
+// Drives an asynchronous datastore the way dsl::Archive does, reading a file in pieces
+static void AsyncReadsLikeArchive()
+{
+	BLTAsyncFileDataStore* store = BLTAsyncFileDataStore::Open(TEST_FILE);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	TEST_CHECK(store->size() == TEST_FILE_SIZE);
+	TEST_CHECK(store->state() == (uint64_t)BLTAsyncFileDataStore::State::Ready);
+
+	size_t before = CompletionCount();
+	TestArchive archive(store);
+
+	const std::string& contents = memory_files[TEST_FILE];
+	std::string buffer(TEST_FILE_SIZE, '\0');
+	size_t reads = 0;
+	for (size_t position = 0; position < TEST_FILE_SIZE; position += 30000, reads++)
+	{
+		size_t count = 0;
+		TEST_CHECK(archive.Read(position, (uint8_t*)buffer.data() + position, 30000, count));
+
+		// The last one is cut off at the end of the file
+		TEST_CHECK(count == std::min<size_t>(30000, TEST_FILE_SIZE - position));
+	}
+	TEST_CHECK(buffer == contents);
+
+	// Reading past the end finishes straight away with nothing
+	size_t count = 1;
+	TEST_CHECK(archive.Read(TEST_FILE_SIZE + 10, (uint8_t*)buffer.data(), 100, count));
+	TEST_CHECK(count == 0);
+	reads++;
+
+	// Every read gets exactly one callback, run on this thread with the callback it was given
+	WaitForCompletions(before + reads);
+	TEST_CHECK(archive.completions == reads);
+	{
+		std::lock_guard guard(completion_mutex);
+		for (size_t i = before; i < completions.size(); i++)
+			TEST_CHECK(completions[i].first == store && completions[i].second == &archive);
+	}
+
+	delete store;
+}
+
+// read() returns before the data is there, and the archive has to wait for state() to change
+static void AsyncReadDoesNotBlock()
+{
+	BLTAsyncFileDataStore* store = BLTAsyncFileDataStore::Open(TEST_FILE);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	size_t before = CompletionCount();
+	TestArchive archive(store);
+
+	read_gate.Close();
+	std::string buffer(1000, '\0');
+	TEST_CHECK(store->read(5000, (uint8_t*)buffer.data(), buffer.size()) == buffer.size());
+	TEST_CHECK(read_gate.WaitForReaders(1));
+	TEST_CHECK(store->state() == (uint64_t)BLTAsyncFileDataStore::State::Busy);
+
+	// No callback until it's done
+	TestArchive::RunFrame();
+	TEST_CHECK(archive.completions == 0);
+
+	read_gate.Open();
+	WaitForCompletions(before + 1);
+	TEST_CHECK(store->state() == (uint64_t)BLTAsyncFileDataStore::State::Ready);
+	TEST_CHECK(buffer == memory_files[TEST_FILE].substr(5000, 1000));
+
+	delete store;
+}
+
+// A read that comes up short is reported through state()
+static void AsyncReadFails()
+{
+	BLTAsyncFileDataStore* store = BLTAsyncFileDataStore::Open(TEST_FILE);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	size_t before = CompletionCount();
+	TestArchive archive(store);
+
+	std::string buffer(1000, '\0');
+	size_t count = 0;
+	short_reads = true;
+	TEST_CHECK(!archive.Read(0, (uint8_t*)buffer.data(), buffer.size(), count));
+	short_reads = false;
+	TEST_CHECK(store->state() == (uint64_t)BLTAsyncFileDataStore::State::Failed);
+
+	// The next read is fine again
+	TEST_CHECK(archive.Read(0, (uint8_t*)buffer.data(), buffer.size(), count));
+	WaitForCompletions(before + 2);
+	TEST_CHECK(archive.completions == 2);
+
+	delete store;
+}
+
+// Destroying the datastore during a read waits for it, as the archive's buffer goes with it, and the
+// callback for that read is never run
+static void AsyncDestroyWhileReading()
+{
+	BLTAsyncFileDataStore* store = BLTAsyncFileDataStore::Open(TEST_FILE);
+	TEST_CHECK(store != nullptr);
+	if (!store)
+		return;
+
+	size_t before = CompletionCount();
+	TestArchive archive(store);
+
+	read_gate.Close();
+	std::string buffer(1000, '\0');
+	store->read(0, (uint8_t*)buffer.data(), buffer.size());
+	TEST_CHECK(read_gate.WaitForReaders(1));
+
+	std::atomic<bool> destroyed = false;
+	std::thread destroyer([&] {
+		delete store;
+		destroyed = true;
+	});
+
+	std::this_thread::sleep_for(50ms);
+	TEST_CHECK(!destroyed);
+
+	read_gate.Open();
+	destroyer.join();
+	TEST_CHECK(destroyed);
+	TEST_CHECK(buffer == memory_files[TEST_FILE].substr(0, 1000));
+
+	for (int i = 0; i < 20; i++)
+		TestArchive::RunFrame();
+	TEST_CHECK(CompletionCount() == before);
+	TEST_CHECK(archive.completions == 0);
+}
+
+int main()
+{
+	std::string& contents = memory_files[TEST_FILE];
+	for (size_t i = 0; i < TEST_FILE_SIZE; i++)
+		contents.push_back((char)(i * 7 + i / 256));
+
+	TEST_CHECK(BLTPrefetchDataStore::Open("missing_file", 0, 100) == nullptr);
+
+	ReadsFromPrefetch();
+	ReadsOutsidePrefetch();
+	ReadWaitsForRunningPrefetch();
+	ReadClaimsQueuedPrefetch();
+	DestroyWhilePrefetchRunning();
+	DestroyWhilePrefetchQueued();
+
+	BLTAsyncFileDataStore::SetCompletionHandler(RecordCompletion);
+	TEST_CHECK(BLTAsyncFileDataStore::Open("missing_file") == nullptr);
+
+	AsyncReadsLikeArchive();
+	AsyncReadDoesNotBlock();
+	AsyncReadFails();
+	AsyncDestroyWhileReading();
+
+	return TEST_RESULT;
+}
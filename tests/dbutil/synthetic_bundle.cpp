@@ -0,0 +1,138 @@
+#include "synthetic_bundle.h"
+
+#include "dbutil/DB.h"
+#include "util/util.h"
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#include <string.h>
+
+#include <zlib.h>
+
+// DB.cpp's DieselDB constructor lists the game's assets directory, which is in the Windows-only part of
+// util. Nothing here builds a DieselDB, only the bundles and files inside one.
+std::vector<std::string> raidhook::Util::GetDirectoryContents(const std::string& path, bool isDirs)
+{
+	throw std::runtime_error("DieselDB isn't used by the bundle tests");
+}
+
+namespace synthetic_bundle
+{
+	std::vector<uint8_t> MakeContents(size_t size, uint32_t seed)
+	{
+		// Runs of repeated words with some noise, which deflates to about a third of its size
+		static const char* words[] = { "unit", "object", "body", "anim_state_machine", "sequence", "material", "  ", "\n" };
+
+		std::mt19937 random(seed);
+		std::vector<uint8_t> contents;
+		contents.reserve(size);
+
+		while (contents.size() < size)
+		{
+			const char* word = words[random() % std::size(words)];
+			contents.insert(contents.end(), word, word + strlen(word));
+			contents.push_back((uint8_t)random());
+		}
+
+		contents.resize(size);
+		return contents;
+	}
+
+	// A block as the bundles store it: the deflated data, then the inflated size
+	static std::vector<uint8_t> CompressBlock(const uint8_t* data, size_t size)
+	{
+		uLongf compressedSize = compressBound((uLong)size);
+		std::vector<uint8_t> block(compressedSize + sizeof(uint32_t));
+
+		if (compress(block.data(), &compressedSize, data, (uLong)size) != Z_OK)
+			throw std::runtime_error("Failed to compress a synthetic block");
+
+		uint32_t inflatedSize = (uint32_t)size;
+		memcpy(block.data() + compressedSize, &inflatedSize, sizeof(inflatedSize));
+		block.resize(compressedSize + sizeof(inflatedSize));
+		return block;
+	}
+
+	std::vector<Asset> WritePlainBundle(const std::string& path, size_t count, size_t maxSize, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+		std::vector<Asset> assets;
+		unsigned int offset = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			Asset asset;
+			asset.contents = MakeContents(1 + random() % maxSize, seed + (uint32_t)i);
+
+			std::vector<uint8_t> block = CompressBlock(asset.contents.data(), asset.contents.size());
+			out.write((const char*)block.data(), block.size());
+
+			asset.offset = offset;
+			asset.length = (unsigned int)block.size();
+			offset += asset.length;
+
+			assets.push_back(std::move(asset));
+		}
+
+		return assets;
+	}
+
+	std::vector<Asset> MakePackagedAssets(size_t count, size_t maxSize, uint32_t seed)
+	{
+		std::mt19937 random(seed);
+		std::vector<Asset> assets;
+		unsigned int offset = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			Asset asset;
+			asset.contents = MakeContents(1 + random() % maxSize, seed + (uint32_t)i);
+			asset.offset = offset;
+			asset.length = (unsigned int)asset.contents.size();
+			offset += asset.length;
+
+			assets.push_back(std::move(asset));
+		}
+
+		return assets;
+	}
+
+	std::vector<size_t> WritePackagedBundle(const std::string& path, const std::vector<Asset>& assets,
+	                                        size_t& decompressedSize)
+	{
+		std::vector<uint8_t> contents;
+		for (const Asset& asset : assets)
+			contents.insert(contents.end(), asset.contents.begin(), asset.contents.end());
+
+		decompressedSize = contents.size();
+
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		std::vector<size_t> chunkOffsets;
+		size_t position = 0;
+
+		for (size_t start = 0; start < contents.size(); start += blt::db::DieselBundle::CHUNK_SIZE)
+		{
+			size_t size = std::min(blt::db::DieselBundle::CHUNK_SIZE, contents.size() - start);
+			std::vector<uint8_t> block = CompressBlock(contents.data() + start, size);
+
+			uint32_t compressedLength = (uint32_t)block.size();
+			out.write((const char*)&compressedLength, sizeof(compressedLength));
+			out.write((const char*)block.data(), block.size());
+
+			chunkOffsets.push_back(position);
+			position += sizeof(compressedLength) + block.size();
+		}
+
+		return chunkOffsets;
+	}
+
+	std::string TempPath(const std::string& name)
+	{
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+} // namespace synthetic_bundle
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Writes bundles in the same layout as the game's, for the tests and benchmarks to read back through
+// DieselBundle and DslFile. Also see synthetic_bundle.cpp for the bits of the DB it stands in for.
+
+namespace synthetic_bundle
+{
+	struct Asset
+	{
+		unsigned int offset; // In the file for plain bundles, or the decompressed data for packaged ones
+		unsigned int length; // Compressed length for plain bundles, decompressed for packaged ones
+		std::vector<uint8_t> contents;
+	};
+
+	// Somewhat compressible data, different for every seed
+	std::vector<uint8_t> MakeContents(size_t size, uint32_t seed);
+
+	// A plain bundle, where each asset is compressed separately and placed one after another
+	std::vector<Asset> WritePlainBundle(const std::string& path, size_t count, size_t maxSize, uint32_t seed);
+
+	// A packaged bundle, where the assets are placed one after another and the whole lot is compressed
+	// in 64KiB chunks. Returns the file offset of each chunk, and sets decompressedSize.
+	std::vector<size_t> WritePackagedBundle(const std::string& path, const std::vector<Asset>& assets,
+	                                        size_t& decompressedSize);
+
+	// Lays out count assets of up to maxSize bytes for a packaged bundle
+	std::vector<Asset> MakePackagedAssets(size_t count, size_t maxSize, uint32_t seed);
+
+	// Somewhere in the temp directory
+	std::string TempPath(const std::string& name);
+} // namespace synthetic_bundle
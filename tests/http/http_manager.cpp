@@ -0,0 +1,520 @@
+#include "http/http.h"
+#include "threading/queue.h"
+
+#include "test.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Sends requests through HTTPManager to a small HTTP server on localhost, and checks they all come back
+// right, that no more run at once than the limit allows, that connections get reused, and that all of
+// it happens on the one network thread.
+
+using raidhook::EventQueueMaster;
+using raidhook::HTTPItem;
+using raidhook::HTTPManager;
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	// Every byte of a body is different from its neighbours, so one that got mixed up can't pass
+	uint8_t ByteAt(size_t position)
+	{
+		uint32_t value = (uint32_t)position * 2654435761u;
+		return (uint8_t)(value >> 24) ^ (uint8_t)position;
+	}
+
+	std::string MakeBody(size_t size)
+	{
+		std::string body(size, '\0');
+		for (size_t i = 0; i < size; i++)
+			body[i] = (char)ByteAt(i);
+		return body;
+	}
+
+	// Understands just enough HTTP/1.1 for curl, keeping connections open between requests. Each
+	// connection gets its own thread. The paths it answers are:
+	//   /size/N     N bytes of body
+	//   /slow/N     a short body after waiting N milliseconds
+	//   /drip/N     N bytes of body, sent a piece at a time so progress gets reported along the way
+	//   /status/N   an empty reply with that status code
+	class LocalServer
+	{
+	  public:
+		LocalServer()
+		{
+			listener = socket(AF_INET, SOCK_STREAM, 0);
+
+			int reuse = 1;
+			setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+			sockaddr_in address = {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			address.sin_port = 0;
+
+			if (bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0)
+			{
+				perror("couldn't start the local server");
+				exit(1);
+			}
+
+			socklen_t length = sizeof(address);
+			getsockname(listener, (sockaddr*)&address, &length);
+			port = ntohs(address.sin_port);
+
+			acceptThread = std::thread(&LocalServer::Accept, this);
+		}
+
+		~LocalServer()
+		{
+			stopping = true;
+			shutdown(listener, SHUT_RDWR);
+			close(listener);
+			acceptThread.join();
+
+			std::lock_guard guard(mutex);
+			for (int connection : connections)
+				shutdown(connection, SHUT_RDWR);
+			for (std::thread& thread : threads)
+				thread.join();
+		}
+
+		std::string Url(const std::string& path) const
+		{
+			return "http://127.0.0.1:" + std::to_string(port) + path;
+		}
+
+		void ResetCounts()
+		{
+			accepted = 0;
+			requests = 0;
+			peakInFlight = 0;
+		}
+
+		std::atomic<size_t> accepted = 0;     // Connections opened
+		std::atomic<size_t> requests = 0;     // Requests answered
+		std::atomic<size_t> inFlight = 0;     // Requests being answered right now
+		std::atomic<size_t> peakInFlight = 0; // The most requests that were ever being answered at once
+		std::atomic<size_t> liveThreads = 0;  // The server's own threads, including the one accepting
+
+	  private:
+		void Accept()
+		{
+			liveThreads++;
+
+			while (!stopping)
+			{
+				int connection = accept(listener, nullptr, nullptr);
+				if (connection < 0)
+					continue;
+
+				accepted++;
+
+				std::lock_guard guard(mutex);
+				connections.push_back(connection);
+				threads.emplace_back(&LocalServer::Serve, this, connection);
+			}
+
+			liveThreads--;
+		}
+
+		void Serve(int connection)
+		{
+			liveThreads++;
+
+			std::string buffer;
+			char chunk[4096];
+
+			while (true)
+			{
+				size_t end = buffer.find("\r\n\r\n");
+				if (end == std::string::npos)
+				{
+					ssize_t count = recv(connection, chunk, sizeof(chunk), 0);
+					if (count <= 0)
+						break;
+					buffer.append(chunk, count);
+					continue;
+				}
+
+				// GET /path HTTP/1.1
+				size_t pathStart = buffer.find(' ') + 1;
+				std::string path = buffer.substr(pathStart, buffer.find(' ', pathStart) - pathStart);
+				buffer.erase(0, end + 4);
+
+				size_t now = ++inFlight;
+				size_t peak = peakInFlight;
+				while (now > peak && !peakInFlight.compare_exchange_weak(peak, now))
+				{
+				}
+
+				bool sent = Respond(connection, path);
+
+				inFlight--;
+				requests++;
+
+				if (!sent)
+					break;
+			}
+
+			close(connection);
+			liveThreads--;
+		}
+
+		bool Respond(int connection, const std::string& path)
+		{
+			int status = 200;
+			std::string body;
+			size_t dripSize = 0;
+
+			size_t argument = (size_t)atoll(path.c_str() + path.rfind('/') + 1);
+			if (path.starts_with("/size/"))
+			{
+				body = MakeBody(argument);
+			}
+			else if (path.starts_with("/slow/"))
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(argument));
+				body = "slow";
+			}
+			else if (path.starts_with("/drip/"))
+			{
+				body = MakeBody(argument);
+				dripSize = argument / 8 + 1;
+			}
+			else if (path.starts_with("/status/"))
+			{
+				status = (int)argument;
+			}
+			else
+			{
+				status = 404;
+			}
+
+			std::string headers = "HTTP/1.1 " + std::to_string(status) + " Test\r\n"
+			                      "Content-Length: " + std::to_string(body.size()) + "\r\n"
+			                      "X-Sblt-Path: " + path + "\r\n"
+			                      "\r\n";
+
+			if (!SendAll(connection, headers.data(), headers.size()))
+				return false;
+
+			if (dripSize == 0)
+				return SendAll(connection, body.data(), body.size());
+
+			for (size_t start = 0; start < body.size(); start += dripSize)
+			{
+				if (!SendAll(connection, body.data() + start, std::min(dripSize, body.size() - start)))
+					return false;
+				std::this_thread::sleep_for(20ms);
+			}
+			return true;
+		}
+
+		static bool SendAll(int connection, const char* data, size_t size)
+		{
+			while (size > 0)
+			{
+				ssize_t count = send(connection, data, size, MSG_NOSIGNAL);
+				if (count <= 0)
+					return false;
+				data += count;
+				size -= count;
+			}
+			return true;
+		}
+
+		int listener;
+		int port;
+		std::atomic<bool> stopping = false;
+		std::thread acceptThread;
+
+		std::mutex mutex;
+		std::vector<int> connections;
+		std::vector<std::thread> threads;
+	};
+
+	// What came back for one request. HTTPManager deletes the item once its callback returns, so
+	// everything worth checking is copied out of it.
+	struct Result
+	{
+		bool done = false;
+		int errorCode = -1;
+		long status = 0;
+		std::string contents;
+		std::string path;
+		std::vector<std::pair<long, long>> progress;
+	};
+
+	void RecordResult(HTTPItem* item)
+	{
+		Result* result = (Result*)item->data;
+		result->done = true;
+		result->errorCode = item->errorCode;
+		result->status = item->httpStatusCode;
+		result->contents = std::move(item->httpContents);
+
+		auto header = item->responseHeaders.find("X-Sblt-Path");
+		if (header != item->responseHeaders.end())
+			result->path = header->second;
+	}
+
+	void RecordProgress(void* data, long progress, long total)
+	{
+		Result* result = (Result*)data;
+		result->progress.emplace_back(progress, total);
+	}
+
+	void Launch(const std::string& url, Result& result, const std::string& downloadPath = "", bool progress = false)
+	{
+		std::unique_ptr<HTTPItem> item = std::make_unique<HTTPItem>();
+		item->url = url;
+		item->call = RecordResult;
+		item->data = &result;
+		item->downloadPath = downloadPath;
+		if (progress)
+			item->progress = RecordProgress;
+
+		HTTPManager::GetSingleton()->LaunchHTTPRequest(std::move(item));
+	}
+
+	// Runs the game thread's side of things until every result is in. Returns false if they took too long.
+	bool WaitForResults(std::vector<Result>& results)
+	{
+		Clock::time_point deadline = Clock::now() + 60s;
+
+		while (Clock::now() < deadline)
+		{
+			EventQueueMaster::GetSingleton().ProcessEvents();
+
+			bool done = true;
+			for (const Result& result : results)
+				done = done && result.done;
+			if (done)
+				return true;
+
+			std::this_thread::sleep_for(1ms);
+		}
+
+		fprintf(stderr, "timed out waiting for the requests to finish\n");
+		return false;
+	}
+
+	// Every thread in the process, or zero if that can't be found out here
+	size_t CountThreads()
+	{
+#ifdef __linux__
+		std::error_code error;
+		std::filesystem::directory_iterator tasks("/proc/self/task", error);
+		if (!error)
+			return (size_t)std::distance(tasks, std::filesystem::directory_iterator());
+#endif
+		return 0;
+	}
+
+	std::string TempPath(const std::string& name)
+	{
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+} // namespace
+
+// Lots of requests of different sizes, all sent at once
+static void ManyRequests(LocalServer& server)
+{
+	const size_t count = 200;
+	std::vector<Result> results(count);
+
+	Clock::time_point start = Clock::now();
+
+	for (size_t i = 0; i < count; i++)
+		Launch(server.Url("/size/" + std::to_string((i * 7919) % 100000)), results[i]);
+
+	TEST_CHECK(WaitForResults(results));
+
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	size_t bytes = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t size = (i * 7919) % 100000;
+		TEST_CHECK_MSG(results[i].errorCode == 0 && results[i].status == 200, "request %zu: curl %d, HTTP %ld", i,
+		               results[i].errorCode, results[i].status);
+		TEST_CHECK_MSG(results[i].contents == MakeBody(size), "request %zu came back with the wrong body", i);
+		TEST_CHECK(results[i].path == "/size/" + std::to_string(size));
+		bytes += results[i].contents.size();
+	}
+
+	printf("%zu requests, %.1f MB in %.1f ms: %.0f requests/s, %.1f MB/s, over %zu connections\n", count,
+	       bytes / 1048576.0, seconds * 1000, count / seconds, bytes / 1048576.0 / seconds, server.accepted.load());
+}
+
+// No more requests are sent at once than the limit allows, and once some finish the rest go out over the
+// same connections
+static void ConcurrencyLimit(LocalServer& server)
+{
+	const size_t limit = 4;
+	const size_t count = 24;
+
+	HTTPManager::GetSingleton()->SetMaxConcurrentRequests(limit);
+	server.ResetCounts();
+
+	std::vector<Result> results(count);
+	for (size_t i = 0; i < count; i++)
+		Launch(server.Url("/slow/50"), results[i]);
+
+	TEST_CHECK(WaitForResults(results));
+
+	for (const Result& result : results)
+		TEST_CHECK(result.errorCode == 0 && result.status == 200 && result.contents == "slow");
+
+	TEST_CHECK(server.requests == count);
+	TEST_CHECK_MSG(server.peakInFlight <= limit, "%zu requests ran at once", server.peakInFlight.load());
+	TEST_CHECK_MSG(server.peakInFlight == limit, "only %zu requests ran at once", server.peakInFlight.load());
+
+	// Connections left over from the last test may be reused too, so this can be below the limit
+	TEST_CHECK_MSG(server.accepted <= limit, "%zu connections for %zu requests", server.accepted.load(), count);
+
+	HTTPManager::GetSingleton()->SetMaxConcurrentRequests(16);
+}
+
+// However many requests are running, they all run on the one network thread
+static void OneNetworkThread(LocalServer& server)
+{
+	size_t before = CountThreads();
+	if (before == 0)
+	{
+		printf("can't count threads here, skipping the thread check\n");
+		return;
+	}
+
+	const size_t count = 16;
+	std::vector<Result> results(count);
+	for (size_t i = 0; i < count; i++)
+		Launch(server.Url("/slow/200"), results[i]);
+
+	// Wait until they're all with the server, then see how many threads there are
+	Clock::time_point deadline = Clock::now() + 10s;
+	while (server.inFlight < count && Clock::now() < deadline)
+		std::this_thread::sleep_for(1ms);
+
+	TEST_CHECK_MSG(server.inFlight == count, "only %zu of %zu requests reached the server", server.inFlight.load(), count);
+
+	// Only this thread and the network thread are ours, the rest belong to the server
+	size_t ours = CountThreads() - server.liveThreads;
+	TEST_CHECK_MSG(ours <= 2, "%zu threads for %zu requests", ours, count);
+
+	TEST_CHECK(WaitForResults(results));
+	for (const Result& result : results)
+		TEST_CHECK(result.errorCode == 0 && result.status == 200);
+
+	printf("%zu requests at once used %zu threads outside the server\n", count, ours);
+}
+
+static void Statuses(LocalServer& server)
+{
+	std::vector<Result> results(3);
+	Launch(server.Url("/status/204"), results[0]);
+	Launch(server.Url("/status/404"), results[1]);
+	Launch(server.Url("/status/500"), results[2]);
+
+	TEST_CHECK(WaitForResults(results));
+
+	// Error statuses still come back as successful transfers, for the Lua side to look at
+	TEST_CHECK(results[0].errorCode == 0 && results[0].status == 204);
+	TEST_CHECK(results[1].errorCode == 0 && results[1].status == 404);
+	TEST_CHECK(results[2].errorCode == 0 && results[2].status == 500);
+
+	// Nothing's listening here, so that's a curl error instead
+	std::vector<Result> refused(1);
+	Launch("http://127.0.0.1:1/", refused[0]);
+	TEST_CHECK(WaitForResults(refused));
+	TEST_CHECK(refused[0].errorCode != 0);
+}
+
+// Downloads are written under a temporary name, and only show up once they're complete
+static void Downloads(LocalServer& server)
+{
+	std::string path = TempPath("sblt_http_download.bin");
+	std::string failedPath = TempPath("sblt_http_download_failed.bin");
+	std::filesystem::remove(path);
+	std::filesystem::remove(failedPath);
+
+	const size_t size = 3 * 1024 * 1024 + 17;
+
+	std::vector<Result> results(2);
+	Launch(server.Url("/size/" + std::to_string(size)), results[0], path);
+	Launch(server.Url("/status/404"), results[1], failedPath);
+
+	TEST_CHECK(WaitForResults(results));
+
+	TEST_CHECK(results[0].errorCode == 0 && results[0].status == 200);
+	TEST_CHECK(results[0].contents.empty());
+	TEST_CHECK(!std::filesystem::exists(path + ".part"));
+
+	std::ifstream in(path, std::ios::binary);
+	std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	TEST_CHECK_MSG(contents == MakeBody(size), "downloaded %zu bytes, expected %zu", contents.size(), size);
+
+	// A failed download doesn't leave anything behind
+	TEST_CHECK(results[1].status == 404);
+	TEST_CHECK(!std::filesystem::exists(failedPath));
+	TEST_CHECK(!std::filesystem::exists(failedPath + ".part"));
+
+	std::filesystem::remove(path);
+}
+
+// Progress is reported on the game thread as the body comes in, and never goes backwards
+static void Progress(LocalServer& server)
+{
+	const size_t size = 256 * 1024;
+
+	std::vector<Result> results(1);
+	Launch(server.Url("/drip/" + std::to_string(size)), results[0], "", true);
+
+	TEST_CHECK(WaitForResults(results));
+	TEST_CHECK(results[0].errorCode == 0 && results[0].contents == MakeBody(size));
+
+	const std::vector<std::pair<long, long>>& progress = results[0].progress;
+	TEST_CHECK_MSG(progress.size() >= 2, "only %zu progress updates", progress.size());
+
+	long last = 0;
+	for (const std::pair<long, long>& update : progress)
+	{
+		TEST_CHECK(update.first > last && update.first < (long)size);
+		TEST_CHECK(update.second == (long)size);
+		last = update.first;
+	}
+}
+
+int main()
+{
+	LocalServer server;
+
+	ManyRequests(server);
+	ConcurrencyLimit(server);
+	OneNetworkThread(server);
+	Statuses(server);
+	Downloads(server);
+	Progress(server);
+
+	return TEST_RESULT;
+}
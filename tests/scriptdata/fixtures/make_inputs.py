@@ -0,0 +1,181 @@
+"""
+Writes the ScriptData files the round-trip test's fixtures are made from, in both the 32 and 64-bit layouts.
+
+Each <name>.in.bin this writes was then read and written back out by the ScriptData writer as it was
+before it was changed to write in two passes, giving <name>.bin. The test checks the current writer
+gives exactly the same bytes for both. Apart from duplicate_keys, the old writer gave back exactly what
+it was given, so only the .bin is kept.
+
+Keys within a table are all the same type: entries are ordered by the address of their key, and the
+relative order of (for example) a string and a number depends on where the allocator put each type's
+items, so a mixed table doesn't have one right answer.
+
+Usage: make_inputs.py <output directory>
+"""
+
+import os
+import struct
+import sys
+
+NUM, STRING, VECTOR, QUAT, IDSTRING, TABLE = 3, 4, 5, 6, 7, 8
+ORDER = [NUM, STRING, VECTOR, QUAT, IDSTRING, TABLE]
+
+
+class Item:
+    def __init__(self, kind, value, meta=None):
+        self.kind = kind
+        self.value = value
+        self.meta = meta
+
+
+def num(v): return Item(NUM, v)
+def string(v): return Item(STRING, v)
+def vector(x, y, z): return Item(VECTOR, (x, y, z))
+def quat(x, y, z, w): return Item(QUAT, (x, y, z, w))
+def idstring(v): return Item(IDSTRING, v)
+
+
+def table(entries, meta=None):
+    return Item(TABLE, list(entries), meta)
+
+
+def array(values, meta=None):
+    return table([(num(i + 1), v) for i, v in enumerate(values)], meta)
+
+
+class Writer:
+    def __init__(self, is32bit):
+        self.ptr = "<I" if is32bit else "<Q"
+        self.items = {kind: [] for kind in ORDER}
+        self.index = {}
+
+    def add(self, item):
+        if not isinstance(item, Item) or id(item) in self.index:
+            return
+
+        self.index[id(item)] = len(self.items[item.kind])
+        self.items[item.kind].append(item)
+
+        if item.kind == TABLE:
+            if item.meta:
+                self.add(item.meta)
+            for key, value in item.value:
+                self.add(key)
+                self.add(value)
+
+    def ref(self, item):
+        if item is None:
+            return 0
+        if item is True:
+            return 1 << 24
+        if item is False:
+            return 2 << 24
+        return (item.kind << 24) | self.index[id(item)]
+
+    def write(self, root):
+        self.add(root)
+
+        ptr_size = struct.calcsize(self.ptr)
+        header_size = ptr_size + (8 + ptr_size * 2) * len(ORDER) + 4
+
+        # Lay each type's contents vector out after the header, with the strings' text and the tables'
+        # entries straight after their vectors
+        body = bytearray()
+        vectors = {}
+        for kind in ORDER:
+            items = self.items[kind]
+            vectors[kind] = header_size + len(body)
+
+            if kind == NUM:
+                for item in items:
+                    body += struct.pack("<f", item.value)
+            elif kind == VECTOR or kind == QUAT:
+                for item in items:
+                    body += struct.pack("<%df" % len(item.value), *item.value)
+            elif kind == IDSTRING:
+                for item in items:
+                    body += struct.pack("<Q", item.value)
+            elif kind == STRING:
+                text = header_size + len(body) + len(items) * ptr_size * 2
+                for item in items:
+                    body += struct.pack(self.ptr, 0) + struct.pack(self.ptr, text)
+                    text += len(item.value.encode()) + 1
+                for item in items:
+                    body += item.value.encode() + b"\0"
+            elif kind == TABLE:
+                contents = header_size + len(body) + len(items) * (ptr_size * 3 + 8)
+                for item in items:
+                    meta = self.index[id(item.meta)] if item.meta else 0xFFFFFFFF
+                    count = len(item.value)
+                    body += struct.pack(self.ptr, meta) + struct.pack("<II", count, count)
+                    body += struct.pack(self.ptr, contents) + struct.pack(self.ptr, 0)
+                    contents += count * 8
+                for item in items:
+                    for key, value in item.value:
+                        body += struct.pack("<II", self.ref(key), self.ref(value))
+
+        header = bytearray(struct.pack(self.ptr, 0))
+        for kind in ORDER:
+            count = len(self.items[kind])
+            header += struct.pack("<II", count, count) + struct.pack(self.ptr, vectors[kind]) + struct.pack(self.ptr, 0)
+        header += struct.pack("<I", self.ref(root))
+
+        return bytes(header + body)
+
+
+def nested_tables():
+    leaf = table([
+        (string("position"), vector(1.5, -2, 300)),
+        (string("rotation"), quat(0, 0.7071, 0, 0.7071)),
+        (string("unit"), idstring(0x0123456789ABCDEF)),
+        (string("enabled"), True),
+        (string("hidden"), False),
+        (string("name"), string("a leaf")),
+    ])
+    middle = table([
+        (string("leaf"), leaf),
+        (string("list"), array([num(1), num(2.5), string("three"), array([num(4), num(5)])])),
+        (string("empty"), table([])),
+    ])
+    return table([
+        (string("middle"), middle),
+        (string("again"), table([(string("middle"), middle)])),
+        (string("count"), num(42)),
+    ])
+
+
+def meta_strings():
+    weapon = string("weapon")
+    return array([
+        table([(string("id"), string("pistol")), (string("damage"), num(12))], meta=weapon),
+        table([(string("id"), string("rifle")), (string("damage"), num(30))], meta=weapon),
+        array([string("weapon"), string("not a meta string")], meta=string("list")),
+        table([(string("meta"), weapon)], meta=string("")),
+        table([]),
+    ])
+
+
+def duplicate_keys():
+    key = string("key")
+    other = string("other")
+    first = num(1)
+    return table([
+        (string("sub"), table([(first, string("a")), (num(2), string("b")), (first, string("c"))])),
+        (key, num(1)),
+        (other, string("kept")),
+        (key, num(2)),
+        (string("key"), string("same text, different string")),
+        (key, num(3)),
+    ])
+
+
+def main():
+    out = sys.argv[1]
+    for name, build in [("nested_tables", nested_tables), ("meta_strings", meta_strings), ("duplicate_keys", duplicate_keys)]:
+        for bits in (32, 64):
+            with open(os.path.join(out, "%s_%d.in.bin" % (name, bits)), "wb") as f:
+                f.write(Writer(bits == 32).write(build()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,611 @@
+#include "scriptdata/ScriptData.h"
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Times parsing a large generated ScriptData file in both the 32 and 64-bit layouts, with the current
+// parser and with the one from before it moved to flat arenas and string views, which is copied below.
+// Not run as a test: build it in release and run it by hand.
+//
+// Usage: scriptdata_benchmark [runs] [objects]
+
+using namespace raidhook::scriptdata;
+
+using Clock = std::chrono::steady_clock;
+
+// The old parser, cut down to just the reading side: every string is copied into a std::string, and
+// every table owns a std::map of its contents.
+
+namespace before
+{
+	class SItem
+	{
+	public:
+		virtual ~SItem() {}
+		virtual int GetId() const = 0;
+
+		int index = -1;
+	};
+
+	class SNil : public SItem
+	{
+	public:
+		int GetId() const override { return ID; }
+		static const int ID = 0;
+		static const SNil INSTANCE;
+	};
+
+	class SBool : public SItem
+	{
+	public:
+		explicit SBool(bool val) : val(val) {}
+		bool val;
+
+		int GetId() const override { return val ? ID_T : ID_F; }
+		static const int ID_T = 1;
+		static const int ID_F = 2;
+		static const SBool STRUE;
+		static const SBool SFALSE;
+	};
+
+	class SNum : public SItem
+	{
+	public:
+		SNum() : SNum(0) {}
+		explicit SNum(float val) : val(val) {}
+		float val;
+
+		int GetId() const override { return ID; }
+		static const int ID = 3;
+	};
+
+	class SString : public SItem
+	{
+	public:
+		SString() : SString(std::string()) {}
+		explicit SString(std::string val) : val(val) {}
+		std::string val;
+
+		int GetId() const override { return ID; }
+		static const int ID = 4;
+	};
+
+	class SVector : public SItem
+	{
+	public:
+		SVector() : SVector(0, 0, 0) {}
+		explicit SVector(float x, float y, float z) : x(x), y(y), z(z) {}
+		float x, y, z;
+
+		int GetId() const override { return ID; }
+		static const int ID = 5;
+	};
+
+	class SQuaternion : public SItem
+	{
+	public:
+		SQuaternion() : SQuaternion(0, 0, 0, 0) {}
+		explicit SQuaternion(float x, float y, float z, float w) : x(x), y(y), z(z), w(w) {}
+		float x, y, z, w;
+
+		int GetId() const override { return ID; }
+		static const int ID = 6;
+	};
+
+	class SIdstring : public SItem
+	{
+	public:
+		SIdstring() : SIdstring(0) {}
+		explicit SIdstring(uint64_t val) : val(val) {}
+		uint64_t val;
+
+		int GetId() const override { return ID; }
+		static const int ID = 7;
+	};
+
+	class STable : public SItem
+	{
+	public:
+		SString *meta;
+		std::map<const SItem*, const SItem*> items;
+
+		int GetId() const override { return ID; }
+		static const int ID = 8;
+	};
+
+	const SNil SNil::INSTANCE;
+	const SBool SBool::STRUE(true);
+	const SBool SBool::SFALSE(false);
+
+	template<typename Ptr>
+	struct RawVec
+	{
+		unsigned int count;
+		unsigned int capacity;
+		Ptr offset;
+		Ptr ignore;
+	};
+
+	template<typename Ptr>
+	struct RawStr
+	{
+		Ptr ignore;
+		Ptr str;
+	};
+
+	template<typename Ptr>
+	struct RawTable
+	{
+		Ptr meta;
+		RawVec<Ptr> contents;
+	};
+
+	typedef uint32_t valid_t;
+
+	template<typename T>
+	struct VecInfo
+	{
+		size_t count;
+		T *items;
+	};
+
+	template<typename T>
+	VecInfo<T> readVec(bool is32bit, const uint8_t *data, size_t &offset)
+	{
+		VecInfo<T> info = {};
+
+		if(is32bit)
+		{
+			RawVec<uint32_t> &vec = *(RawVec<uint32_t>*) &data[offset];
+			info.count = vec.count;
+			info.items = (T*) &data[vec.offset];
+			offset += sizeof(RawVec<uint32_t>);
+		}
+		else
+		{
+			RawVec<uint64_t> &vec = *(RawVec<uint64_t>*) &data[offset];
+			info.count = vec.count;
+			info.items = (T*) &data[vec.offset];
+			offset += sizeof(RawVec<uint64_t>);
+		}
+
+		return info;
+	}
+
+	template<typename from, typename to>
+	using Reader = std::function<void(const from&, to&)>;
+
+	template<typename from, typename to>
+	void readIntoVec(bool is32bit, std::vector<to> &res, const uint8_t *data, size_t &offset, Reader<from, to> f)
+	{
+		VecInfo<from> info = readVec<from>(is32bit, data, offset);
+
+		res.clear();
+		res.resize(info.count);
+
+		for(size_t i=0; i<info.count; i++)
+		{
+			f(info.items[i], res[i]);
+		}
+	}
+
+	template<typename T>
+	void numberList(std::vector<T> &items)
+	{
+		for(size_t i=0; i<items.size(); i++)
+		{
+			items[i].index = i;
+		}
+	}
+
+	class ScriptData
+	{
+	public:
+		ScriptData(size_t length, const uint8_t *data)
+		{
+			bool is32bit = determine_is_32bit(length, data);
+
+			size_t offset = is32bit ? 4 : 8;
+
+			readIntoVec<float, SNum>(is32bit, numbers, data, offset, [](const float &in, SNum &out)
+			{
+				out = SNum(in);
+			});
+
+			if(is32bit)
+			{
+				readIntoVec<RawStr<uint32_t>, SString>(is32bit, strings, data, offset, [data](const RawStr<uint32_t> &in, SString &out)
+				{
+					out = SString((const char*) &data[in.str]);
+				});
+			}
+			else
+			{
+				readIntoVec<RawStr<uint64_t>, SString>(is32bit, strings, data, offset, [data](const RawStr<uint64_t> &in, SString &out)
+				{
+					out = SString((const char*) &data[in.str]);
+				});
+			}
+
+			readIntoVec<float[3], SVector>(is32bit, vectors, data, offset, [](const float (&in)[3], SVector &out)
+			{
+				out = SVector(in[0], in[1], in[2]);
+			});
+
+			readIntoVec<float[4], SQuaternion>(is32bit, quats, data, offset, [](const float (&in)[4], SQuaternion &out)
+			{
+				out = SQuaternion(in[0], in[1], in[2], in[3]);
+			});
+
+			readIntoVec<uint64_t, SIdstring>(is32bit, idstrings, data, offset, [](const uint64_t &in, SIdstring &out)
+			{
+				out = SIdstring(in);
+			});
+
+			if(is32bit)
+			{
+				readIntoVec<RawTable<uint32_t>, STable>(is32bit, tables, data, offset, [data, this](const RawTable<uint32_t> &in, STable &out)
+				{
+					out = STable();
+					ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta);
+				});
+			}
+			else
+			{
+				readIntoVec<RawTable<uint64_t>, STable>(is32bit, tables, data, offset, [data, this](const RawTable<uint64_t> &in, STable &out)
+				{
+					out = STable();
+					ReadTable(out, (std::pair<valid_t, valid_t>*) &data[in.contents.offset], in.contents.count, in.meta);
+				});
+			}
+
+			numberList(numbers);
+			numberList(strings);
+			numberList(vectors);
+			numberList(quats);
+			numberList(idstrings);
+			numberList(tables);
+
+			uint32_t *val = (uint32_t*) &data[offset];
+			root = Read(*val);
+		}
+
+		const SItem* GetRoot()
+		{
+			return root;
+		}
+
+	private:
+		std::vector<SNum> numbers;
+		std::vector<SString> strings;
+		std::vector<SVector> vectors;
+		std::vector<SQuaternion> quats;
+		std::vector<SIdstring> idstrings;
+		std::vector<STable> tables;
+
+		const SItem *root;
+
+		const SItem* Read(uint32_t val)
+		{
+			uint8_t type = val >> 24;
+			uint32_t index = val & 0xFFFFFF;
+
+			switch(type)
+			{
+			case SNil::ID:
+				return &SNil::INSTANCE;
+			case SBool::ID_F:
+				return &SBool::SFALSE;
+			case SBool::ID_T:
+				return &SBool::STRUE;
+			case SNum::ID:
+				return &numbers[index];
+			case SString::ID:
+				return &strings[index];
+			case SVector::ID:
+				return &vectors[index];
+			case SQuaternion::ID:
+				return &quats[index];
+			case SIdstring::ID:
+				return &idstrings[index];
+			case STable::ID:
+				return &tables[index];
+			default:
+				throw std::exception();
+			}
+		}
+
+		void ReadTable(STable &out, std::pair<valid_t, valid_t> *data, size_t count, uint32_t meta)
+		{
+			for(size_t i=0; i<count; i++)
+			{
+				const SItem *key = Read(data[i].first);
+				const SItem *val = Read(data[i].second);
+				out.items[key] = val;
+			}
+
+			out.meta = meta != ~0u ? &strings[meta] : nullptr;
+		}
+	};
+} // namespace before
+
+namespace
+{
+	// Builds a ScriptData file the same way fixtures/make_inputs.py's Writer does: a header with each
+	// type's contents vector, then each type's items in turn, with the strings' text and the tables'
+	// entries straight after their own vectors.
+	class Layout
+	{
+	public:
+		enum Kind
+		{
+			NUM = 3,
+			STRING,
+			VECTOR,
+			QUAT,
+			IDSTRING,
+			TABLE,
+		};
+
+		typedef uint32_t Ref;
+
+		static const Ref TRUE_REF = 1 << 24;
+		static const Ref FALSE_REF = 2 << 24;
+
+		Ref Num(float value) { return Add(NUM, numbers, value); }
+		Ref String(std::string value) { return Add(STRING, strings, std::move(value)); }
+		Ref Vector(float x, float y, float z) { return Add(VECTOR, vectors, std::array<float, 3>{ x, y, z }); }
+		Ref Quat(float x, float y, float z, float w) { return Add(QUAT, quats, std::array<float, 4>{ x, y, z, w }); }
+		Ref Idstring(uint64_t value) { return Add(IDSTRING, idstrings, value); }
+
+		// Tables can be filled in after they're made, so they can be made before the things they contain
+		Ref Table(Ref meta = 0) { return Add(TABLE, tables, TableItem{ meta, {} }); }
+		void Set(Ref table, Ref key, Ref value) { tables[table & 0xFFFFFF].entries.emplace_back(key, value); }
+
+		std::string Write(bool is32bit, Ref root) const
+		{
+			size_t ptrSize = is32bit ? 4 : 8;
+			size_t headerSize = ptrSize + (8 + ptrSize * 2) * 6 + 4;
+
+			std::string body;
+			size_t vectorOffsets[TABLE + 1] = {};
+
+			vectorOffsets[NUM] = headerSize + body.size();
+			for (float value : numbers)
+				Put(body, value);
+
+			vectorOffsets[STRING] = headerSize + body.size();
+			size_t text = headerSize + body.size() + strings.size() * ptrSize * 2;
+			for (const std::string& value : strings)
+			{
+				PutPtr(body, is32bit, 0);
+				PutPtr(body, is32bit, text);
+				text += value.size() + 1;
+			}
+			for (const std::string& value : strings)
+				body.append(value.c_str(), value.size() + 1);
+
+			vectorOffsets[VECTOR] = headerSize + body.size();
+			for (const std::array<float, 3>& value : vectors)
+				Put(body, value);
+
+			vectorOffsets[QUAT] = headerSize + body.size();
+			for (const std::array<float, 4>& value : quats)
+				Put(body, value);
+
+			vectorOffsets[IDSTRING] = headerSize + body.size();
+			for (uint64_t value : idstrings)
+				Put(body, value);
+
+			vectorOffsets[TABLE] = headerSize + body.size();
+			size_t contents = headerSize + body.size() + tables.size() * (ptrSize * 3 + 8);
+			for (const TableItem& table : tables)
+			{
+				uint32_t count = (uint32_t)table.entries.size();
+				PutPtr(body, is32bit, table.meta ? (table.meta & 0xFFFFFF) : 0xFFFFFFFF);
+				Put(body, count);
+				Put(body, count);
+				PutPtr(body, is32bit, contents);
+				PutPtr(body, is32bit, 0);
+				contents += count * 8;
+			}
+			for (const TableItem& table : tables)
+			{
+				for (const std::pair<Ref, Ref>& entry : table.entries)
+					Put(body, entry);
+			}
+
+			std::string header;
+			PutPtr(header, is32bit, 0);
+			size_t counts[TABLE + 1] = { 0, 0, 0, numbers.size(), strings.size(), vectors.size(), quats.size(), idstrings.size(), tables.size() };
+			for (int kind = NUM; kind <= TABLE; kind++)
+			{
+				Put(header, (uint32_t)counts[kind]);
+				Put(header, (uint32_t)counts[kind]);
+				PutPtr(header, is32bit, vectorOffsets[kind]);
+				PutPtr(header, is32bit, 0);
+			}
+			Put(header, root);
+
+			return header + body;
+		}
+
+	private:
+		struct TableItem
+		{
+			Ref meta; // Zero for none, or a string
+			std::vector<std::pair<Ref, Ref>> entries;
+		};
+
+		template <typename T>
+		static Ref Add(Kind kind, std::vector<T>& items, T value)
+		{
+			items.push_back(std::move(value));
+			return ((Ref)kind << 24) | (Ref)(items.size() - 1);
+		}
+
+		template <typename T>
+		static void Put(std::string& out, const T& value)
+		{
+			out.append((const char*)&value, sizeof(value));
+		}
+
+		static void PutPtr(std::string& out, bool is32bit, size_t value)
+		{
+			if (is32bit)
+				Put(out, (uint32_t)value);
+			else
+				Put(out, (uint64_t)value);
+		}
+
+		std::vector<float> numbers;
+		std::vector<std::string> strings;
+		std::vector<std::array<float, 3>> vectors;
+		std::vector<std::array<float, 4>> quats;
+		std::vector<uint64_t> idstrings;
+		std::vector<TableItem> tables;
+	};
+
+	// A list of unit-like objects, each with its own strings and a nested list, sharing their keys and
+	// meta strings like the game's files do. As in make_inputs.py, every table's keys are the same type,
+	// so both parsers put them in the same order.
+	std::string MakeInput(bool is32bit, size_t objects)
+	{
+		Layout layout;
+		Layout::Ref root = layout.Table();
+
+		const char* keyNames[] = { "name", "position", "rotation", "unit", "enabled", "damage", "parts" };
+		std::vector<Layout::Ref> keys;
+		for (const char* name : keyNames)
+			keys.push_back(layout.String(name));
+
+		Layout::Ref meta = layout.String("weapon");
+
+		for (size_t i = 0; i < objects; i++)
+		{
+			Layout::Ref object = layout.Table(i % 3 == 0 ? meta : 0);
+			layout.Set(root, layout.Num((float)(i + 1)), object);
+
+			std::string n = std::to_string(i);
+			layout.Set(object, keys[0], layout.String("units/pd2_dlc_test/weapons/wpn_fps_test_" + n));
+			layout.Set(object, keys[1], layout.Vector((float)i, -2.5f, 300));
+			layout.Set(object, keys[2], layout.Quat(0, 0.7071f, 0, 0.7071f));
+			layout.Set(object, keys[3], layout.Idstring(0x0123456789ABCDEFull * (i + 1)));
+			layout.Set(object, keys[4], i % 2 ? Layout::TRUE_REF : Layout::FALSE_REF);
+			layout.Set(object, keys[5], layout.Num(i * 0.5f));
+
+			Layout::Ref parts = layout.Table();
+			layout.Set(object, keys[6], parts);
+			for (size_t part = 0; part < 4; part++)
+				layout.Set(parts, layout.Num((float)(part + 1)), layout.String("g_part_" + n + "_" + std::to_string(part)));
+		}
+
+		return layout.Write(is32bit, root);
+	}
+
+	// Checks both parsers read the same thing
+	bool Same(const before::SItem* old, const SItem* item)
+	{
+		if (old->GetId() != item->GetId())
+			return false;
+
+		switch (item->GetId())
+		{
+		case SNum::ID:
+			return ((const before::SNum*)old)->val == ((const SNum*)item)->val;
+		case SString::ID:
+			return ((const before::SString*)old)->val == ((const SString*)item)->val;
+		case SVector::ID:
+			return ((const before::SVector*)old)->x == ((const SVector*)item)->x;
+		case SQuaternion::ID:
+			return ((const before::SQuaternion*)old)->w == ((const SQuaternion*)item)->w;
+		case SIdstring::ID:
+			return ((const before::SIdstring*)old)->val == ((const SIdstring*)item)->val;
+		case STable::ID:
+		{
+			const before::STable* oldTable = (const before::STable*)old;
+			const STable* table = (const STable*)item;
+
+			if (oldTable->items.size() != table->items.size() || (oldTable->meta == nullptr) != (table->meta == nullptr))
+				return false;
+			if (table->meta && oldTable->meta->val != table->meta->val)
+				return false;
+
+			auto oldEntry = oldTable->items.begin();
+			for (const STable::Entry& entry : table->items)
+			{
+				if (!Same(oldEntry->first, entry.first) || !Same(oldEntry->second, entry.second))
+					return false;
+				++oldEntry;
+			}
+			return true;
+		}
+		default:
+			return true;
+		}
+	}
+
+	template <typename ParseFn>
+	double TimeParses(int runs, ParseFn parse)
+	{
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < runs; i++)
+			parse();
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / runs;
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 20;
+	if (runs < 1)
+		runs = 1;
+
+	size_t objects = argc > 2 ? (size_t)atoll(argv[2]) : 20000;
+	if (objects < 1)
+		objects = 1;
+
+	printf("%zu objects, average of %d runs\n", objects, runs);
+
+	for (bool is32bit : { true, false })
+	{
+		std::string input = MakeInput(is32bit, objects);
+		const uint8_t* data = (const uint8_t*)input.data();
+
+		if (determine_is_32bit(input.size(), data) != is32bit)
+		{
+			fprintf(stderr, "the generated %d-bit file was detected as the wrong layout\n", is32bit ? 32 : 64);
+			return 1;
+		}
+
+		{
+			before::ScriptData old(input.size(), data);
+			ScriptData current(input.size(), data);
+			if (!Same(old.GetRoot(), current.GetRoot()))
+			{
+				fprintf(stderr, "the %d-bit file parsed differently before and after\n", is32bit ? 32 : 64);
+				return 1;
+			}
+		}
+
+		double oldTime = TimeParses(runs, [&] { before::ScriptData sd(input.size(), data); });
+		double copyTime = TimeParses(runs, [&] { ScriptData sd(input.size(), data, ScriptData::SourceMode::Copy); });
+		double borrowTime = TimeParses(runs, [&] { ScriptData sd(input.size(), data, ScriptData::SourceMode::Borrow); });
+
+		double megabytes = input.size() / 1048576.0;
+		printf("%d-bit, %.2f MB\n", is32bit ? 32 : 64, megabytes);
+		printf("  before         %8.2f ms  %8.1f MB/s\n", oldTime, megabytes / (oldTime / 1000));
+		printf("  after (copy)   %8.2f ms  %8.1f MB/s\n", copyTime, megabytes / (copyTime / 1000));
+		printf("  after (borrow) %8.2f ms  %8.1f MB/s\n", borrowTime, megabytes / (borrowTime / 1000));
+	}
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+#include "scriptdata/ScriptData.h"
+
+#include "test.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+// Reads each fixture and writes it back out, checking the bytes come out exactly the same as the old
+// ScriptData writer made them. See fixtures/make_inputs.py for how they were made.
+
+using namespace raidhook::scriptdata;
+
+static bool LoadFile(const std::string& path, std::string& out)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in.good())
+		return false;
+
+	out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// Finds a string key in a table, or returns null
+static const SItem* Get(const SItem* table, const char* key)
+{
+	if (table->GetId() != STable::ID)
+		return nullptr;
+
+	for (const STable::Entry& entry : ((const STable*)table)->items)
+	{
+		if (entry.first->GetId() == SString::ID && ((const SString*)entry.first)->val == key)
+			return entry.second;
+	}
+
+	return nullptr;
+}
+
+static void CheckRoundTrip(const std::string& name, const std::string& input, const std::string& expected, bool is32bit)
+{
+	const uint8_t* data = (const uint8_t*)input.data();
+	TEST_CHECK_MSG(determine_is_32bit(input.size(), data) == is32bit, "%s", name.c_str());
+
+	for (ScriptData::SourceMode mode : {ScriptData::SourceMode::Copy, ScriptData::SourceMode::Borrow})
+	{
+		ScriptData sd(input.size(), data, mode);
+		std::string output = sd.GetRoot()->Serialise(is32bit);
+
+		size_t mismatch = 0;
+		while (mismatch < output.size() && mismatch < expected.size() && output[mismatch] == expected[mismatch])
+			mismatch++;
+
+		TEST_CHECK_MSG(output == expected, "%s: %zu bytes written, %zu expected, first difference at %zu",
+			name.c_str(), output.size(), expected.size(), mismatch);
+	}
+}
+
+// The last value for a key that appears more than once is the one that's kept
+static void CheckDuplicateKeys(const std::string& input)
+{
+	ScriptData sd(input.size(), (const uint8_t*)input.data());
+	const SItem* root = sd.GetRoot();
+
+	const SItem* key = Get(root, "key");
+	TEST_CHECK(key && key->GetId() == SNum::ID && ((const SNum*)key)->val == 3);
+
+	// Two different strings with the same text are still different keys
+	TEST_CHECK(root->GetId() == STable::ID && ((const STable*)root)->items.size() == 4);
+
+	const SItem* sub = Get(root, "sub");
+	TEST_CHECK(sub && sub->GetId() == STable::ID && ((const STable*)sub)->items.size() == 2);
+}
+
+int main()
+{
+	const char* names[] = { "nested_tables", "meta_strings", "duplicate_keys" };
+
+	for (const char* name : names)
+	{
+		for (int bits : { 32, 64 })
+		{
+			std::string base = std::string("scriptdata/fixtures/") + name + "_" + std::to_string(bits);
+
+			std::string golden;
+			if (!LoadFile(base + ".bin", golden))
+			{
+				TEST_CHECK_MSG(false, "couldn't read %s.bin", base.c_str());
+				continue;
+			}
+
+			CheckRoundTrip(base + ".bin", golden, golden, bits == 32);
+
+			std::string input;
+			if (LoadFile(base + ".in.bin", input))
+			{
+				CheckRoundTrip(base + ".in.bin", input, golden, bits == 32);
+			}
+
+			if (std::string(name) == "duplicate_keys")
+			{
+				CheckDuplicateKeys(input);
+				CheckDuplicateKeys(golden);
+			}
+		}
+	}
+
+	return TEST_RESULT;
+}
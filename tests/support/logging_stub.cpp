@@ -0,0 +1,51 @@
+#include "util/util.h"
+
+#include <stdio.h>
+
+// The real logger writes into mods/logs, which the tests shouldn't do - print everything instead
+
+namespace raidhook::Logging
+{
+	namespace
+	{
+		class TestLogger : public Logger
+		{
+		};
+	}
+
+	Logger& Logger::Instance()
+	{
+		static TestLogger logger;
+		return logger;
+	}
+
+	void Logger::Close()
+	{
+	}
+
+	void Logger::setForceFlush(bool forceFlush)
+	{
+	}
+
+	void Logger::flush()
+	{
+		fflush(stderr);
+	}
+
+	void Logger::log(const Message_t& msg)
+	{
+		fprintf(stderr, "%s\n", msg.c_str());
+	}
+
+	LogWriter::LogWriter(LogType msgType)
+	{
+	}
+
+	LogWriter::LogWriter(const char *file, int line, LogType msgType)
+	{
+		if (file)
+		{
+			*this << file << ':' << line << ": ";
+		}
+	}
+}
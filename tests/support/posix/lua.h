@@ -0,0 +1,10 @@
+#pragma once
+
+// Only the declarations the headers under test need - nothing here is ever called by the tests
+
+#include <stddef.h>
+
+typedef struct lua_State lua_State;
+typedef int (*lua_CFunction)(lua_State* L);
+
+void* lua_touserdata(lua_State* L, int idx);
@@ -0,0 +1,118 @@
+#pragma once
+
+// The little bit of the Windows API the code under test uses, so the tests can be built elsewhere.
+// Implemented in windows_posix.cpp.
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void* HANDLE;
+typedef unsigned long DWORD;
+typedef int BOOL;
+typedef unsigned short WORD;
+typedef long LONG;
+typedef long long LONGLONG;
+typedef const char* LPCSTR;
+typedef uintptr_t ULONG_PTR;
+
+#define TRUE 1
+#define FALSE 0
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define ERROR_HANDLE_EOF 38
+#define ERROR_IO_PENDING 997
+
+DWORD GetLastError();
+BOOL CloseHandle(HANDLE hObject);
+
+// Files
+
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 0x1
+#define FILE_SHARE_WRITE 0x2
+#define FILE_SHARE_DELETE 0x4
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_FLAG_OVERLAPPED 0x40000000
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _FILETIME
+{
+	DWORD dwLowDateTime;
+	DWORD dwHighDateTime;
+} FILETIME;
+
+typedef struct _WIN32_FILE_ATTRIBUTE_DATA
+{
+	DWORD dwFileAttributes;
+	FILETIME ftCreationTime;
+	FILETIME ftLastAccessTime;
+	FILETIME ftLastWriteTime;
+	DWORD nFileSizeHigh;
+	DWORD nFileSizeLow;
+} WIN32_FILE_ATTRIBUTE_DATA;
+
+typedef enum _GET_FILEEX_INFO_LEVELS
+{
+	GetFileExInfoStandard,
+} GET_FILEEX_INFO_LEVELS;
+
+typedef struct _OVERLAPPED
+{
+	ULONG_PTR Internal;
+	ULONG_PTR InternalHigh;
+	union
+	{
+		struct
+		{
+			DWORD Offset;
+			DWORD OffsetHigh;
+		};
+		void* Pointer;
+	};
+	HANDLE hEvent;
+} OVERLAPPED;
+
+// On a handle opened with FILE_FLAG_OVERLAPPED, reads finish on another thread and always report
+// ERROR_IO_PENDING, so callers have to wait for them properly.
+HANDLE CreateFileA(LPCSTR lpFileName, DWORD dwDesiredAccess, DWORD dwShareMode, void* lpSecurityAttributes,
+                   DWORD dwCreationDisposition, DWORD dwFlagsAndAttributes, HANDLE hTemplateFile);
+BOOL GetFileSizeEx(HANDLE hFile, LARGE_INTEGER* lpFileSize);
+BOOL GetFileAttributesExA(LPCSTR lpFileName, GET_FILEEX_INFO_LEVELS fInfoLevelId, void* lpFileInformation);
+#define MOVEFILE_REPLACE_EXISTING 0x1
+
+BOOL MoveFileExA(LPCSTR lpExistingFileName, LPCSTR lpNewFileName, DWORD dwFlags);
+BOOL DeleteFileA(LPCSTR lpFileName);
+BOOL ReadFile(HANDLE hFile, void* lpBuffer, DWORD nNumberOfBytesToRead, DWORD* lpNumberOfBytesRead, OVERLAPPED* lpOverlapped);
+BOOL GetOverlappedResult(HANDLE hFile, OVERLAPPED* lpOverlapped, DWORD* lpNumberOfBytesTransferred, BOOL bWait);
+
+// Timers
+
+BOOL QueryPerformanceFrequency(LARGE_INTEGER* lpFrequency);
+BOOL QueryPerformanceCounter(LARGE_INTEGER* lpPerformanceCount);
+
+// Events
+
+HANDLE CreateEventA(void* lpEventAttributes, BOOL bManualReset, BOOL bInitialState, LPCSTR lpName);
+
+// Console
+
+#define STD_OUTPUT_HANDLE ((DWORD)-11)
+
+#define FOREGROUND_BLUE 0x1
+#define FOREGROUND_GREEN 0x2
+#define FOREGROUND_RED 0x4
+#define FOREGROUND_INTENSITY 0x8
+
+HANDLE GetStdHandle(DWORD nStdHandle);
+BOOL SetConsoleTextAttribute(HANDLE hConsoleOutput, WORD wAttributes);
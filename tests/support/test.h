@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdio.h>
+
+// Just enough of a test framework to check things and report what went wrong. A test's main returns
+// TEST_RESULT, which fails the test if any check did.
+
+namespace sblt_test
+{
+	inline int failures = 0;
+}
+
+#define TEST_CHECK(cond) do { \
+	if (!(cond)) \
+	{ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		sblt_test::failures++; \
+	} \
+} while (false)
+
+#define TEST_CHECK_MSG(cond, ...) do { \
+	if (!(cond)) \
+	{ \
+		fprintf(stderr, "%s:%d: check failed: %s - ", __FILE__, __LINE__, #cond); \
+		fprintf(stderr, __VA_ARGS__); \
+		fprintf(stderr, "\n"); \
+		sblt_test::failures++; \
+	} \
+} while (false)
+
+#define TEST_RESULT (sblt_test::failures == 0 ? 0 : 1)
@@ -0,0 +1,198 @@
+#include "threading/queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Times getting events from several threads onto the game thread through EventQueue, and through the
+// mutex and deque it used before, which is copied below. The game thread runs its queue in a loop the
+// whole time, like it would at a very high frame rate. Not run as a test: build it in release and run
+// it by hand.
+//
+// Usage: event_queue_benchmark [runs] [events per thread]
+
+using raidhook::EventBudget;
+
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	struct Event
+	{
+		uint64_t value;
+	};
+
+	// EventQueue as it was before it was made lock-free
+	template<typename DataT>
+	class MutexQueue
+	{
+	public:
+		typedef void(*EventFunction)(DataT);
+
+		class EventItem
+		{
+		public:
+			EventItem(EventFunction runFunction, DataT data) : mFunc(runFunction), mData(std::move(data)) {}
+			EventItem(EventItem&& mv) : mFunc(mv.mFunc), mData(std::move(mv.mData)) {}
+			void operator()() { mFunc(std::move(mData)); }
+
+		private:
+			EventItem(const EventItem&) = delete;
+
+			EventFunction mFunc;
+			DataT mData;
+		};
+
+		void ProcessEvents()
+		{
+			decltype(eventQueue) localQueue;
+			{
+				std::lock_guard<std::mutex> locker(lock);
+				while (!eventQueue.empty())
+				{
+					localQueue.push_back(std::move(eventQueue.front()));
+					eventQueue.pop_front();
+				}
+			}
+
+			std::for_each(localQueue.begin(), localQueue.end(), [](EventItem& e)
+			{
+				e();
+			});
+		}
+
+		void AddToQueue(EventFunction runFunction, DataT data)
+		{
+			std::lock_guard<std::mutex> locker(lock);
+			eventQueue.emplace_back(runFunction, std::move(data));
+		}
+
+	private:
+		std::deque<EventItem> eventQueue;
+		std::mutex lock;
+	};
+
+	// Only touched on the thread running the events
+	uint64_t events_run = 0;
+	uint64_t checksum = 0;
+
+	void RunEvent(Event event)
+	{
+		events_run++;
+		checksum += event.value;
+	}
+
+	struct Timings
+	{
+		double total = 0;   // Until the last event had run
+		double pushing = 0; // Until the slowest thread had pushed its last event
+	};
+
+	// Pushes events from the given number of threads, while the calling thread runs them
+	template <typename PushFn, typename ProcessFn>
+	Timings Run(size_t threads, uint64_t perThread, PushFn push, ProcessFn process)
+	{
+		events_run = 0;
+		checksum = 0;
+
+		std::atomic<bool> go = false;
+		std::atomic<int64_t> pushEnd = 0;
+		std::vector<std::thread> producers;
+
+		for (size_t t = 0; t < threads; t++)
+		{
+			producers.emplace_back([&, t] {
+				while (!go)
+					std::this_thread::yield();
+
+				for (uint64_t i = 0; i < perThread; i++)
+					push(Event{ t * perThread + i });
+
+				int64_t end = Clock::now().time_since_epoch().count();
+				int64_t latest = pushEnd;
+				while (end > latest && !pushEnd.compare_exchange_weak(latest, end))
+				{
+				}
+			});
+		}
+
+		Clock::time_point start = Clock::now();
+		go = true;
+
+		uint64_t expected = threads * perThread;
+		while (events_run < expected)
+			process();
+
+		Clock::time_point end = Clock::now();
+
+		for (std::thread& producer : producers)
+			producer.join();
+
+		uint64_t sum = expected * (expected - 1) / 2;
+		if (checksum != sum)
+		{
+			fprintf(stderr, "the events didn't all come through exactly once\n");
+			exit(1);
+		}
+
+		Timings timings;
+		timings.total = std::chrono::duration<double, std::milli>(end - start).count();
+		timings.pushing = std::chrono::duration<double, std::milli>(Clock::time_point(Clock::duration(pushEnd.load())) - start).count();
+		return timings;
+	}
+} // namespace
+
+RAIDHOOK_REGISTER_EVENTQUEUE(Event, Benchmark)
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 5;
+	if (runs < 1)
+		runs = 1;
+
+	uint64_t perThread = argc > 2 ? (uint64_t)atoll(argv[2]) : 200000;
+	if (perThread < 1)
+		perThread = 1;
+
+	printf("%llu events per thread, average of %d runs\n", (unsigned long long)perThread, runs);
+	printf("threads  queue      total ms   push ms   Mevents/s\n");
+
+	MutexQueue<Event> mutexQueue;
+
+	for (size_t threads : { 1, 2, 4, 8 })
+	{
+		Timings mutex, lockFree;
+
+		for (int i = 0; i < runs; i++)
+		{
+			Timings timings = Run(
+			    threads, perThread, [&](Event event) { mutexQueue.AddToQueue(RunEvent, event); },
+			    [&] { mutexQueue.ProcessEvents(); });
+			mutex.total += timings.total / runs;
+			mutex.pushing += timings.pushing / runs;
+
+			timings = Run(
+			    threads, perThread, [](Event event) { GetBenchmarkQueue().AddToQueue(RunEvent, event); },
+			    [] {
+				    EventBudget budget(0us, 0);
+				    GetBenchmarkQueue().ProcessEvents(budget);
+			    });
+			lockFree.total += timings.total / runs;
+			lockFree.pushing += timings.pushing / runs;
+		}
+
+		double events = threads * (double)perThread / 1e6;
+		printf("%7zu  mutex      %8.2f  %8.2f  %10.2f\n", threads, mutex.total, mutex.pushing, events / (mutex.total / 1000));
+		printf("%7zu  lock-free  %8.2f  %8.2f  %10.2f\n", threads, lockFree.total, lockFree.pushing, events / (lockFree.total / 1000));
+	}
+
+	return 0;
+}
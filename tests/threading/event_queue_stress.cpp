@@ -0,0 +1,190 @@
+#include "threading/queue.h"
+
+#include "test.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Lots of threads push onto the same EventQueue at once while the game thread runs ProcessEvents under
+// various budgets, checking every event is run exactly once and that each thread's events run in the
+// order it added them.
+
+using raidhook::EventQueueMaster;
+
+using namespace std::chrono_literals;
+
+namespace
+{
+	struct Message
+	{
+		uint32_t producer;
+		uint32_t sequence;
+	};
+
+	// Separate types, so they get separate queues
+	struct Early
+	{
+		int value;
+	};
+
+	struct Late
+	{
+		int value;
+	};
+} // namespace
+
+RAIDHOOK_REGISTER_EVENTQUEUE(Message, Stress)
+RAIDHOOK_REGISTER_EVENTQUEUE_PRIORITY(Late, Late, 0)
+RAIDHOOK_REGISTER_EVENTQUEUE_PRIORITY(Early, Early, 10)
+
+static const size_t PRODUCERS = 8;
+static const uint32_t EVENTS_PER_PRODUCER = 100000;
+
+namespace
+{
+	// Only touched on the thread running the events
+	std::vector<uint32_t> next_sequence(PRODUCERS);
+	size_t events_run = 0;
+	size_t out_of_order = 0;
+
+	void RunMessage(Message message)
+	{
+		if (message.sequence != next_sequence[message.producer])
+			out_of_order++;
+
+		next_sequence[message.producer] = message.sequence + 1;
+		events_run++;
+	}
+
+	std::vector<int> run_order;
+
+	void RunEarly(Early early)
+	{
+		run_order.push_back(early.value);
+	}
+
+	void RunLate(Late late)
+	{
+		run_order.push_back(late.value);
+	}
+
+	void Reset()
+	{
+		next_sequence.assign(PRODUCERS, 0);
+		events_run = 0;
+		out_of_order = 0;
+		EventQueueMaster::GetSingleton().ResetStats();
+	}
+
+	// Runs the producers, while running events under the current budget until every event has run
+	void RunProducers(size_t maxPerFrame)
+	{
+		std::atomic<bool> go = false;
+		std::vector<std::thread> producers;
+		for (uint32_t p = 0; p < PRODUCERS; p++)
+		{
+			producers.emplace_back([p, &go] {
+				while (!go)
+					std::this_thread::yield();
+
+				for (uint32_t i = 0; i < EVENTS_PER_PRODUCER; i++)
+					GetStressQueue().AddToQueue(RunMessage, Message{ p, i });
+			});
+		}
+
+		go = true;
+
+		EventQueueMaster& master = EventQueueMaster::GetSingleton();
+		size_t expected = PRODUCERS * EVENTS_PER_PRODUCER;
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + 60s;
+
+		while (events_run < expected && std::chrono::steady_clock::now() < deadline)
+		{
+			master.ProcessEvents();
+
+			if (maxPerFrame > 0)
+				TEST_CHECK_MSG(master.GetStats().lastProcessed <= maxPerFrame, "%zu events in one frame",
+				               master.GetStats().lastProcessed);
+		}
+
+		for (std::thread& producer : producers)
+			producer.join();
+
+		// Nothing should turn up after the last one, and nothing should be left over
+		master.ProcessEvents();
+
+		TEST_CHECK_MSG(events_run == expected, "%zu of %zu events ran", events_run, expected);
+		TEST_CHECK_MSG(out_of_order == 0, "%zu events ran out of order", out_of_order);
+		for (uint32_t p = 0; p < PRODUCERS; p++)
+			TEST_CHECK(next_sequence[p] == EVENTS_PER_PRODUCER);
+
+		TEST_CHECK(GetStressQueue().PendingCount() == 0);
+		TEST_CHECK(master.GetStats().deferred == 0);
+	}
+} // namespace
+
+// With no budget, every frame runs everything that's been pushed so far
+static void Unlimited()
+{
+	Reset();
+	EventQueueMaster::GetSingleton().SetBudget(0us, 0);
+	RunProducers(0);
+}
+
+// With a small budget, most frames leave events for the next one, which must still run in order
+static void CountBudget()
+{
+	Reset();
+	EventQueueMaster::GetSingleton().SetBudget(0us, 100);
+	RunProducers(100);
+
+	EventQueueMaster::Stats stats = EventQueueMaster::GetSingleton().GetStats();
+	TEST_CHECK(stats.deferredFrames > 0);
+	TEST_CHECK(stats.peakDeferred > 0);
+	TEST_CHECK(stats.processed == PRODUCERS * EVENTS_PER_PRODUCER);
+}
+
+// A budget too short for even one event still runs one event every frame
+static void TimeBudget()
+{
+	Reset();
+	EventQueueMaster::GetSingleton().SetBudget(1us, 0);
+	RunProducers(0);
+}
+
+// Higher priority queues run first, and once the budget runs out the later ones wait too, even if they
+// had events ready first
+static void Priorities()
+{
+	EventQueueMaster& master = EventQueueMaster::GetSingleton();
+	master.SetBudget(0us, 3);
+	run_order.clear();
+
+	GetLateQueue().AddToQueue(RunLate, Late{ 10 });
+	GetLateQueue().AddToQueue(RunLate, Late{ 11 });
+	GetEarlyQueue().AddToQueue(RunEarly, Early{ 1 });
+	GetEarlyQueue().AddToQueue(RunEarly, Early{ 2 });
+
+	master.ProcessEvents();
+	TEST_CHECK((run_order == std::vector<int>{ 1, 2, 10 }));
+	TEST_CHECK(master.GetStats().deferred == 1);
+
+	GetEarlyQueue().AddToQueue(RunEarly, Early{ 3 });
+	master.ProcessEvents();
+	TEST_CHECK((run_order == std::vector<int>{ 1, 2, 10, 3, 11 }));
+	TEST_CHECK(master.GetStats().deferred == 0);
+
+	master.SetBudget(0us, 0);
+}
+
+int main()
+{
+	Unlimited();
+	CountBudget();
+	TimeBudget();
+	Priorities();
+
+	return TEST_RESULT;
+}
@@ -0,0 +1,187 @@
+#include "tweaker/xmldom.h"
+
+#include <chrono>
+#include <string>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SBLT_TEST_WITH_MXML
+#include <mxml.h>
+#endif
+
+// Times parsing, editing and writing out a large unit-style document the way a tweak would, with the
+// DOM behind the Wren XML class and (when lib/mxml is checked out) with mxml as it was used before.
+// Not run as a test: build it in release and run it by hand.
+//
+// Usage: xml_benchmark [runs]
+
+using namespace raidhook::tweaker::xmldom;
+
+using Clock = std::chrono::steady_clock;
+
+namespace
+{
+	struct Timings
+	{
+		double parse = 0;
+		double edit = 0;
+		double serialise = 0;
+		size_t output = 0;
+	};
+
+	double Millis(Clock::time_point start, Clock::time_point end)
+	{
+		return std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	std::string MakeDocument()
+	{
+		std::string doc = "<?xml version=\"1.0\"?>\n<unit type=\"test\" slot=\"1\">\n";
+
+		for (int i = 0; i < 40000; i++)
+		{
+			std::string n = std::to_string(i);
+			doc += "\t<object name=\"g_obj_" + n + "\" file=\"units/vanilla/weapons/wpn_fps_test/wpn_fps_test_" + n + "\" enabled=\"true\">\n";
+			doc += "\t\t<!-- part " + n + " -->\n";
+			doc += "\t\t<body name=\"body_" + n + "\" enabled=\"true\" template=\"static\" extra=\"a &lt; b &amp; c\"/>\n";
+			doc += "\t\t<anim_state_machine name=\"sm\"/>\n";
+			doc += "\t</object>\n";
+		}
+
+		doc += "</unit>\n";
+		return doc;
+	}
+
+	// Sets an attribute on everything with a name, like most tweaks do
+	void Edit(Arena& arena, Node* node)
+	{
+		if (GetAttribute(node, "name"))
+			SetAttribute(arena, node, "tweaked", "yes");
+
+		for (Node* child = node->firstChild; child; child = child->next)
+			Edit(arena, child);
+	}
+
+	Timings RunDom(const std::string& doc)
+	{
+		Timings timings;
+		std::string out;
+
+		Arena arena;
+		std::string error;
+
+		Clock::time_point start = Clock::now();
+		Node* root = Parse(arena, doc.data(), doc.size(), error);
+		Clock::time_point parsed = Clock::now();
+
+		if (!root)
+		{
+			fprintf(stderr, "xmldom couldn't parse the document: %s\n", error.c_str());
+			exit(1);
+		}
+
+		Edit(arena, root);
+		Clock::time_point edited = Clock::now();
+
+		Serialise(root, out);
+		Clock::time_point serialised = Clock::now();
+
+		timings.parse = Millis(start, parsed);
+		timings.edit = Millis(parsed, edited);
+		timings.serialise = Millis(edited, serialised);
+		timings.output = out.size();
+		return timings;
+	}
+
+#ifdef SBLT_TEST_WITH_MXML
+	mxml_type_t IgnoreText(mxml_node_t*)
+	{
+		return MXML_IGNORE;
+	}
+
+	void EditMxml(mxml_node_t* node)
+	{
+		if (mxmlElementGetAttr(node, "name"))
+			mxmlElementSetAttr(node, "tweaked", "yes");
+
+		for (mxml_node_t* child = mxmlGetFirstChild(node); child; child = mxmlGetNextSibling(child))
+			EditMxml(child);
+	}
+
+	Timings RunMxml(const std::string& doc)
+	{
+		Timings timings;
+
+		Clock::time_point start = Clock::now();
+		mxml_node_t* root = mxmlLoadString(nullptr, doc.c_str(), IgnoreText);
+		Clock::time_point parsed = Clock::now();
+
+		if (!root)
+		{
+			fprintf(stderr, "mxml couldn't parse the document\n");
+			exit(1);
+		}
+
+		EditMxml(root);
+		Clock::time_point edited = Clock::now();
+
+		// The same as XML.string used to: once to find the size, then again into a buffer that fits
+		char buffer[8192];
+		int bytes = mxmlSaveString(root, buffer, sizeof(buffer), MXML_NO_CALLBACK);
+		char* out = (char*)malloc(bytes + 1);
+		mxmlSaveString(root, out, bytes + 1, MXML_NO_CALLBACK);
+		Clock::time_point serialised = Clock::now();
+
+		free(out);
+		mxmlDelete(root);
+
+		timings.parse = Millis(start, parsed);
+		timings.edit = Millis(parsed, edited);
+		timings.serialise = Millis(edited, serialised);
+		timings.output = bytes;
+		return timings;
+	}
+#endif
+
+	void Report(const char* name, const Timings& total, int runs)
+	{
+		printf("%-8s parse %8.2f ms   edit %8.2f ms   serialise %8.2f ms   (%zu bytes out)\n", name, total.parse / runs,
+		       total.edit / runs, total.serialise / runs, total.output);
+	}
+
+	void Add(Timings& total, const Timings& run)
+	{
+		total.parse += run.parse;
+		total.edit += run.edit;
+		total.serialise += run.serialise;
+		total.output = run.output;
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 10;
+	if (runs < 1)
+		runs = 1;
+
+	std::string doc = MakeDocument();
+	printf("%.1f MB document, average of %d runs\n", doc.size() / 1048576.0, runs);
+
+	Timings dom;
+	for (int i = 0; i < runs; i++)
+		Add(dom, RunDom(doc));
+	Report("xmldom", dom, runs);
+
+#ifdef SBLT_TEST_WITH_MXML
+	Timings mxml;
+	for (int i = 0; i < runs; i++)
+		Add(mxml, RunMxml(doc));
+	Report("mxml", mxml, runs);
+#else
+	printf("lib/mxml isn't checked out, so there's nothing to compare with\n");
+#endif
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+#include "tweaker/xmldom.h"
+
+#include "test.h"
+
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include <string.h>
+
+#ifdef SBLT_TEST_WITH_MXML
+#include <mxml.h>
+#endif
+
+// Checks the DOM behind the Wren XML class reads and writes XML the same way mxml did. When lib/mxml
+// is checked out, the fixtures are also run through mxml itself and the output compared byte for byte.
+
+using namespace raidhook::tweaker::xmldom;
+
+static const char* FIXTURES[] = { "tweaker/fixtures/unit.xml", "tweaker/fixtures/entities.xml", "tweaker/fixtures/structure.xml" };
+
+static bool LoadFile(const std::string& path, std::string& out)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in.good())
+		return false;
+
+	out.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return true;
+}
+
+// Parses and serialises some text, or returns the error (which is empty if there were no elements)
+static std::string RoundTrip(const std::string& text)
+{
+	Arena arena;
+	std::string error;
+	Node* root = Parse(arena, text.data(), text.size(), error);
+	if (!root)
+		return "error: " + error;
+
+	std::string out;
+	Serialise(root, out);
+	return out;
+}
+
+#define CHECK_ROUND_TRIP(text, expected) do { \
+	std::string result = RoundTrip(text); \
+	TEST_CHECK_MSG(result == (expected), "got %s", result.c_str()); \
+} while (false)
+
+static void Parsing()
+{
+	CHECK_ROUND_TRIP("<?xml version=\"1.0\"?>\n<unit a=\"1\" b='x&amp;y'>\n  <!-- c -->\n  <obj file=\"f\"/>\n  <seq><x  /></seq>\n</unit>\n",
+		"<?xml version=\"1.0\"?><unit a=\"1\" b=\"x&amp;y\"><!-- c --><obj file=\"f\" /><seq><x /></seq></unit>\n");
+
+	// Text is ignored, but comments, CDATA and other declarations are elements
+	CHECK_ROUND_TRIP("<a>text &lt; here<b c=d/></a>", "<a><b c=\"d\" /></a>\n");
+	CHECK_ROUND_TRIP("<a><![CDATA[x<y]]><!DOCTYPE foo bar><!----></a>", "<a><![CDATA[x<y]]><!DOCTYPE foo bar><!----></a>\n");
+
+	// A leading comment is the first node, and the only one that's written
+	CHECK_ROUND_TRIP("<!-- lead --><root/>", "<!-- lead -->\n");
+
+	// The last copy of an attribute wins
+	CHECK_ROUND_TRIP("<a x=\"1\" x=\"2\"/>", "<a x=\"2\" />\n");
+
+	CHECK_ROUND_TRIP("\xEF\xBB\xBF<a q=\"&quot;&gt;\"/>", "<a q=\"&quot;&gt;\" />\n");
+	CHECK_ROUND_TRIP("   ", "error: ");
+}
+
+static void Errors()
+{
+	CHECK_ROUND_TRIP("<a></b>", "error: Mismatched close tag </b> under parent <a>");
+	CHECK_ROUND_TRIP("<a><b></a>", "error: Mismatched close tag </a> under parent <b>");
+	CHECK_ROUND_TRIP("<a><b>", "error: Missing close tag </b> under parent <a>");
+	CHECK_ROUND_TRIP("<a>x & y</a>", "error: Character entity \"\" not terminated under parent <a>");
+	CHECK_ROUND_TRIP("<a b/>", "error: Missing value for attribute 'b' in element a");
+	CHECK_ROUND_TRIP("<a b=\"&foo;\"/>", "error: Entity name \"foo;\" not supported under parent <(null)>");
+	CHECK_ROUND_TRIP("<a>\x01</a>", "error: Bad control character 0x01 not allowed by XML standard");
+}
+
+static void Entities()
+{
+	CHECK_ROUND_TRIP("<a v=\"&#65;&#x42;&eacute;&apos;\"/>", "<a v=\"AB\xC3\xA9'\" />\n");
+
+	// The rest of HTML 4's entities, which go up to three bytes each
+	CHECK_ROUND_TRIP("<a v=\"&hellip;&mdash;&euro;&trade;\"/>", "<a v=\"\xE2\x80\xA6\xE2\x80\x94\xE2\x82\xAC\xE2\x84\xA2\" />\n");
+	CHECK_ROUND_TRIP("<a v=\"&alpha;&Omega;&ne;&or;\"/>", "<a v=\"\xCE\xB1\xCE\xA9\xE2\x89\xA0\xE2\x88\xA8\" />\n");
+
+	// Entity names are case sensitive
+	CHECK_ROUND_TRIP("<a v=\"&Amp;\"/>", "error: Entity name \"Amp;\" not supported under parent <(null)>");
+}
+
+static void Wrapping()
+{
+	// Once an attribute would go past column 72 it starts a new line
+	std::string value(52, 'x');
+	CHECK_ROUND_TRIP("<a first=\"" + value + "\" second=\"1\" third=\"2\"/>",
+		"<a first=\"" + value + "\"\nsecond=\"1\" third=\"2\" />\n");
+
+	// The width of an attribute is worked out before it's escaped
+	std::string escaped;
+	for (int i = 0; i < 64; i++)
+		escaped += "&amp;";
+
+	CHECK_ROUND_TRIP("<a v=\"" + escaped + "\" w=\"1\"/>", "<a v=\"" + escaped + "\"\nw=\"1\" />\n");
+
+	// The column carries on across elements, as there's no other whitespace to reset it
+	std::string many = "<r>";
+	std::string expected = "<r>";
+	size_t column = 3;
+	for (int i = 0; i < 10; i++)
+	{
+		many += "<item name=\"n\"/>";
+		expected += "<item";
+		column += 5;
+		if (column + 8 > 72)
+		{
+			expected += "\nname=\"n\" />";
+			column = 11;
+		}
+		else
+		{
+			expected += " name=\"n\" />";
+			column += 12;
+		}
+	}
+	many += "</r>";
+	expected += "</r>\n";
+	CHECK_ROUND_TRIP(many, expected);
+}
+
+static void Editing()
+{
+	Arena arena;
+	std::string error;
+	const char* text = "<r><a/><b k=\"v\"/></r>";
+	Node* root = Parse(arena, text, strlen(text), error);
+	TEST_CHECK(root != nullptr);
+	if (!root)
+		return;
+
+	Node* b = root->lastChild;
+	SetAttribute(arena, b, "k", "w");
+	SetAttribute(arena, b, "n1", "1");
+	SetAttribute(arena, b, "n2", "2");
+	SetAttribute(arena, b, "n3", "3");
+	SetAttribute(arena, b, "n4", "4");
+	DeleteAttribute(b, "n2");
+	TEST_CHECK(GetAttribute(b, "n2") == nullptr);
+	TEST_CHECK(strcmp(GetAttribute(b, "n3"), "3") == 0);
+
+	NewElement(arena, b, "child");
+	Remove(root->firstChild);
+
+	// Clones can go in a different arena to the original
+	Arena other;
+	Node* copy = Clone(other, b);
+	Insert(root, copy, nullptr);
+	SetName(arena, b, "bb");
+
+	std::string out;
+	Serialise(root, out);
+	TEST_CHECK_MSG(out == "<r><b k=\"w\" n1=\"1\" n3=\"3\" n4=\"4\"><child /></b><bb k=\"w\" n1=\"1\" n3=\"3\"\nn4=\"4\"><child /></bb></r>\n",
+		"got %s", out.c_str());
+}
+
+#ifdef SBLT_TEST_WITH_MXML
+
+static mxml_type_t IgnoreText(mxml_node_t*)
+{
+	return MXML_IGNORE;
+}
+
+static std::string mxml_error;
+
+static void NoteError(const char* error)
+{
+	mxml_error = error;
+}
+
+// What the Wren XML class used to give for a document, before it had its own DOM
+static std::string MxmlRoundTrip(const std::string& text, void (*edit)(mxml_node_t* node) = nullptr)
+{
+	mxml_error.clear();
+	mxmlSetErrorCallback(NoteError);
+
+	mxml_node_t* root = mxmlLoadString(nullptr, text.c_str(), IgnoreText);
+	if (!root)
+		return "error: " + mxml_error;
+
+	if (edit)
+		edit(root);
+
+	int bytes = mxmlSaveString(root, nullptr, 0, MXML_NO_CALLBACK);
+	std::string out(bytes > 0 ? bytes : 0, '\0');
+	if (bytes > 0)
+		mxmlSaveString(root, out.data(), bytes + 1, MXML_NO_CALLBACK);
+
+	mxmlDelete(root);
+	return out;
+}
+
+// Tags every element that has a name, and gives every element with children a new last child
+static void EditMxml(mxml_node_t* node)
+{
+	for (mxml_node_t* child = mxmlGetFirstChild(node); child; child = mxmlGetNextSibling(child))
+		EditMxml(child);
+
+	if (mxmlElementGetAttr(node, "name"))
+		mxmlElementSetAttr(node, "tweaked", "yes & <more>");
+
+	if (mxmlGetFirstChild(node))
+		mxmlNewElement(node, "added");
+}
+
+static void EditDom(Arena& arena, Node* node)
+{
+	for (Node* child = node->firstChild; child; child = child->next)
+		EditDom(arena, child);
+
+	if (GetAttribute(node, "name"))
+		SetAttribute(arena, node, "tweaked", "yes & <more>");
+
+	if (node->firstChild)
+		NewElement(arena, node, "added");
+}
+
+static void CompareWithMxml()
+{
+	for (const char* path : FIXTURES)
+	{
+		std::string text;
+		if (!LoadFile(path, text))
+		{
+			TEST_CHECK_MSG(false, "couldn't read %s", path);
+			continue;
+		}
+
+		std::string expected = MxmlRoundTrip(text);
+		std::string result = RoundTrip(text);
+		TEST_CHECK_MSG(result == expected, "%s:\nmxml:   %s\nxmldom: %s", path, expected.c_str(), result.c_str());
+
+		Arena arena;
+		std::string error;
+		Node* root = Parse(arena, text.data(), text.size(), error);
+		if (!root)
+			continue;
+
+		EditDom(arena, root);
+		result.clear();
+		Serialise(root, result);
+
+		expected = MxmlRoundTrip(text, EditMxml);
+		TEST_CHECK_MSG(result == expected, "%s, edited:\nmxml:   %s\nxmldom: %s", path, expected.c_str(), result.c_str());
+	}
+
+	// The errors should match too, as they end up in the log
+	const char* broken[] = { "<a></b>", "<a><b>", "<a>x & y</a>", "<a b/>", "<a b=\"&foo;\"/>", "<a>\x01</a>" };
+	for (const char* text : broken)
+	{
+		std::string expected = MxmlRoundTrip(text);
+		std::string result = RoundTrip(text);
+		TEST_CHECK_MSG(result == expected, "%s:\nmxml:   %s\nxmldom: %s", text, expected.c_str(), result.c_str());
+	}
+}
+
+#endif
+
+int main()
+{
+	Parsing();
+	Errors();
+	Entities();
+	Wrapping();
+	Editing();
+
+	// The fixtures should all parse, whether or not there's mxml to compare them with
+	for (const char* path : FIXTURES)
+	{
+		std::string text;
+		TEST_CHECK_MSG(LoadFile(path, text), "couldn't read %s", path);
+
+		std::string result = RoundTrip(text);
+		TEST_CHECK_MSG(result.rfind("error: ", 0) != 0, "%s: %s", path, result.c_str());
+	}
+
+#ifdef SBLT_TEST_WITH_MXML
+	CompareWithMxml();
+#else
+	printf("lib/mxml isn't checked out, so nothing was compared with mxml's output\n");
+#endif
+
+	return TEST_RESULT;
+}
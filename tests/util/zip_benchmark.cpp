@@ -0,0 +1,528 @@
+#include "util/util.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Extracts a large synthetic ZIP archive with ExtractZIPArchive, both sequentially and in parallel, and
+// the way it used to be done (every entry read and inflated into memory before anything was written,
+// copied below), and reports how long each took and the most heap memory each had allocated at once.
+// Not run as a test: build it in release and run it by hand.
+//
+// Usage: zip_benchmark [runs] [megabytes]
+
+using Clock = std::chrono::steady_clock;
+
+// Counts the bytes allocated through operator new that haven't been freed yet, and the most there have
+// been at once since the last reset. zlib allocates its own state with malloc, which is only a few tens
+// of KB for each stream being inflated, so it's left out.
+
+namespace
+{
+	std::atomic<size_t> live_bytes = 0;
+	std::atomic<size_t> peak_bytes = 0;
+
+	// Keeps the size in front of each allocation, without upsetting its alignment
+	const size_t HEADER = alignof(std::max_align_t);
+
+	void ResetPeak()
+	{
+		peak_bytes = live_bytes.load();
+	}
+} // namespace
+
+void* operator new(size_t size)
+{
+	char* memory = (char*)malloc(size + HEADER);
+	if (!memory)
+		throw std::bad_alloc();
+
+	*(size_t*)memory = size;
+
+	size_t now = live_bytes += size;
+	size_t peak = peak_bytes;
+	while (now > peak && !peak_bytes.compare_exchange_weak(peak, now))
+	{
+	}
+
+	return memory + HEADER;
+}
+
+void operator delete(void* pointer) noexcept
+{
+	if (!pointer)
+		return;
+
+	char* memory = (char*)pointer - HEADER;
+	live_bytes -= *(size_t*)memory;
+	free(memory);
+}
+
+// files.cpp needs the Windows file APIs, and this is the only part of it extracting uses
+void raidhook::Util::EnsurePathWritable(const std::string& path)
+{
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+}
+
+// The old extractor, which read each local header in turn and kept every entry in memory
+
+namespace before
+{
+	const int32_t MagicFileHeader = 0x04034b50;
+
+	typedef std::pair<int32_t, std::string> DataPair_t;
+
+	class ByteStream
+	{
+	public:
+		ByteStream(const std::string& path) : mainStream(path.c_str(), std::ifstream::binary) {}
+
+		template<typename T>
+		T readType()
+		{
+			T read;
+
+			mainStream.read(reinterpret_cast<char *>(&read), sizeof(T));
+			return read;
+		}
+
+		std::string readString(int length)
+		{
+			std::unique_ptr<char[]> readData(new char[length + 1]);
+			mainStream.read(readData.get(), length);
+			return std::string(readData.get(), length);
+		}
+
+	private:
+		std::ifstream mainStream;
+	};
+
+	struct ZIPFileData
+	{
+		std::string filepath;
+		std::string decompressedData;
+		int compressedSize;
+		int uncompressedSize;
+	};
+
+	std::string DecompressData(const DataPair_t& compressedData)
+	{
+		z_stream stream;
+		stream.zalloc = Z_NULL;
+		stream.zfree = Z_NULL;
+		stream.opaque = Z_NULL;
+
+		stream.avail_in = 0;
+		stream.next_in = Z_NULL;
+
+		inflateInit2(&stream, -MAX_WBITS);
+
+		stream.avail_in = compressedData.second.size();
+		stream.next_in = reinterpret_cast<unsigned char*>(const_cast<char *>(compressedData.second.data()));
+
+		std::unique_ptr<unsigned char[]> out(new unsigned char[compressedData.first + 1]);
+
+		stream.avail_out = compressedData.first;
+		stream.next_out = out.get();
+
+		inflate(&stream, Z_NO_FLUSH);
+		inflateEnd(&stream);
+
+		return std::string(reinterpret_cast<const char *>(out.get()), compressedData.first);
+	}
+
+	std::unique_ptr<ZIPFileData> ReadFile(ByteStream& mainStream)
+	{
+		auto fileHeader = mainStream.readType<int32_t>();
+		if (fileHeader != MagicFileHeader) return nullptr;
+
+		mainStream.readType<int16_t>();
+		mainStream.readType<int16_t>();
+
+		auto compressionMethod = mainStream.readType<int16_t>();
+
+		mainStream.readType<int32_t>();
+		mainStream.readType<int32_t>();
+
+		std::unique_ptr<ZIPFileData> newFile(new ZIPFileData());
+		newFile->compressedSize = mainStream.readType<int32_t>();
+		newFile->uncompressedSize = mainStream.readType<int32_t>();
+
+		auto fileNameLength = mainStream.readType<int16_t>();
+		auto extraFieldLength = mainStream.readType<int16_t>();
+
+		newFile->filepath = mainStream.readString(fileNameLength);
+		std::string extraField = mainStream.readString(extraFieldLength);
+		(void)extraField;
+
+		std::string compressedData = mainStream.readString(newFile->compressedSize);
+
+		switch (compressionMethod)
+		{
+		case 0:
+			newFile->decompressedData = std::move(compressedData);
+			break;
+		case 8:
+			newFile->decompressedData = DecompressData(std::make_pair(newFile->uncompressedSize, std::move(compressedData)));
+			break;
+		}
+
+		return newFile;
+	}
+
+	bool WriteFile(const std::string& extractPath, const ZIPFileData& data)
+	{
+		const std::string finalWritePath = extractPath + "/" + data.filepath;
+		raidhook::Util::EnsurePathWritable(finalWritePath);
+
+		char trailingChar = finalWritePath.at(finalWritePath.size()-1);
+		if(trailingChar == '/' || trailingChar == '\\')
+		{
+			return true;
+		}
+		else
+		{
+			std::ofstream outFile(finalWritePath.c_str(), std::ios::binary);
+			if (!outFile)
+				return false;
+
+			outFile.write(data.decompressedData.data(), data.uncompressedSize);
+			return true;
+		}
+	}
+
+	bool ExtractZIPArchive(const std::string& path, const std::string& extractPath)
+	{
+		ByteStream mainStream(path);
+
+		std::list<std::unique_ptr<ZIPFileData>> files;
+		{
+			std::unique_ptr<ZIPFileData> file;
+			while ((file = ReadFile(mainStream)))
+			{
+				files.push_back(std::move(file));
+			}
+		}
+
+		bool result = true;
+		std::for_each(files.cbegin(), files.cend(), [extractPath, &result](const std::unique_ptr<ZIPFileData>& data)
+		{
+			result &= WriteFile(extractPath, *data);
+		});
+		return result;
+	}
+} // namespace before
+
+namespace
+{
+	struct Entry
+	{
+		std::string name;
+		uint32_t crc;
+		uint32_t size;
+	};
+
+	// Somewhat compressible text, different for every seed, made a chunk at a time
+	void MakeContents(std::vector<uint8_t>& out, size_t size, uint32_t& state)
+	{
+		static const char* words[] = { "function ", "local ", "end\n", "return ", "self.", "tweak_data", "  ", "= {}\n" };
+
+		out.clear();
+		while (out.size() < size)
+		{
+			state = state * 1664525 + 1013904223;
+			const char* word = words[(state >> 24) % std::size(words)];
+			out.insert(out.end(), word, word + strlen(word));
+			out.push_back('a' + (state >> 8) % 26);
+		}
+		out.resize(size);
+	}
+
+	template <typename T>
+	void Put(std::ofstream& out, T value)
+	{
+		out.write((const char*)&value, sizeof(value));
+	}
+
+	// Writes ZIP archives without holding their contents in memory, by going back to fill in each local
+	// header once its entry has been written
+	class ZIPWriter
+	{
+	public:
+		explicit ZIPWriter(const std::string& path) : out(path, std::ios::binary | std::ios::trunc) {}
+
+		void AddDirectory(const std::string& name)
+		{
+			Begin(name, 0);
+			End(crc32(0, Z_NULL, 0), 0, 0);
+		}
+
+		// Adds a file of the given size, deflated if compress is set and stored otherwise
+		Entry AddFile(const std::string& name, size_t size, bool compress, uint32_t seed)
+		{
+			uint16_t method = compress ? 8 : 0;
+			Begin(name, method);
+
+			z_stream stream = {};
+			if (compress)
+				deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+
+			uint32_t crc = crc32(0, Z_NULL, 0);
+			uint32_t written = 0;
+			std::vector<uint8_t> chunk;
+			std::vector<uint8_t> deflated(128 * 1024);
+
+			size_t remaining = size;
+			do
+			{
+				size_t length = std::min<size_t>(remaining, 64 * 1024);
+				MakeContents(chunk, length, seed);
+				crc = crc32(crc, chunk.data(), (uInt)length);
+				remaining -= length;
+
+				if (!compress)
+				{
+					out.write((const char*)chunk.data(), length);
+					written += (uint32_t)length;
+					continue;
+				}
+
+				stream.next_in = chunk.data();
+				stream.avail_in = (uInt)length;
+				int flush = remaining == 0 ? Z_FINISH : Z_NO_FLUSH;
+				do
+				{
+					stream.next_out = deflated.data();
+					stream.avail_out = (uInt)deflated.size();
+					deflate(&stream, flush);
+
+					size_t produced = deflated.size() - stream.avail_out;
+					out.write((const char*)deflated.data(), produced);
+					written += (uint32_t)produced;
+				} while (stream.avail_out == 0);
+			} while (remaining > 0);
+
+			if (compress)
+				deflateEnd(&stream);
+
+			End(crc, written, (uint32_t)size);
+			return Entry{ name, crc, (uint32_t)size };
+		}
+
+		void Finish()
+		{
+			uint32_t directoryOffset = (uint32_t)out.tellp();
+
+			for (const Central& entry : entries)
+			{
+				Put<uint32_t>(out, 0x02014b50);
+				Put<uint16_t>(out, 20); // Version made by
+				Put<uint16_t>(out, 20); // Version needed
+				Put<uint16_t>(out, 0);  // Flags
+				Put<uint16_t>(out, entry.method);
+				Put<uint32_t>(out, 0); // Modification time and date
+				Put<uint32_t>(out, entry.crc);
+				Put<uint32_t>(out, entry.compressedSize);
+				Put<uint32_t>(out, entry.size);
+				Put<uint16_t>(out, (uint16_t)entry.name.size());
+				Put<uint16_t>(out, 0); // Extra field
+				Put<uint16_t>(out, 0); // Comment
+				Put<uint16_t>(out, 0); // Disk
+				Put<uint16_t>(out, 0); // Internal attributes
+				Put<uint32_t>(out, 0); // External attributes
+				Put<uint32_t>(out, entry.offset);
+				out.write(entry.name.data(), entry.name.size());
+			}
+
+			uint32_t directorySize = (uint32_t)out.tellp() - directoryOffset;
+
+			Put<uint32_t>(out, 0x06054b50);
+			Put<uint16_t>(out, 0);
+			Put<uint16_t>(out, 0);
+			Put<uint16_t>(out, (uint16_t)entries.size());
+			Put<uint16_t>(out, (uint16_t)entries.size());
+			Put<uint32_t>(out, directorySize);
+			Put<uint32_t>(out, directoryOffset);
+			Put<uint16_t>(out, 0);
+
+			out.close();
+		}
+
+	private:
+		struct Central
+		{
+			std::string name;
+			uint16_t method;
+			uint32_t crc;
+			uint32_t compressedSize;
+			uint32_t size;
+			uint32_t offset;
+		};
+
+		void Begin(const std::string& name, uint16_t method)
+		{
+			entries.push_back(Central{ name, method, 0, 0, 0, (uint32_t)out.tellp() });
+
+			Put<uint32_t>(out, 0x04034b50);
+			Put<uint16_t>(out, 20); // Version needed
+			Put<uint16_t>(out, 0);  // Flags
+			Put<uint16_t>(out, method);
+			Put<uint32_t>(out, 0); // Modification time and date
+			Put<uint32_t>(out, 0); // CRC and sizes, filled in by End
+			Put<uint32_t>(out, 0);
+			Put<uint32_t>(out, 0);
+			Put<uint16_t>(out, (uint16_t)name.size());
+			Put<uint16_t>(out, 0); // Extra field
+			out.write(name.data(), name.size());
+		}
+
+		void End(uint32_t crc, uint32_t compressedSize, uint32_t size)
+		{
+			Central& entry = entries.back();
+			entry.crc = crc;
+			entry.compressedSize = compressedSize;
+			entry.size = size;
+
+			std::streampos end = out.tellp();
+			out.seekp(entry.offset + 14);
+			Put(out, crc);
+			Put(out, compressedSize);
+			Put(out, size);
+			out.seekp(end);
+		}
+
+		std::ofstream out;
+		std::vector<Central> entries;
+	};
+
+	// Lots of small scripts, one big deflated asset and one big stored one, about the given size in total
+	std::vector<Entry> WriteArchive(const std::string& path, size_t megabytes)
+	{
+		ZIPWriter writer(path);
+		std::vector<Entry> files;
+
+		writer.AddDirectory("mod/");
+		writer.AddDirectory("mod/lua/");
+		for (uint32_t i = 0; i < 2000; i++)
+			files.push_back(writer.AddFile("mod/lua/script_" + std::to_string(i) + ".lua", 1000 + (i * 7919) % 8000, true, i));
+
+		size_t remaining = megabytes * 1048576 - std::min<size_t>(megabytes * 1048576, 10 * 1048576);
+		files.push_back(writer.AddFile("mod/assets/big.bundle", remaining * 5 / 6, true, 1000001));
+		files.push_back(writer.AddFile("mod/assets/stored.bin", remaining / 6, false, 1000002));
+
+		writer.Finish();
+		return files;
+	}
+
+	// Returns false if any of the files didn't come out as they went in
+	bool CheckExtracted(const std::string& directory, const std::vector<Entry>& files)
+	{
+		std::vector<char> buffer(64 * 1024);
+
+		for (const Entry& file : files)
+		{
+			std::ifstream in(directory + "/" + file.name, std::ios::binary);
+			uint32_t crc = crc32(0, Z_NULL, 0);
+			size_t size = 0;
+
+			while (in.read(buffer.data(), buffer.size()) || in.gcount() > 0)
+			{
+				crc = crc32(crc, (const Bytef*)buffer.data(), (uInt)in.gcount());
+				size += (size_t)in.gcount();
+			}
+
+			if (crc != file.crc || size != file.size)
+			{
+				fprintf(stderr, "%s didn't extract correctly\n", file.name.c_str());
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	struct Result
+	{
+		double millis = 0;
+		size_t peak = 0;
+	};
+
+	template <typename ExtractFn>
+	Result Run(const char* name, const std::string& extractPath, const std::vector<Entry>& files, int runs, ExtractFn extract)
+	{
+		Result result;
+
+		for (int i = 0; i < runs; i++)
+		{
+			std::filesystem::remove_all(extractPath);
+
+			size_t before = live_bytes;
+			ResetPeak();
+			Clock::time_point start = Clock::now();
+
+			if (!extract())
+			{
+				fprintf(stderr, "%s: extracting failed\n", name);
+				exit(1);
+			}
+
+			result.millis += std::chrono::duration<double, std::milli>(Clock::now() - start).count() / runs;
+			result.peak = std::max(result.peak, peak_bytes - before);
+
+			if (!CheckExtracted(extractPath, files))
+				exit(1);
+		}
+
+		printf("  %-10s %9.1f ms   peak heap %9.2f MB\n", name, result.millis, result.peak / 1048576.0);
+		return result;
+	}
+} // namespace
+
+int main(int argc, char** argv)
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 3;
+	if (runs < 1)
+		runs = 1;
+
+	size_t megabytes = argc > 2 ? (size_t)atoll(argv[2]) : 256;
+	if (megabytes < 16)
+		megabytes = 16;
+
+	std::filesystem::path temp = std::filesystem::temp_directory_path();
+	std::string archivePath = (temp / "sblt_zip_benchmark.zip").string();
+	std::string extractPath = (temp / "sblt_zip_benchmark").string();
+
+	std::vector<Entry> files = WriteArchive(archivePath, megabytes);
+
+	size_t extracted = 0;
+	for (const Entry& file : files)
+		extracted += file.size;
+
+	printf("%zu files, %.1f MB extracted from a %.1f MB archive, average of %d runs\n", files.size(),
+	       extracted / 1048576.0, std::filesystem::file_size(archivePath) / 1048576.0, runs);
+
+	Run("before", extractPath, files, runs, [&] { return before::ExtractZIPArchive(archivePath, extractPath); });
+	Run("sequential", extractPath, files, runs,
+	    [&] { return raidhook::ExtractZIPArchive(archivePath, extractPath, false); });
+	Run("parallel", extractPath, files, runs,
+	    [&] { return raidhook::ExtractZIPArchive(archivePath, extractPath, true); });
+
+	std::filesystem::remove_all(extractPath);
+	std::filesystem::remove(archivePath);
+
+	return 0;
+}